@@ -0,0 +1,138 @@
+/* include area */
+#include "arena.h"
+#include <stdlib.h>
+
+/** Rounds a size up to the alignment */
+#define ALIGN_UP(n) (((n) + ARENA_ALIGN - 1) & ~(( size_t )ARENA_ALIGN - 1))
+
+/** Chunk of memory (its data follows the header, aligned) */
+typedef struct chunk {
+  struct chunk *next;
+  size_t size;
+} chunk_t;
+
+/** Size of the chunk header, so the data stays aligned (malloc aligns the chunks) */
+#define CHUNK_HEADER_SIZE ALIGN_UP(sizeof(chunk_t))
+
+struct arena {
+  size_t chunk_size;
+  size_t max_size;
+  /** Bytes of all the chunks. */
+  size_t size;
+  chunk_t *first;
+  /** Chunk being used, and bytes used in it. */
+  chunk_t *current;
+  size_t used;
+};
+
+/**
+ * @brief Adds a chunk after the current one.
+ *
+ * @param arena The arena.
+ * @param size Bytes needed.
+ * @return The chunk or NULL on error (or if the arena would exceed its max size).
+ */
+static chunk_t *_chunk_add(arena_t *arena, size_t size) {
+  if (size < arena->chunk_size)
+    size = arena->chunk_size;
+  if (arena->max_size > 0 && arena->size + size > arena->max_size)
+    return NULL;
+
+  chunk_t *chunk = malloc(CHUNK_HEADER_SIZE + size);
+  if (chunk == NULL)
+    return NULL;
+
+  chunk->size = size;
+  if (arena->current == NULL) {
+    chunk->next = NULL;
+    arena->first = chunk;
+  } else {
+    chunk->next = arena->current->next;
+    arena->current->next = chunk;
+  }
+
+  arena->size += size;
+  return chunk;
+}
+
+/**
+ * @brief Creates an empty arena.
+ *
+ * @param chunk_size Size of the chunks (larger allocations get a chunk of their own).
+ * @param max_size Max bytes of all the chunks (0 for no limit).
+ * @return The arena or NULL on error.
+ */
+arena_t *arena_create(size_t chunk_size, size_t max_size) {
+  arena_t *arena = calloc(1, sizeof(arena_t));
+  if (arena == NULL)
+    return NULL;
+
+  arena->chunk_size = chunk_size;
+  arena->max_size = max_size;
+  return arena;
+}
+
+/**
+ * @brief Allocates memory from the arena (aligned to ARENA_ALIGN).
+ * It's valid until the arena is reset or destroyed.
+ *
+ * @param arena The arena.
+ * @param size Bytes to allocate.
+ * @return The memory or NULL on error.
+ */
+void *arena_alloc(arena_t *arena, size_t size) {
+  size = ALIGN_UP(size);
+
+  /* the next chunks (kept by a reset) are used before adding new ones */
+  chunk_t *chunk = arena->current;
+  while (chunk == NULL || arena->used + size > chunk->size) {
+    chunk_t *next = chunk ? chunk->next : arena->first;
+    if (next == NULL || next->size < size)
+      next = _chunk_add(arena, size);
+    if (next == NULL)
+      return NULL;
+
+    arena->current = chunk = next;
+    arena->used = 0;
+  }
+
+  void *ptr = ( unsigned char * )chunk + CHUNK_HEADER_SIZE + arena->used;
+  arena->used += size;
+  return ptr;
+}
+
+/**
+ * @brief Releases everything allocated from the arena (its chunks are kept for the next allocations).
+ *
+ * @param arena The arena.
+ */
+void arena_reset(arena_t *arena) {
+  arena->current = arena->first;
+  arena->used = 0;
+}
+
+/**
+ * @brief Returns the bytes of the chunks of the arena.
+ *
+ * @param arena The arena.
+ * @return bytes allocated by the arena (used or not).
+ */
+size_t arena_size(const arena_t *arena) {
+  return arena->size;
+}
+
+/**
+ * @brief Releases the arena and its chunks.
+ *
+ * @param arena The arena.
+ */
+void arena_destroy(arena_t *arena) {
+  chunk_t *chunk = arena->first;
+  while (chunk != NULL) {
+    chunk_t *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+
+  free(arena);
+}
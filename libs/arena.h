@@ -0,0 +1,34 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+/**
+ * @brief This module implements a bump allocator: memory is taken from the
+ * current chunk by moving a cursor, and it's only released all at once, by
+ * resetting the arena (e.g. once a request is answered).
+ *
+ * A reset keeps the chunks (the cursor goes back to the first one), so it
+ * takes O(1) and an arena that already grew doesn't allocate again. The
+ * chunks are allocated as needed, up to a max size, and are only freed when
+ * the arena is destroyed.
+ */
+
+/* include area */
+#include <stddef.h>
+
+/** Alignment of the allocations */
+#define ARENA_ALIGN 16
+
+/** Bump allocator (see arena.c) */
+typedef struct arena arena_t;
+
+/*--------------------------------------------------------------------------
+   Prototypes
+--------------------------------------------------------------------------*/
+
+arena_t *arena_create(size_t chunk_size, size_t max_size);
+void *arena_alloc(arena_t *arena, size_t size);
+void arena_reset(arena_t *arena);
+size_t arena_size(const arena_t *arena);
+void arena_destroy(arena_t *arena);
+
+#endif
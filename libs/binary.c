@@ -0,0 +1,344 @@
+/* include area */
+#include "binary.h"
+#include <string.h>
+
+/** Max size (in bytes) of an encoded varint (32 bits) */
+#define MAX_VARINT_SIZE 5
+
+/** Max size (in bytes) of an encoded field (a string list, the largest one) */
+#define MAX_FIELD_SIZE (MAX_VARINT_SIZE * (LIST_MAX_ITEMS + 1) + STRING_LIST_SIZE)
+
+/** Serialization context. */
+typedef struct {
+  /** The output callback. */
+  write_cb_t out;
+  /** The output callback context. */
+  void *out_ctx;
+} serialization_ctx_t;
+
+/** Deserialization context. */
+typedef struct {
+  /** The input callback. */
+  read_cb_t in;
+  /** The input callback context. */
+  void *in_ctx;
+} deserialization_ctx_t;
+
+/**
+ * @brief Encodes a 32 bits value (little endian).
+ *
+ * @param data Output buffer (at least 4 bytes).
+ * @param value Value to encode.
+ */
+static void _u32_encode(uint8_t *data, uint32_t value) {
+  for (size_t i = 0; i < sizeof(value); i++) {
+    data[i] = value & 0xFF;
+    value >>= 8;
+  }
+}
+
+/**
+ * @brief Decodes a 32 bits value (little endian).
+ *
+ * @param data Encoded value (4 bytes).
+ * @return The decoded value.
+ */
+static uint32_t _u32_decode(const uint8_t *data) {
+  uint32_t value = 0;
+  for (size_t i = sizeof(value); i > 0; i--) {
+    value = (value << 8) | data[i - 1];
+  }
+
+  return value;
+}
+
+/**
+ * @brief Encodes a varint (LEB128).
+ *
+ * @param data Output buffer (at least MAX_VARINT_SIZE bytes).
+ * @param value Value to encode.
+ * @return The number of bytes used.
+ */
+static size_t _varint_encode(uint8_t *data, uint32_t value) {
+  size_t length = 0;
+  for (;; value >>= 7) {
+    data[length++] = (value & 0x7F) | (value > 0x7F ? 0x80 : 0);
+    if (value <= 0x7F)
+      return length;
+  }
+}
+
+/**
+ * @brief Encodes a float (its bits, little endian).
+ *
+ * @param data Output buffer (at least 4 bytes).
+ * @param f Float to encode.
+ */
+static void _float_encode(uint8_t *data, float_t f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  _u32_encode(data, bits);
+}
+
+/**
+ * @brief Decodes a float.
+ *
+ * @param data Encoded float (4 bytes).
+ * @return The decoded float.
+ */
+static float_t _float_decode(const uint8_t *data) {
+  uint32_t bits = _u32_decode(data);
+  float_t f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+/**
+ * @brief Reads an exact number of bytes from the input callback.
+ *
+ * @param output Buffer where the read data is copied to.
+ * @param bytes Number of bytes to read.
+ * @param ctx Deserialization context.
+ * @return false if the input ended before, true on success.
+ */
+static bool _read(void *output, size_t bytes, deserialization_ctx_t *ctx) {
+  for (size_t bytes_read = 0; bytes_read < bytes;) {
+    size_t n = ctx->in(( uint8_t * )output + bytes_read, bytes - bytes_read, ctx->in_ctx);
+    if (n == 0)
+      return false;
+
+    bytes_read += n;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Reads a varint (LEB128) from the input callback.
+ *
+ * @param value Decoded value (output).
+ * @param ctx Deserialization context.
+ * @return false on error, true on success.
+ */
+static bool _varint_read(uint32_t *value, deserialization_ctx_t *ctx) {
+  *value = 0;
+  for (size_t i = 0; i < MAX_VARINT_SIZE; i++) {
+    uint8_t byte;
+    if (!_read(&byte, sizeof(byte), ctx))
+      return false;
+
+    *value |= ( uint32_t )(byte & 0x7F) << (7 * i);
+    if ((byte & 0x80) == 0)
+      return true;
+  }
+
+  /* too long */
+  return false;
+}
+
+/**
+ * @brief Writes an encoded field through the out callback.
+ *
+ * @param field Field to serialize and output.
+ * @param desc Field description.
+ * @param cb_ctx Serialization context.
+ * @return false on error, true on success.
+ */
+static bool _field_serialize(const void *field, const field_desc_t *desc, void *cb_ctx) {
+  serialization_ctx_t *ctx = cb_ctx;
+
+  /* a string list is the largest field */
+  uint8_t data[MAX_FIELD_SIZE];
+  size_t length = 0;
+
+  switch (desc->type) {
+    case field_type_integer:
+      _u32_encode(data, *( const integer_t * )field);
+      length = sizeof(integer_t);
+      break;
+    case field_type_float:
+      _float_encode(data, *( const float_t * )field);
+      length = sizeof(float_t);
+      break;
+    case field_type_string: {
+      const string_t *st = field;
+      length = _varint_encode(data, str_len(st));
+      memcpy(data + length, str_to_cstr(st), str_len(st));
+      length += str_len(st);
+      break;
+    }
+    case field_type_float_list: {
+      const float_list_t *l = field;
+      length = _varint_encode(data, l->count);
+      for (uint32_t i = 0; i < l->count; i++, length += sizeof(float_t))
+        _float_encode(data + length, l->items[i]);
+      break;
+    }
+    case field_type_string_list: {
+      const string_list_t *l = field;
+      length = _varint_encode(data, l->count);
+      for (uint32_t i = 0; i < l->count; i++) {
+        size_t item_length;
+        const char *item = string_list_get(l, i, &item_length);
+        length += _varint_encode(data + length, item_length);
+        memcpy(data + length, item, item_length);
+        length += item_length;
+      }
+      break;
+    }
+  }
+
+  return ctx->out(data, length, ctx->out_ctx);
+}
+
+/**
+ * @brief Reads an encoded field and decodes it.
+ *
+ * @param field Field to deserialize.
+ * @param desc Field description.
+ * @param cb_ctx Deserialization context.
+ * @return false on error, true on success.
+ */
+static bool _field_deserialize(void *field, const field_desc_t *desc, void *cb_ctx) {
+  deserialization_ctx_t *ctx = cb_ctx;
+
+  uint8_t data[sizeof(uint32_t)];
+  switch (desc->type) {
+    case field_type_integer:
+      if (!_read(data, sizeof(data), ctx))
+        return false;
+      *( integer_t * )field = ( integer_t )_u32_decode(data);
+      return true;
+    case field_type_float:
+      if (!_read(data, sizeof(data), ctx))
+        return false;
+      *( float_t * )field = _float_decode(data);
+      return true;
+    case field_type_string: {
+      string_t *st = field;
+      uint32_t length;
+      char *chars;
+      if (!_varint_read(&length, ctx) || (chars = str_reserve(st, length)) == NULL ||
+          !_read(chars, length, ctx))
+        return false;
+      str_set_length(st, length);
+      return true;
+    }
+    case field_type_float_list: {
+      float_list_t *l = field;
+      uint32_t count;
+      uint8_t items[LIST_MAX_ITEMS * sizeof(float_t)];
+      if (!_varint_read(&count, ctx) || count > LIST_MAX_ITEMS || !_read(items, count * sizeof(float_t), ctx))
+        return false;
+
+      l->count = 0;
+      for (uint32_t i = 0; i < count; i++) {
+        if (!float_list_append(l, _float_decode(items + i * sizeof(float_t))))
+          return false;
+      }
+      return true;
+    }
+    case field_type_string_list: {
+      string_list_t *l = field;
+      uint32_t count;
+      if (!_varint_read(&count, ctx))
+        return false;
+
+      /* the items are read in place */
+      l->count = 0;
+      for (uint32_t i = 0; i < count; i++) {
+        size_t size;
+        uint32_t length;
+        char *item = string_list_next(l, &size);
+        if (item == NULL || !_varint_read(&length, ctx) || length >= size || !_read(item, length, ctx))
+          return false;
+        string_list_push(l, length);
+      }
+      return true;
+    }
+  }
+
+  /* unreachable */
+  return false;
+}
+
+/**
+ * @brief Serializes a message (binary encoding) and sends it through an output callback.
+ *
+ * @param msg Message to serialize (the union).
+ * @param desc Message description.
+ * @param type Message type (the enum value).
+ * @param id Correlation id.
+ * @param out Output callback.
+ * @param out_ctx Output callback context.
+ * @return false on error, true on success.
+ */
+bool binary_serialize(const void *msg, const message_desc_t *desc, uint8_t type, message_id_t id, write_cb_t out,
+                      void *out_ctx) {
+  return binary_serialize_header(type, id, out, out_ctx) && binary_serialize_fields(msg, desc, out, out_ctx);
+}
+
+/**
+ * @brief Serializes the header of a message: its type and correlation id.
+ *
+ * @param type Message type (the enum value).
+ * @param id Correlation id.
+ * @param out Output callback.
+ * @param out_ctx Output callback context.
+ * @return false on error, true on success.
+ */
+bool binary_serialize_header(uint8_t type, message_id_t id, write_cb_t out, void *out_ctx) {
+  uint8_t header[BINARY_HEADER_SIZE];
+  header[0] = type;
+  _u32_encode(header + 1, id);
+  return out(header, sizeof(header), out_ctx);
+}
+
+/**
+ * @brief Serializes the fields of a message (what follows its header).
+ *
+ * @param msg Message to serialize (the union).
+ * @param desc Message description.
+ * @param out Output callback.
+ * @param out_ctx Output callback context.
+ * @return false on error, true on success.
+ */
+bool binary_serialize_fields(const void *msg, const message_desc_t *desc, write_cb_t out, void *out_ctx) {
+  serialization_ctx_t ctx = {.out = out, .out_ctx = out_ctx};
+  return message_iter_const(msg, desc, _field_serialize, &ctx);
+}
+
+/**
+ * @brief Reads the type and the id of a binary encoded message (so the
+ * caller can find the message description).
+ *
+ * @param type Message type (output).
+ * @param id Correlation id (output).
+ * @param in Input callback.
+ * @param in_ctx Input callback context.
+ * @return false on error, true on success.
+ */
+bool binary_deserialize_header(uint8_t *type, message_id_t *id, read_cb_t in, void *in_ctx) {
+  uint8_t header[BINARY_HEADER_SIZE];
+  deserialization_ctx_t ctx = {.in = in, .in_ctx = in_ctx};
+  if (!_read(header, sizeof(header), &ctx))
+    return false;
+
+  *type = header[0];
+  *id = _u32_decode(header + 1);
+  return true;
+}
+
+/**
+ * @brief Reads the fields of a binary encoded message (after its header).
+ *
+ * @param msg Message to deserialize (the union).
+ * @param desc Message description.
+ * @param in Input callback.
+ * @param in_ctx Input callback context.
+ * @return false on error, true on success.
+ */
+bool binary_deserialize(void *msg, const message_desc_t *desc, read_cb_t in, void *in_ctx) {
+  deserialization_ctx_t ctx = {.in = in, .in_ctx = in_ctx};
+  return message_iter(msg, desc, _field_deserialize, &ctx);
+}
@@ -0,0 +1,40 @@
+#ifndef BINARY_H
+#define BINARY_H
+
+/**
+ * @brief This module implements the compact binary encoding of the messages
+ * (an alternative to JSON, see message_format_t).
+ *
+ * The encoding is driven by the message descriptions (see message_decl.h):
+ *
+ *    +-----------+--------------------+--------------------------------+
+ *    | type (u8) | id (u32, LE)       | fields (in declaration order)  |
+ *    +-----------+--------------------+--------------------------------+
+ *
+ * where each field is encoded as:
+ *   * integer: int32, little endian.
+ *   * float: IEEE 754 single precision, little endian.
+ *   * string: length (varint, LEB128) followed by the characters (no NULL).
+ *   * lists: number of items (varint) followed by the items, encoded as above.
+ */
+
+/* include area */
+#include "message.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Size (in bytes) of the type and the id that precede the fields */
+#define BINARY_HEADER_SIZE 5
+
+/*--------------------------------------------------------------------------
+   Prototypes
+--------------------------------------------------------------------------*/
+
+bool binary_serialize(const void *msg, const message_desc_t *desc, uint8_t type, message_id_t id, write_cb_t out,
+                      void *out_ctx);
+bool binary_serialize_header(uint8_t type, message_id_t id, write_cb_t out, void *out_ctx);
+bool binary_serialize_fields(const void *msg, const message_desc_t *desc, write_cb_t out, void *out_ctx);
+bool binary_deserialize_header(uint8_t *type, message_id_t *id, read_cb_t in, void *in_ctx);
+bool binary_deserialize(void *msg, const message_desc_t *desc, read_cb_t in, void *in_ctx);
+
+#endif
@@ -0,0 +1,272 @@
+/* include area */
+#include "buffer.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+/**
+ * @brief Makes sure the buffer can hold the given number of unconsumed bytes
+ * (moving them to the beginning and growing the buffer if needed).
+ *
+ * @param b The buffer.
+ * @param bytes Number of unconsumed bytes the buffer must be able to hold.
+ * @return false on error, true on success.
+ */
+bool recv_buffer_reserve(recv_buffer_t *b, size_t bytes) {
+  if (b->start + bytes <= b->capacity)
+    return true;
+
+  /* the consumed bytes are only dropped when the room is needed */
+  size_t length = b->end - b->start;
+  memmove(b->data, b->data + b->start, length);
+  b->start = 0;
+  b->end = length;
+
+  if (bytes <= b->capacity)
+    return true;
+
+  size_t capacity = b->capacity ? b->capacity : BUFFER_INITIAL_SIZE;
+  while (capacity < bytes)
+    capacity *= 2;
+
+  char *data = realloc(b->data, capacity);
+  if (data == NULL)
+    return false;
+
+  b->data = data;
+  b->capacity = capacity;
+  return true;
+}
+
+/**
+ * @brief Receives as much as fits in the buffer with a single recv (growing it if it's full).
+ *
+ * @param b The buffer.
+ * @param fd Socket.
+ * @return Number of bytes received, 0 if the peer closed the connection, -1
+ * on error (errno is EAGAIN/EWOULDBLOCK if a non-blocking socket would block).
+ */
+ssize_t recv_buffer_fill(recv_buffer_t *b, int fd) {
+  size_t length = b->end - b->start;
+  if (b->end == b->capacity && !recv_buffer_reserve(b, length ? length * 2 : BUFFER_INITIAL_SIZE)) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  while (true) {
+    ssize_t bytes = recv(fd, b->data + b->end, b->capacity - b->end, 0);
+    if (bytes < 0 && errno == EINTR)
+      continue;
+
+    if (bytes > 0)
+      b->end += bytes;
+
+    return bytes;
+  }
+}
+
+/**
+ * @brief Receives until the buffer has at least the given number of unconsumed
+ * bytes (blocking sockets).
+ *
+ * @param b The buffer.
+ * @param fd Socket.
+ * @param bytes Number of unconsumed bytes needed.
+ * @return false on error or if the connection was closed before, true on success.
+ */
+bool recv_buffer_fill_to(recv_buffer_t *b, int fd, size_t bytes) {
+  if (!recv_buffer_reserve(b, bytes))
+    return false;
+
+  while (b->end - b->start < bytes) {
+    if (recv_buffer_fill(b, fd) <= 0)
+      return false;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Returns the unconsumed bytes (in place, they are valid until the
+ * next call that modifies the buffer).
+ *
+ * @param b The buffer.
+ * @param length Number of unconsumed bytes (output).
+ * @return The first unconsumed byte.
+ */
+const char *recv_buffer_peek(const recv_buffer_t *b, size_t *length) {
+  *length = b->end - b->start;
+  return b->data + b->start;
+}
+
+/**
+ * @brief Consumes bytes from the beginning of the buffer.
+ *
+ * @param b The buffer.
+ * @param bytes Number of bytes (at most the unconsumed ones).
+ */
+void recv_buffer_consume(recv_buffer_t *b, size_t bytes) {
+  b->start += bytes;
+
+  /* rewinds for free when everything was consumed */
+  if (b->start == b->end) {
+    b->start = 0;
+    b->end = 0;
+  }
+}
+
+/**
+ * @brief Releases the buffer memory.
+ *
+ * @param b The buffer.
+ */
+void recv_buffer_free(recv_buffer_t *b) {
+  free(b->data);
+  memset(b, 0, sizeof(*b));
+}
+
+/**
+ * @brief Message serialization callback that appends to a send buffer.
+ *
+ * @param data Data to write.
+ * @param bytes Number of bytes to write.
+ * @param cb_ctx The send buffer.
+ * @return false on error, true on success.
+ */
+bool send_buffer_write(const void *data, size_t bytes, void *cb_ctx) {
+  send_buffer_t *b = cb_ctx;
+
+  /* grows the buffer if needed (the unsent bytes stay where they are, see send_buffer_flush) */
+  if (b->end + bytes > b->capacity) {
+    size_t capacity = b->capacity ? b->capacity : BUFFER_INITIAL_SIZE;
+    while (capacity < b->end + bytes)
+      capacity *= 2;
+
+    char *buffer = realloc(b->data, capacity);
+    if (buffer == NULL)
+      return false;
+
+    b->data = buffer;
+    b->capacity = capacity;
+  }
+
+  memcpy(b->data + b->end, data, bytes);
+  b->end += bytes;
+  return true;
+}
+
+/**
+ * @brief Returns the number of bytes not sent yet.
+ *
+ * @param b The buffer.
+ * @return Number of bytes.
+ */
+size_t send_buffer_pending(const send_buffer_t *b) {
+  return b->end - b->start;
+}
+
+/**
+ * @brief Defers the flushes until the buffer is uncorked (corks can be nested).
+ *
+ * @param b The buffer.
+ */
+void send_buffer_cork(send_buffer_t *b) {
+  b->corked++;
+}
+
+/**
+ * @brief Undoes a send_buffer_cork (the next flush sends everything once it's not corked).
+ *
+ * @param b The buffer.
+ */
+void send_buffer_uncork(send_buffer_t *b) {
+  if (b->corked > 0)
+    b->corked--;
+}
+
+/**
+ * @brief Sends the pending bytes with a single send (more only after partial writes).
+ * It does nothing while the buffer is corked.
+ *
+ * @param b The buffer.
+ * @param fd Socket.
+ * @return true if there's nothing left to send (or it's corked), false on error
+ * (errno is EAGAIN/EWOULDBLOCK if a non-blocking socket would block).
+ */
+bool send_buffer_flush(send_buffer_t *b, int fd) {
+  if (b->corked > 0)
+    return true;
+
+  while (b->start < b->end) {
+    ssize_t bytes = send(fd, b->data + b->start, b->end - b->start, MSG_NOSIGNAL);
+    if (bytes < 0 && errno == EINTR)
+      continue;
+
+    if (bytes < 0) {
+      /* moves what's left to the beginning, so the buffer doesn't keep growing */
+      if (b->start > 0) {
+        int error = errno;
+        memmove(b->data, b->data + b->start, b->end - b->start);
+        b->end -= b->start;
+        b->start = 0;
+        errno = error;
+      }
+      return false;
+    }
+
+    b->start += bytes;
+  }
+
+  b->start = 0;
+  b->end = 0;
+  return true;
+}
+
+/**
+ * @brief Releases the buffer memory.
+ *
+ * @param b The buffer.
+ */
+void send_buffer_free(send_buffer_t *b) {
+  free(b->data);
+  memset(b, 0, sizeof(*b));
+}
+
+/**
+ * @brief Message deserialization callback that reads from memory.
+ *
+ * @param output Buffer where the read data is copied to.
+ * @param bytes Number of bytes to read.
+ * @param cb_ctx Memory reader.
+ * @return Bytes read.
+ */
+size_t mem_reader_read(void *output, size_t bytes, void *cb_ctx) {
+  mem_reader_t *reader = cb_ctx;
+
+  size_t available = reader->length - reader->offset;
+  if (bytes > available)
+    bytes = available;
+
+  memcpy(output, reader->data + reader->offset, bytes);
+  reader->offset += bytes;
+  return bytes;
+}
+
+/**
+ * @brief Output callback that appends the data to a memory region (see write_cb_t).
+ *
+ * @param data Data to write.
+ * @param bytes Number of bytes.
+ * @param cb_ctx The writer (mem_writer_t).
+ * @return false if the data doesn't fit, true on success.
+ */
+bool mem_writer_write(const void *data, size_t bytes, void *cb_ctx) {
+  mem_writer_t *writer = cb_ctx;
+  if (bytes > writer->size - writer->length)
+    return false;
+
+  memcpy(writer->data + writer->length, data, bytes);
+  writer->length += bytes;
+  return true;
+}
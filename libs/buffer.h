@@ -0,0 +1,87 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+/**
+ * @brief This module implements the connection buffers.
+ *
+ * A receive buffer reads from a socket in bulk (as much as fits in a single
+ * recv), and the parsers consume the received bytes in place (see
+ * recv_buffer_peek and mem_reader_t), so a message usually costs one or two
+ * syscalls and no copies.
+ *
+ * A send buffer accumulates whole serialized messages (the serializers write
+ * into it through send_buffer_write) and sends them with a single send,
+ * resuming after partial writes. Several messages (e.g. the responses to
+ * pipelined requests) can be corked, so they go out together in one flush.
+ */
+
+/* include area */
+#include "message.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/** Initial size (in bytes) of the buffers */
+#define BUFFER_INITIAL_SIZE 1024
+
+/** Receive buffer of a connection */
+typedef struct {
+  char *data;
+  /** Offset of the first byte not consumed yet. */
+  size_t start;
+  /** Offset of the end of the received bytes. */
+  size_t end;
+  size_t capacity;
+} recv_buffer_t;
+
+/** Send buffer of a connection */
+typedef struct {
+  char *data;
+  /** Offset of the first byte not sent yet. */
+  size_t start;
+  /** Offset of the end of the written bytes (offsets don't change until the next flush). */
+  size_t end;
+  size_t capacity;
+  /** Flushes are deferred while it's corked (see send_buffer_cork). */
+  size_t corked;
+} send_buffer_t;
+
+/** Reader over a memory region (a read_cb_t context, for parsing a received message in place) */
+typedef struct {
+  const char *data;
+  size_t length;
+  size_t offset;
+} mem_reader_t;
+
+/** Writer over a memory region (a write_cb_t context, for serializing a message into a fixed buffer) */
+typedef struct {
+  char *data;
+  size_t size;
+  size_t length;
+} mem_writer_t;
+
+/*--------------------------------------------------------------------------
+   Prototypes
+--------------------------------------------------------------------------*/
+
+/* receive buffer */
+bool recv_buffer_reserve(recv_buffer_t *b, size_t bytes);
+ssize_t recv_buffer_fill(recv_buffer_t *b, int fd);
+bool recv_buffer_fill_to(recv_buffer_t *b, int fd, size_t bytes);
+const char *recv_buffer_peek(const recv_buffer_t *b, size_t *length);
+void recv_buffer_consume(recv_buffer_t *b, size_t bytes);
+void recv_buffer_free(recv_buffer_t *b);
+
+/* send buffer */
+bool send_buffer_write(const void *data, size_t bytes, void *cb_ctx);
+size_t send_buffer_pending(const send_buffer_t *b);
+void send_buffer_cork(send_buffer_t *b);
+void send_buffer_uncork(send_buffer_t *b);
+bool send_buffer_flush(send_buffer_t *b, int fd);
+void send_buffer_free(send_buffer_t *b);
+
+/* memory reader/writer */
+size_t mem_reader_read(void *output, size_t bytes, void *cb_ctx);
+bool mem_writer_write(const void *data, size_t bytes, void *cb_ctx);
+
+#endif
@@ -0,0 +1,262 @@
+/* include area */
+#define _GNU_SOURCE
+#include "cache.h"
+#include "str.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+/** Entry of a shard */
+typedef struct {
+  uint8_t type;
+  /** It was hit since the last pass of the hand. */
+  bool referenced;
+  uint8_t key_length;
+  uint8_t size;
+  /** When it expires (monotonic clock, in milliseconds). */
+  uint64_t expires;
+  char key[CACHE_MAX_KEY];
+  uint8_t value[CACHE_MAX_VALUE];
+} entry_t;
+
+/** Shard of the cache */
+typedef struct {
+  pthread_mutex_t lock;
+  /** Bumped on every invalidation (see cache_put). */
+  uint64_t version;
+  /** Next entry the CLOCK hand looks at. */
+  size_t hand;
+  /** Hash of each entry (0 if the entry is empty), apart from the entries so a lookup scans them fast. */
+  uint32_t *tags;
+  entry_t *entries;
+} shard_t;
+
+struct cache {
+  size_t num_entries;
+  uint32_t ttl;
+  shard_t shards[CACHE_SHARDS];
+};
+
+/**
+ * @brief Returns the monotonic time.
+ *
+ * @return time in milliseconds.
+ */
+static uint64_t _now_ms( ) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ( uint64_t )t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Hashes a key (never 0, that's an empty entry).
+ *
+ * @param type Request type.
+ * @param key Key characters.
+ * @param length Key length.
+ * @return the hash.
+ */
+static uint32_t _hash(uint8_t type, const char *key, size_t length) {
+  return (str_hash_n(key, length) ^ (type * 0x9E3779B9u)) | 1;
+}
+
+/**
+ * @brief Returns the shard of a key.
+ *
+ * @param cache The cache.
+ * @param tag Key hash.
+ * @return the shard.
+ */
+static shard_t *_shard(cache_t *cache, uint32_t tag) {
+  return &cache->shards[(tag >> 16) % CACHE_SHARDS];
+}
+
+/**
+ * @brief Looks up the entry of a key (with the lock of the shard held).
+ *
+ * @param cache The cache.
+ * @param shard Shard of the key.
+ * @param tag Key hash.
+ * @param type Request type.
+ * @param key Key characters.
+ * @param length Key length.
+ * @return the entry index, or -1 if the key is not in the shard.
+ */
+static ssize_t _find(const cache_t *cache, const shard_t *shard, uint32_t tag, uint8_t type, const char *key,
+                     size_t length) {
+  for (size_t i = 0; i < cache->num_entries; i++) {
+    const entry_t *e = &shard->entries[i];
+    if (shard->tags[i] == tag && e->type == type && e->key_length == length &&
+        memcmp(e->key, key, length) == 0)
+      return i;
+  }
+
+  return -1;
+}
+
+/**
+ * @brief Picks the entry to replace (CLOCK): the first one that is empty,
+ * expired or not referenced since the last pass of the hand.
+ *
+ * @param cache The cache.
+ * @param shard The shard.
+ * @param now Current time.
+ * @return the entry index.
+ */
+static size_t _evict(const cache_t *cache, shard_t *shard, uint64_t now) {
+  for (;;) {
+    size_t i = shard->hand;
+    shard->hand = (i + 1) % cache->num_entries;
+
+    entry_t *e = &shard->entries[i];
+    if (shard->tags[i] == 0 || e->expires <= now || !e->referenced)
+      return i;
+
+    /* a second chance */
+    e->referenced = false;
+  }
+}
+
+/**
+ * @brief Creates an empty cache.
+ *
+ * @param capacity Max number of entries (split among the shards).
+ * @param ttl_ms Time to live of the entries (in milliseconds).
+ * @return The cache or NULL on error.
+ */
+cache_t *cache_create(size_t capacity, uint32_t ttl_ms) {
+  cache_t *cache = calloc(1, sizeof(cache_t));
+  if (cache == NULL)
+    return NULL;
+
+  cache->num_entries = (capacity + CACHE_SHARDS - 1) / CACHE_SHARDS;
+  cache->ttl = ttl_ms;
+  if (cache->num_entries == 0)
+    cache->num_entries = 1;
+
+  for (size_t s = 0; s < CACHE_SHARDS; s++) {
+    shard_t *shard = &cache->shards[s];
+    pthread_mutex_init(&shard->lock, NULL);
+    shard->tags = calloc(cache->num_entries, sizeof(uint32_t));
+    shard->entries = calloc(cache->num_entries, sizeof(entry_t));
+    if (shard->tags == NULL || shard->entries == NULL) {
+      cache_destroy(cache);
+      return NULL;
+    }
+  }
+
+  return cache;
+}
+
+/**
+ * @brief Looks up a value.
+ *
+ * @param cache The cache.
+ * @param type Request type.
+ * @param key Key characters.
+ * @param length Key length.
+ * @param value Copy of the value (output, CACHE_MAX_VALUE bytes).
+ * @param version Version of the shard of the key (output, to store the value on a miss, see cache_put).
+ * @return the size of the value, 0 if it's not cached.
+ */
+size_t cache_get(cache_t *cache, uint8_t type, const char *key, size_t length, void *value,
+                 uint64_t *version) {
+  uint32_t tag = _hash(type, key, length);
+  shard_t *shard = _shard(cache, tag);
+
+  pthread_mutex_lock(&shard->lock);
+  *version = shard->version;
+
+  size_t size = 0;
+  ssize_t i = _find(cache, shard, tag, type, key, length);
+  if (i >= 0 && shard->entries[i].expires <= _now_ms( )) {
+    shard->tags[i] = 0;
+  } else if (i >= 0) {
+    entry_t *e = &shard->entries[i];
+    e->referenced = true;
+    memcpy(value, e->value, e->size);
+    size = e->size;
+  }
+
+  pthread_mutex_unlock(&shard->lock);
+  return size;
+}
+
+/**
+ * @brief Stores a value, unless its key was invalidated since the lookup
+ * that missed it (the value may be stale).
+ *
+ * @param cache The cache.
+ * @param type Request type.
+ * @param key Key characters.
+ * @param length Key length.
+ * @param value Value.
+ * @param size Size of the value.
+ * @param version Version given by the lookup (see cache_get).
+ */
+void cache_put(cache_t *cache, uint8_t type, const char *key, size_t length, const void *value, size_t size,
+               uint64_t version) {
+  if (length > CACHE_MAX_KEY || size == 0 || size > CACHE_MAX_VALUE)
+    return;
+
+  uint32_t tag = _hash(type, key, length);
+  shard_t *shard = _shard(cache, tag);
+
+  pthread_mutex_lock(&shard->lock);
+  if (shard->version == version) {
+    uint64_t now = _now_ms( );
+    ssize_t i = _find(cache, shard, tag, type, key, length);
+    if (i < 0)
+      i = _evict(cache, shard, now);
+
+    /* new entries start without their reference bit (a one-off lookup is evicted first) */
+    entry_t *e = &shard->entries[i];
+    e->type = type;
+    e->referenced = false;
+    e->key_length = length;
+    e->size = size;
+    e->expires = now + cache->ttl;
+    memcpy(e->key, key, length);
+    memcpy(e->value, value, size);
+    shard->tags[i] = tag;
+  }
+
+  pthread_mutex_unlock(&shard->lock);
+}
+
+/**
+ * @brief Removes a key (e.g. because it was updated).
+ *
+ * @param cache The cache.
+ * @param type Request type.
+ * @param key Key characters.
+ * @param length Key length.
+ */
+void cache_invalidate(cache_t *cache, uint8_t type, const char *key, size_t length) {
+  uint32_t tag = _hash(type, key, length);
+  shard_t *shard = _shard(cache, tag);
+
+  pthread_mutex_lock(&shard->lock);
+  shard->version++;
+  ssize_t i = _find(cache, shard, tag, type, key, length);
+  if (i >= 0)
+    shard->tags[i] = 0;
+  pthread_mutex_unlock(&shard->lock);
+}
+
+/**
+ * @brief Releases the cache.
+ *
+ * @param cache The cache.
+ */
+void cache_destroy(cache_t *cache) {
+  for (size_t s = 0; s < CACHE_SHARDS; s++) {
+    pthread_mutex_destroy(&cache->shards[s].lock);
+    free(cache->shards[s].tags);
+    free(cache->shards[s].entries);
+  }
+
+  free(cache);
+}
@@ -0,0 +1,51 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+/**
+ * @brief This module implements a bounded cache of serialized responses (so
+ * the portal answers repeated GETs without asking a microservice, and a
+ * microservice doesn't serialize them again).
+ *
+ * Entries are keyed by the request type and its target (a city/currency),
+ * and they expire after a TTL. The cache is split in shards (by the key
+ * hash), each one with its own lock and a fixed number of entries, evicted
+ * with the CLOCK policy: a hit only sets the reference bit of the entry, and
+ * the hand sweeps the entries looking for one that wasn't referenced since
+ * its last pass (clearing the bits it passes over), so the hot keys stay
+ * while the one-off lookups go first. A lookup scans the (packed) hashes of
+ * the shard, comparing the key only when the hash matches.
+ *
+ * Invalidating a key (when it's updated) bumps the version of its shard: a
+ * response fetched after a miss is only stored if no invalidation happened
+ * meanwhile (see cache_get), so a response that raced with an update is
+ * never cached.
+ */
+
+/* include area */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Max length of a key, and max size of a value (longer ones are not cached) */
+#define CACHE_MAX_KEY 64
+#define CACHE_MAX_VALUE 128
+
+/** Number of shards (each one has capacity / CACHE_SHARDS entries) */
+#define CACHE_SHARDS 16
+
+/** Response cache (see cache.c) */
+typedef struct cache cache_t;
+
+/*--------------------------------------------------------------------------
+   Prototypes
+--------------------------------------------------------------------------*/
+
+cache_t *cache_create(size_t capacity, uint32_t ttl_ms);
+size_t cache_get(cache_t *cache, uint8_t type, const char *key, size_t length, void *value,
+                 uint64_t *version);
+void cache_put(cache_t *cache, uint8_t type, const char *key, size_t length, const void *value, size_t size,
+               uint64_t version);
+void cache_invalidate(cache_t *cache, uint8_t type, const char *key, size_t length);
+void cache_destroy(cache_t *cache);
+
+#endif
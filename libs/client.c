@@ -1,47 +1,433 @@
 /* include area */
+#define _GNU_SOURCE
 #include "client.h"
+#include "buffer.h"
+#include "frame.h"
 #include <errno.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+
+/** Max size (in bytes) of a serialized response */
+#define MAX_RESPONSE_SIZE (64 << 10)
+
+/** Max number of events handled by each client_async_process call */
+#define CLIENT_ASYNC_MAX_EVENTS 64
+
+/** Size of the chunks of the arena where the responses are parsed, and its max size */
+#define CLIENT_ARENA_CHUNK_SIZE (16 << 10)
+#define CLIENT_ARENA_MAX_SIZE (1 << 20)
+
+/** Request sent through a pooled connection, waiting for its response */
+typedef struct client_call {
+  message_id_t id;
+  response_t *resp;
+  /** Arena of the caller, where the long strings of the response are copied (see _conn_complete). */
+  arena_t *arena;
+  bool done;
+  bool success;
+  /** Asynchronous calls get their response through a callback instead (see client_async_send). */
+  client_cb_t cb;
+  void *ctx;
+  struct client_call *next;
+} call_t;
+
+/**
+ * Connection to a server (kept alive and shared by the pools).
+ * Pooled connections carry several requests at the same time (pipelining):
+ * every caller sends its request and waits, while one of them (the reader)
+ * reads the responses and hands them to their callers by id.
+ */
+typedef struct client_conn {
+  int fd;
+  /** Serialization format of the requests (the responses come in the same one). */
+  message_format_t format;
+  /** Received bytes (not yet parsed, only used by the reader). */
+  recv_buffer_t in;
+  /** Where the reader parses a response (reset once it's copied to its caller, see _conn_complete). */
+  arena_t *arena;
+  /** Serialized requests not sent yet, and the buffer swapped with it while sending (guarded by write_lock). */
+  send_buffer_t out;
+  send_buffer_t spare;
+  /** Some caller is sending the requests (for every caller that wrote one meanwhile). */
+  bool flushing;
+  pthread_mutex_t write_lock;
+  /** Guards the fields below. */
+  pthread_mutex_t lock;
+  /** Signaled when a call is done or there's no reader. */
+  pthread_cond_t cond;
+  message_id_t last_id;
+  /** Calls in flight. */
+  call_t *calls;
+  /** Some caller is reading the responses. */
+  bool reading;
+  /** Failed or closed by the server (no more requests are sent through it). */
+  bool broken;
+  /** Closed (asynchronous: it's released once the events being processed are done, see _async_close). */
+  bool closed;
+  /** The connection is being established (asynchronous, requests are sent once it's done). */
+  bool connecting;
+  /** Number of callers using the connection (guarded by the pool lock), or calls in flight (asynchronous). */
+  size_t refs;
+  /** Next connection to the same port. */
+  struct client_conn *next;
+} conn_t;
+
+/** Connections to a given port */
+typedef struct client_upstream {
+  uint16_t port;
+  conn_t *conns;
+  struct client_upstream *next;
+} upstream_t;
+
+/** Pool of persistent connections, keyed by port */
+struct client_pool {
+  pthread_mutex_t lock;
+  /** Serialization format used by the connections. */
+  message_format_t format;
+  /** Server address (resolved once). */
+  struct in_addr addr;
+  upstream_t *upstreams;
+};
+
+/**
+ * Asynchronous client: its connections are non-blocking and they carry
+ * several requests at the same time, like the pooled ones, but nobody waits
+ * for the responses. Their sockets are watched by an epoll set (whose fd is
+ * watched by the caller's event loop), and the responses are handed to the
+ * callbacks of their requests when the caller processes the events. It's
+ * used from a single thread, so it doesn't take any lock.
+ */
+struct client_async {
+  /** Serialization format used by the connections. */
+  message_format_t format;
+  /** Server address (resolved once). */
+  struct in_addr addr;
+  int epoll_fd;
+  upstream_t *upstreams;
+  /** Its events are being processed, and the connections closed meanwhile (released after them). */
+  bool processing;
+  conn_t *closed;
+};
+
+/**
+ * @brief Resolves the server address.
+ *
+ * @param addr Resolved address (output).
+ * @return false on error, true on success.
+ */
+static bool _resolve(struct in_addr *addr) {
+  /* getaddrinfo is thread-safe (the portal sends from every server worker) */
+  struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
+  struct addrinfo *server = NULL;
+  if (getaddrinfo("localhost", NULL, &hints, &server) != 0) {
+    perror("client - getaddrinfo");
+    return false;
+  }
+
+  *addr = (( struct sockaddr_in * )server->ai_addr)->sin_addr;
+  freeaddrinfo(server);
+  return true;
+}
+
+/**
+ * @brief Connects to a server.
+ *
+ * @param addr Server address.
+ * @param port Server port.
+ * @param nonblocking true for a non-blocking socket (the connection may be established later, see
+ * _async_connected).
+ * @return The connection or NULL on error.
+ */
+static conn_t *_conn_open(const struct in_addr *addr, uint16_t port, bool nonblocking) {
+  int fd = socket(AF_INET, SOCK_STREAM | (nonblocking ? SOCK_NONBLOCK : 0), 0);
+  if (fd < 0) {
+    perror("client - socket error");
+    /* I'd rather use the log_write function in order to have a logfile
+    for each different process with specific failure info */
+    return NULL;
+  }
+
+  struct sockaddr_in serv_addr = {0};
+  serv_addr.sin_family = AF_INET;
+  serv_addr.sin_port = htons(port);
+  serv_addr.sin_addr = *addr;
+
+  int connectOk = connect(fd, ( const struct sockaddr * )&serv_addr, sizeof(serv_addr));
+  bool connecting = connectOk < 0 && nonblocking && errno == EINPROGRESS;
+  if (connectOk < 0 && !connecting) {
+    perror("client connect error");
+    close(fd);
+    return NULL;
+  }
+
+  /* requests are sent in a single write, so Nagle would only delay them */
+  int on = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+  conn_t *conn = calloc(1, sizeof(conn_t));
+  arena_t *arena = arena_create(CLIENT_ARENA_CHUNK_SIZE, CLIENT_ARENA_MAX_SIZE);
+  if (conn == NULL || arena == NULL) {
+    if (arena != NULL)
+      arena_destroy(arena);
+    free(conn);
+    close(fd);
+    return NULL;
+  }
+
+  conn->fd = fd;
+  conn->arena = arena;
+  conn->connecting = connecting;
+  pthread_mutex_init(&conn->write_lock, NULL);
+  pthread_mutex_init(&conn->lock, NULL);
+  pthread_cond_init(&conn->cond, NULL);
+  return conn;
+}
+
+/**
+ * @brief Closes a connection and releases its resources.
+ *
+ * @param conn Connection to close.
+ */
+static void _conn_close(conn_t *conn) {
+  pthread_cond_destroy(&conn->cond);
+  pthread_mutex_destroy(&conn->lock);
+  pthread_mutex_destroy(&conn->write_lock);
+  close(conn->fd);
+  arena_destroy(conn->arena);
+  recv_buffer_free(&conn->in);
+  send_buffer_free(&conn->out);
+  send_buffer_free(&conn->spare);
+  free(conn);
+}
+
+/**
+ * @brief Reads the next response from a connection.
+ *
+ * @param conn Connection.
+ * @param resp Parsed response (output).
+ * @param close Set to true if the server closes the connection after this response (output).
+ * @return false on error, true on success.
+ */
+static bool _conn_read_response(conn_t *conn, response_t *resp, bool *close) {
+  /* the header usually comes along with the whole response (and maybe more responses) */
+  size_t length;
+  frame_header_t header;
+  if (!recv_buffer_fill_to(&conn->in, conn->fd, FRAME_HEADER_SIZE) ||
+      !frame_header_read(&header, recv_buffer_peek(&conn->in, &length), FRAME_HEADER_SIZE) ||
+      header.payload_length > MAX_RESPONSE_SIZE || !recv_buffer_fill_to(&conn->in, conn->fd, frame_length(&header)))
+    return false;
+
+  /* deserializes the response in place, and then consumes it */
+  mem_reader_t reader = {.data = recv_buffer_peek(&conn->in, &length) + FRAME_HEADER_SIZE,
+                         .length = header.payload_length};
+  bool success = response_deserialize_as(resp, header.format, mem_reader_read, &reader);
+  *close = header.close;
+
+  recv_buffer_consume(&conn->in, frame_length(&header));
+  return success;
+}
+
+/**
+ * @brief Appends a (framed) request to a send buffer.
+ *
+ * @param b The send buffer.
+ * @param req Request.
+ * @param close true to ask the server to close the connection after the response.
+ * @param format Serialization format.
+ * @return false on error (nothing is appended), true on success.
+ */
+static bool _frame_request(send_buffer_t *b, const request_t *req, bool close, message_format_t format) {
+  /* serializes the request after room for its header */
+  size_t start = b->end;
+  char header_data[FRAME_HEADER_SIZE] = {0};
+  frame_header_t header = {.close = close, .format = format};
+  if (send_buffer_write(header_data, sizeof(header_data), b) && request_serialize_as(req, format, send_buffer_write, b)) {
+    header.payload_length = b->end - start - FRAME_HEADER_SIZE;
+    if (frame_header_write(b->data + start, &header))
+      return true;
+  }
+
+  /* drops the partial request, the buffer may hold other requests */
+  b->end = start;
+  return false;
+}
+
+/**
+ * @brief Sends a request through a connection.
+ * Requests written by several callers at the same time are sent together: the
+ * first caller sends whatever was written while it was sending, until there's
+ * nothing left.
+ *
+ * @param conn Connection.
+ * @param req Request that will be sent.
+ * @param close true to ask the server to close the connection after the response.
+ * @return false on error, true on success (or if it will be sent by another caller).
+ */
+static bool _conn_send_request(conn_t *conn, const request_t *req, bool close) {
+  pthread_mutex_lock(&conn->write_lock);
+
+  bool success = _frame_request(&conn->out, req, close, conn->format);
+  if (!success || conn->flushing) {
+    pthread_mutex_unlock(&conn->write_lock);
+    return success;
+  }
+
+  conn->flushing = true;
+  while (success && send_buffer_pending(&conn->out) > 0) {
+    /* sends what was written so far, while the other callers keep writing into the spare buffer */
+    send_buffer_t batch = conn->out;
+    conn->out = conn->spare;
+    pthread_mutex_unlock(&conn->write_lock);
+
+    success = send_buffer_flush(&batch, conn->fd);
+
+    pthread_mutex_lock(&conn->write_lock);
+    batch.start = 0;
+    batch.end = 0;
+    conn->spare = batch;
+  }
+
+  /* on error, the connection fails (along with the requests of the other callers) */
+  conn->flushing = false;
+  pthread_mutex_unlock(&conn->write_lock);
+  return success;
+}
+
+/**
+ * @brief Marks a pooled connection as broken, failing every call in flight.
+ * The connection lock must be held.
+ *
+ * @param conn Connection.
+ */
+static void _conn_fail(conn_t *conn) {
+  conn->broken = true;
+
+  while (conn->calls) {
+    call_t *call = conn->calls;
+    conn->calls = call->next;
+    call->done = true;
+    call->success = false;
+  }
+
+  pthread_cond_broadcast(&conn->cond);
+}
 
 /**
- * @brief Reads from a socket.
+ * @brief Hands a response to the call waiting for it: it's copied into the
+ * arena of the caller (who is waiting, so nobody else uses it), since the
+ * arena where it was parsed is reset for the next response.
+ * The connection lock must be held.
  *
- * @param output Output buffer.
- * @param bytes Number of bytes to read.
- * @param cb_ctx Callback context.
- * @return bytes read.
+ * @param conn Connection.
+ * @param resp Response.
  */
-static size_t _socket_read(void *output, size_t bytes, void *cb_ctx) {
-  int *fd = cb_ctx;
+static void _conn_complete(conn_t *conn, const response_t *resp) {
+  for (call_t **call = &conn->calls; *call; call = &(*call)->next) {
+    if ((*call)->id == resp->id) {
+      call_t *done = *call;
+      *call = done->next;
+
+      arena_t *previous = str_set_arena(done->arena);
+      done->success = response_copy(done->resp, resp);
+      done->done = true;
+      str_set_arena(previous);
+      return;
+    }
+  }
 
-  ssize_t bytes_read = 0;
-  do {
-    bytes_read += recv(*fd, ( char * )output + bytes_read, bytes - bytes_read, MSG_WAITALL);
-  } while (errno == EINTR);
+  /* nobody is waiting for it (e.g. an unknown id), the response is dropped */
+}
 
-  /* must have read the exact number of bytes requested*/
-  return bytes_read;
+/**
+ * @brief Checks whether the server closed an idle connection (without blocking).
+ *
+ * @param conn Connection (nothing in flight through it).
+ * @return true if it's closed (or failed), false otherwise.
+ */
+static bool _conn_closed(conn_t *conn) {
+  char byte;
+  ssize_t bytes = recv(conn->fd, &byte, sizeof(byte), MSG_PEEK | MSG_DONTWAIT);
+  return bytes == 0 || (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
 }
 
 /**
- * @brief Response serialization callback that outputs through a socket.
+ * @brief Sends a request through a pooled connection and waits for its response.
+ * Responses can arrive in any order: while waiting, the caller may become the
+ * reader of the connection and hand the responses it reads to their callers.
  *
- * @param data Data to write.
- * @param bytes Numer of bytes to write.
- * @param cb_ctx Client connection.
+ * @param conn Connection (shared with other callers).
+ * @param resp Response to the request (output).
+ * @param req Request that will be sent.
+ * @param written Set to true once the request may have reached the server (output).
  * @return false on error, true on success.
  */
-static bool _socket_write(const void *data, size_t bytes, void *cb_ctx) {
-  int *fd = cb_ctx;
+static bool _conn_call(conn_t *conn, response_t *resp, const request_t *req, bool *written) {
+  call_t call = {.resp = resp, .arena = str_get_arena( )};
+
+  /* the request goes with an id unique in the connection (never 0, which means unset) */
+  request_t tagged = *req;
+
+  pthread_mutex_lock(&conn->lock);
+  /* an idle connection closed by the server is caught before writing anything */
+  if (!conn->broken && conn->calls == NULL && !conn->reading && _conn_closed(conn))
+    _conn_fail(conn);
+
+  if (conn->broken) {
+    pthread_mutex_unlock(&conn->lock);
+    return false;
+  }
+
+  if (++conn->last_id == 0)
+    ++conn->last_id;
+
+  call.id = tagged.id = conn->last_id;
+  call.next = conn->calls;
+  conn->calls = &call;
+  pthread_mutex_unlock(&conn->lock);
+
+  /* registered before sending it, so the response can't arrive before the call */
+  *written = true;
+  bool sent = _conn_send_request(conn, &tagged, false);
+
+  pthread_mutex_lock(&conn->lock);
+  if (!sent)
+    _conn_fail(conn);
+
+  while (!call.done) {
+    if (conn->reading) {
+      pthread_cond_wait(&conn->cond, &conn->lock);
+      continue;
+    }
+
+    /* reads the next response (for whichever call it is) */
+    conn->reading = true;
+    pthread_mutex_unlock(&conn->lock);
+
+    response_t next = {0};
+    bool close = false;
+    arena_t *previous = str_set_arena(conn->arena);
+    bool success = _conn_read_response(conn, &next, &close);
+    str_set_arena(previous);
+
+    pthread_mutex_lock(&conn->lock);
+    conn->reading = false;
+    if (success)
+      _conn_complete(conn, &next);
+    arena_reset(conn->arena);
 
-  ssize_t bytes_sent = 0;
-  do {
-    bytes_sent = send(*fd, data, bytes, MSG_NOSIGNAL);
-  } while (errno == EINTR);
+    /* the server won't answer anything else through this connection */
+    if (!success || close)
+      _conn_fail(conn);
 
-  /* must have sent the all the data */
-  return (bytes_sent == bytes);
+    pthread_cond_broadcast(&conn->cond);
+  }
+
+  pthread_mutex_unlock(&conn->lock);
+  return call.success;
 }
 
 /**
@@ -53,42 +439,549 @@ static bool _socket_write(const void *data, size_t bytes, void *cb_ctx) {
  * @return false on error, true on success.
  */
 bool client_send(response_t *resp, uint16_t port, const request_t *req) {
-  int fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (fd < 0) {
-    perror("client - socket error");
-    /* I'd rather use the log_write function in order to have a logfile
-    for each different process with specific failure info */
+  struct in_addr addr;
+  if (!_resolve(&addr))
+    return false;
+
+  conn_t *conn = _conn_open(&addr, port, false);
+  if (conn == NULL)
     return false;
+
+  /* sends the request and waits the response (a single exchange, so the connection isn't kept alive) */
+  bool close;
+  bool success = _conn_send_request(conn, req, true) && _conn_read_response(conn, resp, &close);
+
+  /* cleanup */
+  _conn_close(conn);
+
+  return success;
+}
+
+/**
+ * @brief Creates a pool of persistent connections.
+ * Requests sent through the pool reuse the connections (so they don't pay
+ * the address resolution and the TCP handshake every time), and several
+ * requests can be in flight through the same connection. The pool can be
+ * used from several threads at the same time.
+ *
+ * @param format Serialization format of the requests sent through the pool.
+ * @return The pool or NULL on error.
+ */
+client_pool_t *client_pool_create(message_format_t format) {
+  client_pool_t *pool = calloc(1, sizeof(client_pool_t));
+  if (pool == NULL)
+    return NULL;
+
+  pool->format = format;
+
+  if (!_resolve(&pool->addr)) {
+    free(pool);
+    return NULL;
   }
 
-  struct sockaddr_in serv_addr = {0};
-  serv_addr.sin_family = AF_INET;
-  serv_addr.sin_port = htons(port);
+  pthread_mutex_init(&pool->lock, NULL);
+  return pool;
+}
 
-  struct hostent *server = gethostbyname("localhost");
-  if (server == NULL) {
-    perror("client - gethostbyname");
-    close(fd);
+/**
+ * @brief Finds the connections to a given port (creating the entry if needed).
+ * The pool lock must be held.
+ *
+ * @param pool The pool.
+ * @param port Server port.
+ * @return The upstream or NULL on error.
+ */
+static upstream_t *_pool_upstream(client_pool_t *pool, uint16_t port) {
+  upstream_t *up = pool->upstreams;
+  while (up && up->port != port)
+    up = up->next;
+
+  if (up == NULL) {
+    up = calloc(1, sizeof(upstream_t));
+    if (up == NULL)
+      return NULL;
+
+    up->port = port;
+    up->next = pool->upstreams;
+    pool->upstreams = up;
+  }
+
+  return up;
+}
+
+/**
+ * @brief Takes the least busy connection to the given port (or opens a new
+ * one if every connection has CLIENT_POOL_MAX_PIPELINE requests in flight).
+ *
+ * @param pool The pool.
+ * @param port Server port.
+ * @param fresh true to always open a new connection.
+ * @return The connection or NULL on error.
+ */
+static conn_t *_pool_acquire(client_pool_t *pool, uint16_t port, bool fresh) {
+  pthread_mutex_lock(&pool->lock);
+
+  upstream_t *up = _pool_upstream(pool, port);
+  if (up == NULL) {
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+  }
+
+  conn_t *conn = NULL;
+  for (conn_t *c = up->conns; c && !fresh; c = c->next) {
+    if (c->refs < CLIENT_POOL_MAX_PIPELINE && (conn == NULL || c->refs < conn->refs))
+      conn = c;
+  }
+
+  if (conn == NULL) {
+    /* connecting to localhost doesn't take long, and avoids opening several connections at once */
+    conn = _conn_open(&pool->addr, port, false);
+    if (conn != NULL) {
+      conn->format = pool->format;
+      conn->next = up->conns;
+      up->conns = conn;
+    }
+  }
+
+  if (conn != NULL)
+    conn->refs++;
+
+  pthread_mutex_unlock(&pool->lock);
+  return conn;
+}
+
+/**
+ * @brief Stops using a pooled connection (closing it if it's broken and
+ * nobody else is using it).
+ *
+ * @param pool The pool.
+ * @param port Server port.
+ * @param conn The connection.
+ */
+static void _pool_release(client_pool_t *pool, uint16_t port, conn_t *conn) {
+  pthread_mutex_lock(&pool->lock);
+
+  pthread_mutex_lock(&conn->lock);
+  bool broken = conn->broken;
+  pthread_mutex_unlock(&conn->lock);
+
+  if (broken) {
+    /* unlinks it (if nobody did it already), so no more requests are sent through it */
+    upstream_t *up = _pool_upstream(pool, port);
+    for (conn_t **c = up ? &up->conns : NULL; c && *c; c = &(*c)->next) {
+      if (*c == conn) {
+        *c = conn->next;
+        break;
+      }
+    }
+  }
+
+  bool unused = (--conn->refs == 0);
+  pthread_mutex_unlock(&pool->lock);
+
+  if (broken && unused)
+    _conn_close(conn);
+}
+
+/**
+ * @brief Sends a request to the given port through a pooled connection and
+ * waits for its response (its long strings go to the arena of the calling
+ * thread, see str_set_arena).
+ * If the connection fails before the request is written (e.g. the server
+ * closed it while it was idle), the request is retried once through a new
+ * connection. Once written it's never retried, since the server may have
+ * applied it already (e.g. a post whose response was lost).
+ *
+ * @param pool The pool.
+ * @param resp Response to the request (output).
+ * @param port Port where the request is sent to.
+ * @param req Request that will be sent (properly initialized by the caller, its id is ignored).
+ * @return false on error, true on success.
+ */
+bool client_pool_send(client_pool_t *pool, response_t *resp, uint16_t port, const request_t *req) {
+  for (int attempt = 0; attempt < 2; attempt++) {
+    conn_t *conn = _pool_acquire(pool, port, attempt > 0);
+    if (conn == NULL)
+      return false;
+
+    bool written = false;
+    bool success = _conn_call(conn, resp, req, &written);
+    _pool_release(pool, port, conn);
+
+    if (success || written)
+      return success;
+  }
+
+  return false;
+}
+
+/**
+ * @brief Closes every connection of a pool and destroys it (there shouldn't
+ * be requests in flight).
+ *
+ * @param pool The pool.
+ */
+void client_pool_destroy(client_pool_t *pool) {
+  while (pool->upstreams) {
+    upstream_t *up = pool->upstreams;
+    pool->upstreams = up->next;
+
+    while (up->conns) {
+      conn_t *conn = up->conns;
+      up->conns = conn->next;
+      _conn_close(conn);
+    }
+
+    free(up);
+  }
+
+  pthread_mutex_destroy(&pool->lock);
+  free(pool);
+}
+
+/**
+ * @brief Creates an asynchronous client.
+ *
+ * @param format Serialization format of the requests sent through the client.
+ * @return The client or NULL on error.
+ */
+client_async_t *client_async_create(message_format_t format) {
+  client_async_t *client = calloc(1, sizeof(client_async_t));
+  if (client == NULL)
+    return NULL;
+
+  client->format = format;
+  client->epoll_fd = epoll_create1(0);
+  if (client->epoll_fd < 0 || !_resolve(&client->addr)) {
+    if (client->epoll_fd >= 0)
+      close(client->epoll_fd);
+    free(client);
+    return NULL;
+  }
+
+  return client;
+}
+
+/**
+ * @brief Gets the fd the caller's event loop watches: it's readable when
+ * there are events to process (see client_async_process).
+ *
+ * @param client The client.
+ * @return The fd.
+ */
+int client_async_fd(const client_async_t *client) {
+  return client->epoll_fd;
+}
+
+/**
+ * @brief Takes the least busy connection to the given port (or opens a new
+ * one if every connection has CLIENT_POOL_MAX_PIPELINE requests in flight).
+ *
+ * @param client The client.
+ * @param up Connections to the port.
+ * @return The connection or NULL on error.
+ */
+static conn_t *_async_acquire(client_async_t *client, upstream_t *up) {
+  conn_t *conn = NULL;
+  for (conn_t *c = up->conns; c; c = c->next) {
+    if (!c->broken && c->refs < CLIENT_POOL_MAX_PIPELINE && (conn == NULL || c->refs < conn->refs))
+      conn = c;
+  }
+
+  if (conn != NULL)
+    return conn;
+
+  /* the connection is established in the background, it gets writable once it's done */
+  conn = _conn_open(&client->addr, up->port, true);
+  if (conn == NULL)
+    return NULL;
+
+  struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = conn};
+  if (epoll_ctl(client->epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev) < 0) {
+    perror("client - epoll_ctl");
+    _conn_close(conn);
+    return NULL;
+  }
+
+  conn->format = client->format;
+  conn->next = up->conns;
+  up->conns = conn;
+  return conn;
+}
+
+/**
+ * @brief Closes an asynchronous connection, failing every call in flight.
+ * While the client processes its events (whose callbacks may close any
+ * connection, e.g. by sending through it), it's only released after them.
+ *
+ * @param client The client.
+ * @param conn Connection to close.
+ */
+static void _async_close(client_async_t *client, conn_t *conn) {
+  if (conn->closed)
+    return;
+
+  /* unlinked first, so the callbacks don't send anything through it */
+  conn->closed = true;
+  conn->broken = true;
+  for (upstream_t *up = client->upstreams; up; up = up->next) {
+    for (conn_t **c = &up->conns; *c; c = &(*c)->next) {
+      if (*c == conn) {
+        *c = conn->next;
+        break;
+      }
+    }
+  }
+
+  while (conn->calls) {
+    call_t *call = conn->calls;
+    conn->calls = call->next;
+    call->cb(NULL, call->ctx);
+    free(call);
+  }
+
+  /* the events being processed may refer to it */
+  if (client->processing) {
+    conn->next = client->closed;
+    client->closed = conn;
+    return;
+  }
+
+  /* closing the fd also removes it from the epoll set */
+  _conn_close(conn);
+}
+
+/**
+ * @brief Sends a request to the given port without waiting for its response:
+ * the callback gets it (or NULL if the connection fails) from
+ * client_async_process, never from this call.
+ *
+ * @param client The client.
+ * @param port Port where the request is sent to.
+ * @param req Request that will be sent (properly initialized by the caller, its id is ignored).
+ * @param arena Arena where the long strings of the response go (it must live until the callback is called,
+ * which also allocates from it, see str_set_arena).
+ * @param cb Callback that gets the response.
+ * @param ctx Context of the callback.
+ * @return false on error (the callback won't be called), true on success.
+ */
+bool client_async_send(client_async_t *client, uint16_t port, const request_t *req, arena_t *arena,
+                       client_cb_t cb, void *ctx) {
+  upstream_t *up = client->upstreams;
+  while (up && up->port != port)
+    up = up->next;
+
+  if (up == NULL) {
+    up = calloc(1, sizeof(upstream_t));
+    if (up == NULL)
+      return false;
+
+    up->port = port;
+    up->next = client->upstreams;
+    client->upstreams = up;
+  }
+
+  conn_t *conn = _async_acquire(client, up);
+  call_t *call = calloc(1, sizeof(call_t));
+  if (conn == NULL || call == NULL) {
+    free(call);
     return false;
   }
 
-  memcpy(&serv_addr.sin_addr.s_addr, server->h_addr_list[0], server->h_length);
+  /* the request goes with an id unique in the connection (never 0, which means unset) */
+  request_t tagged = *req;
+  if (++conn->last_id == 0)
+    ++conn->last_id;
 
-  int connectOk = connect(fd, ( const struct sockaddr * )&serv_addr, sizeof(serv_addr));
-  if (connectOk < 0) {
+  call->id = tagged.id = conn->last_id;
+  if (!_frame_request(&conn->out, &tagged, false, conn->format)) {
+    free(call);
+    return false;
+  }
+
+  /* sent right away (unless it's still connecting), what doesn't fit in the socket goes when it gets
+   * writable */
+  bool sent = conn->connecting || send_buffer_flush(&conn->out, conn->fd);
+  if (!sent && errno != EAGAIN && errno != EWOULDBLOCK) {
+    /* no more requests go through it: it's closed once the calls in flight fail (when it's processed),
+     * or right away if there are none */
+    conn->broken = true;
+    free(call);
+    if (conn->refs == 0)
+      _async_close(client, conn);
+    return false;
+  }
+
+  call->arena = arena;
+  call->cb = cb;
+  call->ctx = ctx;
+  call->next = conn->calls;
+  conn->calls = call;
+  conn->refs++;
+  return true;
+}
+
+/**
+ * @brief Hands a response to the asynchronous call waiting for it: it's
+ * copied into the arena of the call, which is also the arena of the thread
+ * while the callback runs.
+ *
+ * @param conn Connection.
+ * @param resp Response.
+ */
+static void _async_complete(conn_t *conn, const response_t *resp) {
+  for (call_t **call = &conn->calls; *call; call = &(*call)->next) {
+    if ((*call)->id == resp->id) {
+      call_t *done = *call;
+      *call = done->next;
+      conn->refs--;
+
+      response_t copy;
+      arena_t *previous = str_set_arena(done->arena);
+      done->cb(response_copy(&copy, resp) ? &copy : NULL, done->ctx);
+      str_set_arena(previous);
+      free(done);
+      return;
+    }
+  }
+
+  /* nobody is waiting for it (e.g. an unknown id), the response is dropped */
+}
+
+/**
+ * @brief Handles every complete response received through an asynchronous connection.
+ *
+ * @param conn Connection.
+ * @return false if the connection failed (or the server closes it), true otherwise.
+ */
+static bool _async_on_data(conn_t *conn) {
+  while (true) {
+    size_t length;
+    const char *data = recv_buffer_peek(&conn->in, &length);
+
+    frame_header_t header;
+    if (!frame_header_read(&header, data, length))
+      return true;
+
+    if (header.payload_length > MAX_RESPONSE_SIZE)
+      return false;
+
+    /* makes room for the whole response at once */
+    if (length < frame_length(&header))
+      return recv_buffer_reserve(&conn->in, frame_length(&header));
+
+    /* the response is parsed before it's consumed (and before its callback, that may send more requests) */
+    response_t resp = {0};
+    mem_reader_t reader = {.data = data + FRAME_HEADER_SIZE, .length = header.payload_length};
+    arena_t *previous = str_set_arena(conn->arena);
+    bool success = response_deserialize_as(&resp, header.format, mem_reader_read, &reader);
+    str_set_arena(previous);
+    recv_buffer_consume(&conn->in, frame_length(&header));
+    if (success)
+      _async_complete(conn, &resp);
+
+    arena_reset(conn->arena);
+    if (!success)
+      return false;
+
+    /* the server won't answer anything else through this connection */
+    if (header.close)
+      return false;
+  }
+}
+
+/**
+ * @brief Checks whether an asynchronous connection was established.
+ *
+ * @param conn Connection (being established).
+ * @param events Events of its socket.
+ * @return false if it failed, true otherwise (it's still connecting if it didn't finish yet).
+ */
+static bool _async_connected(conn_t *conn, uint32_t events) {
+  int error = 0;
+  socklen_t length = sizeof(error);
+  if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+    errno = error;
     perror("client connect error");
-    close(fd);
     return false;
   }
 
-  /* sends the request and waits the response */
-  bool success = request_serialize(req, _socket_write, &fd);
-  if (success) {
-    success = response_deserialize(resp, _socket_read, &fd);
+  /* it gets writable once it's established */
+  conn->connecting = !(events & EPOLLOUT);
+  return true;
+}
+
+/**
+ * @brief Sends the pending requests and reads the responses of an
+ * asynchronous connection, as far as the socket allows (edge-triggered).
+ *
+ * @param client The client.
+ * @param conn Connection.
+ * @param events Events of its socket.
+ */
+static void _async_process(client_async_t *client, conn_t *conn, uint32_t events) {
+  /* closed by the callbacks of an event before */
+  if (conn->closed)
+    return;
+
+  /* the requests sent while it was connecting go once it's established */
+  bool success = !conn->connecting || _async_connected(conn, events);
+  bool pending = success && !conn->connecting && send_buffer_pending(&conn->out) > 0;
+  if (pending && !send_buffer_flush(&conn->out, conn->fd))
+    success = (errno == EAGAIN || errno == EWOULDBLOCK);
+
+  /* the callbacks may send more requests through it (or close it) */
+  while (success && !conn->connecting && !conn->closed) {
+    ssize_t bytes = recv_buffer_fill(&conn->in, conn->fd);
+    if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+
+    success = (bytes > 0) && _async_on_data(conn);
   }
 
-  /* cleanup */
-  close(fd);
+  if (!success || (conn->broken && conn->refs == 0))
+    _async_close(client, conn);
+}
 
-  return success;
+/**
+ * @brief Processes the events of the client's connections: sends the
+ * requests that didn't fit in their sockets, and hands the responses
+ * received to the callbacks of their requests (it doesn't block).
+ *
+ * @param client The client.
+ */
+void client_async_process(client_async_t *client) {
+  struct epoll_event events[CLIENT_ASYNC_MAX_EVENTS];
+  int n = epoll_wait(client->epoll_fd, events, CLIENT_ASYNC_MAX_EVENTS, 0);
+  client->processing = true;
+  for (int i = 0; i < n; i++)
+    _async_process(client, events[i].data.ptr, events[i].events);
+  client->processing = false;
+
+  /* the connections closed by the events above (which may refer to any of them) */
+  while (client->closed) {
+    conn_t *conn = client->closed;
+    client->closed = conn->next;
+    _conn_close(conn);
+  }
+}
+
+/**
+ * @brief Closes every connection of an asynchronous client (failing the
+ * requests in flight) and destroys it.
+ *
+ * @param client The client.
+ */
+void client_async_destroy(client_async_t *client) {
+  while (client->upstreams) {
+    upstream_t *up = client->upstreams;
+    while (up->conns)
+      _async_close(client, up->conns);
+
+    client->upstreams = up->next;
+    free(up);
+  }
+
+  close(client->epoll_fd);
+  free(client);
 }
@@ -9,10 +9,41 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
+/** Max number of requests in flight through a pooled connection (more open another connection) */
+#define CLIENT_POOL_MAX_PIPELINE 128
+
+/** Pool of persistent connections (see client.c) */
+typedef struct client_pool client_pool_t;
+
+/** Client with non-blocking connections, driven by the caller's event loop (see client.c) */
+typedef struct client_async client_async_t;
+
+/** Gets the response of an asynchronous request (NULL if it failed), see client_async_send */
+typedef void (*client_cb_t)(response_t *resp, void *ctx);
+
 /*-------------------------------------------------------------------------
   Client
 -------------------------------------------------------------------------*/
 
 bool client_send(response_t *resp, uint16_t port, const request_t *req);
 
+/*-------------------------------------------------------------------------
+  Connection pool
+-------------------------------------------------------------------------*/
+
+client_pool_t *client_pool_create(message_format_t format);
+bool client_pool_send(client_pool_t *pool, response_t *resp, uint16_t port, const request_t *req);
+void client_pool_destroy(client_pool_t *pool);
+
+/*-------------------------------------------------------------------------
+  Asynchronous client
+-------------------------------------------------------------------------*/
+
+client_async_t *client_async_create(message_format_t format);
+int client_async_fd(const client_async_t *client);
+bool client_async_send(client_async_t *client, uint16_t port, const request_t *req, arena_t *arena,
+                       client_cb_t cb, void *ctx);
+void client_async_process(client_async_t *client);
+void client_async_destroy(client_async_t *client);
+
 #endif
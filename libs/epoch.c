@@ -0,0 +1,184 @@
+/* include area */
+#define _GNU_SOURCE
+#include "epoch.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/** Slot of a reader thread (a whole cache line, so readers don't share lines) */
+typedef struct {
+  /** Epoch when the reader entered its read section (0 if it's not in one). */
+  uint64_t epoch;
+  /** The slot belongs to a thread. */
+  bool taken;
+  char padding[64 - sizeof(uint64_t) - sizeof(bool)];
+} reader_t;
+
+/** Object waiting to be destroyed */
+typedef struct retired {
+  void *ptr;
+  epoch_destroy_t destroy;
+  /** Epoch when it was retired (readers that entered later can't see it). */
+  uint64_t epoch;
+  struct retired *next;
+} retired_t;
+
+static reader_t readers[EPOCH_MAX_READERS];
+static uint64_t global_epoch = 1;
+
+/** Retired objects (guarded by retired_lock) */
+static retired_t *retired = NULL;
+static pthread_mutex_t retired_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Slot of the thread (released when the thread exits, see _reader_release) */
+static __thread reader_t *reader = NULL;
+static pthread_key_t reader_key;
+static pthread_once_t reader_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Releases the slot of a thread that exited.
+ *
+ * @param ptr The slot.
+ */
+static void _reader_release(void *ptr) {
+  reader_t *slot = ptr;
+  __atomic_store_n(&slot->taken, false, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Creates the key that releases the slots (once).
+ */
+static void _reader_key_init(void) {
+  pthread_key_create(&reader_key, _reader_release);
+}
+
+/**
+ * @brief Takes a free slot for the calling thread (waiting if there's none).
+ *
+ * @return The slot.
+ */
+static reader_t *_reader_acquire(void) {
+  pthread_once(&reader_once, _reader_key_init);
+
+  for (;;) {
+    for (size_t i = 0; i < EPOCH_MAX_READERS; i++) {
+      bool taken = false;
+      if (!__atomic_load_n(&readers[i].taken, __ATOMIC_RELAXED) &&
+          __atomic_compare_exchange_n(&readers[i].taken, &taken, true, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        pthread_setspecific(reader_key, &readers[i]);
+        return &readers[i];
+      }
+    }
+    sched_yield( );
+  }
+}
+
+/**
+ * @brief Returns the oldest epoch of the readers in a read section.
+ *
+ * @return the epoch, or UINT64_MAX if no thread is reading.
+ */
+static uint64_t _min_reader_epoch(void) {
+  uint64_t min = UINT64_MAX;
+  for (size_t i = 0; i < EPOCH_MAX_READERS; i++) {
+    uint64_t epoch = __atomic_load_n(&readers[i].epoch, __ATOMIC_ACQUIRE);
+    if (epoch != 0 && epoch < min)
+      min = epoch;
+  }
+
+  return min;
+}
+
+/**
+ * @brief Enters a read section: shared structures read until epoch_exit
+ * are not destroyed meanwhile.
+ */
+void epoch_enter(void) {
+  if (reader == NULL)
+    reader = _reader_acquire( );
+
+  /* the epoch must be visible to the writers before any shared pointer is read */
+  __atomic_store_n(&reader->epoch, __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief Leaves a read section.
+ */
+void epoch_exit(void) {
+  __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Retires an object that is no longer reachable by new readers
+ * (its replacement was already published): it's destroyed once the
+ * readers that could still be reading it leave their read sections.
+ *
+ * @param ptr The object.
+ * @param destroy Destroys the object.
+ */
+void epoch_retire(void *ptr, epoch_destroy_t destroy) {
+  /* readers that enter from now on can't see the object */
+  uint64_t epoch = __atomic_fetch_add(&global_epoch, 1, __ATOMIC_SEQ_CST);
+
+  retired_t *item = malloc(sizeof(retired_t));
+  if (item == NULL) {
+    /* can't keep it for later, so it waits for the readers */
+    while (_min_reader_epoch( ) <= epoch)
+      sched_yield( );
+    destroy(ptr);
+    return;
+  }
+
+  item->ptr = ptr;
+  item->destroy = destroy;
+  item->epoch = epoch;
+
+  /* takes out the objects nobody can be reading anymore */
+  pthread_mutex_lock(&retired_lock);
+  item->next = retired;
+  retired = item;
+
+  retired_t *reclaimed = NULL;
+  uint64_t min = _min_reader_epoch( );
+  for (retired_t **it = &retired; *it;) {
+    if ((*it)->epoch < min) {
+      retired_t *next = (*it)->next;
+      (*it)->next = reclaimed;
+      reclaimed = *it;
+      *it = next;
+    } else {
+      it = &(*it)->next;
+    }
+  }
+  pthread_mutex_unlock(&retired_lock);
+
+  while (reclaimed) {
+    retired_t *next = reclaimed->next;
+    reclaimed->destroy(reclaimed->ptr);
+    free(reclaimed);
+    reclaimed = next;
+  }
+}
+
+/**
+ * @brief Destroys every retired object, waiting for the readers that could
+ * still be reading them (e.g. on shutdown).
+ */
+void epoch_flush(void) {
+  pthread_mutex_lock(&retired_lock);
+  retired_t *reclaimed = retired;
+  retired = NULL;
+  pthread_mutex_unlock(&retired_lock);
+
+  uint64_t epoch = __atomic_fetch_add(&global_epoch, 1, __ATOMIC_SEQ_CST);
+  while (_min_reader_epoch( ) <= epoch)
+    sched_yield( );
+
+  while (reclaimed) {
+    retired_t *next = reclaimed->next;
+    reclaimed->destroy(reclaimed->ptr);
+    free(reclaimed);
+    reclaimed = next;
+  }
+}
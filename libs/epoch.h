@@ -0,0 +1,37 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+/**
+ * @brief This module implements epoch based reclamation, so readers can
+ * traverse shared structures without locks.
+ *
+ * Readers wrap every access between epoch_enter and epoch_exit (a read
+ * section, that must be short and can't be nested): entering only publishes
+ * the current epoch in a slot of the thread. Writers never modify what a
+ * reader may be reading: they publish a new version (with an atomic store)
+ * and retire the old one, which is destroyed once every reader that could
+ * have seen it has left its read section.
+ *
+ * The writers of a structure synchronize among themselves (e.g. a mutex).
+ */
+
+/* include area */
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Max number of threads in a read section at the same time (each thread takes a slot on its first read) */
+#define EPOCH_MAX_READERS 256
+
+/** Destroys a retired object. */
+typedef void (*epoch_destroy_t)(void *ptr);
+
+/*--------------------------------------------------------------------------
+   Prototypes
+--------------------------------------------------------------------------*/
+
+void epoch_enter(void);
+void epoch_exit(void);
+void epoch_retire(void *ptr, epoch_destroy_t destroy);
+void epoch_flush(void);
+
+#endif
@@ -0,0 +1,63 @@
+/* include area */
+#include "frame.h"
+#include <stdint.h>
+
+/**
+ * @brief Parses the header at the beginning of a buffer.
+ *
+ * @param header Parsed header (output).
+ * @param data Received data.
+ * @param length Number of bytes received.
+ * @return false if the header is incomplete, true on success.
+ */
+bool frame_header_read(frame_header_t *header, const char *data, size_t length) {
+  if (length < FRAME_HEADER_SIZE)
+    return false;
+
+  /* big endian */
+  uint32_t value = 0;
+  for (size_t i = 0; i < FRAME_HEADER_SIZE; i++) {
+    value = (value << 8) | ( uint8_t )data[i];
+  }
+
+  header->payload_length = value & FRAME_MAX_PAYLOAD;
+  header->close = (value & FRAME_FLAG_CLOSE) != 0;
+  header->format = (value & FRAME_FLAG_BINARY) ? message_format_binary : message_format_json;
+  return true;
+}
+
+/**
+ * @brief Writes a frame header.
+ *
+ * @param data Output buffer (at least FRAME_HEADER_SIZE bytes).
+ * @param header Header to write.
+ * @return false if the payload is too large, true on success.
+ */
+bool frame_header_write(char *data, const frame_header_t *header) {
+  if (header->payload_length > FRAME_MAX_PAYLOAD)
+    return false;
+
+  uint32_t value = header->payload_length;
+  if (header->close)
+    value |= FRAME_FLAG_CLOSE;
+  if (header->format == message_format_binary)
+    value |= FRAME_FLAG_BINARY;
+
+  /* big endian */
+  for (size_t i = FRAME_HEADER_SIZE; i > 0; i--) {
+    data[i - 1] = value & 0xFF;
+    value >>= 8;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Returns the size of a whole frame (header and payload).
+ *
+ * @param header Frame header.
+ * @return size (in bytes) of the frame.
+ */
+size_t frame_length(const frame_header_t *header) {
+  return FRAME_HEADER_SIZE + header->payload_length;
+}
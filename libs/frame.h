@@ -0,0 +1,62 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+/**
+ * @brief This module handles the message framing, so more than one
+ * request/response can be exchanged through the same connection.
+ *
+ * Every serialized message (the payload) is preceded by a fixed size header:
+ *
+ *    +--------------------------------------+---------------------+
+ *    | MAX_SIZE_IN_BYTES (big endian)       | payload             |
+ *    | bit 31: FRAME_FLAG_CLOSE             | (payload_length     |
+ *    | bit 30: FRAME_FLAG_BINARY            |  bytes)             |
+ *    | bits 0-29: payload_length            |                     |
+ *    +--------------------------------------+---------------------+
+ *
+ * Connections are persistent (like HTTP/1.1): a client can send any number of
+ * requests through the same connection. A request with FRAME_FLAG_CLOSE set
+ * (like "Connection: close") asks the server to close the connection after
+ * sending its response, which also carries the flag.
+ *
+ * The payload is serialized as JSON, or in the binary format if FRAME_FLAG_BINARY
+ * is set (see binary.h). The format is chosen by the client (usually once per
+ * connection), and the server answers every request in the format it was sent.
+ */
+
+/* include area */
+#include "message.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Size (in bytes) of the frame header */
+#define FRAME_HEADER_SIZE MAX_SIZE_IN_BYTES
+
+/** Header flag: the connection is closed after this exchange */
+#define FRAME_FLAG_CLOSE 0x80000000u
+
+/** Header flag: the payload is serialized in the binary format */
+#define FRAME_FLAG_BINARY 0x40000000u
+
+/** Max payload size that fits in the header */
+#define FRAME_MAX_PAYLOAD 0x3FFFFFFFu
+
+/** Frame header */
+typedef struct {
+  /** Size (in bytes) of the payload that follows the header. */
+  size_t payload_length;
+  /** The connection is closed after this exchange. */
+  bool close;
+  /** Serialization format of the payload. */
+  message_format_t format;
+} frame_header_t;
+
+/*--------------------------------------------------------------------------
+   Prototypes
+--------------------------------------------------------------------------*/
+
+bool frame_header_read(frame_header_t *header, const char *data, size_t length);
+bool frame_header_write(char *data, const frame_header_t *header);
+size_t frame_length(const frame_header_t *header);
+
+#endif
@@ -0,0 +1,200 @@
+/* include area */
+#include "intern.h"
+#include "str.h"
+#include <jansson.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Initial number of slots (a power of 2) */
+#define INTERN_INITIAL_SLOTS 64
+
+/** Slot of the hash table */
+typedef struct {
+  uint32_t hash;
+  /** ID of the key (0 if the slot is empty). */
+  uint32_t id;
+} slot_t;
+
+/** Key of an ID (its characters are in the keys area) */
+typedef struct {
+  size_t offset;
+  size_t length;
+} entry_t;
+
+/** The table of the process (entries[id - 1] is the key of an ID) */
+static struct {
+  size_t num_slots;
+  slot_t *slots;
+  size_t num_entries;
+  size_t max_entries;
+  entry_t *entries;
+  size_t keys_length;
+  size_t keys_capacity;
+  char *keys;
+} table;
+
+/**
+ * @brief Looks up the slot of a key.
+ *
+ * @param key Key characters.
+ * @param length Key length.
+ * @param hash Key hash.
+ * @return the slot of the key, or the empty slot where it would be inserted.
+ */
+static slot_t *_find(const char *key, size_t length, uint32_t hash) {
+  size_t mask = table.num_slots - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    slot_t *slot = &table.slots[i];
+    if (slot->id == 0)
+      return slot;
+
+    const entry_t *entry = &table.entries[slot->id - 1];
+    if (slot->hash == hash && entry->length == length && memcmp(table.keys + entry->offset, key, length) == 0)
+      return slot;
+  }
+}
+
+/**
+ * @brief Doubles the hash table (or creates it).
+ *
+ * @return false on error, true on success.
+ */
+static bool _grow_table( ) {
+  size_t num_slots = table.num_slots ? table.num_slots * 2 : INTERN_INITIAL_SLOTS;
+  slot_t *slots = calloc(num_slots, sizeof(slot_t));
+  if (slots == NULL)
+    return false;
+
+  /* the keys are all different, so each one goes to the first empty slot */
+  for (size_t i = 0; i < table.num_slots; i++) {
+    if (table.slots[i].id == 0)
+      continue;
+
+    size_t j = table.slots[i].hash & (num_slots - 1);
+    while (slots[j].id != 0)
+      j = (j + 1) & (num_slots - 1);
+    slots[j] = table.slots[i];
+  }
+
+  free(table.slots);
+  table.slots = slots;
+  table.num_slots = num_slots;
+  return true;
+}
+
+/**
+ * @brief Makes room for one more key.
+ *
+ * @param length Length of the key.
+ * @return false on error, true on success.
+ */
+static bool _reserve(size_t length) {
+  if ((table.num_entries + 1) * 4 > table.num_slots * 3 && !_grow_table( ))
+    return false;
+
+  if (table.num_entries == table.max_entries) {
+    size_t max_entries = table.max_entries ? table.max_entries * 2 : INTERN_INITIAL_SLOTS;
+    entry_t *entries = realloc(table.entries, max_entries * sizeof(entry_t));
+    if (entries == NULL)
+      return false;
+
+    table.entries = entries;
+    table.max_entries = max_entries;
+  }
+
+  if (table.keys_length + length > table.keys_capacity) {
+    size_t capacity = table.keys_capacity ? table.keys_capacity : 1024;
+    while (capacity < table.keys_length + length)
+      capacity *= 2;
+
+    char *keys = realloc(table.keys, capacity);
+    if (keys == NULL)
+      return false;
+
+    table.keys = keys;
+    table.keys_capacity = capacity;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Interns a key (only at startup, see intern.h).
+ *
+ * @param key Key characters.
+ * @param length Key length.
+ * @return the ID of the key (the one it already had, if it was interned), 0 on error.
+ */
+uint32_t intern_add(const char *key, size_t length) {
+  uint32_t hash = str_hash_n(key, length);
+  uint32_t id = intern_find(key, length, hash);
+  if (id != 0)
+    return id;
+
+  if (table.num_entries == UINT32_MAX - 1 || !_reserve(length))
+    return 0;
+
+  entry_t *entry = &table.entries[table.num_entries];
+  entry->offset = table.keys_length;
+  entry->length = length;
+  memcpy(table.keys + entry->offset, key, length);
+  table.keys_length += length;
+
+  slot_t *slot = _find(key, length, hash);
+  slot->hash = hash;
+  slot->id = ++table.num_entries;
+  return slot->id;
+}
+
+/**
+ * @brief Looks up the ID of a key.
+ *
+ * @param key Key characters.
+ * @param length Key length.
+ * @param hash Key hash (see str_hash_n).
+ * @return the ID of the key, 0 if it isn't interned.
+ */
+uint32_t intern_find(const char *key, size_t length, uint32_t hash) {
+  return table.num_entries > 0 ? _find(key, length, hash)->id : 0;
+}
+
+/**
+ * @brief Returns the number of interned keys (IDs go from 1 to this number).
+ *
+ * @return number of keys.
+ */
+size_t intern_count( ) {
+  return table.num_entries;
+}
+
+/**
+ * @brief Interns the keys of a JSON file (an object keyed by city/currency,
+ * like the files of the microservices).
+ *
+ * @param path Path of the file.
+ * @return false on error (e.g. the file doesn't exist), true on success.
+ */
+bool intern_from_json(const char *path) {
+  json_error_t error;
+  json_t *json = json_load_file(path, 0, &error);
+  bool success = json_is_object(json);
+
+  const char *name;
+  json_t *value;
+  json_object_foreach(json, name, value) {
+    success = success && intern_add(name, strlen(name)) != 0;
+  }
+
+  json_decref(json);
+  return success;
+}
+
+/**
+ * @brief Removes all the keys (their IDs may be given to other keys, e.g. between tests).
+ */
+void intern_clear( ) {
+  free(table.slots);
+  free(table.entries);
+  free(table.keys);
+  memset(&table, 0, sizeof(table));
+}
@@ -0,0 +1,32 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+/**
+ * @brief This module implements the interned keys of the process: a table
+ * that maps every city/currency name to a small integer ID (1, 2, ... in the
+ * order they were added, 0 means the key isn't interned).
+ *
+ * The table is filled at startup, from the JSON files of the microservices
+ * (see intern_from_json), before any thread is started or any microservice
+ * is forked, so it's the same in every process and it's only read afterwards
+ * (lookups don't take any lock). A string looks its key up once, when it's
+ * set (see str_id), so the store and the snapshots can then find a record by
+ * its ID instead of hashing/comparing the characters.
+ */
+
+/* include area */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*--------------------------------------------------------------------------
+   Prototypes
+--------------------------------------------------------------------------*/
+
+uint32_t intern_add(const char *key, size_t length);
+uint32_t intern_find(const char *key, size_t length, uint32_t hash);
+size_t intern_count(void);
+bool intern_from_json(const char *path);
+void intern_clear(void);
+
+#endif
@@ -0,0 +1,62 @@
+/* include area */
+#include "json_alloc.h"
+#include <jansson.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+/** Size of the tag before every allocation (keeps the allocations aligned) */
+#define TAG_SIZE ARENA_ALIGN
+
+/** Arena where the JSON values of the thread go (see json_alloc_set_arena) */
+static __thread arena_t *_arena = NULL;
+
+/**
+ * @brief Allocation hook of jansson.
+ *
+ * @param size Bytes to allocate.
+ * @return The memory or NULL on error.
+ */
+static void *_json_malloc(size_t size) {
+  unsigned char *data = _arena ? arena_alloc(_arena, TAG_SIZE + size) : malloc(TAG_SIZE + size);
+  if (data == NULL)
+    return NULL;
+
+  /* the tag says whether it's freed with free */
+  *( bool * )data = _arena == NULL;
+  return data + TAG_SIZE;
+}
+
+/**
+ * @brief Release hook of jansson (values from an arena are released with it).
+ *
+ * @param ptr Memory given by _json_malloc (or NULL).
+ */
+static void _json_free(void *ptr) {
+  if (ptr == NULL)
+    return;
+
+  unsigned char *data = ( unsigned char * )ptr - TAG_SIZE;
+  if (*( bool * )data)
+    free(data);
+}
+
+/**
+ * @brief Installs the allocation hooks in jansson. It must be called before
+ * any other jansson function (the hooks are global), e.g. first thing in main.
+ */
+void json_alloc_init( ) {
+  json_set_alloc_funcs(_json_malloc, _json_free);
+}
+
+/**
+ * @brief Sets the arena where the JSON values created by the calling thread
+ * are allocated (it has no effect unless json_alloc_init was called).
+ *
+ * @param arena The arena (NULL to use malloc).
+ * @return the previous arena of the thread.
+ */
+arena_t *json_alloc_set_arena(arena_t *arena) {
+  arena_t *previous = _arena;
+  _arena = arena;
+  return previous;
+}
@@ -0,0 +1,25 @@
+#ifndef JSON_ALLOC_H
+#define JSON_ALLOC_H
+
+/**
+ * @brief This module routes the allocations of jansson (used to convert the
+ * JSON files) into arenas: while a thread has an arena set, the JSON values
+ * it creates are allocated from it, and freeing them does nothing (they go
+ * away all at once when the arena is reset). Without an arena, they are
+ * allocated with malloc as usual.
+ *
+ * Every allocation is tagged with where it came from, so a value can be
+ * freed whatever arena is set at the time.
+ */
+
+/* include area */
+#include "arena.h"
+
+/*--------------------------------------------------------------------------
+   Prototypes
+--------------------------------------------------------------------------*/
+
+void json_alloc_init(void);
+arena_t *json_alloc_set_arena(arena_t *arena);
+
+#endif
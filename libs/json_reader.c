@@ -0,0 +1,794 @@
+/* include area */
+#include "json_reader.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MSG_TYPE_KEY "@type"
+#define MSG_ID_KEY "@id"
+
+/** Max length of a key (longer keys can't be a field name, their values are skipped) */
+#define MAX_KEY_LENGTH 64
+
+/** Max length of a number */
+#define MAX_NUMBER_LENGTH 64
+
+/** Max nesting of the skipped values */
+#define MAX_DEPTH 32
+
+/** Max number of seeds tried when building a perfect hash table */
+#define MAX_SEEDS (1 << 16)
+
+/** Input stream */
+typedef struct {
+  read_cb_t in;
+  void *in_ctx;
+  /** Byte read ahead (the one after a number), -1 if there's none. */
+  int next;
+} reader_t;
+
+/** Kinds of JSON values kept aside */
+typedef enum {
+  value_kind_string,
+  value_kind_integer,
+  value_kind_real,
+  value_kind_float_list,
+  value_kind_string_list,
+} value_kind_t;
+
+/** Field read before the message type was known */
+typedef struct {
+  char key[MAX_KEY_LENGTH];
+  size_t key_length;
+  value_kind_t kind;
+  union {
+    /** String contents, or the number as text. */
+    string_t value;
+    /** List items (an empty list is kept as a float list). */
+    float_list_t floats;
+    string_list_t strings;
+  } u;
+} pending_field_t;
+
+/*--------------------------------------------------------------------------
+   Perfect hash
+--------------------------------------------------------------------------*/
+
+/**
+ * @brief Hashes a name (FNV-1a) into a slot of a table.
+ *
+ * @param seed Table seed.
+ * @param name Name.
+ * @param length Name length.
+ * @return The slot.
+ */
+static size_t _hash(uint32_t seed, const char *name, size_t length) {
+  uint32_t h = 2166136261u ^ (seed * 0x9E3779B9u);
+  for (size_t i = 0; i < length; i++) {
+    h = (h ^ ( unsigned char )name[i]) * 16777619u;
+  }
+
+  return (h ^ (h >> 15)) & (JSON_SCHEMA_SLOTS - 1);
+}
+
+/**
+ * @brief Builds a perfect hash table (looking for a seed without collisions).
+ *
+ * @param table Table to build.
+ * @param names Names.
+ * @param count Number of names.
+ * @return false if there's no such seed (or too many names), true on success.
+ */
+static bool _phash_build(json_phash_t *table, const char **names, size_t count) {
+  if (count * 2 > JSON_SCHEMA_SLOTS)
+    return false;
+
+  for (uint32_t seed = 0; seed < MAX_SEEDS; seed++) {
+    memset(table->slots, 0, sizeof(table->slots));
+    table->seed = seed;
+
+    size_t i = 0;
+    for (; i < count; i++) {
+      size_t slot = _hash(seed, names[i], strlen(names[i]));
+      if (table->slots[slot] != 0)
+        break;
+      table->slots[slot] = i + 1;
+    }
+
+    if (i == count)
+      return true;
+  }
+
+  return false;
+}
+
+/**
+ * @brief Finds the only candidate for a name in a table.
+ *
+ * @param table Table.
+ * @param name Name.
+ * @param length Name length.
+ * @return The index of the candidate (its name must still be compared), -1 if there's none.
+ */
+static int _phash_find(const json_phash_t *table, const char *name, size_t length) {
+  return table->slots[_hash(table->seed, name, length)] - 1;
+}
+
+/**
+ * @brief Compares a name (not NULL terminated) with a C string.
+ *
+ * @param name Name.
+ * @param length Name length.
+ * @param cstr C string.
+ * @return true if they are equal.
+ */
+static bool _name_eq(const char *name, size_t length, const char *cstr) {
+  return strncmp(name, cstr, length) == 0 && cstr[length] == '\0';
+}
+
+/**
+ * @brief Checks whether a name is a field of some message of a group.
+ *
+ * @param schema Schema of the group.
+ * @param name Name.
+ * @param length Name length.
+ * @return true if it's a field name.
+ */
+static bool _schema_has_field(const json_schema_t *schema, const char *name, size_t length) {
+  for (size_t t = 0; t < schema->num_descs; t++) {
+    int f = _phash_find(&schema->fields[t], name, length);
+    if (f >= 0 && _name_eq(name, length, schema->descs[t].fields[f].name))
+      return true;
+  }
+
+  return false;
+}
+
+/**
+ * @brief Builds the schema of a message group.
+ *
+ * @param schema Schema to build.
+ * @param descs Message descriptions (indexed by message type).
+ * @param num_descs Number of messages.
+ * @return false on error, true on success.
+ */
+bool json_schema_init(json_schema_t *schema, const message_desc_t *descs, size_t num_descs) {
+  if (num_descs > JSON_SCHEMA_MAX_MESSAGES)
+    return false;
+
+  schema->descs = descs;
+  schema->num_descs = num_descs;
+
+  const char *names[JSON_SCHEMA_SLOTS / 2];
+  for (size_t i = 0; i < num_descs && i < ASIZE(names); i++)
+    names[i] = descs[i].name;
+
+  if (!_phash_build(&schema->types, names, num_descs))
+    return false;
+
+  for (size_t t = 0; t < num_descs; t++) {
+    for (size_t i = 0; i < descs[t].num_fields && i < ASIZE(names); i++)
+      names[i] = descs[t].fields[i].name;
+
+    if (!_phash_build(&schema->fields[t], names, descs[t].num_fields))
+      return false;
+  }
+
+  return true;
+}
+
+/*--------------------------------------------------------------------------
+   Lexer
+--------------------------------------------------------------------------*/
+
+/**
+ * @brief Reads the next byte.
+ *
+ * @param r The reader.
+ * @return The byte, -1 at the end of the input.
+ */
+static int _getc(reader_t *r) {
+  if (r->next >= 0) {
+    int c = r->next;
+    r->next = -1;
+    return c;
+  }
+
+  unsigned char c;
+  return (r->in(&c, 1, r->in_ctx) == 1) ? c : -1;
+}
+
+/**
+ * @brief Reads the next byte that isn't whitespace.
+ *
+ * @param r The reader.
+ * @return The byte, -1 at the end of the input.
+ */
+static int _getc_nonblank(reader_t *r) {
+  int c;
+  do {
+    c = _getc(r);
+  } while (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+
+  return c;
+}
+
+/**
+ * @brief Appends a byte to an output buffer (counting the bytes that don't fit).
+ *
+ * @param out Output buffer (may be NULL).
+ * @param size Buffer size.
+ * @param length Number of bytes appended so far.
+ * @param c Byte.
+ */
+static void _put(char *out, size_t size, size_t *length, char c) {
+  if (*length < size)
+    out[*length] = c;
+  (*length)++;
+}
+
+/**
+ * @brief Reads the 4 hex digits of a \u escape.
+ *
+ * @param r The reader.
+ * @param value Decoded value (output).
+ * @return false on error, true on success.
+ */
+static bool _read_hex4(reader_t *r, uint32_t *value) {
+  *value = 0;
+  for (int i = 0; i < 4; i++) {
+    int c = _getc(r);
+    if (c >= '0' && c <= '9')
+      c -= '0';
+    else if (c >= 'a' && c <= 'f')
+      c -= 'a' - 10;
+    else if (c >= 'A' && c <= 'F')
+      c -= 'A' - 10;
+    else
+      return false;
+
+    *value = (*value << 4) | c;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Reads a JSON string (after its opening quote), unescaping it.
+ *
+ * @param r The reader.
+ * @param out Output buffer (NULL to skip the string).
+ * @param size Buffer size.
+ * @param length String length (output). If it's not less than size, the string didn't fit.
+ * @return false on error, true on success.
+ */
+static bool _read_string(reader_t *r, char *out, size_t size, size_t *length) {
+  *length = 0;
+  while (true) {
+    int c = _getc(r);
+    if (c < 0x20)
+      return false;
+
+    if (c == '"')
+      return true;
+
+    if (c != '\\') {
+      _put(out, size, length, c);
+      continue;
+    }
+
+    c = _getc(r);
+    switch (c) {
+      case '"':
+      case '\\':
+      case '/':
+        break;
+      case 'b':
+        c = '\b';
+        break;
+      case 'f':
+        c = '\f';
+        break;
+      case 'n':
+        c = '\n';
+        break;
+      case 'r':
+        c = '\r';
+        break;
+      case 't':
+        c = '\t';
+        break;
+      case 'u': {
+        uint32_t cp;
+        if (!_read_hex4(r, &cp) || cp == 0 || (cp >= 0xDC00 && cp <= 0xDFFF))
+          return false;
+
+        if (cp >= 0xD800 && cp <= 0xDBFF) {
+          /* surrogate pair */
+          uint32_t low;
+          if (_getc(r) != '\\' || _getc(r) != 'u' || !_read_hex4(r, &low) || low < 0xDC00 || low > 0xDFFF)
+            return false;
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+        }
+
+        /* UTF-8 */
+        if (cp < 0x80) {
+          _put(out, size, length, cp);
+        } else if (cp < 0x800) {
+          _put(out, size, length, 0xC0 | (cp >> 6));
+          _put(out, size, length, 0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+          _put(out, size, length, 0xE0 | (cp >> 12));
+          _put(out, size, length, 0x80 | ((cp >> 6) & 0x3F));
+          _put(out, size, length, 0x80 | (cp & 0x3F));
+        } else {
+          _put(out, size, length, 0xF0 | (cp >> 18));
+          _put(out, size, length, 0x80 | ((cp >> 12) & 0x3F));
+          _put(out, size, length, 0x80 | ((cp >> 6) & 0x3F));
+          _put(out, size, length, 0x80 | (cp & 0x3F));
+        }
+        continue;
+      }
+      default:
+        return false;
+    }
+
+    _put(out, size, length, c);
+  }
+}
+
+/**
+ * @brief Reads the digits of a number.
+ *
+ * @param r The reader.
+ * @param c First byte (updated to the byte after the digits).
+ * @param text Output buffer.
+ * @param length Number of bytes in the output buffer.
+ * @return The number of digits read.
+ */
+static size_t _read_digits(reader_t *r, int *c, char *text, size_t *length) {
+  size_t digits = 0;
+  for (; *c >= '0' && *c <= '9'; digits++) {
+    _put(text, MAX_NUMBER_LENGTH, length, *c);
+    *c = _getc(r);
+  }
+
+  return digits;
+}
+
+/**
+ * @brief Reads a JSON number.
+ *
+ * @param r The reader.
+ * @param c First byte of the number.
+ * @param text The number as a C string (output, at least MAX_NUMBER_LENGTH bytes).
+ * @param kind Set to value_kind_real if it has a fraction or an exponent, value_kind_integer otherwise.
+ * @return false on error, true on success.
+ */
+static bool _read_number(reader_t *r, int c, char *text, value_kind_t *kind) {
+  size_t length = 0;
+  *kind = value_kind_integer;
+
+  if (c == '-') {
+    _put(text, MAX_NUMBER_LENGTH, &length, c);
+    c = _getc(r);
+  }
+
+  /* no leading zeros */
+  bool zero = (c == '0');
+  size_t digits = _read_digits(r, &c, text, &length);
+  if (digits == 0 || (zero && digits > 1))
+    return false;
+
+  if (c == '.') {
+    *kind = value_kind_real;
+    _put(text, MAX_NUMBER_LENGTH, &length, c);
+    c = _getc(r);
+    if (_read_digits(r, &c, text, &length) == 0)
+      return false;
+  }
+
+  if (c == 'e' || c == 'E') {
+    *kind = value_kind_real;
+    _put(text, MAX_NUMBER_LENGTH, &length, c);
+    c = _getc(r);
+    if (c == '+' || c == '-') {
+      _put(text, MAX_NUMBER_LENGTH, &length, c);
+      c = _getc(r);
+    }
+    if (_read_digits(r, &c, text, &length) == 0)
+      return false;
+  }
+
+  /* the byte after the number is read again */
+  r->next = c;
+
+  if (length >= MAX_NUMBER_LENGTH)
+    return false;
+
+  text[length] = '\0';
+  return true;
+}
+
+/**
+ * @brief Reads a literal (true, false or null).
+ *
+ * @param r The reader.
+ * @param c First byte.
+ * @return false on error, true on success.
+ */
+static bool _read_literal(reader_t *r, int c) {
+  const char *literal = (c == 't') ? "true" : (c == 'f') ? "false" : "null";
+  if (c != literal[0])
+    return false;
+
+  for (size_t i = 1; literal[i]; i++) {
+    if (_getc(r) != literal[i])
+      return false;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Skips a JSON value.
+ *
+ * @param r The reader.
+ * @param c First byte of the value.
+ * @param depth Nesting level.
+ * @return false on error, true on success.
+ */
+static bool _skip_value(reader_t *r, int c, size_t depth) {
+  size_t length;
+  char text[MAX_NUMBER_LENGTH];
+  value_kind_t kind;
+
+  if (depth > MAX_DEPTH)
+    return false;
+
+  switch (c) {
+    case '"':
+      return _read_string(r, NULL, 0, &length);
+    case '{':
+    case '[': {
+      char end = (c == '{') ? '}' : ']';
+      c = _getc_nonblank(r);
+      if (c == end)
+        return true;
+
+      while (true) {
+        if (end == '}') {
+          /* key */
+          if (c != '"' || !_read_string(r, NULL, 0, &length) || _getc_nonblank(r) != ':')
+            return false;
+          c = _getc_nonblank(r);
+        }
+
+        if (!_skip_value(r, c, depth + 1))
+          return false;
+
+        c = _getc_nonblank(r);
+        if (c == end)
+          return true;
+        if (c != ',')
+          return false;
+        c = _getc_nonblank(r);
+      }
+    }
+    case 't':
+    case 'f':
+    case 'n':
+      return _read_literal(r, c);
+    default:
+      return (c == '-' || (c >= '0' && c <= '9')) && _read_number(r, c, text, &kind);
+  }
+}
+
+/*--------------------------------------------------------------------------
+   Parser
+--------------------------------------------------------------------------*/
+
+/**
+ * @brief Converts a number into a field.
+ *
+ * @param field Field.
+ * @param type Field type.
+ * @param text The number.
+ * @param kind Number kind (integers and floats can't be mixed up).
+ * @return false on error, true on success.
+ */
+static bool _number_to_field(void *field, field_type_t type, const char *text, value_kind_t kind) {
+  errno = 0;
+  switch (type) {
+    case field_type_integer: {
+      if (kind != value_kind_integer)
+        return false;
+
+      long long value = strtoll(text, NULL, 10);
+      if (errno != 0 || value < INT32_MIN || value > INT32_MAX)
+        return false;
+
+      *( integer_t * )field = value;
+      return true;
+    }
+    case field_type_float: {
+      if (kind != value_kind_real)
+        return false;
+
+      double value = strtod(text, NULL);
+      if (errno != 0 && (value > 1 || value < -1))
+        return false;
+
+      *( float_t * )field = value;
+      return true;
+    }
+    case field_type_string:
+    case field_type_float_list:
+    case field_type_string_list:
+      return false;
+  }
+
+  /* unreachable */
+  return false;
+}
+
+/**
+ * @brief Reads a JSON array straight into a list field.
+ *
+ * @param r The reader.
+ * @param c First byte of the value.
+ * @param field Field (a float_list_t or a string_list_t).
+ * @param type Field type.
+ * @return false on error, true on success.
+ */
+static bool _list_read(reader_t *r, int c, void *field, field_type_t type) {
+  float_list_t *floats = field;
+  string_list_t *strings = field;
+  uint32_t *count = (type == field_type_float_list) ? &floats->count : &strings->count;
+
+  *count = 0;
+  if (c != '[')
+    return false;
+
+  c = _getc_nonblank(r);
+  if (c == ']')
+    return true;
+
+  while (true) {
+    if (type == field_type_string_list) {
+      /* the items are read in place */
+      size_t size, length;
+      char *item = string_list_next(strings, &size);
+      if (item == NULL || c != '"' || !_read_string(r, item, size, &length) || length >= size)
+        return false;
+      string_list_push(strings, length);
+    } else {
+      char text[MAX_NUMBER_LENGTH];
+      value_kind_t kind;
+      float_t item;
+      if (c != '-' && (c < '0' || c > '9'))
+        return false;
+      if (!_read_number(r, c, text, &kind) || !_number_to_field(&item, field_type_float, text, kind) ||
+          !float_list_append(floats, item))
+        return false;
+    }
+
+    c = _getc_nonblank(r);
+    if (c == ']')
+      return true;
+    if (c != ',')
+      return false;
+    c = _getc_nonblank(r);
+  }
+}
+
+/**
+ * @brief Reads a field value straight into the message struct.
+ *
+ * @param r The reader.
+ * @param c First byte of the value.
+ * @param field Field.
+ * @param desc Field description.
+ * @return false on error, true on success.
+ */
+static bool _field_read(reader_t *r, int c, void *field, const field_desc_t *desc) {
+  if (desc->type == field_type_string) {
+    char text[STR_MAX_LENGTH + 1];
+    size_t length;
+    return c == '"' && _read_string(r, text, sizeof(text), &length) && length < sizeof(text) &&
+           str_init_n(field, text, length);
+  }
+
+  if (desc->type == field_type_float_list || desc->type == field_type_string_list)
+    return _list_read(r, c, field, desc->type);
+
+  char text[MAX_NUMBER_LENGTH];
+  value_kind_t kind;
+  if (c != '-' && (c < '0' || c > '9'))
+    return false;
+
+  return _read_number(r, c, text, &kind) && _number_to_field(field, desc->type, text, kind);
+}
+
+/**
+ * @brief Reads a value whose field can't be resolved yet (the message type
+ * is not known), keeping it aside. Lists are read like the list fields (into
+ * the arena of the thread, see _list_read), their type is given by their
+ * first item.
+ *
+ * @param r The reader.
+ * @param c First byte of the value.
+ * @param pending Where the value is kept.
+ * @return false on error, true on success.
+ */
+static bool _pending_read(reader_t *r, int c, pending_field_t *pending) {
+  char text[STR_MAX_LENGTH + 1];
+  size_t length;
+
+  if (c == '[') {
+    /* the first item is read again by _list_read */
+    r->next = _getc_nonblank(r);
+    memset(&pending->u, 0, sizeof(pending->u));
+    if (r->next == '"') {
+      pending->kind = value_kind_string_list;
+      return _list_read(r, c, &pending->u.strings, field_type_string_list);
+    }
+
+    pending->kind = value_kind_float_list;
+    return _list_read(r, c, &pending->u.floats, field_type_float_list);
+  }
+
+  if (c == '"') {
+    pending->kind = value_kind_string;
+    if (!_read_string(r, text, sizeof(text), &length) || length >= sizeof(text))
+      return false;
+  } else {
+    if ((c != '-' && (c < '0' || c > '9')) || !_read_number(r, c, text, &pending->kind))
+      return false;
+    length = strlen(text);
+  }
+
+  return str_init_n(&pending->u.value, text, length);
+}
+
+/**
+ * @brief Parses a JSON message (exactly one, the input is not read after its closing brace).
+ *
+ * @param schema Schema of the message group.
+ * @param type Message type (output).
+ * @param id Correlation id, 0 if the message doesn't have one (output).
+ * @param msg Message (the union of the group, output).
+ * @param in Input callback.
+ * @param in_ctx Input callback context.
+ * @return false on error, true on success.
+ */
+bool json_reader_message(const json_schema_t *schema, size_t *type, message_id_t *id, void *msg, read_cb_t in,
+                         void *in_ctx) {
+  reader_t r = {.in = in, .in_ctx = in_ctx, .next = -1};
+  const message_desc_t *desc = NULL;
+  uint64_t fields_read = 0;
+
+  /* fields that precede "@type" */
+  pending_field_t pending[JSON_MAX_PENDING_FIELDS];
+  size_t num_pending = 0;
+
+  *id = 0;
+  if (_getc_nonblank(&r) != '{')
+    return false;
+
+  int c = _getc_nonblank(&r);
+  while (c != '}') {
+    char key[MAX_KEY_LENGTH];
+    size_t key_length;
+    if (c != '"' || !_read_string(&r, key, sizeof(key), &key_length) || _getc_nonblank(&r) != ':')
+      return false;
+
+    c = _getc_nonblank(&r);
+    if (key_length >= sizeof(key)) {
+      /* it can't be a field */
+      if (!_skip_value(&r, c, 0))
+        return false;
+    } else if (_name_eq(key, key_length, MSG_TYPE_KEY)) {
+      char name[MAX_KEY_LENGTH];
+      size_t length;
+      if (c != '"' || !_read_string(&r, name, sizeof(name), &length) || length >= sizeof(name))
+        return false;
+
+      int t = _phash_find(&schema->types, name, length);
+      if (t < 0 || !_name_eq(name, length, schema->descs[t].name) || (desc && desc != &schema->descs[t]))
+        return false;
+
+      *type = t;
+      desc = &schema->descs[t];
+    } else if (_name_eq(key, key_length, MSG_ID_KEY)) {
+      char text[MAX_NUMBER_LENGTH];
+      value_kind_t kind;
+      if (c != '-' && (c < '0' || c > '9'))
+        return false;
+      if (!_read_number(&r, c, text, &kind) || kind != value_kind_integer)
+        return false;
+
+      errno = 0;
+      long long value = strtoll(text, NULL, 10);
+      if (errno != 0 || value < 0 || value > UINT32_MAX)
+        return false;
+      *id = value;
+    } else if (desc != NULL) {
+      /* the value goes straight to the field (unknown keys are skipped) */
+      int f = _phash_find(&schema->fields[*type], key, key_length);
+      if (f >= 0 && _name_eq(key, key_length, desc->fields[f].name)) {
+        if (!_field_read(&r, c, ( uint8_t * )msg + desc->fields[f].offset, &desc->fields[f]))
+          return false;
+        fields_read |= ( uint64_t )1 << f;
+      } else if (!_skip_value(&r, c, 0)) {
+        return false;
+      }
+    } else if (_schema_has_field(schema, key, key_length) &&
+               (c == '"' || c == '[' || c == '-' || (c >= '0' && c <= '9'))) {
+      /* may be a field, resolved once the type is known */
+      if (num_pending == JSON_MAX_PENDING_FIELDS)
+        return false;
+
+      pending_field_t *p = &pending[num_pending++];
+      memcpy(p->key, key, key_length);
+      p->key_length = key_length;
+      if (!_pending_read(&r, c, p))
+        return false;
+    } else if (!_skip_value(&r, c, 0)) {
+      /* unknown keys, objects and literals aren't kept aside */
+      return false;
+    }
+
+    c = _getc_nonblank(&r);
+    if (c == ',') {
+      /* another member must follow */
+      c = _getc_nonblank(&r);
+      if (c != '"')
+        return false;
+    } else if (c != '}') {
+      return false;
+    }
+  }
+
+  if (desc == NULL)
+    return false;
+
+  /* the fields that came before the type */
+  for (size_t i = 0; i < num_pending; i++) {
+    pending_field_t *p = &pending[i];
+    int f = _phash_find(&schema->fields[*type], p->key, p->key_length);
+    if (f < 0 || !_name_eq(p->key, p->key_length, desc->fields[f].name))
+      continue;
+
+    void *field = ( uint8_t * )msg + desc->fields[f].offset;
+    if (desc->fields[f].type == field_type_float_list) {
+      if (p->kind != value_kind_float_list)
+        return false;
+      memcpy(field, &p->u.floats, sizeof(p->u.floats));
+    } else if (desc->fields[f].type == field_type_string_list) {
+      /* an empty list was kept as a float list */
+      if (p->kind == value_kind_float_list && p->u.floats.count == 0)
+        (( string_list_t * )field)->count = 0;
+      else if (p->kind == value_kind_string_list)
+        memcpy(field, &p->u.strings, sizeof(p->u.strings));
+      else
+        return false;
+    } else if (p->kind == value_kind_float_list || p->kind == value_kind_string_list) {
+      /* a list can't be a string or a number */
+      return false;
+    } else if (desc->fields[f].type == field_type_string) {
+      if (p->kind != value_kind_string)
+        return false;
+      memcpy(field, &p->u.value, sizeof(p->u.value));
+    } else if (p->kind == value_kind_string ||
+               !_number_to_field(field, desc->fields[f].type, str_to_cstr(&p->u.value), p->kind)) {
+      return false;
+    }
+
+    fields_read |= ( uint64_t )1 << f;
+  }
+
+  /* every field is required */
+  uint64_t all_fields = (desc->num_fields < 64) ? ((( uint64_t )1 << desc->num_fields) - 1) : ~( uint64_t )0;
+  return fields_read == all_fields;
+}
@@ -0,0 +1,60 @@
+#ifndef JSON_READER_H
+#define JSON_READER_H
+
+/**
+ * @brief This module parses JSON messages in a single pass (without building
+ * a JSON tree), writing the values straight into the message structs.
+ *
+ * The parser knows the messages of a group (the schema, built from the
+ * message descriptions, see message_decl.h): the "@type" and the field names
+ * are resolved through perfect hash tables computed once per group.
+ *
+ * Fields can come in any order: the fields that precede "@type" (lists
+ * included, their items go to the arena of the thread like the list fields)
+ * are kept aside until the type is known, at most JSON_MAX_PENDING_FIELDS of
+ * them. Unknown keys are skipped, and every field of the message is
+ * required. The parser reads the input one byte at a time, so it consumes
+ * exactly one message (up to its closing brace).
+ */
+
+/* include area */
+#include "message.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Max number of fields that can precede "@type" (unknown keys and "@id" excluded) */
+#define JSON_MAX_PENDING_FIELDS 8
+
+/** Max number of messages in a group */
+#define JSON_SCHEMA_MAX_MESSAGES 16
+
+/** Size of the hash tables (a power of 2, with room for twice the names of a table) */
+#define JSON_SCHEMA_SLOTS 64
+
+/** Perfect hash table of a set of names */
+typedef struct {
+  uint32_t seed;
+  /** Index of the name in each slot plus 1 (0 if the slot is empty). */
+  uint8_t slots[JSON_SCHEMA_SLOTS];
+} json_phash_t;
+
+/** Messages of a group, with the tables used to resolve their names */
+typedef struct {
+  const message_desc_t *descs;
+  size_t num_descs;
+  /** Message names. */
+  json_phash_t types;
+  /** Field names of each message. */
+  json_phash_t fields[JSON_SCHEMA_MAX_MESSAGES];
+} json_schema_t;
+
+/*--------------------------------------------------------------------------
+   Prototypes
+--------------------------------------------------------------------------*/
+
+bool json_schema_init(json_schema_t *schema, const message_desc_t *descs, size_t num_descs);
+bool json_reader_message(const json_schema_t *schema, size_t *type, message_id_t *id, void *msg, read_cb_t in,
+                         void *in_ctx);
+
+#endif
@@ -0,0 +1,414 @@
+/* include area */
+#include "json_writer.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MSG_TYPE_KEY "@type"
+#define MSG_ID_KEY "@id"
+
+/** Max number of significant digits needed to round-trip a float_t */
+#define FLOAT_MAX_DIGITS 9
+
+/** Powers of ten that are exact as doubles */
+static const double _pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/** Range of values formatted with the exact powers of ten (with room for FLOAT_MAX_DIGITS) */
+#define FAST_FORMAT_MIN 1e-13
+#define FAST_FORMAT_MAX 1e22
+
+/**
+ * @brief Appends data to the writer buffer (flushing it if needed).
+ *
+ * @param w The writer.
+ * @param data Data to write.
+ * @param bytes Number of bytes to write.
+ * @return false on error, true on success.
+ */
+static bool _write(json_writer_t *w, const char *data, size_t bytes) {
+  while (w->length + bytes > w->size) {
+    /* fills the buffer and flushes it */
+    size_t chunk = w->size - w->length;
+    memcpy(w->buffer + w->length, data, chunk);
+    w->length += chunk;
+    data += chunk;
+    bytes -= chunk;
+
+    if (!json_writer_flush(w) || w->length != 0)
+      return false;
+  }
+
+  memcpy(w->buffer + w->length, data, bytes);
+  w->length += bytes;
+  return true;
+}
+
+/**
+ * @brief Writes a C string (as is, not as a JSON string).
+ *
+ * @param w The writer.
+ * @param cstr C string.
+ * @return false on error, true on success.
+ */
+static bool _write_cstr(json_writer_t *w, const char *cstr) {
+  return _write(w, cstr, strlen(cstr));
+}
+
+/**
+ * @brief Writes an unsigned integer.
+ *
+ * @param w The writer.
+ * @param value Integer.
+ * @return false on error, true on success.
+ */
+static bool _write_uint(json_writer_t *w, uint32_t value) {
+  char digits[10];
+  size_t n = sizeof(digits);
+  do {
+    digits[--n] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+
+  return _write(w, digits + n, sizeof(digits) - n);
+}
+
+/**
+ * @brief Writes an integer_t.
+ *
+ * @param w The writer.
+ * @param value Integer.
+ * @return false on error, true on success.
+ */
+static bool _write_int(json_writer_t *w, integer_t value) {
+  if (value >= 0)
+    return _write_uint(w, value);
+
+  /* the magnitude of INT32_MIN doesn't fit in an int32_t */
+  return _write(w, "-", 1) && _write_uint(w, -( uint32_t )value);
+}
+
+/**
+ * @brief Writes a JSON string (quoted and escaped).
+ *
+ * @param w The writer.
+ * @param data Characters (UTF-8).
+ * @param length Number of bytes.
+ * @return false on error, true on success.
+ */
+static bool _write_string(json_writer_t *w, const char *data, size_t length) {
+  static const char hex[] = "0123456789abcdef";
+
+  if (!_write(w, "\"", 1))
+    return false;
+
+  /* writes the runs of characters that don't need escaping at once */
+  size_t start = 0;
+  for (size_t i = 0; i < length; i++) {
+    unsigned char c = data[i];
+    if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+
+    char escaped[6] = {'\\', c, 0};
+    size_t escaped_length = 2;
+    switch (c) {
+      case '"':
+      case '\\':
+        break;
+      case '\n':
+        escaped[1] = 'n';
+        break;
+      case '\r':
+        escaped[1] = 'r';
+        break;
+      case '\t':
+        escaped[1] = 't';
+        break;
+      case '\b':
+        escaped[1] = 'b';
+        break;
+      case '\f':
+        escaped[1] = 'f';
+        break;
+      default:
+        memcpy(escaped + 1, "u00", 3);
+        escaped[4] = hex[c >> 4];
+        escaped[5] = hex[c & 0xF];
+        escaped_length = 6;
+        break;
+    }
+
+    if (!_write(w, data + start, i - start) || !_write(w, escaped, escaped_length))
+      return false;
+    start = i + 1;
+  }
+
+  return _write(w, data + start, length - start) && _write(w, "\"", 1);
+}
+
+/**
+ * @brief Writes the digits of a decimal number (digits x 10^exponent) in
+ * plain or scientific notation (always with a '.' or an exponent, so it's a JSON real).
+ *
+ * @param s Output buffer (at least JSON_FLOAT_MAX_LENGTH bytes).
+ * @param digits Significant digits.
+ * @param exponent Decimal exponent.
+ * @return Number of characters written.
+ */
+static size_t _decimal_format(char *s, uint64_t digits, int exponent) {
+  char d[20];
+  int n = 0;
+  for (uint64_t value = digits; value; value /= 10)
+    n++;
+  for (int i = n - 1; i >= 0; i--, digits /= 10)
+    d[i] = '0' + digits % 10;
+
+  /* number of digits before the decimal point */
+  int point = n + exponent;
+  size_t length = 0;
+
+  if (exponent >= 0 && point <= 17) {
+    /* integer: ddd000.0 */
+    memcpy(s, d, n);
+    length = n;
+    memset(s + length, '0', exponent);
+    length += exponent;
+    memcpy(s + length, ".0", 2);
+    return length + 2;
+  }
+
+  if (point > 0 && exponent < 0) {
+    /* ddd.ddd */
+    memcpy(s, d, point);
+    s[point] = '.';
+    memcpy(s + point + 1, d + point, n - point);
+    return n + 1;
+  }
+
+  if (point <= 0 && point > -5) {
+    /* 0.000ddd */
+    memcpy(s, "0.", 2);
+    length = 2;
+    memset(s + length, '0', -point);
+    length += -point;
+    memcpy(s + length, d, n);
+    return length + n;
+  }
+
+  /* d.ddde[-]xx */
+  s[length++] = d[0];
+  if (n > 1) {
+    s[length++] = '.';
+    memcpy(s + length, d + 1, n - 1);
+    length += n - 1;
+  }
+
+  return length + sprintf(s + length, "e%d", point - 1);
+}
+
+/**
+ * @brief Formats a float_t as a JSON real, with the shortest representation
+ * that parses back to the same value.
+ * The candidates (from 1 to FLOAT_MAX_DIGITS significant digits) are checked
+ * with a single (correctly rounded) double operation, which gives the same
+ * double a JSON parser would, as long as the powers of ten are exact.
+ * Values out of that range (very large or very small) go through snprintf/strtod.
+ *
+ * @param s Output buffer (at least JSON_FLOAT_MAX_LENGTH bytes).
+ * @param f Value.
+ * @return Number of characters written, 0 on error (NaN and infinities can't be represented).
+ */
+size_t json_float_format(char *s, float_t f) {
+  /* NaN or infinity */
+  if (!(f - f == 0))
+    return 0;
+
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  size_t sign = bits >> 31;
+  if (sign)
+    s[0] = '-';
+
+  double value = sign ? -( double )f : ( double )f;
+  if (value == 0) {
+    memcpy(s + sign, "0.0", 3);
+    return sign + 3;
+  }
+
+  if (value >= FAST_FORMAT_MIN && value < FAST_FORMAT_MAX) {
+    /* decimal exponent of the first significant digit */
+    int magnitude = 0;
+    if (value >= 1) {
+      while (magnitude + 1 < ( int )ASIZE(_pow10) && _pow10[magnitude + 1] <= value)
+        magnitude++;
+    } else {
+      while (value * _pow10[-magnitude] < 1)
+        magnitude--;
+    }
+
+    for (int digits = 1; digits <= FLOAT_MAX_DIGITS; digits++) {
+      int exponent = magnitude - digits + 1;
+      double scaled = (exponent >= 0) ? value / _pow10[exponent] : value * _pow10[-exponent];
+      uint64_t candidate = ( uint64_t )(scaled + 0.5);
+
+      double parsed = (exponent >= 0) ? candidate * _pow10[exponent] : candidate / _pow10[-exponent];
+      if (( float_t )parsed == ( float_t )value)
+        return sign + _decimal_format(s + sign, candidate, exponent);
+    }
+  }
+
+  /* slow path (the shortest precision that round-trips), makes sure it's parsed as a real */
+  int length = 0;
+  for (int digits = 1; digits <= FLOAT_MAX_DIGITS; digits++) {
+    length = snprintf(s + sign, JSON_FLOAT_MAX_LENGTH - sign - 2, "%.*g", digits, value);
+    if (length < 0)
+      return 0;
+
+    if (( float_t )strtod(s + sign, NULL) == ( float_t )value)
+      break;
+  }
+
+  if (strpbrk(s + sign, ".e") == NULL) {
+    memcpy(s + sign + length, ".0", 3);
+    length += 2;
+  }
+
+  return sign + length;
+}
+
+/**
+ * @brief Writes a float_t.
+ *
+ * @param w The writer.
+ * @param f Float.
+ * @return false on error, true on success.
+ */
+static bool _write_float(json_writer_t *w, float_t f) {
+  char s[JSON_FLOAT_MAX_LENGTH];
+  size_t length = json_float_format(s, f);
+  return length > 0 && _write(w, s, length);
+}
+
+/**
+ * @brief Writes a field as a JSON key/value pair (preceded by a comma).
+ *
+ * @param field Field to serialize.
+ * @param desc Field description.
+ * @param cb_ctx The writer.
+ * @return false on error, true on success.
+ */
+static bool _field_write(const void *field, const field_desc_t *desc, void *cb_ctx) {
+  json_writer_t *w = cb_ctx;
+
+  if (!_write(w, ",", 1) || !_write_string(w, desc->name, strlen(desc->name)) || !_write(w, ":", 1))
+    return false;
+
+  switch (desc->type) {
+    case field_type_integer:
+      return _write_int(w, *( const integer_t * )field);
+    case field_type_float:
+      return _write_float(w, *( const float_t * )field);
+    case field_type_string:
+      return _write_string(w, str_to_cstr(field), str_len(field));
+    case field_type_float_list: {
+      const float_list_t *l = field;
+      for (uint32_t i = 0; i < l->count; i++) {
+        if (!_write(w, i ? "," : "[", 1) || !_write_float(w, l->items[i]))
+          return false;
+      }
+      return _write_cstr(w, l->count ? "]" : "[]");
+    }
+    case field_type_string_list: {
+      const string_list_t *l = field;
+      for (uint32_t i = 0; i < l->count; i++) {
+        size_t length;
+        const char *item = string_list_get(l, i, &length);
+        if (!_write(w, i ? "," : "[", 1) || !_write_string(w, item, length))
+          return false;
+      }
+      return _write_cstr(w, l->count ? "]" : "[]");
+    }
+  }
+
+  /* unreachable */
+  return false;
+}
+
+/**
+ * @brief Initializes a JSON writer.
+ *
+ * @param w The writer.
+ * @param buffer Output buffer.
+ * @param size Buffer size (in bytes).
+ * @param out Callback where the buffer is flushed to when it's full (NULL if the output must fit in the buffer).
+ * @param out_ctx Output callback context.
+ */
+void json_writer_init(json_writer_t *w, char *buffer, size_t size, write_cb_t out, void *out_ctx) {
+  w->buffer = buffer;
+  w->size = size;
+  w->length = 0;
+  w->out = out;
+  w->out_ctx = out_ctx;
+}
+
+/**
+ * @brief Writes a message as a JSON object.
+ *
+ * @param w The writer.
+ * @param msg Message to serialize (the union).
+ * @param desc Message description.
+ * @param id Correlation id (not included if 0).
+ * @return false on error, true on success.
+ */
+bool json_writer_message(json_writer_t *w, const void *msg, const message_desc_t *desc, message_id_t id) {
+  return json_writer_header(w, desc, id) && json_writer_fields(w, msg, desc);
+}
+
+/**
+ * @brief Writes the start of a message: its type and correlation id (the
+ * fields are written by json_writer_fields).
+ *
+ * @param w The writer.
+ * @param desc Message description.
+ * @param id Correlation id (not included if 0).
+ * @return false on error, true on success.
+ */
+bool json_writer_header(json_writer_t *w, const message_desc_t *desc, message_id_t id) {
+  if (!_write_cstr(w, "{\"" MSG_TYPE_KEY "\":") || !_write_string(w, desc->name, strlen(desc->name)))
+    return false;
+
+  return id == 0 || (_write_cstr(w, ",\"" MSG_ID_KEY "\":") && _write_uint(w, id));
+}
+
+/**
+ * @brief Writes the fields of a message (and the end of the message), after
+ * its header. They don't depend on the header, so they can be written once
+ * and reused (see json_writer_header).
+ *
+ * @param w The writer.
+ * @param msg Message to serialize (the union).
+ * @param desc Message description.
+ * @return false on error, true on success.
+ */
+bool json_writer_fields(json_writer_t *w, const void *msg, const message_desc_t *desc) {
+  return message_iter_const(msg, desc, _field_write, w) && _write(w, "}", 1);
+}
+
+/**
+ * @brief Sends the buffered output through the output callback.
+ * Without an output callback it does nothing (the output stays in the buffer).
+ *
+ * @param w The writer.
+ * @return false on error, true on success.
+ */
+bool json_writer_flush(json_writer_t *w) {
+  if (w->out == NULL || w->length == 0)
+    return true;
+
+  if (!w->out(w->buffer, w->length, w->out_ctx))
+    return false;
+
+  w->length = 0;
+  return true;
+}
@@ -0,0 +1,53 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+/**
+ * @brief This module serializes messages as JSON without building a JSON
+ * tree (and without any heap allocation).
+ *
+ * The messages are written straight into a caller-provided buffer, walking
+ * the message descriptions (see message_decl.h). If an output callback is
+ * given, the buffer is flushed through it whenever it gets full (so any
+ * message fits), otherwise a message that doesn't fit is an error.
+ *
+ * The output is compact JSON, for example:
+ *
+ *    {"@type":"weather","@id":7,"humidity":57.0,"pressure":1030.92,"temperature":21.22}
+ *
+ * Floats are written with the shortest representation that parses back to
+ * the same float_t (and always as JSON reals, e.g. "57.0"), and lists as
+ * JSON arrays.
+ */
+
+/* include area */
+#include "message.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Max length of a float_t formatted as JSON */
+#define JSON_FLOAT_MAX_LENGTH 32
+
+/** JSON writer */
+typedef struct {
+  /** Output buffer. */
+  char *buffer;
+  size_t size;
+  /** Bytes written in the buffer (not flushed yet). */
+  size_t length;
+  /** Callback where the buffer is flushed to (may be NULL). */
+  write_cb_t out;
+  void *out_ctx;
+} json_writer_t;
+
+/*--------------------------------------------------------------------------
+   Prototypes
+--------------------------------------------------------------------------*/
+
+void json_writer_init(json_writer_t *w, char *buffer, size_t size, write_cb_t out, void *out_ctx);
+bool json_writer_message(json_writer_t *w, const void *msg, const message_desc_t *desc, message_id_t id);
+bool json_writer_header(json_writer_t *w, const message_desc_t *desc, message_id_t id);
+bool json_writer_fields(json_writer_t *w, const void *msg, const message_desc_t *desc);
+bool json_writer_flush(json_writer_t *w);
+size_t json_float_format(char *s, float_t f);
+
+#endif
@@ -1,21 +1,364 @@
+#define _GNU_SOURCE
 #include "log.h"
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/time.h>
+#include <string.h>
+#include <sys/eventfd.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
-#include <unistd.h>
+
+/* Level of the padding records, written when a record doesn't fit before the end of the ring. */
+#define LOG_PAD 0xFF
+
+/* Returned by _encode when the format has a conversion that isn't supported. */
+#define LOG_UNSUPPORTED (( size_t )-1)
+
+/* Size of each argument in a record. */
+#define ARG_SIZE sizeof(uint64_t)
+#define ARG_ALIGN(n) (((n) + ARG_SIZE - 1) & ~(ARG_SIZE - 1))
+
+/* Kind of argument taken by a conversion (arg_invalid if it's not supported, see log.h). */
+typedef enum {
+  arg_none,
+  arg_invalid,
+  arg_signed,
+  arg_unsigned,
+  arg_char,
+  arg_double,
+  arg_long_double,
+  arg_string,
+  arg_pointer
+} arg_kind;
+
+/* Conversion specification of a format, e.g. %-8.*lu */
+typedef struct {
+  const char *start;
+  /* Where the length modifier goes (the conversion if there's none). */
+  const char *modifier;
+  /* After the conversion. */
+  const char *end;
+  arg_kind kind;
+  bool width_star;
+  bool precision_star;
+  /* -1 if it's not given as a number. */
+  int precision;
+  char length[3];
+} spec_t;
+
+/* Header of a record, followed by its arguments: ARG_SIZE bytes each, and
+ * strings as their length followed by their (NULL terminated) characters. */
+typedef struct {
+  /* Size of the record (header included, a multiple of ARG_SIZE). */
+  uint32_t size;
+  uint8_t level;
+  /* Nanoseconds since the log was created. */
+  uint64_t time;
+  const char *format;
+} record_t;
+
+/* Ring buffer of a thread (head and dropped are written by the thread, tail
+ * and reported by the background thread). */
+typedef struct ring_ {
+  struct ring_ *next;
+  uint64_t head;
+  uint64_t tail;
+  uint64_t dropped;
+  uint64_t reported;
+  uint8_t data[LOG_RING_SIZE];
+} ring_t;
+
+struct log_ {
+  FILE *log_file;
+  struct timespec time_created;
+  /* The rings of the threads created with this log (see _thread_ring). */
+  uint64_t generation;
+  /* Rings of the threads (pushed at the front, freed when the log is closed). */
+  ring_t *rings;
+  /* Records of the threads that couldn't get a ring. */
+  uint64_t dropped;
+  uint64_t reported;
+  /* Background thread, sleeping on the eventfd while every ring is empty (see _wake). */
+  pthread_t writer;
+  int wakeup;
+  bool sleeping;
+  bool stop;
+};
+
+/* Levels written (all of them, unless debug mode is off). */
+#define LOG_ALL_LEVELS ((1u << (CRITICAL_L + 1)) - 1)
+#define LOG_DEBUG_OFF_LEVELS ((1u << NONE_L) | (1u << STAT_L))
+
+unsigned log_levels = LOG_ALL_LEVELS;
+
+/* The log of the process (created on the first use). */
+static log_t *_log = NULL;
+static pthread_mutex_t _log_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t _generation = 0;
+
+/* Ring of the calling thread. */
+static __thread ring_t *_ring = NULL;
+static __thread uint64_t _ring_generation = 0;
+
+/* Returns true if a length modifier is valid for an integer conversion. */
+static bool _integer_length(const char *length) {
+  const char *valid[] = {"", "hh", "h", "l", "ll", "j", "z", "t"};
+  for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+    if (strcmp(length, valid[i]) == 0)
+      return true;
+  }
+
+  return false;
+}
+
+/* Parses the conversion specification that starts at p (a '%'). */
+static void _parse_spec(const char *p, spec_t *spec) {
+  spec->start = p++;
+  spec->width_star = spec->precision_star = false;
+  spec->precision = -1;
+  spec->kind = arg_none;
+
+  p += strspn(p, "-+ #0'");
+  if (*p == '*') {
+    spec->width_star = true;
+    p++;
+  } else {
+    p += strspn(p, "0123456789");
+  }
+
+  if (*p == '.' && *++p == '*') {
+    spec->precision_star = true;
+    p++;
+  } else if (p[-1] == '.') {
+    spec->precision = atoi(p);
+    p += strspn(p, "0123456789");
+  }
+
+  /* a longer modifier (e.g. lll) isn't valid, so it's left empty */
+  size_t length = strspn(p, "hlLjzt");
+  size_t kept = length > 2 ? 0 : length;
+  memcpy(spec->length, p, kept);
+  spec->length[kept] = '\0';
+  spec->modifier = p;
+  p += length;
+
+  /* the integers take every modifier but L, the doubles l and L, and the rest none */
+  bool integer_length = length == kept && _integer_length(spec->length);
+  switch (*p) {
+    case '%':
+      spec->kind = length == 0 && p == spec->start + 1 ? arg_none : arg_invalid;
+      break;
+    case 'd':
+    case 'i':
+      spec->kind = integer_length ? arg_signed : arg_invalid;
+      break;
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+      spec->kind = integer_length ? arg_unsigned : arg_invalid;
+      break;
+    case 'c':
+      spec->kind = length == 0 ? arg_char : arg_invalid;
+      break;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+      if (length == 0 || strcmp(spec->length, "l") == 0)
+        spec->kind = arg_double;
+      else
+        spec->kind = length == kept && strcmp(spec->length, "L") == 0 ? arg_long_double : arg_invalid;
+      break;
+    case 's':
+      spec->kind = length == 0 ? arg_string : arg_invalid;
+      break;
+    case 'p':
+      spec->kind = length == 0 ? arg_pointer : arg_invalid;
+      break;
+    default:
+      /* e.g. %n, %m, wide characters or positional arguments */
+      spec->kind = arg_invalid;
+      break;
+  }
+
+  spec->end = *p ? p + 1 : p;
+}
+
+/* Reads a signed integer argument (with the type given by the length modifier). */
+static int64_t _signed_arg(const char *length, va_list *args) {
+  if (strcmp(length, "l") == 0)
+    return va_arg(*args, long);
+  if (strcmp(length, "ll") == 0)
+    return va_arg(*args, long long);
+  if (strcmp(length, "j") == 0)
+    return va_arg(*args, intmax_t);
+  if (strcmp(length, "z") == 0)
+    return va_arg(*args, ssize_t);
+  if (strcmp(length, "t") == 0)
+    return va_arg(*args, ptrdiff_t);
+
+  int value = va_arg(*args, int);
+  if (strcmp(length, "hh") == 0)
+    return ( signed char )value;
+  return strcmp(length, "h") == 0 ? ( short )value : value;
+}
+
+/* Reads an unsigned integer argument (with the type given by the length modifier). */
+static uint64_t _unsigned_arg(const char *length, va_list *args) {
+  if (strcmp(length, "l") == 0)
+    return va_arg(*args, unsigned long);
+  if (strcmp(length, "ll") == 0)
+    return va_arg(*args, unsigned long long);
+  if (strcmp(length, "j") == 0)
+    return va_arg(*args, uintmax_t);
+  if (strcmp(length, "z") == 0)
+    return va_arg(*args, size_t);
+  if (strcmp(length, "t") == 0)
+    return va_arg(*args, ptrdiff_t);
+
+  unsigned value = va_arg(*args, unsigned);
+  if (strcmp(length, "hh") == 0)
+    return ( unsigned char )value;
+  return strcmp(length, "h") == 0 ? ( unsigned short )value : value;
+}
+
+/* Copies the arguments of a format after the header of a record. Returns
+ * the size of the record, 0 if they don't fit in LOG_MAX_RECORD bytes, or
+ * LOG_UNSUPPORTED if a conversion isn't supported (see log.h). */
+static size_t _encode(record_t *record, const char *format, va_list *args) {
+  uint8_t *out = ( uint8_t * )record;
+  size_t size = sizeof(record_t);
+  spec_t spec;
+  for (const char *p = format; (p = strchr(p, '%')) != NULL; p = spec.end) {
+    _parse_spec(p, &spec);
+    if (spec.kind == arg_invalid)
+      return LOG_UNSUPPORTED;
+
+    /* the values of the stars go first, like in the call */
+    int precision = spec.precision;
+    for (int star = spec.width_star + spec.precision_star; star > 0; star--) {
+      int64_t value = va_arg(*args, int);
+      if (size + ARG_SIZE > LOG_MAX_RECORD)
+        return 0;
+      memcpy(out + size, &value, ARG_SIZE);
+      size += ARG_SIZE;
+      if (star == 1 && spec.precision_star)
+        precision = value;
+    }
+
+    if (spec.kind == arg_none)
+      continue;
+
+    if (spec.kind == arg_string) {
+      const char *s = va_arg(*args, const char *);
+      s = s ? s : "(null)";
+      size_t max = precision >= 0 && precision < LOG_MAX_STRING ? ( size_t )precision : LOG_MAX_STRING;
+      uint64_t length = strnlen(s, max);
+      if (size + ARG_SIZE + 1 > LOG_MAX_RECORD)
+        return 0;
+      if (size + ARG_SIZE + length + 1 > LOG_MAX_RECORD)
+        length = LOG_MAX_RECORD - size - ARG_SIZE - 1;
+
+      memcpy(out + size, &length, ARG_SIZE);
+      memcpy(out + size + ARG_SIZE, s, length);
+      out[size + ARG_SIZE + length] = '\0';
+      size += ARG_SIZE + ARG_ALIGN(length + 1);
+      continue;
+    }
+
+    uint64_t value = 0;
+    if (spec.kind == arg_signed) {
+      int64_t n = _signed_arg(spec.length, args);
+      memcpy(&value, &n, ARG_SIZE);
+    } else if (spec.kind == arg_unsigned) {
+      value = _unsigned_arg(spec.length, args);
+    } else if (spec.kind == arg_char) {
+      value = va_arg(*args, int);
+    } else if (spec.kind == arg_double || spec.kind == arg_long_double) {
+      double n = spec.kind == arg_double ? va_arg(*args, double) : va_arg(*args, long double);
+      memcpy(&value, &n, ARG_SIZE);
+    } else {
+      value = ( uintptr_t )va_arg(*args, void *);
+    }
+
+    if (size + ARG_SIZE > LOG_MAX_RECORD)
+      return 0;
+    memcpy(out + size, &value, ARG_SIZE);
+    size += ARG_SIZE;
+  }
+
+  return size;
+}
+
+/* Writes a conversion of a record (the arguments start at args + *offset,
+ * and *offset is moved past the ones it takes). */
+static void _print_spec(FILE *file, const spec_t *spec, const uint8_t *args, size_t *offset) {
+  /* the stars are replaced by their values (a negative precision is ignored) */
+  char text[64];
+  size_t length = 0;
+  for (const char *p = spec->start; p < spec->modifier && length < sizeof(text) - 24; p++) {
+    if (*p != '*') {
+      text[length++] = *p;
+      continue;
+    }
+
+    int64_t value;
+    memcpy(&value, args + *offset, ARG_SIZE);
+    *offset += ARG_SIZE;
+    if (value < 0 && p[-1] == '.')
+      length--;
+    else
+      length += sprintf(text + length, "%d", ( int )value);
+  }
+
+  /* %% is a '%' (the unsupported conversions never get into a record) */
+  if (spec->kind == arg_none) {
+    fputc('%', file);
+    return;
+  }
+
+  /* integers are printed as intmax_t, doubles as double, and pointers as %p */
+  if (spec->kind == arg_signed || spec->kind == arg_unsigned)
+    text[length++] = 'j';
+  text[length++] = spec->kind == arg_pointer ? 'p' : spec->end[-1];
+  text[length] = '\0';
+
+  uint64_t value;
+  memcpy(&value, args + *offset, ARG_SIZE);
+  *offset += ARG_SIZE;
+  if (spec->kind == arg_string) {
+    fprintf(file, text, ( const char * )(args + *offset));
+    *offset += ARG_ALIGN(value + 1);
+  } else if (spec->kind == arg_signed) {
+    int64_t n;
+    memcpy(&n, &value, ARG_SIZE);
+    fprintf(file, text, ( intmax_t )n);
+  } else if (spec->kind == arg_unsigned) {
+    fprintf(file, text, ( uintmax_t )value);
+  } else if (spec->kind == arg_char) {
+    fprintf(file, text, ( int )value);
+  } else if (spec->kind == arg_pointer) {
+    fprintf(file, text, ( void * )( uintptr_t )value);
+  } else {
+    double n;
+    memcpy(&n, &value, ARG_SIZE);
+    fprintf(file, text, n);
+  }
+}
 
 /* Auxiliar function that creates a pretty-printeable
  * time string. The final string is stored at str.*/
-void get_time_string(log_t *log, char *str) {
-  struct timeval time_now;
-  gettimeofday(&time_now, NULL);
-
-  unsigned long int timestamp = (time_now.tv_sec - log->time_created.tv_sec) * 1000000L;
-  timestamp += (time_now.tv_usec - log->time_created.tv_usec);
+static void _time_string(uint64_t nanoseconds, char *str) {
+  unsigned long int timestamp = nanoseconds / 1000;
   // Check microseconds
   if (timestamp < 1000L)
     sprintf(str, "%lu Us", timestamp);
@@ -25,121 +368,334 @@ void get_time_string(log_t *log, char *str) {
     sprintf(str, "%.3f s", (( double )timestamp) / 1000000L);
 }
 
-/* Opens file at route and dynamically creates a log with it.
- * If append is false, then the file is overwritten. Returns
- * NULL if creating the log failed.*/
-log_t *log_open(char *route, bool append) {
+/* Returns the nanoseconds since the log was created. */
+static uint64_t _elapsed(const log_t *log) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - log->time_created.tv_sec) * 1000000000L + (now.tv_nsec - log->time_created.tv_nsec);
+}
+
+/* Formats a record, the same way log_write used to write it. */
+static void _print_record(FILE *file, const record_t *record) {
+  char time_str[32];
+  _time_string(record->time, time_str);
+
+  char *str_lvl = NULL;
+  switch (record->level) {
+    case STAT_L:
+      str_lvl = "STATS";
+      break;
+    case INFO_L:
+      str_lvl = "INFO";
+      break;
+    case DEBUG_L:
+      str_lvl = "DEBUG";
+      break;
+    case WARNING_L:
+      str_lvl = "WARN";
+      break;
+    case ERROR_L:
+      str_lvl = "ERROR";
+      break;
+    case CRITICAL_L:
+      str_lvl = "CRITICAL";
+      break;
+    default:
+      break;
+  }
+
+  if (str_lvl)
+    fprintf(file, "[%s] [%s] ", time_str, str_lvl);
+  else
+    fprintf(file, "[%s] ", time_str);
+
+  const uint8_t *args = ( const uint8_t * )(record + 1);
+  size_t offset = 0;
+  const char *p = record->format;
+  spec_t spec;
+  for (const char *next; (next = strchr(p, '%')) != NULL; p = spec.end) {
+    fwrite(p, 1, next - p, file);
+    _parse_spec(next, &spec);
+    _print_spec(file, &spec, args, &offset);
+  }
+  fputs(p, file);
+}
+
+/* Writes the records of every ring, and how many were dropped since the
+ * last batch. Returns the number of lines written. */
+static size_t _drain(log_t *log) {
+  size_t lines = 0;
+  uint64_t dropped = __atomic_load_n(&log->dropped, __ATOMIC_RELAXED) - log->reported;
+  log->reported += dropped;
+
+  for (ring_t *ring = __atomic_load_n(&log->rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+    uint64_t tail = ring->tail;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    while (tail < head) {
+      const record_t *record = ( const record_t * )(ring->data + (tail & (LOG_RING_SIZE - 1)));
+      if (record->level != LOG_PAD) {
+        _print_record(log->log_file, record);
+        lines++;
+      }
+      tail += record->size;
+    }
+
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    uint64_t ring_dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    dropped += ring_dropped - ring->reported;
+    ring->reported = ring_dropped;
+  }
+
+  if (dropped > 0) {
+    char time_str[32];
+    _time_string(_elapsed(log), time_str);
+    fprintf(log->log_file, "[%s] [WARN] %lu log records dropped\n", time_str, ( unsigned long )dropped);
+    lines++;
+  }
+
+  if (lines > 0)
+    fflush(log->log_file);
+  return lines;
+}
+
+/* Returns true if some ring has records (or some were dropped) since the last batch. */
+static bool _pending(const log_t *log) {
+  if (__atomic_load_n(&log->dropped, __ATOMIC_RELAXED) != log->reported)
+    return true;
+
+  for (ring_t *ring = __atomic_load_n(&log->rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+    if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != ring->tail)
+      return true;
+  }
+
+  return false;
+}
+
+/* Background thread: writes the records in batches, as long as there are
+ * records, and then sleeps until a thread writes one (see _wake). */
+static void *_writer(void *arg) {
+  log_t *log = arg;
+
+  while (!__atomic_load_n(&log->stop, __ATOMIC_ACQUIRE)) {
+    _drain(log);
+
+    /* the rings are checked once it's marked as sleeping, so a record
+     * written meanwhile either is seen here or wakes it up */
+    __atomic_store_n(&log->sleeping, true, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!_pending(log) && !__atomic_load_n(&log->stop, __ATOMIC_ACQUIRE)) {
+      uint64_t count;
+      if (read(log->wakeup, &count, sizeof(count)) < 0)
+        __atomic_store_n(&log->stop, true, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&log->sleeping, false, __ATOMIC_RELAXED);
+  }
+
+  /* the records written before closing */
+  _drain(log);
+  return NULL;
+}
+
+/* Wakes up the background thread if it's sleeping (only the first record
+ * written to the empty rings wakes it up, the next ones go in its batch). */
+static void _wake(log_t *log) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&log->sleeping, __ATOMIC_RELAXED) &&
+      __atomic_exchange_n(&log->sleeping, false, __ATOMIC_RELAXED)) {
+    uint64_t one = 1;
+    if (write(log->wakeup, &one, sizeof(one)) < 0)
+      perror("log - eventfd");
+  }
+}
+
+/* After a fork, the child has no background thread: it creates its own log on the first use. */
+static void _atfork_child( ) {
+  pthread_mutex_init(&_log_lock, NULL);
+  _log = NULL;
+  _ring = NULL;
+}
+
+/* Opens file at route and dynamically creates a log with it,
+ * starting its background thread. If append is false, then the
+ * file is overwritten. Returns NULL if creating the log failed.*/
+static log_t *_log_open(char *route, bool append) {
   FILE *pf = fopen(route, (append ? "a" : "w"));
   if (!pf)
     return NULL;
 
-  log_t *log = malloc(sizeof(log_t));
+  log_t *log = calloc(1, sizeof(log_t));
   if (!log) {
     fclose(pf);
     return NULL;
   }
 
   log->log_file = pf;
-
-  struct timeval time_start;
-  gettimeofday(&time_start, NULL);
-
-  log->time_created = time_start;
-  log->debug = true;
+  clock_gettime(CLOCK_MONOTONIC, &log->time_created);
+  log->generation = ++_generation;
+  log->wakeup = eventfd(0, EFD_CLOEXEC);
+  if (log->wakeup < 0 || pthread_create(&log->writer, NULL, _writer, log) != 0) {
+    if (log->wakeup >= 0)
+      close(log->wakeup);
+    fclose(pf);
+    free(log);
+    return NULL;
+  }
 
   return log;
 }
 
-/* Retrieves log singleton instance. */
-log_t *log_get_instance( ) {
-  static log_t *log = NULL;
-  // Check if there's log already
+/* Retrieves log singleton instance (creating it on the first call). */
+static log_t *_log_get_instance( ) {
+  log_t *log = __atomic_load_n(&_log, __ATOMIC_ACQUIRE);
   if (log)
     return log;
-  // If not, create log
-  int pid = getpid( );
-  char log_name[12];
-  sprintf(log_name, "%d.log", pid);
-  printf("%s\n", log_name);
-  log = log_open(log_name, false);
+
+  static bool atfork = false;
+  pthread_mutex_lock(&_log_lock);
+  if (!atfork)
+    atfork = pthread_atfork(NULL, NULL, _atfork_child) == 0;
+
+  // If there's no log yet, create it
+  if (!_log) {
+    char log_name[32];
+    sprintf(log_name, "%d.log", ( int )getpid( ));
+    printf("%s\n", log_name);
+    __atomic_store_n(&_log, _log_open(log_name, false), __ATOMIC_RELEASE);
+  }
+
+  log = _log;
+  pthread_mutex_unlock(&_log_lock);
   return log;
 }
 
-/* Closes the received log file and destroys the log itself.*/
+/* Returns the ring of the calling thread, creating it on its first record. */
+static ring_t *_thread_ring(log_t *log) {
+  if (_ring && _ring_generation == log->generation)
+    return _ring;
+
+  ring_t *ring = calloc(1, sizeof(ring_t));
+  if (!ring)
+    return NULL;
+
+  ring->next = __atomic_load_n(&log->rings, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&log->rings, &ring->next, ring, true, __ATOMIC_RELEASE,
+                                      __ATOMIC_RELAXED))
+    ;
+
+  _ring = ring;
+  _ring_generation = log->generation;
+  return ring;
+}
+
+/* Copies a record into a ring (the record is dropped if there's no room). */
+static bool _push(ring_t *ring, const record_t *record) {
+  uint64_t head = ring->head;
+  uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  size_t offset = head & (LOG_RING_SIZE - 1);
+  size_t contiguous = LOG_RING_SIZE - offset;
+
+  /* records don't wrap around: the rest of the ring is skipped with a padding record */
+  size_t needed = record->size + (contiguous < record->size ? contiguous : 0);
+  if (LOG_RING_SIZE - (head - tail) < needed) {
+    __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+    return false;
+  }
+
+  if (contiguous < record->size) {
+    record_t *pad = ( record_t * )(ring->data + offset);
+    pad->size = contiguous;
+    pad->level = LOG_PAD;
+    head += contiguous;
+    offset = 0;
+  }
+
+  memcpy(ring->data + offset, record, record->size);
+  __atomic_store_n(&ring->head, head + record->size, __ATOMIC_RELEASE);
+  return true;
+}
+
+/* Writes the pending records, stops the background thread, closes the log
+ * file and destroys the log itself (no other thread may be writing to it).*/
 void log_close( ) {
-  log_t *log = log_get_instance( );
-  if (log && log->log_file)
-    fclose(log->log_file);
+  pthread_mutex_lock(&_log_lock);
+  log_t *log = _log;
+  __atomic_store_n(&_log, NULL, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&_log_lock);
+  if (!log)
+    return;
 
-  if (log)
-    free(log);
+  /* the eventfd keeps the wakeup, even if the thread isn't sleeping yet */
+  uint64_t one = 1;
+  __atomic_store_n(&log->stop, true, __ATOMIC_RELEASE);
+  if (write(log->wakeup, &one, sizeof(one)) < 0)
+    perror("log - eventfd");
+  pthread_join(log->writer, NULL);
+
+  close(log->wakeup);
+  fclose(log->log_file);
+  while (log->rings) {
+    ring_t *next = log->rings->next;
+    free(log->rings);
+    log->rings = next;
+  }
+
+  free(log);
 }
 
 /* Enables or disables "debug mode" for log depending on the
- * value received in set_debug. Only NONE_L log level strings
- * will be written if debug mode is off.*/
+ * value received in set_debug. Only NONE_L and STAT_L log level
+ * strings will be written if debug mode is off.*/
 void log_set_debug_mode(bool set_debug) {
-  log_t *log = log_get_instance( );
-  if (log)
-    log->debug = set_debug;
+  __atomic_store_n(&log_levels, set_debug ? LOG_ALL_LEVELS : LOG_DEBUG_OFF_LEVELS, __ATOMIC_RELAXED);
 }
 
-/* Write string msg to the received log file, using the log
- * level specified for the writing. If successful, returns
- * the total of characters written. Otherwise, a negative
- * number is returned.*/
-int log_write(log_level lvl, char *msg, ...) {
-  log_t *log = log_get_instance( );
-  if (!(log && log->log_file))
+/* Write string msg to the log, using the log level specified for
+ * the writing. Returns 0 if the record was queued, -1 if it was
+ * filtered out or dropped, or -2 if the format isn't supported.*/
+int log_write(log_level lvl, const char *msg, ...) {
+  if (!(__atomic_load_n(&log_levels, __ATOMIC_RELAXED) & (1u << lvl)))
     return -1;
 
-  if ((!log->debug) && ((lvl != NONE_L) && (lvl != STAT_L)))
+  log_t *log = _log_get_instance( );
+  if (!log)
     return -1;
 
-  fflush(log->log_file);
-
-  char time_str[10];
-  get_time_string(log, time_str);
+  /* the record is built on the stack, and then copied into the ring */
+  uint64_t buffer[LOG_MAX_RECORD / sizeof(uint64_t)];
+  record_t *record = ( record_t * )buffer;
 
   va_list args;
   va_start(args, msg);
+  size_t size = _encode(record, msg, &args);
+  va_end(args);
+  if (size == LOG_UNSUPPORTED)
+    return -2;
 
-  if (lvl == NONE_L) {
-    fprintf(log->log_file, "[%s] ", time_str);
-    vfprintf(log->log_file, msg, args);
-    va_end(args);
-    fflush(log->log_file);
-    return 0;
+  ring_t *ring = _thread_ring(log);
+  if (!ring || size == 0) {
+    __atomic_add_fetch(ring ? &ring->dropped : &log->dropped, 1, __ATOMIC_RELAXED);
+    _wake(log);
+    return -1;
   }
 
-  char *str_lvl;
-  switch (lvl) {
-    case STAT_L:
-      str_lvl = "STATS";
-      break;
-    case INFO_L:
-      str_lvl = "INFO";
-      break;
-    case DEBUG_L:
-      str_lvl = "DEBUG";
-      break;
-    case WARNING_L:
-      str_lvl = "WARN";
-      break;
-    case ERROR_L:
-      str_lvl = "ERROR";
-      break;
-    case CRITICAL_L:
-      str_lvl = "CRITICAL";
-      break;
-    default:
-      break;
-  }
+  record->size = size;
+  record->level = lvl;
+  record->time = _elapsed(log);
+  record->format = msg;
+  bool pushed = _push(ring, record);
+  _wake(log);
+  return pushed ? 0 : -1;
+}
 
-  fprintf(log->log_file, "[%s] [%s] ", time_str, str_lvl);
-  vfprintf(log->log_file, msg, args);
-  // fprintf(log->log_file, "\x1b[37;1", time_str, str_lvl);
-  va_end(args);
-  fflush(log->log_file);
-  return 0;
+/* Returns the number of records dropped because a ring buffer was full. */
+uint64_t log_dropped( ) {
+  log_t *log = __atomic_load_n(&_log, __ATOMIC_ACQUIRE);
+  if (!log)
+    return 0;
+
+  uint64_t dropped = __atomic_load_n(&log->dropped, __ATOMIC_RELAXED);
+  for (ring_t *ring = __atomic_load_n(&log->rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next)
+    dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+
+  return dropped;
 }
@@ -1,37 +1,88 @@
 #ifndef LOG_H
 #define LOG_H
 
+/* The log of the process (one file per process, named after its pid).
+ *
+ * Writing to the log never blocks on the file: the calling thread only
+ * copies a compact binary record (level, timestamp, format string pointer
+ * and the arguments) into its own ring buffer, and a background thread
+ * formats the records of every ring and writes them in batches. Each ring
+ * has a single producer (its thread) and a single consumer (the background
+ * thread), so neither of them takes a lock. The background thread sleeps
+ * while every ring is empty, and the first record written wakes it up. When
+ * a ring is full the record is dropped and counted, and the background
+ * thread logs how many were dropped.
+ *
+ * Since the record keeps a pointer to the format, it must be a string
+ * literal (or live until the log is closed). Strings given as arguments are
+ * copied (up to LOG_MAX_STRING characters). */
+
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/time.h>
 
-/* Log structure used to represent the log.
- * Shall we add more fields to it? */
-typedef struct log_ {
-  FILE *log_file;
-  struct timeval time_created;
-  bool debug;
-} log_t;
+/* Size of the ring buffer of each thread (a power of 2), and max size of a record. */
+#define LOG_RING_SIZE (1 << 16)
+#define LOG_MAX_RECORD 1024
+
+/* Max length of a string argument (longer ones are truncated). */
+#define LOG_MAX_STRING 256
+
+/* Log structure used to represent the log (see log.c). */
+typedef struct log_ log_t;
 
 /* Log level specifier for writing to the log. */
 typedef enum log_level_ { NONE_L, STAT_L, DEBUG_L, INFO_L, WARNING_L, ERROR_L, CRITICAL_L } log_level;
 
-/* Closes the received log file and destroys the log itself.*/
+/* Lowest level (from DEBUG_L up) built into the binaries (the Makefile sets it, e.g. make LOG_LEVEL=DEBUG_L).
+ * NONE_L and STAT_L are always built, like they are always written. */
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL INFO_L
+#endif
+
+/* Levels written at runtime (bit 1 << level, see log_set_debug_mode). */
+extern unsigned log_levels;
+
+/* Writes to the log like log_write, unless the level is below LOG_MIN_LEVEL
+ * (then the call is removed at compile time) or disabled at runtime (then
+ * it's a single branch): either way, the arguments aren't evaluated. */
+#define LOG(lvl, ...)                                                                                        \
+  do {                                                                                                       \
+    if (((lvl) <= STAT_L || (lvl) >= LOG_MIN_LEVEL) &&                                                       \
+        (__atomic_load_n(&log_levels, __ATOMIC_RELAXED) & (1u << (lvl))))                                    \
+      log_write((lvl), __VA_ARGS__);                                                                         \
+  } while (0)
+
+#define LOG_STAT(...) LOG(STAT_L, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG(DEBUG_L, __VA_ARGS__)
+#define LOG_INFO(...) LOG(INFO_L, __VA_ARGS__)
+#define LOG_WARNING(...) LOG(WARNING_L, __VA_ARGS__)
+#define LOG_ERROR(...) LOG(ERROR_L, __VA_ARGS__)
+#define LOG_CRITICAL(...) LOG(CRITICAL_L, __VA_ARGS__)
+
+/* Writes the pending records, stops the background thread, closes the log
+ * file and destroys the log itself (no other thread may be writing to it).*/
 void log_close( );
 
 /* Enables or disables "debug mode" for log depending on the
- * value received in set_debug. Only NONE_L log level strings
- * will be written if debug mode is off.*/
+ * value received in set_debug. Only NONE_L and STAT_L log level
+ * strings will be written if debug mode is off.*/
 void log_set_debug_mode(bool set_debug);
 
-/* Write string msg to the received log file, using the log
- * level specified for the writing. Works exactly like printf
- * meaning that you can pass msg as a formated string, and then
- * specify list of arguments. If successful, returns
- * the total of characters written. Otherwise, a negative
- * number is returned.*/
-int log_write(log_level lvl, char *msg, ...);
+/* Write string msg to the log, using the log level specified for
+ * the writing. Works like printf meaning that you can pass msg as a
+ * formated string, and then specify list of arguments. Only these
+ * conversions are supported: %d %i %u %o %x %X (with the length
+ * modifiers hh h l ll j z t), %f %F %e %E %g %G %a %A (l and L), and
+ * %c %s %p %% (none), with any flags, width and precision (* too).
+ * Returns 0 if the record was queued, -1 if it was filtered out or
+ * dropped, or -2 if the format has any other conversion (e.g. %n,
+ * wide characters or positional arguments), then nothing is logged.*/
+int log_write(log_level lvl, const char *msg, ...);
+
+/* Returns the number of records dropped because a ring buffer was full. */
+uint64_t log_dropped( );
 
 #endif
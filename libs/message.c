@@ -42,3 +42,23 @@ bool message_iter_const(const void *message, const message_desc_t *desc, const_i
 
   return true;
 }
+
+/**
+ * @brief Copies the fields of a message (see field_copy), so the copy doesn't
+ * share the characters the long strings keep in an arena.
+ *
+ * @param dst Copy of the message (the structs in the union, not the group!).
+ * @param src Message to copy.
+ * @param desc The corresponding message's field descriptions.
+ * @return false on error, true on success.
+ */
+bool message_copy(void *dst, const void *src, const message_desc_t *desc) {
+  for (size_t i = 0; i < desc->num_fields; i++) {
+    size_t offset = desc->fields[i].offset;
+    if (!field_copy(( uint8_t * )dst + offset, ( const uint8_t * )src + offset, desc->fields[i].type)) {
+      return false;
+    }
+  }
+
+  return true;
+}
@@ -12,8 +12,9 @@
 /* include area */
 #include "types.h"
 #include <stddef.h>
+#include <stdint.h>
 
-/** The number of bytes used to serialize the field size */
+/** The number of bytes used to serialize the message size (see frame.h) */
 #define MAX_SIZE_IN_BYTES 4
 
 /*--------------------------------------------------------------------------
@@ -37,6 +38,17 @@ typedef struct field_desc {
   const char *name;
 } field_desc_t;
 
+/** Correlation id, matches a response with its request (0 means unset). */
+typedef uint32_t message_id_t;
+
+/** Serialization formats */
+typedef enum {
+  /** JSON (human readable, for debugging). */
+  message_format_json,
+  /** Compact binary encoding (see binary.h). */
+  message_format_binary,
+} message_format_t;
+
 /** Message description. */
 typedef struct message_desc {
   /** Array of field descriptions (one for each field in the message struct). */
@@ -51,6 +63,12 @@ typedef struct message_desc {
    Prototypes
 --------------------------------------------------------------------------*/
 
+/** Callback where a message is read from */
+typedef size_t (*read_cb_t)(void *output, size_t bytes, void *cb_ctx);
+
+/** Callback where a message is written to */
+typedef bool (*write_cb_t)(const void *data, size_t bytes, void *cb_ctx);
+
 /**
  * @brief Message iteration callback.
  * This callback is called for every field in the message struct (like map).
@@ -67,5 +85,6 @@ typedef bool (*const_iter_cb_t)(const void *field, const field_desc_t *desc, voi
 /** IO */
 bool message_iter(void *message, const message_desc_t *desc, iter_cb_t cb, void *cb_ctx);
 bool message_iter_const(const void *message, const message_desc_t *desc, const_iter_cb_t cb, void *cb_ctx);
+bool message_copy(void *dst, const void *src, const message_desc_t *desc);
 
 #endif
@@ -164,10 +164,13 @@ static const struct message_desc CONCAT(MESSAGE_NAME, _descs)[] = {MESSAGES};
 
 /**
  * @brief Generic message container type.
- *  Contains a union with all the message structs and a field specifying the message type.
+ *  Contains a union with all the message structs, a field specifying the message type
+ *  and the correlation id (so responses can be matched with their requests when several
+ *  of them are in flight through the same connection).
  *
  *    typedef struct {
  *      foobar_type_t type;  // the enum indicating what struct in the union was used
+ *      message_id_t id;     // correlation id (a response carries the id of its request)
  *      union {
  *        foobar_foo_t foo;  // and any other "foobar" defined in MESSAGES
  *      } u;
@@ -179,6 +182,8 @@ static const struct message_desc CONCAT(MESSAGE_NAME, _descs)[] = {MESSAGES};
 typedef struct {
   /** The type of the message instance. */
   CONCAT(MESSAGE_NAME, _type_t) type;
+  /** Correlation id (0 if unset). */
+  message_id_t id;
   /** Message contents (should use the union field that corresponds to "type").  */
   union {
     MESSAGES
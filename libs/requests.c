@@ -1,6 +1,9 @@
 /* include area */
 #include "requests.h"
-#include <jansson.h>
+#include "binary.h"
+#include "json_reader.h"
+#include "json_writer.h"
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -10,36 +13,32 @@
 #define _STR(value) #value
 #define STR(value) _STR(value)
 
-#define MSG_TYPE_KEY "@type"
-
 #define MAX_SERIALIZED_SIZE_LENGTH 128
 
-/** Serialization context. */
-typedef struct {
-  /** The output callback. */
-  write_cb_t out;
-  /** The output callback context. */
-  void *out_ctx;
-} serialization_ctx_t;
+/** Size of the buffer where messages are serialized (larger messages are written in chunks) */
+#define JSON_WRITER_BUFFER_SIZE 512
+
+/** Size of the text of request_str/response_str (longer messages are truncated) */
+#define MESSAGE_STR_SIZE 256
 
-/** Deerialization context. */
+/** Text of a message (see _text_write_cb) */
 typedef struct {
-  /** The input callback. */
-  read_cb_t in;
-  /** The input callback context. */
-  void *in_ctx;
-} deserialization_ctx_t;
-
-static int _json_dump_cb(const char *buffer, size_t size, void *data) {
-  serialization_ctx_t *ctx = data;
-
-  if (!ctx->out(buffer, size, ctx->out_ctx)) {
-    /* error */
-    return -1;
-  }
+  char chars[MESSAGE_STR_SIZE];
+  size_t length;
+} text_t;
+
+/** Schemas used to parse the messages (built once, see _schemas_init) */
+static pthread_once_t schemas_once = PTHREAD_ONCE_INIT;
+static bool schemas_ready = false;
+static json_schema_t request_schema;
+static json_schema_t response_schema;
 
-  /* success */
-  return 0;
+/**
+ * @brief Builds the schemas of the requests and the responses (their perfect hash tables).
+ */
+static void _schemas_init( ) {
+  schemas_ready = json_schema_init(&request_schema, request_descs, request_last) &&
+                  json_schema_init(&response_schema, response_descs, response_last);
 }
 
 /**
@@ -51,148 +50,45 @@ static int _json_dump_cb(const char *buffer, size_t size, void *data) {
  * @return Always true.
  */
 static bool _stdout_print_cb(const void *data, size_t size, void *ignored) {
-  printf("%*s", ( int )size, ( const char * )data);
+  printf("%.*s", ( int )size, ( const char * )data);
   return true;
 }
 
 /**
- * @brief Writes a serialized field through the out callback.
+ * @brief Output callback for request/response serialization that appends to
+ * a text (truncating it when it's full).
  *
- * @param field Field to serialize and output.
- * @param desc Field description.
- * @param cb_ctx Callback context.
- * @return false on error, true on success.
+ * @param data Buffer to append.
+ * @param size Buffer length.
+ * @param ctx The text.
+ * @return Always true.
  */
-static bool _field_serialize(const void *field, const field_desc_t *desc, void *cb_ctx) {
-  json_t *json = cb_ctx;
-
-  json_t *json_field = NULL;
-  switch (desc->type) {
-    case field_type_integer:
-      json_field = json_integer(*( integer_t * )field);
-      break;
-    case field_type_float:
-      json_field = json_real(*( float_t * )field);
-      break;
-    case field_type_string:
-      json_field = json_string(str_to_cstr(field));
-      break;
-  }
-
-  if (json_field == NULL) {
-    return false;
-  }
-
-  /* sets the JSON encoded fields into the output object */
-  if (json_object_set_new_nocheck(json, desc->name, json_field) != 0) {
-    json_decref(json_field);
-    return false;
-  }
-
-  /* success */
+static bool _text_write_cb(const void *data, size_t size, void *ctx) {
+  text_t *text = ctx;
+  size_t room = sizeof(text->chars) - 1 - text->length;
+  size = size < room ? size : room;
+  memcpy(text->chars + text->length, data, size);
+  text->length += size;
   return true;
 }
 
-/**
- * @brief Reads a serialized field and deserializes it.
- *
- * @param field Field to deserialize.
- * @param desc Field description.
- * @param cb_ctx Callback context.
- * @return false on error, true on success.
- */
-static bool _field_deserialize(void *field, const field_desc_t *desc, void *cb_ctx) {
-  json_t *json = cb_ctx;
-
-  /* gets the corresponding JSON key */
-  json_t *json_field = json_object_get(json, desc->name);
-  if (json_field == NULL) {
-    return false;
-  }
-
-  switch (desc->type) {
-    case field_type_integer:
-      if (json_typeof(json_field) != JSON_INTEGER) {
-        return false;
-      }
-      *( integer_t * )field = json_integer_value(json_field);
-      return true;
-    case field_type_float:
-      if (json_typeof(json_field) != JSON_REAL) {
-        return false;
-      }
-      *( float_t * )field = json_real_value(json_field);
-      return true;
-    case field_type_string:
-      if (json_typeof(json_field) != JSON_STRING) {
-        return false;
-      }
-      return str_init(field, json_string_value(json_field));
-  }
-
-  /* unreachable */
-  return false;
-}
-
-/**
- * @brief Converts a message into a JSON object.
- *
- * @param msg Message struct to convert (the union).
- * @param desc Message description.
- * @return JSON object on success, NULL on error.
- */
-static json_t *_message_to_json(const void *msg, const message_desc_t *desc) {
-  /* creates the JSON object that will hold the message */
-  json_t *json = json_object( );
-  if (json_object_set_new_nocheck(json, MSG_TYPE_KEY, json_string_nocheck(desc->name)) != 0) {
-    json_decref(json);
-    return NULL;
-  }
-
-  if (!message_iter_const(msg, desc, _field_serialize, json)) {
-    json_decref(json);
-    return NULL;
-  }
-
-  /* returns the JSON object */
-  return json;
-}
-
-/**
- * @brief Loads a message from a JSON object.
- *
- * @param msg Message to load (the union).
- * @param desc Message description.
- * @param json JSON object where the message is loaded from.
- * @return false on error.
- */
-static bool _message_from_json(void *msg, const message_desc_t *desc, json_t *json) {
-  /* deserializes from the JSON object */
-  return message_iter(msg, desc, _field_deserialize, json);
-}
-
 /**
  * @brief Serializes a message and sends it through an output callback.
  *
  * @param msg Message to serialize (the union).
  * @param desc Message description.
+ * @param id Correlation id.
  * @param out Output callback.
  * @param out_ctx Output callback context.
  * @return false on error.
  */
-static bool _message_serialize(const void *msg, const message_desc_t *desc, write_cb_t out, void *out_ctx) {
-  /* creates the JSON object that will hold the message */
-  json_t *json = _message_to_json(msg, desc);
-  if (json == NULL) {
-    return false;
-  }
-
-  /* dumps to string through the output callback */
-  serialization_ctx_t ctx = {.out = out, .out_ctx = out_ctx};
-  bool success = (json_dump_callback(json, _json_dump_cb, &ctx, JSON_INDENT(4)) == 0);
-
-  json_decref(json);
-  return success;
+static bool _message_serialize(const void *msg, const message_desc_t *desc, message_id_t id, write_cb_t out,
+                               void *out_ctx) {
+  /* writes straight to a buffer that's flushed through the output callback (no JSON tree) */
+  char buffer[JSON_WRITER_BUFFER_SIZE];
+  json_writer_t writer;
+  json_writer_init(&writer, buffer, sizeof(buffer), out, out_ctx);
+  return json_writer_message(&writer, msg, desc, id) && json_writer_flush(&writer);
 }
 
 /**
@@ -212,7 +108,28 @@ bool request_serialize(const request_t *r, write_cb_t out, void *out_ctx) {
 
   /* serialization */
   const message_desc_t *desc = &request_descs[r->type];
-  return _message_serialize(&r->u, desc, out, out_ctx);
+  return _message_serialize(&r->u, desc, r->id, out, out_ctx);
+}
+
+/**
+ * @brief Serializes a request in the given format, sending the output through the "out" callback.
+ *
+ * @param r Request to serialize.
+ * @param format Serialization format.
+ * @param out Callback that outputs the serialized data.
+ * @param out_ctx Pointer passed to out.
+ * @return false on error, true on success.
+ */
+bool request_serialize_as(const request_t *r, message_format_t format, write_cb_t out, void *out_ctx) {
+  if (format != message_format_binary)
+    return request_serialize(r, out, out_ctx);
+
+  if (r->type >= request_last) {
+    return false;
+  }
+
+  const message_desc_t *desc = &request_descs[r->type];
+  return binary_serialize(&r->u, desc, r->type, r->id, out, out_ctx);
 }
 
 /**
@@ -224,40 +141,43 @@ bool request_serialize(const request_t *r, write_cb_t out, void *out_ctx) {
  * @return false on error, true on success.
  */
 bool request_deserialize(request_t *r, read_cb_t in, void *in_ctx) {
-  /* deserializes the JSON object from the input callback */
-  json_t *json = json_load_callback(in, in_ctx, JSON_DISABLE_EOF_CHECK, NULL);
-  if (json == NULL) {
+  pthread_once(&schemas_once, _schemas_init);
+  if (!schemas_ready) {
     return false;
   }
 
-  /* gets the request type */
-  json_t *type = json_object_get(json, MSG_TYPE_KEY);
-  if (type == NULL || json_typeof(type) != JSON_STRING) {
-    json_decref(json);
+  /* parses straight into the request */
+  size_t type;
+  if (!json_reader_message(&request_schema, &type, &r->id, &r->u, in, in_ctx)) {
     return false;
   }
 
-  /* gets the coresponding description */
-  r->type = request_last;
-  const char *type_cstr = json_string_value(type);
-  for (request_type_t t = 0; t < request_last; t++) {
-    if (strcmp(type_cstr, request_descs[t].name) == 0) {
-      r->type = t;
-      break;
-    }
-  }
+  r->type = type;
+  return true;
+}
+
+/**
+ * @brief Parses a request serialized in the given format, reading the content from the "in" callback.
+ *
+ * @param r Parsed request (output).
+ * @param format Serialization format.
+ * @param in Callback that gives the data to parse.
+ * @param in_ctx Pointer passed to in.
+ * @return false on error, true on success.
+ */
+bool request_deserialize_as(request_t *r, message_format_t format, read_cb_t in, void *in_ctx) {
+  if (format != message_format_binary)
+    return request_deserialize(r, in, in_ctx);
 
-  if (r->type == request_last) {
-    json_decref(json);
+  /* gets the request type (and the coresponding description) */
+  uint8_t type;
+  if (!binary_deserialize_header(&type, &r->id, in, in_ctx) || type >= request_last) {
     return false;
   }
 
-  /* deserializes from the JSON object */
+  r->type = type;
   const message_desc_t *desc = &request_descs[r->type];
-  bool success = _message_from_json(&r->u, desc, json);
-
-  json_decref(json);
-  return success;
+  return binary_deserialize(&r->u, desc, in, in_ctx);
 }
 
 /**
@@ -268,10 +188,25 @@ bool request_deserialize(request_t *r, read_cb_t in, void *in_ctx) {
 void request_print(const request_t *r) {
   /* serialization */
   const message_desc_t *desc = &request_descs[r->type];
-  _message_serialize(&r->u, desc, _stdout_print_cb, NULL);
+  _message_serialize(&r->u, desc, r->id, _stdout_print_cb, NULL);
   printf("\n");
 }
 
+/**
+ * @brief Serializes a request into a text, e.g. for the log.
+ *
+ * @param r Request to serialize.
+ * @return The text (truncated to MESSAGE_STR_SIZE - 1 characters, valid until
+ * the thread serializes another message this way).
+ */
+const char *request_str(const request_t *r) {
+  static __thread text_t text;
+  text.length = 0;
+  _message_serialize(&r->u, &request_descs[r->type], r->id, _text_write_cb, &text);
+  text.chars[text.length] = '\0';
+  return text.chars;
+}
+
 /**
  * @brief Serializes a response, writing the serialized content through
  * the given output callback.
@@ -290,7 +225,84 @@ bool response_serialize(const response_t *r, write_cb_t out, void *out_ctx) {
 
   /* serialization */
   const message_desc_t *desc = &response_descs[r->type];
-  return _message_serialize(&r->u, desc, out, out_ctx);
+  return _message_serialize(&r->u, desc, r->id, out, out_ctx);
+}
+
+/**
+ * @brief Serializes a response in the given format, sending the output through the "out" callback.
+ *
+ * @param r Response to serialize.
+ * @param format Serialization format.
+ * @param out Callback that outputs the serialized data.
+ * @param out_ctx Pointer passed to out.
+ * @return false on error, true on success.
+ */
+bool response_serialize_as(const response_t *r, message_format_t format, write_cb_t out, void *out_ctx) {
+  if (format != message_format_binary)
+    return response_serialize(r, out, out_ctx);
+
+  if (r->type >= response_last) {
+    return false;
+  }
+
+  const message_desc_t *desc = &response_descs[r->type];
+  return binary_serialize(&r->u, desc, r->type, r->id, out, out_ctx);
+}
+
+/**
+ * @brief Serializes only the fields of a response (what follows its type and
+ * id), so they can be encoded once and sent with any id (see
+ * response_serialize_encoded_as).
+ *
+ * @param r Response to serialize.
+ * @param format Serialization format.
+ * @param out Callback that outputs the serialized data.
+ * @param out_ctx Pointer passed to out.
+ * @return false on error, true on success.
+ */
+bool response_serialize_fields_as(const response_t *r, message_format_t format, write_cb_t out,
+                                  void *out_ctx) {
+  if (r->type >= response_last) {
+    return false;
+  }
+
+  const message_desc_t *desc = &response_descs[r->type];
+  if (format == message_format_binary)
+    return binary_serialize_fields(&r->u, desc, out, out_ctx);
+
+  char buffer[JSON_WRITER_BUFFER_SIZE];
+  json_writer_t writer;
+  json_writer_init(&writer, buffer, sizeof(buffer), out, out_ctx);
+  return json_writer_fields(&writer, &r->u, desc) && json_writer_flush(&writer);
+}
+
+/**
+ * @brief Serializes a response whose fields are already encoded (see
+ * response_serialize_fields_as): only its header is serialized.
+ *
+ * @param type Response type.
+ * @param id Correlation id.
+ * @param format Serialization format (the one of the fields).
+ * @param fields Encoded fields.
+ * @param length Length of the encoded fields.
+ * @param out Callback that outputs the serialized data.
+ * @param out_ctx Pointer passed to out.
+ * @return false on error, true on success.
+ */
+bool response_serialize_encoded_as(response_type_t type, message_id_t id, message_format_t format,
+                                   const void *fields, size_t length, write_cb_t out, void *out_ctx) {
+  if (type >= response_last) {
+    return false;
+  }
+
+  if (format == message_format_binary)
+    return binary_serialize_header(type, id, out, out_ctx) && out(fields, length, out_ctx);
+
+  char buffer[MAX_SERIALIZED_SIZE_LENGTH];
+  json_writer_t writer;
+  json_writer_init(&writer, buffer, sizeof(buffer), out, out_ctx);
+  return json_writer_header(&writer, &response_descs[type], id) && json_writer_flush(&writer) &&
+         out(fields, length, out_ctx);
 }
 
 /**
@@ -302,40 +314,62 @@ bool response_serialize(const response_t *r, write_cb_t out, void *out_ctx) {
  * @return false on error, true on success.
  */
 bool response_deserialize(response_t *r, read_cb_t in, void *in_ctx) {
-  /* deserializes the JSON object from the input callback */
-  json_t *json = json_load_callback(in, in_ctx, JSON_DISABLE_EOF_CHECK, NULL);
-  if (json == NULL) {
+  pthread_once(&schemas_once, _schemas_init);
+  if (!schemas_ready) {
     return false;
   }
 
-  /* gets the request type */
-  json_t *type = json_object_get(json, MSG_TYPE_KEY);
-  if (type == NULL || json_typeof(type) != JSON_STRING) {
-    json_decref(json);
+  /* parses straight into the response */
+  size_t type;
+  if (!json_reader_message(&response_schema, &type, &r->id, &r->u, in, in_ctx)) {
     return false;
   }
 
-  /* gets the coresponding description */
-  r->type = response_last;
-  const char *type_cstr = json_string_value(type);
-  for (response_type_t t = 0; t < response_last; t++) {
-    if (strcmp(type_cstr, response_descs[t].name) == 0) {
-      r->type = t;
-      break;
-    }
-  }
+  r->type = type;
+  return true;
+}
+
+/**
+ * @brief Parses a response serialized in the given format, reading the content from the "in" callback.
+ *
+ * @param r Parsed response (output).
+ * @param format Serialization format.
+ * @param in Callback that gives the data to parse.
+ * @param in_ctx Pointer passed to in.
+ * @return false on error, true on success.
+ */
+bool response_deserialize_as(response_t *r, message_format_t format, read_cb_t in, void *in_ctx) {
+  if (format != message_format_binary)
+    return response_deserialize(r, in, in_ctx);
 
-  if (r->type == response_last) {
-    json_decref(json);
+  /* gets the response type (and the coresponding description) */
+  uint8_t type;
+  if (!binary_deserialize_header(&type, &r->id, in, in_ctx) || type >= response_last) {
     return false;
   }
 
-  /* deserializes from the JSON object */
+  r->type = type;
   const message_desc_t *desc = &response_descs[r->type];
-  bool success = _message_from_json(&r->u, desc, json);
+  return binary_deserialize(&r->u, desc, in, in_ctx);
+}
+
+/**
+ * @brief Copies a response, along with the characters of its long strings
+ * (into the arena of the calling thread, see str_set_arena), e.g. to keep it
+ * once the arena where it was parsed is reset.
+ *
+ * @param dst Copy of the response (output).
+ * @param src Response to copy.
+ * @return false on error, true on success.
+ */
+bool response_copy(response_t *dst, const response_t *src) {
+  if (src->type >= response_last) {
+    return false;
+  }
 
-  json_decref(json);
-  return success;
+  dst->type = src->type;
+  dst->id = src->id;
+  return message_copy(&dst->u, &src->u, &response_descs[src->type]);
 }
 
 /**
@@ -346,6 +380,21 @@ bool response_deserialize(response_t *r, read_cb_t in, void *in_ctx) {
 void response_print(const response_t *r) {
   /* serialization */
   const message_desc_t *desc = &response_descs[r->type];
-  _message_serialize(&r->u, desc, _stdout_print_cb, NULL);
+  _message_serialize(&r->u, desc, r->id, _stdout_print_cb, NULL);
   printf("\n");
 }
+
+/**
+ * @brief Serializes a response into a text, e.g. for the log.
+ *
+ * @param r Response to serialize.
+ * @return The text (truncated to MESSAGE_STR_SIZE - 1 characters, valid until
+ * the thread serializes another message this way).
+ */
+const char *response_str(const response_t *r) {
+  static __thread text_t text;
+  text.length = 0;
+  _message_serialize(&r->u, &response_descs[r->type], r->id, _text_write_cb, &text);
+  text.chars[text.length] = '\0';
+  return text.chars;
+}
@@ -15,34 +15,59 @@
  * Also, the serialization/deserialization is handled automatically (no
  * need to define a (de)serialization function for every request/response).
  *
+ * The batch requests carry a list of cities/currencies, answered in a single
+ * round-trip: the response lists the ones that were found, with their values
+ * in the same order. The batch posts carry the values of each city/currency
+ * in the same order, and they are applied as a whole (or not at all).
+ *
  * See message.h for more information.
  */
 // clang-format off
 
 #define REQUESTS( )\
-  ENTRY(weather,                               \
-    FIELD(weather, city, string))              \
-  ENTRY(currency,                              \
-    FIELD(currency, currency, string))         \
-  ENTRY(post_weather,                          \
-    FIELD(weather, city, string)               \
-    FIELD(post_weather, humidity, float)       \
-    FIELD(post_weather, pressure, float)       \
-    FIELD(post_weather, temperature, float))   \
-  ENTRY(post_currency,                         \
-    FIELD(post_currency, currency, string)     \
-    FIELD(post_currency, value, float))        \
-
-
-#define RESPONSES( )                           \
-  ENTRY(weather,                               \
-    FIELD(weather, humidity, float)            \
-    FIELD(weather, pressure, float)            \
-    FIELD(weather, temperature, float))        \
-  ENTRY(currency,                              \
-    FIELD(currency, quote, float))             \
-  ENTRY(result,                                \
-    FIELD(result, message, string))
+  ENTRY(weather,                                        \
+    FIELD(weather, city, string))                       \
+  ENTRY(currency,                                       \
+    FIELD(currency, currency, string))                  \
+  ENTRY(post_weather,                                   \
+    FIELD(weather, city, string)                        \
+    FIELD(post_weather, humidity, float)                \
+    FIELD(post_weather, pressure, float)                \
+    FIELD(post_weather, temperature, float))            \
+  ENTRY(post_currency,                                  \
+    FIELD(post_currency, currency, string)              \
+    FIELD(post_currency, value, float))                 \
+  ENTRY(batch_weather,                                  \
+    FIELD(batch_weather, cities, string_list))          \
+  ENTRY(batch_currency,                                 \
+    FIELD(batch_currency, currencies, string_list))     \
+  ENTRY(post_batch_weather,                             \
+    FIELD(post_batch_weather, cities, string_list)      \
+    FIELD(post_batch_weather, humidity, float_list)     \
+    FIELD(post_batch_weather, pressure, float_list)     \
+    FIELD(post_batch_weather, temperature, float_list)) \
+  ENTRY(post_batch_currency,                            \
+    FIELD(post_batch_currency, currencies, string_list) \
+    FIELD(post_batch_currency, values, float_list))
+
+
+#define RESPONSES( )                                    \
+  ENTRY(weather,                                        \
+    FIELD(weather, humidity, float)                     \
+    FIELD(weather, pressure, float)                     \
+    FIELD(weather, temperature, float))                 \
+  ENTRY(currency,                                       \
+    FIELD(currency, quote, float))                      \
+  ENTRY(result,                                         \
+    FIELD(result, message, string))                     \
+  ENTRY(batch_weather,                                  \
+    FIELD(batch_weather, cities, string_list)           \
+    FIELD(batch_weather, humidity, float_list)          \
+    FIELD(batch_weather, pressure, float_list)          \
+    FIELD(batch_weather, temperature, float_list))      \
+  ENTRY(batch_currency,                                 \
+    FIELD(batch_currency, currencies, string_list)      \
+    FIELD(batch_currency, quotes, float_list))
 
 // clang-format on
 
@@ -76,19 +101,24 @@
    Prototypes
 --------------------------------------------------------------------------*/
 
-/** Callback where a message is read from */
-typedef size_t (*read_cb_t)(void *output, size_t bytes, void *cb_ctx);
-
-/** Callback where a message is written to */
-typedef bool (*write_cb_t)(const void *data, size_t bytes, void *cb_ctx);
-
-/** IO prototypes */
+/** IO prototypes (the read/write callbacks are declared in message.h) */
 bool request_serialize(const request_t *r, write_cb_t out, void *out_ctx);
+bool request_serialize_as(const request_t *r, message_format_t format, write_cb_t out, void *out_ctx);
 bool request_deserialize(request_t *r, read_cb_t in, void *in_ctx);
+bool request_deserialize_as(request_t *r, message_format_t format, read_cb_t in, void *in_ctx);
 void request_print(const request_t *r);
+const char *request_str(const request_t *r);
 
 bool response_serialize(const response_t *r, write_cb_t out, void *out_ctx);
+bool response_serialize_as(const response_t *r, message_format_t format, write_cb_t out, void *out_ctx);
+bool response_serialize_fields_as(const response_t *r, message_format_t format, write_cb_t out,
+                                  void *out_ctx);
+bool response_serialize_encoded_as(response_type_t type, message_id_t id, message_format_t format,
+                                   const void *fields, size_t length, write_cb_t out, void *out_ctx);
 bool response_deserialize(response_t *r, read_cb_t in, void *in_ctx);
+bool response_deserialize_as(response_t *r, message_format_t format, read_cb_t in, void *in_ctx);
+bool response_copy(response_t *dst, const response_t *src);
 void response_print(const response_t *r);
+const char *response_str(const response_t *r);
 
 #endif
@@ -0,0 +1,147 @@
+/* include area */
+#include "router.h"
+#include "str.h"
+#include <stdlib.h>
+
+/** Point of the ring */
+typedef struct {
+  uint32_t hash;
+  uint32_t instance;
+} point_t;
+
+/** Instances of a service, and their points sorted by hash */
+typedef struct {
+  size_t num_instances;
+  uint16_t ports[ROUTER_MAX_INSTANCES];
+  point_t ring[ROUTER_MAX_INSTANCES * ROUTER_VNODES];
+} service_t;
+
+struct router {
+  service_t services[ROUTER_MAX_SERVICES];
+};
+
+/**
+ * @brief Mixes the bits of a hash (the FNV hash of short keys that only
+ * differ in the last characters are close, and so would be their points).
+ *
+ * @param hash The hash.
+ * @return the mixed hash.
+ */
+static uint32_t _mix(uint32_t hash) {
+  hash ^= hash >> 16;
+  hash *= 0x85EBCA6Bu;
+  hash ^= hash >> 13;
+  hash *= 0xC2B2AE35u;
+  return hash ^ (hash >> 16);
+}
+
+/**
+ * @brief Compares two points by their hash (qsort callback).
+ *
+ * @param a A point.
+ * @param b Another point.
+ * @return negative, 0 or positive if a goes before, with or after b.
+ */
+static int _point_cmp(const void *a, const void *b) {
+  const point_t *pa = a, *pb = b;
+  if (pa->hash != pb->hash)
+    return pa->hash < pb->hash ? -1 : 1;
+
+  /* ties are broken by instance, so every process sorts the ring the same way */
+  return (pa->instance > pb->instance) - (pa->instance < pb->instance);
+}
+
+/**
+ * @brief Creates an empty routing table.
+ *
+ * @return The table or NULL on error.
+ */
+router_t *router_create( ) {
+  return calloc(1, sizeof(router_t));
+}
+
+/**
+ * @brief Adds an instance to a service (its index is the number of instances added before).
+ *
+ * @param router The table.
+ * @param service Service (e.g. its base request type).
+ * @param port Port of the instance.
+ * @return false on error (too many services or instances), true on success.
+ */
+bool router_add(router_t *router, size_t service, uint16_t port) {
+  if (service >= ROUTER_MAX_SERVICES || router->services[service].num_instances == ROUTER_MAX_INSTANCES)
+    return false;
+
+  service_t *s = &router->services[service];
+  uint32_t instance = s->num_instances++;
+  s->ports[instance] = port;
+  for (uint32_t v = 0; v < ROUTER_VNODES; v++) {
+    point_t *point = &s->ring[instance * ROUTER_VNODES + v];
+    point->hash = _mix(instance * ROUTER_VNODES + v + 1);
+    point->instance = instance;
+  }
+
+  qsort(s->ring, s->num_instances * ROUTER_VNODES, sizeof(point_t), _point_cmp);
+  return true;
+}
+
+/**
+ * @brief Returns the number of instances of a service.
+ *
+ * @param router The table.
+ * @param service Service.
+ * @return number of instances (0 if it has none).
+ */
+size_t router_instances(const router_t *router, size_t service) {
+  return service < ROUTER_MAX_SERVICES ? router->services[service].num_instances : 0;
+}
+
+/**
+ * @brief Gets the instance that holds a key.
+ *
+ * @param router The table.
+ * @param service Service (with at least one instance).
+ * @param key Key characters.
+ * @param length Key length.
+ * @return index of the instance.
+ */
+size_t router_instance(const router_t *router, size_t service, const char *key, size_t length) {
+  const service_t *s = &router->services[service];
+  size_t num_points = s->num_instances * ROUTER_VNODES;
+  if (s->num_instances < 2)
+    return 0;
+
+  /* the first point at or after the hash (wrapping around) */
+  uint32_t hash = _mix(str_hash_n(key, length));
+  size_t low = 0, high = num_points;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (s->ring[mid].hash < hash)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  return s->ring[low % num_points].instance;
+}
+
+/**
+ * @brief Gets the port of an instance.
+ *
+ * @param router The table.
+ * @param service Service.
+ * @param instance Index of the instance (see router_instance).
+ * @return the port.
+ */
+uint16_t router_port(const router_t *router, size_t service, size_t instance) {
+  return router->services[service].ports[instance];
+}
+
+/**
+ * @brief Releases a routing table.
+ *
+ * @param router The table.
+ */
+void router_destroy(router_t *router) {
+  free(router);
+}
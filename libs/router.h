@@ -0,0 +1,44 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+/**
+ * @brief This module implements the routing table of the portal: it maps each
+ * service (e.g. weather) to its instances, and each key (a city/currency) to
+ * the instance that holds it.
+ *
+ * Keys are sharded with consistent hashing: every instance takes
+ * ROUTER_VNODES points of a hash ring, and a key belongs to the instance of
+ * the first point after the hash of the key (a binary search over the sorted
+ * points). The points only depend on the index of the instance, so the
+ * instances of a service compute the same slices as the portal (to keep
+ * only their slice), and adding an instance moves about 1/N of the keys, all
+ * of them to the new instance.
+ */
+
+/* include area */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Max number of services, and of instances of each service */
+#define ROUTER_MAX_SERVICES 8
+#define ROUTER_MAX_INSTANCES 16
+
+/** Points of each instance in the ring (more points spread the keys more evenly) */
+#define ROUTER_VNODES 64
+
+/** Routing table (see router.c) */
+typedef struct router router_t;
+
+/*--------------------------------------------------------------------------
+   Prototypes
+--------------------------------------------------------------------------*/
+
+router_t *router_create(void);
+bool router_add(router_t *router, size_t service, uint16_t port);
+size_t router_instances(const router_t *router, size_t service);
+size_t router_instance(const router_t *router, size_t service, const char *key, size_t length);
+uint16_t router_port(const router_t *router, size_t service, size_t instance);
+void router_destroy(router_t *router);
+
+#endif
@@ -1,131 +1,874 @@
 /* include area */
+#define _GNU_SOURCE
 #include "server.h"
+#include "arena.h"
+#include "buffer.h"
+#include "frame.h"
 #include <errno.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 #include <wait.h>
 
+/** Max number of events handled by each epoll_wait call */
+#define MAX_EVENTS 64
+
+/** Max size (in bytes) of a serialized request (larger requests close the connection) */
+#define MAX_REQUEST_SIZE (64 << 10)
+
+/** Max size (in bytes) of the unsent responses of a connection before it stops handling requests */
+#define MAX_PENDING_OUTPUT (256 << 10)
+
+/** Size of the chunks of the request arenas, max size (in bytes) of an arena, and max number of
+ * idle arenas kept by a worker (see _arena_acquire) */
+#define ARENA_CHUNK_SIZE (16 << 10)
+#define ARENA_MAX_SIZE (1 << 20)
+#define ARENA_MAX_IDLE 64
+
 /**
- * @brief Reads from a socket.
- *
- * @param output Buffer where the read data is copied to.
- * @param bytes Buffer size.
- * @param cb_ctx User defined callback context.
- * @return size_t Bytes read.
+ * Reactor connection states.
+ * Requests can be pipelined: the client doesn't need to wait for a response
+ * before sending the next request, and the responses carry the id of their
+ * request (see message_decl.h).
  */
-static size_t _socket_read(void *output, size_t bytes, void *cb_ctx) {
-  int *fd = cb_ctx;
+typedef enum {
+  /** Handling requests and sending their responses. */
+  conn_state_open,
+  /** No more requests (FRAME_FLAG_CLOSE or the client shut down), closed once the responses are sent. */
+  conn_state_closing,
+  /** Closed by the client (or failed), should be closed. */
+  conn_state_closed,
+} conn_state_t;
 
-  ssize_t bytes_read = 0;
-  do {
-    bytes_read += recv(*fd, ( char * )output + bytes_read, bytes - bytes_read, 0);
-  } while (errno == EINTR);
+/** Reactor client connection */
+typedef struct server_conn {
+  int fd;
+  conn_state_t state;
+  /** Received bytes (not yet parsed). */
+  recv_buffer_t in;
+  /** Serialized responses (not sent yet). */
+  send_buffer_t out;
+  /** Requests being answered asynchronously (the connection is released once they are answered). */
+  size_t calls;
+  /** One of its requests is being handled (then an asynchronous response is only written). */
+  bool handling;
+  /** Closed by an asynchronous response, it's released after the round of events. */
+  bool finished;
+  struct server_conn *next_finished;
+  /** Answered by a round of upstream responses, its output is sent once the round is done. */
+  bool corked;
+  struct server_conn *next_corked;
+  /** Connections in flight (owned by the worker). */
+  struct server_conn *prev;
+  struct server_conn *next;
+} conn_t;
+
+/** Worker: a listening socket and the event loop serving it */
+typedef struct server_worker {
+  server_t *server;
+  /** Own listening socket (SO_REUSEPORT when there's more than one worker). */
+  int fd;
+  int epoll_fd;
+  /** eventfd written by server_stop to finish the worker's loop. */
+  int wakeup_fd;
+  bool stopped;
+  /** Connections in flight, and those closed by asynchronous responses (see _reactor_handle_events). */
+  conn_t *conns;
+  conn_t *finished;
+  /** The upstream responses are being processed, and the connections they answered (see _conns_uncork). */
+  bool corking;
+  conn_t *corked;
+  /** State set up by the caller and its watched fd (see server_local_t). */
+  void *local;
+  int local_fd;
+  /** Arenas of the requests being handled are taken from here, and return once they are answered. */
+  arena_t *idle_arenas[ARENA_MAX_IDLE];
+  size_t num_idle_arenas;
+  pthread_t thread;
+} worker_t;
+
+/** Request answered asynchronously (allocated from its arena) */
+struct server_call {
+  worker_t *worker;
+  conn_t *conn;
+  arena_t *arena;
+  /** Frame header of the request (the response goes in its format, with its close flag). */
+  frame_header_t header;
+  message_id_t id;
+};
 
-  /* must have read the exact number of bytes requested*/
-  return bytes_read;
+/** Tags that identify the non-connection fds in the epoll set (see epoll_event.data.ptr) */
+static char _listener_tag;
+static char _wakeup_tag;
+static char _local_tag;
+
+/**
+ * @brief Appends a (framed) response to the connection output buffer.
+ * The response is serialized in the same format as the request.
+ *
+ * @param conn Client connection.
+ * @param header Request frame header (its close flag is also set in the response).
+ * @param resp Response (carrying the id of its request).
+ * @return false on error (nothing is appended), true on success.
+ */
+static bool _conn_write(conn_t *conn, const frame_header_t *header, const response_t *resp) {
+  /* serializes the response after room for its header */
+  size_t start = conn->out.end;
+  char header_data[FRAME_HEADER_SIZE] = {0};
+  if (send_buffer_write(header_data, sizeof(header_data), &conn->out) &&
+      response_serialize_as(resp, header->format, send_buffer_write, &conn->out)) {
+    frame_header_t resp_header = *header;
+    resp_header.payload_length = conn->out.end - start - FRAME_HEADER_SIZE;
+    if (frame_header_write(conn->out.data + start, &resp_header))
+      return true;
+  }
+
+  perror("Failed serializing the response");
+  conn->out.end = start;
+  return false;
 }
 
 /**
- * @brief Response serialization callback that outputs through a socket.
+ * @brief Appends an already serialized (framed) response to the connection
+ * output buffer, if the encoded handler has it.
  *
- * @param data Data to write.
- * @param bytes Numer of bytes to write.
- * @param cb_ctx Client connection.
- * @return false on error, true on success.
+ * @param s The server.
+ * @param conn Client connection.
+ * @param header Request frame header (its close flag is also set in the response).
+ * @param req Request.
+ * @return false if there's no serialized response (nothing is appended), true otherwise.
  */
-static bool _socket_write(const void *data, size_t bytes, void *cb_ctx) {
-  int *fd = cb_ctx;
+static bool _conn_write_encoded(server_t *s, conn_t *conn, const frame_header_t *header,
+                                const request_t *req) {
+  size_t start = conn->out.end;
+  char header_data[FRAME_HEADER_SIZE] = {0};
+  if (send_buffer_write(header_data, sizeof(header_data), &conn->out) &&
+      s->encoded_handler(req, header->format, req->id, send_buffer_write, &conn->out, s)) {
+    frame_header_t resp_header = *header;
+    resp_header.payload_length = conn->out.end - start - FRAME_HEADER_SIZE;
+    if (frame_header_write(conn->out.data + start, &resp_header))
+      return true;
+  }
 
-  ssize_t bytes_sent = 0;
-  do {
-    bytes_sent = send(*fd, data, bytes, MSG_NOSIGNAL);
-  } while (errno == EINTR);
+  conn->out.end = start;
+  return false;
+}
 
-  /* must have sent the all the data */
-  return (bytes_sent == bytes);
+/**
+ * @brief Takes an empty arena for a request.
+ *
+ * @param w The worker.
+ * @return The arena or NULL on error.
+ */
+static arena_t *_arena_acquire(worker_t *w) {
+  if (w->num_idle_arenas > 0)
+    return w->idle_arenas[--w->num_idle_arenas];
+
+  return arena_create(ARENA_CHUNK_SIZE, ARENA_MAX_SIZE);
 }
 
 /**
- * @brief Handles a client connection.
+ * @brief Releases the arena of an answered request (in O(1), its chunks are
+ * kept for the next requests, unless there are enough idle arenas).
  *
- * @param s The server.
- * @param client_fd The file descriptor of the connected client.
- * @return false The server should stop receiving requests, true to continue.
+ * @param w The worker.
+ * @param arena The arena.
  */
-static bool _on_request(server_t *s, int client_fd) {
+static void _arena_release(worker_t *w, arena_t *arena) {
+  if (w->num_idle_arenas == ARENA_MAX_IDLE) {
+    arena_destroy(arena);
+    return;
+  }
 
-  /* creates a new process to handle the request */
+  arena_reset(arena);
+  w->idle_arenas[w->num_idle_arenas++] = arena;
+}
+
+/**
+ * @brief Deserializes a request and answers it (see _conn_respond).
+ *
+ * @param w The worker.
+ * @param conn Client connection.
+ * @param header Request frame header (its close flag is also set in the response).
+ * @param payload Serialized request.
+ * @param arena Arena of the request.
+ * @param kept Set if an asynchronous call took the arena (it's released once the call is answered).
+ * @return false on error, true on success.
+ */
+static bool _conn_handle(worker_t *w, conn_t *conn, const frame_header_t *header, const char *payload,
+                         arena_t *arena, bool *kept) {
+  server_t *s = w->server;
 
   /* deserializes the request */
   request_t req = {0};
-  if (!request_deserialize(&req, _socket_read, &client_fd))
+  mem_reader_t reader = {.data = payload, .length = header->payload_length};
+  if (!request_deserialize_as(&req, header->format, mem_reader_read, &reader))
     return false;
 
-  /* calls the handler */
+  if (s->encoded_handler != NULL && _conn_write_encoded(s, conn, header, &req))
+    return true;
+
+  /* the response is written whenever it's ready (see server_call_respond) */
+  server_call_t *call = NULL;
+  if (s->async_handler != NULL && s->mode == server_mode_reactor &&
+      (call = arena_alloc(arena, sizeof(*call))) != NULL) {
+    *call = (server_call_t){.worker = w, .conn = conn, .arena = arena, .header = *header, .id = req.id};
+    *kept = true;
+    conn->calls++;
+    conn->handling = true;
+    s->async_handler(call, &req, s);
+    conn->handling = false;
+    return (conn->state != conn_state_closed);
+  }
+
+  /* calls the handler (the response carries the id of its request) */
   response_t resp = {0};
   s->handler(&resp, &req, s);
+  resp.id = req.id;
+  return _conn_write(conn, header, &resp);
+}
+
+/**
+ * @brief Deserializes a request and answers it: with the response the encoded
+ * handler already has, through the asynchronous handler (reactor mode), or
+ * else with the response filled by the request handler.
+ * The request has an arena, for its long strings (see str_set_arena) and
+ * whatever its handlers allocate (see server_call_alloc), released at once
+ * when its response is written.
+ *
+ * @param w The worker.
+ * @param conn Client connection.
+ * @param header Request frame header (its close flag is also set in the response).
+ * @param payload Serialized request.
+ * @return false on error, true on success.
+ */
+static bool _conn_respond(worker_t *w, conn_t *conn, const frame_header_t *header, const char *payload) {
+  arena_t *arena = _arena_acquire(w);
+  if (arena == NULL)
+    return false;
+
+  bool kept = false;
+  arena_t *previous = str_set_arena(arena);
+  bool success = _conn_handle(w, conn, header, payload, arena, &kept);
+  str_set_arena(previous);
+  if (!kept)
+    _arena_release(w, arena);
+  return success;
+}
+
+/**
+ * @brief Sets a file descriptor as non-blocking.
+ *
+ * @param fd File descriptor.
+ * @return false on error, true on success.
+ */
+static bool _set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0)
+    return false;
+
+  return (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0);
+}
+
+/**
+ * @brief Closes a reactor connection and releases its resources.
+ *
+ * @param w The worker owning the connection.
+ * @param conn Connection to close.
+ */
+static void _conn_close(worker_t *w, conn_t *conn) {
+  /* unlinks the connection */
+  if (conn->prev)
+    conn->prev->next = conn->next;
+  else
+    w->conns = conn->next;
+  if (conn->next)
+    conn->next->prev = conn->prev;
+
+  /* closing the fd also removes it from the epoll set */
+  close(conn->fd);
+  recv_buffer_free(&conn->in);
+  send_buffer_free(&conn->out);
+  free(conn);
+}
+
+/**
+ * @brief Handles a client connection (iterative mode: one request per connection).
+ *
+ * @param s The server.
+ * @param client_fd The file descriptor of the connected client.
+ * @return false on error, true on success.
+ */
+static bool _on_request(server_t *s, int client_fd) {
+  conn_t conn = {.fd = client_fd};
+
+  /* reads the header (usually along with the whole request), and then the rest of the request */
+  size_t length;
+  frame_header_t header;
+  bool success = recv_buffer_fill_to(&conn.in, client_fd, FRAME_HEADER_SIZE) &&
+                 frame_header_read(&header, recv_buffer_peek(&conn.in, &length), FRAME_HEADER_SIZE) &&
+                 header.payload_length <= MAX_REQUEST_SIZE &&
+                 recv_buffer_fill_to(&conn.in, client_fd, frame_length(&header));
+
+  /* a single exchange per connection */
+  header.close = true;
+  success = success && _conn_respond(&s->workers[0], &conn, &header,
+                                     recv_buffer_peek(&conn.in, &length) + FRAME_HEADER_SIZE);
 
   /* sends the response */
-  if (!response_serialize(&resp, _socket_write, &client_fd)) {
+  if (success && !send_buffer_flush(&conn.out, client_fd)) {
     perror("Failed sending the response");
+    success = false;
+  }
+
+  recv_buffer_free(&conn.in);
+  send_buffer_free(&conn.out);
+  return success;
+}
+
+/**
+ * @brief Handles every complete request buffered in a reactor connection
+ * (pipelining), appending their responses to the output buffer.
+ * The requests are parsed in place, and consumed once they are handled.
+ *
+ * @param w The worker.
+ * @param conn Client connection.
+ * @return true if it stopped because there were too many unsent responses
+ * (there may be more requests to handle), false otherwise.
+ */
+static bool _conn_on_data(worker_t *w, conn_t *conn) {
+  while (conn->state == conn_state_open) {
+    if (send_buffer_pending(&conn->out) >= MAX_PENDING_OUTPUT)
+      return true;
+
+    size_t length;
+    const char *data = recv_buffer_peek(&conn->in, &length);
+
+    frame_header_t header;
+    if (!frame_header_read(&header, data, length))
+      return false;
+
+    if (header.payload_length > MAX_REQUEST_SIZE) {
+      conn->state = conn_state_closed;
+      return false;
+    }
+
+    if (length < frame_length(&header)) {
+      /* makes room for the whole request at once */
+      if (!recv_buffer_reserve(&conn->in, frame_length(&header)))
+        conn->state = conn_state_closed;
+      return false;
+    }
+
+    if (!_conn_respond(w, conn, &header, data + FRAME_HEADER_SIZE)) {
+      conn->state = conn_state_closed;
+      return false;
+    }
+
+    /* the last request of the connection */
+    if (header.close)
+      conn->state = conn_state_closing;
+
+    recv_buffer_consume(&conn->in, frame_length(&header));
   }
 
-  /* it's a child process, so it should stop the server */
   return false;
 }
 
 /**
- * @brief Initializes the server.
+ * @brief Receives the data available in a reactor connection (as much as
+ * fits in the buffer).
  *
- * @param s Server to initialize.
- * @param port Port where the server waits for connections.
- * @param handler Request handler.
- * @return false in case of error, true otherwise.
+ * @param conn Client connection.
+ * @return true if some data was received, false if the socket would block
+ * or the connection is no longer open.
  */
-bool server_init(server_t *s, uint16_t port, req_handler_t handler) {
-  s->fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (s->fd < 0) {
-    perror("socket");
+static bool _conn_recv(conn_t *conn) {
+  ssize_t bytes = recv_buffer_fill(&conn->in, conn->fd);
+  if (bytes > 0)
+    return true;
+
+  if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    return false;
+
+  if (bytes < 0) {
+    conn->state = conn_state_closed;
     return false;
   }
 
-  memset(&s->serv_addr, 0, sizeof(s->serv_addr));
-  s->serv_addr.sin_family = AF_INET;
-  s->serv_addr.sin_port = htons(port);
-  s->serv_addr.sin_addr.s_addr = INADDR_ANY;
+  /* the client won't send more requests, but it may still read the responses */
+  conn->state = (send_buffer_pending(&conn->out) || conn->calls) ? conn_state_closing : conn_state_closed;
+  return false;
+}
+
+/**
+ * @brief Sends as much of the pending responses as the socket accepts.
+ *
+ * @param conn Client connection.
+ * @return true if everything was sent and the connection is still open,
+ * false otherwise.
+ */
+static bool _conn_flush(conn_t *conn) {
+  if (conn->state == conn_state_closed)
+    return false;
+
+  if (!send_buffer_flush(&conn->out, conn->fd)) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      conn->state = conn_state_closed;
+    return false;
+  }
+
+  /* everything was sent, keeps the connection alive for the next requests (or the asynchronous responses) */
+  if (conn->state == conn_state_closing && conn->calls == 0)
+    conn->state = conn_state_closed;
+
+  return (conn->state == conn_state_open);
+}
+
+/**
+ * @brief Advances a connection's state machine as far as the socket allows
+ * (until it would block or the connection is closed).
+ * Since it's edge-triggered, it stops only when a read or a write would block
+ * (and the next epoll event resumes it).
+ *
+ * @param w The worker.
+ * @param conn Client connection.
+ */
+static void _conn_process(worker_t *w, conn_t *conn) {
+  while (true) {
+    /* handles every request received so far, and sends all the responses at once */
+    bool more = _conn_on_data(w, conn);
+    if (!_conn_flush(conn))
+      return;
+
+    /* there are requests that were waiting for the responses to be sent */
+    if (more)
+      continue;
+
+    if (!_conn_recv(conn) && conn->state != conn_state_closing)
+      return;
+  }
+}
+
+/**
+ * @brief Resumes a connection once an asynchronous response was written: sends
+ * it (and handles the requests that were waiting for it).
+ *
+ * @param w The worker.
+ * @param conn Client connection.
+ */
+static void _conn_resume(worker_t *w, conn_t *conn) {
+  _conn_process(w, conn);
+  if (conn->state == conn_state_closed && conn->calls == 0 && !conn->finished) {
+    conn->finished = true;
+    conn->next_finished = w->finished;
+    w->finished = conn;
+  }
+}
+
+/**
+ * @brief Sends the responses written by a round of upstream responses: each
+ * connection they answered is flushed once, with all of its responses.
+ *
+ * @param w The worker.
+ */
+static void _conns_uncork(worker_t *w) {
+  while (w->corked) {
+    conn_t *conn = w->corked;
+    w->corked = conn->next_corked;
+    conn->corked = false;
+    send_buffer_uncork(&conn->out);
+    _conn_resume(w, conn);
+  }
+}
+
+/**
+ * @brief Accepts every pending connection and registers it in the epoll set.
+ *
+ * @param w The worker.
+ * @return false on error, true otherwise.
+ */
+static bool _reactor_accept(worker_t *w) {
+  while (true) {
+    int client = accept4(w->fd, NULL, NULL, SOCK_NONBLOCK);
+    if (client < 0 && errno == EINTR)
+      continue;
+
+    if (client < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return true;
+
+    if (client < 0 && (errno == ECONNABORTED || errno == EMFILE || errno == ENFILE)) {
+      /* transient, the server keeps serving the connections already accepted */
+      perror("accept");
+      return true;
+    }
+
+    if (client < 0) {
+      perror("accept");
+      return false;
+    }
+
+    conn_t *conn = calloc(1, sizeof(conn_t));
+    if (conn == NULL) {
+      close(client);
+      continue;
+    }
+
+    /* responses are sent in a single write, so Nagle would only delay them (keep-alive) */
+    int on = 1;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    conn->fd = client;
+    conn->state = conn_state_open;
+
+    /* registered for both directions once, edge-triggered */
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = conn};
+    if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, client, &ev) < 0) {
+      perror("epoll_ctl");
+      close(client);
+      free(conn);
+      continue;
+    }
+
+    /* links the connection */
+    conn->next = w->conns;
+    if (w->conns)
+      w->conns->prev = conn;
+    w->conns = conn;
+  }
+}
+
+/**
+ * @brief Handles one round of events of a worker's reactor.
+ *
+ * @param w The worker.
+ * @return false on error, true otherwise.
+ */
+static bool _reactor_handle_events(worker_t *w) {
+  struct epoll_event events[MAX_EVENTS];
+
+  int n = epoll_wait(w->epoll_fd, events, MAX_EVENTS, -1);
+  if (n < 0 && errno == EINTR) {
+    return true;
+  }
+
+  if (n < 0) {
+    perror("epoll_wait");
+    return false;
+  }
+
+  for (int i = 0; i < n; i++) {
+    if (events[i].data.ptr == &_wakeup_tag) {
+      /* server_stop was called */
+      w->stopped = true;
+      continue;
+    }
+
+    if (events[i].data.ptr == &_listener_tag) {
+      if (!_reactor_accept(w))
+        return false;
+      continue;
+    }
+
+    if (events[i].data.ptr == &_local_tag) {
+      /* e.g. upstream responses, that answer asynchronous requests (sent once they are all written) */
+      w->corking = true;
+      w->server->local.process(w->local);
+      w->corking = false;
+      _conns_uncork(w);
+      continue;
+    }
+
+    conn_t *conn = events[i].data.ptr;
+    _conn_process(w, conn);
+
+    /* kept until its asynchronous responses are answered (or released below) */
+    if (conn->state == conn_state_closed && conn->calls == 0 && !conn->finished)
+      _conn_close(w, conn);
+  }
+
+  /* closed by asynchronous responses (released last, the events above may refer to them) */
+  while (w->finished) {
+    conn_t *conn = w->finished;
+    w->finished = conn->next_finished;
+    _conn_close(w, conn);
+  }
+
+  return true;
+}
+
+/**
+ * @brief Worker thread: runs the worker's event loop until server_stop is called.
+ *
+ * @param arg The worker.
+ * @return NULL.
+ */
+static void *_worker_loop(void *arg) {
+  worker_t *w = arg;
+
+  while (!w->stopped) {
+    if (!_reactor_handle_events(w)) {
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief Creates a bound, listening socket.
+ *
+ * @param addr Address to bind.
+ * @param reuse_port true to share the port with the other workers (SO_REUSEPORT).
+ * @return The socket fd or -1 on error.
+ */
+static int _listen_socket(const struct sockaddr_in *addr, bool reuse_port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    return -1;
+  }
+
+  /* every worker binds its own socket so the kernel spreads the connections among them */
+  int on = 1;
+  if (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+    perror("setsockopt");
+    close(fd);
+    return -1;
+  }
 
   /* binds the socket */
-  int bindOk = bind(s->fd, ( struct sockaddr * )&(s->serv_addr), sizeof(s->serv_addr));
+  int bindOk = bind(fd, ( const struct sockaddr * )addr, sizeof(*addr));
   if (bindOk < 0) {
     perror("bind");
-    close(s->fd);
-    return false;
+    close(fd);
+    return -1;
   }
 
   /* marks the socket as passive */
-  int listenOk = listen(s->fd, MAX_PENDING_CONN);
+  int listenOk = listen(fd, MAX_PENDING_CONN);
   if (listenOk < 0) {
     perror("listen");
-    close(s->fd);
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/**
+ * @brief Releases the resources of a worker (its thread must not be running).
+ *
+ * @param w The worker.
+ */
+static void _worker_destroy(worker_t *w) {
+  /* the state goes first: it may answer its calls, whose connections must be there */
+  w->stopped = true;
+  if (w->local != NULL)
+    w->server->local.destroy(w->local);
+
+  /* drops the connections still in flight */
+  while (w->conns) {
+    _conn_close(w, w->conns);
+  }
+
+  if (w->wakeup_fd >= 0)
+    close(w->wakeup_fd);
+
+  if (w->epoll_fd >= 0)
+    close(w->epoll_fd);
+
+  while (w->num_idle_arenas > 0)
+    arena_destroy(w->idle_arenas[--w->num_idle_arenas]);
+
+  close(w->fd);
+}
+
+/**
+ * @brief Initializes a worker: its listening socket and, in reactor mode, its epoll set.
+ *
+ * @param s The server.
+ * @param w Worker to initialize.
+ * @param reuse_port true if the port is shared with other workers.
+ * @return false on error, true on success.
+ */
+static bool _worker_init(server_t *s, worker_t *w, bool reuse_port) {
+  w->server = s;
+  w->epoll_fd = -1;
+  w->wakeup_fd = -1;
+  w->stopped = false;
+  w->conns = NULL;
+  w->finished = NULL;
+  w->local = NULL;
+  w->local_fd = -1;
+  w->num_idle_arenas = 0;
+
+  w->fd = _listen_socket(&s->serv_addr, reuse_port);
+  if (w->fd < 0) {
+    return false;
+  }
+
+  if (s->mode != server_mode_reactor) {
+    return true;
+  }
+
+  if (!_set_nonblocking(w->fd)) {
+    perror("fcntl");
+    _worker_destroy(w);
+    return false;
+  }
+
+  w->epoll_fd = epoll_create1(0);
+  w->wakeup_fd = eventfd(0, EFD_NONBLOCK);
+  if (w->epoll_fd < 0 || w->wakeup_fd < 0) {
+    perror("epoll_create1/eventfd");
+    _worker_destroy(w);
+    return false;
+  }
+
+  /* the listening socket and the wakeup fd are identified by their tags */
+  struct epoll_event listener = {.events = EPOLLIN | EPOLLET, .data.ptr = &_listener_tag};
+  struct epoll_event wakeup = {.events = EPOLLIN | EPOLLET, .data.ptr = &_wakeup_tag};
+  if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->fd, &listener) < 0 ||
+      epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->wakeup_fd, &wakeup) < 0) {
+    perror("epoll_ctl");
+    _worker_destroy(w);
     return false;
   }
 
+  /* level-triggered: processed as long as the state has events */
+  if (s->local.create != NULL) {
+    struct epoll_event local = {.events = EPOLLIN, .data.ptr = &_local_tag};
+    w->local = s->local.create(&w->local_fd);
+    if (w->local == NULL || epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->local_fd, &local) < 0) {
+      perror("Failed setting up the worker");
+      _worker_destroy(w);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * @brief Stops the threads of the workers [1, count) and releases every worker in [0, count).
+ *
+ * @param s The server.
+ * @param count Number of initialized workers.
+ * @param running Number of workers whose thread was started (counting worker 0, that has none).
+ */
+static void _workers_stop(server_t *s, size_t count, size_t running) {
+  /* wakes up the loops, they finish after handling the current events */
+  for (size_t i = 1; i < running; i++) {
+    uint64_t one = 1;
+    if (write(s->workers[i].wakeup_fd, &one, sizeof(one)) < 0) {
+      perror("write");
+    }
+  }
+
+  for (size_t i = 1; i < running; i++) {
+    pthread_join(s->workers[i].thread, NULL);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    _worker_destroy(&s->workers[i]);
+  }
+
+  free(s->workers);
+  s->workers = NULL;
+  s->num_workers = 0;
+}
+
+/**
+ * @brief Initializes the server.
+ * Worker 0 is served by the thread calling server_handle_request, the other
+ * workers run their own event loop in a new thread.
+ *
+ * @param s Server to initialize.
+ * @param port Port where the server waits for connections.
+ * @param handler Request handler.
+ * @param mode How the server handles the connections (see server_mode_t).
+ * @param workers Number of workers (reactor mode only, the iterative mode always
+ *                uses 1). SERVER_WORKERS_AUTO starts one per online CPU.
+ * @return false in case of error, true otherwise.
+ */
+bool server_init(server_t *s, uint16_t port, req_handler_t handler, server_mode_t mode, size_t workers) {
+  memset(&s->serv_addr, 0, sizeof(s->serv_addr));
+  s->serv_addr.sin_family = AF_INET;
+  s->serv_addr.sin_port = htons(port);
+  s->serv_addr.sin_addr.s_addr = INADDR_ANY;
+
   s->handler = handler;
+  s->mode = mode;
+
+  if (mode != server_mode_reactor) {
+    workers = 1;
+  } else if (workers == SERVER_WORKERS_AUTO) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    workers = (cpus > 0) ? cpus : 1;
+  }
+
+  s->workers = calloc(workers, sizeof(worker_t));
+  if (s->workers == NULL) {
+    perror("calloc");
+    return false;
+  }
+
+  s->num_workers = workers;
+  for (size_t i = 0; i < workers; i++) {
+    if (!_worker_init(s, &s->workers[i], workers > 1)) {
+      _workers_stop(s, i, 0);
+      return false;
+    }
+  }
+
+  /* the signals are handled by the caller's thread (e.g. SIGINT interrupting server_handle_request) */
+  sigset_t all, previous;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &previous);
+
+  size_t running = 1;
+  for (; running < workers; running++) {
+    if (pthread_create(&s->workers[running].thread, NULL, _worker_loop, &s->workers[running]) != 0) {
+      break;
+    }
+  }
+
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+  if (running < workers) {
+    perror("pthread_create");
+    _workers_stop(s, workers, running);
+    return false;
+  }
 
   return true;
 }
 
 /**
  * @brief Waits for a client to connect and handles the request.
+ * In reactor mode, handles one round of events of the first worker instead (new
+ * connections, incoming requests and pending responses of every connection in flight).
  *
  * @return false on error, true otherwise.
  */
 bool server_handle_request(server_t *s) {
+  worker_t *w = &s->workers[0];
+  if (s->mode == server_mode_reactor) {
+    return _reactor_handle_events(w);
+  }
+
   size_t addr_size = sizeof(s->cli_addr);
 
   /* waits for a client to connect */
-  int client = accept(s->fd, ( struct sockaddr * )&s->cli_addr, ( socklen_t * )&addr_size);
+  int client = accept(w->fd, ( struct sockaddr * )&s->cli_addr, ( socklen_t * )&addr_size);
   if (client < 0 && errno == EINTR) {
     return true;
   }
@@ -157,5 +900,77 @@ void server_stop(server_t *s) {
     wait(&status);
   } while (errno != ECHILD);
 
-  close(s->fd);
+  /* stops the worker threads and closes every socket */
+  _workers_stop(s, s->num_workers, s->num_workers);
+}
+
+/**
+ * @brief Gets the state of the worker handling an asynchronous request (see server_local_t).
+ *
+ * @param call The request.
+ * @return The state (NULL if the server has none).
+ */
+void *server_call_local(const server_call_t *call) {
+  return call->worker->local;
+}
+
+/**
+ * @brief Allocates memory for an asynchronous request (e.g. the state of its
+ * handler) from its arena, valid until it's answered.
+ *
+ * @param call The request.
+ * @param size Bytes to allocate.
+ * @return The memory or NULL on error.
+ */
+void *server_call_alloc(server_call_t *call, size_t size) {
+  return arena_alloc(call->arena, size);
+}
+
+/**
+ * @brief Gets the arena of an asynchronous request (see server_call_alloc),
+ * e.g. where the responses it waits for are kept.
+ *
+ * @param call The request.
+ * @return The arena.
+ */
+arena_t *server_call_arena(const server_call_t *call) {
+  return call->arena;
+}
+
+/**
+ * @brief Answers an asynchronous request (see async_handler_t), releasing it
+ * along with its arena (the response may be in it).
+ * The response is sent along with the other responses of its connection,
+ * unless the connection was closed meanwhile.
+ *
+ * @param call The request.
+ * @param resp Its response (its id is set to the one of the request).
+ */
+void server_call_respond(server_call_t *call, response_t *resp) {
+  worker_t *w = call->worker;
+  conn_t *conn = call->conn;
+
+  resp->id = call->id;
+  if (conn->state != conn_state_closed && !w->stopped && !_conn_write(conn, &call->header, resp))
+    conn->state = conn_state_closed;
+
+  conn->calls--;
+  _arena_release(w, call->arena);
+
+  /* answered by the handler, the connection is being processed already */
+  if (conn->handling || w->stopped)
+    return;
+
+  /* answered by a round of upstream responses, it's sent along with the others of the round */
+  if (w->corking) {
+    if (!conn->corked) {
+      conn->corked = true;
+      send_buffer_cork(&conn->out);
+      conn->next_corked = w->corked;
+      w->corked = conn;
+    }
+    return;
+  }
+
+  _conn_resume(w, conn);
 }
@@ -12,11 +12,28 @@
 #define MAX_PENDING_CONN 100
 #define SELF_PORT 8002
 
+/** Worker count that starts one worker per online CPU (see server_init) */
+#define SERVER_WORKERS_AUTO 0
+
 typedef struct server server_t;
+
+/** Server execution modes */
+typedef enum {
+  /** Blocks in accept and serves one connection at a time. */
+  server_mode_iterative,
+  /** Non-blocking, edge-triggered epoll event loop (many connections in flight). */
+  server_mode_reactor,
+} server_mode_t;
+
+/** Event loop run by each worker (only used by the reactor mode, see server.c). */
+struct server_worker;
+
 /**
  * Server request handler
- * This callback is executed *in an independent process* whenever a
- * client sends a request to the server.
+ * This callback is executed whenever a client sends a request to the server.
+ * In reactor mode with more than one worker it's called *concurrently* from
+ * every worker thread (with the same server), so any state shared through
+ * serv->context must be synchronized by the handler.
  *
  * req contains the (parsed) client's request.
  * resp is to be filled by inside the callback with the corresponding data
@@ -25,22 +42,77 @@ typedef struct server server_t;
  */
 typedef void (*req_handler_t)(response_t *resp, const request_t *req, const struct server *serv);
 
+/**
+ * Server encoded response handler (optional)
+ * It's tried before the request handler, and it writes a response that is
+ * already serialized (e.g. cached bytes), so it's sent without serializing it.
+ *
+ * req contains the (parsed) client's request.
+ * format is the serialization format of the response (the one of the request).
+ * id is the correlation id of the response.
+ * out/out_ctx output the serialized response.
+ * Returns false if it doesn't have the response (then the request handler
+ * answers it, and anything written is discarded).
+ */
+typedef bool (*encoded_handler_t)(const request_t *req, message_format_t format, message_id_t id,
+                                  write_cb_t out, void *out_ctx, const struct server *serv);
+
+/** Request answered asynchronously (see async_handler_t) */
+typedef struct server_call server_call_t;
+
+/**
+ * Server asynchronous request handler (optional, reactor mode only)
+ * It replaces the request handler: it takes the request and answers it with
+ * server_call_respond, exactly once, either before returning or later (e.g.
+ * once a microservice answers), from the thread of the same worker. Meanwhile
+ * the worker keeps serving the other requests (those of the same connection
+ * too, whose responses may go first: they carry the id of their request).
+ * A copy of the request is valid until it's answered (its long strings are
+ * in the arena of the call, see server_call_alloc).
+ */
+typedef void (*async_handler_t)(server_call_t *call, const request_t *req, const struct server *serv);
+
+/**
+ * State of each worker set up by the caller (optional, reactor mode only),
+ * e.g. the upstream connections used by its asynchronous handler: its fd is
+ * watched by the worker's event loop, which processes the state when the fd
+ * gets readable (the state is only used from the thread of its worker).
+ */
+typedef struct {
+  /** Creates the state of a worker, setting the fd to watch (output), NULL on error. */
+  void *(*create)(int *fd);
+  /** Processes the events of the state (it doesn't block). */
+  void (*process)(void *local);
+  /** Releases the state (once its worker stopped). */
+  void (*destroy)(void *local);
+} server_local_t;
+
 /** Server type */
 struct server {
-  int fd;
   struct sockaddr_in serv_addr;
   struct sockaddr_in cli_addr;
   req_handler_t handler;
+  encoded_handler_t encoded_handler; // Optional (NULL if unused), set before server_init.
+  async_handler_t async_handler;     // Same as encoded_handler.
+  server_local_t local;              // Same as encoded_handler (see server_call_local).
   request_type_t type; // Used in microservices. Ignored in middleware.
   void *context;       // Optional. Aids microservices to hold state.
+  server_mode_t mode;
+  size_t num_workers;
+  struct server_worker *workers; // workers[0] runs in the thread calling server_handle_request.
 };
 
 /*-------------------------------------------------------------------------
   Server
 -------------------------------------------------------------------------*/
 
-bool server_init(server_t *s, uint16_t port, req_handler_t handler);
+bool server_init(server_t *s, uint16_t port, req_handler_t handler, server_mode_t mode, size_t workers);
 bool server_handle_request(server_t *s);
 void server_stop(server_t *s);
 
+void *server_call_local(const server_call_t *call);
+void *server_call_alloc(server_call_t *call, size_t size);
+arena_t *server_call_arena(const server_call_t *call);
+void server_call_respond(server_call_t *call, response_t *resp);
+
 #endif
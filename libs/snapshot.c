@@ -0,0 +1,535 @@
+/* include area */
+#define _GNU_SOURCE
+#include "snapshot.h"
+#include "intern.h"
+#include "json_alloc.h"
+#include <fcntl.h>
+#include <jansson.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** Size of the chunks of the arenas of the JSON trees */
+#define JSON_ARENA_CHUNK_SIZE (64 << 10)
+
+/** Magic number at the beginning of the snapshots */
+static const char snapshot_magic[4] = {'M', 'S', 'N', 'P'};
+
+/** Entry of the index (one for each record) */
+typedef struct {
+  /** Offset of the key from the beginning of the keys area. */
+  uint64_t key_offset;
+  uint32_t key_length;
+  uint32_t reserved;
+} index_entry_t;
+
+struct snapshot {
+  void *data;
+  size_t size;
+
+  /* sections of the file */
+  const snapshot_header_t *header;
+  const snapshot_field_t *fields;
+  const index_entry_t *index;
+  const float_t *records;
+  const char *keys;
+
+  /* index of each interned key found by a lookup (plus 1, SNAPSHOT_ABSENT if
+   * it's not in the snapshot, 0 if it wasn't looked up yet) */
+  size_t num_ids;
+  uint32_t *by_id;
+};
+
+/** A key looked up by its ID that isn't in the snapshot */
+#define SNAPSHOT_ABSENT UINT32_MAX
+
+/** Record to be saved */
+typedef struct {
+  const char *key;
+  size_t length;
+  const float_t *values;
+} item_t;
+
+/**
+ * @brief Compares 2 keys (by their characters, then by their length).
+ *
+ * @return 0 if they are equal, < 0 if the first key goes first, > 0 otherwise.
+ */
+static int _key_cmp(const char *key1, size_t length1, const char *key2, size_t length2) {
+  int cmp = memcmp(key1, key2, length1 < length2 ? length1 : length2);
+  if (cmp != 0)
+    return cmp;
+
+  return (length1 > length2) - (length1 < length2);
+}
+
+/**
+ * @brief qsort callback that compares 2 items by their keys.
+ */
+static int _item_cmp(const void *a, const void *b) {
+  const item_t *item1 = a;
+  const item_t *item2 = b;
+  return _key_cmp(item1->key, item1->length, item2->key, item2->length);
+}
+
+/**
+ * @brief Syncs the directory of a file (so a rename is durable).
+ *
+ * @param path File.
+ * @return false on error, true on success.
+ */
+static bool _sync_dir(const char *path) {
+  char dir[PATH_MAX];
+  const char *slash = strrchr(path, '/');
+  if (slash == NULL) {
+    strcpy(dir, ".");
+  } else if (slash == path) {
+    strcpy(dir, "/");
+  } else {
+    size_t length = slash - path;
+    if (length >= sizeof(dir))
+      return false;
+    memcpy(dir, path, length);
+    dir[length] = '\0';
+  }
+
+  int fd = open(dir, O_RDONLY | O_DIRECTORY);
+  if (fd < 0)
+    return false;
+
+  bool success = fsync(fd) == 0;
+  close(fd);
+  return success;
+}
+
+/**
+ * @brief Maps a snapshot file (its pages are read lazily, as they are used).
+ *
+ * @param path Snapshot file.
+ * @return The snapshot or NULL on error (errno is ENOENT if the file doesn't exist).
+ */
+snapshot_t *snapshot_open(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || ( size_t )st.st_size < sizeof(snapshot_header_t)) {
+    close(fd);
+    return NULL;
+  }
+
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return NULL;
+
+  const snapshot_header_t *header = data;
+  size_t size = st.st_size;
+  bool valid = memcmp(header->magic, snapshot_magic, sizeof(snapshot_magic)) == 0 &&
+               header->version == SNAPSHOT_VERSION && header->num_values > 0 &&
+               header->num_values <= STORE_MAX_VALUES && header->num_records <= size / sizeof(index_entry_t);
+
+  /* the sections must fill the file exactly */
+  size_t index_offset = sizeof(snapshot_header_t) + header->num_values * sizeof(snapshot_field_t);
+  size_t records_size = header->num_records * (sizeof(index_entry_t) + header->num_values * sizeof(float_t));
+  if (!valid || size < index_offset || size - index_offset < records_size ||
+      size - index_offset - records_size != header->keys_length) {
+    munmap(data, size);
+    return NULL;
+  }
+
+  snapshot_t *snapshot = calloc(1, sizeof(snapshot_t));
+  size_t num_ids = intern_count( );
+  uint32_t *by_id = num_ids ? calloc(num_ids, sizeof(uint32_t)) : NULL;
+  if (snapshot == NULL || (num_ids > 0 && by_id == NULL)) {
+    munmap(data, size);
+    free(snapshot);
+    free(by_id);
+    return NULL;
+  }
+
+  snapshot->data = data;
+  snapshot->size = size;
+  snapshot->header = header;
+  snapshot->fields = ( const snapshot_field_t * )(( const char * )data + sizeof(snapshot_header_t));
+  snapshot->index = ( const index_entry_t * )(( const char * )data + index_offset);
+  snapshot->records = ( const float_t * )(snapshot->index + header->num_records);
+  snapshot->keys = ( const char * )(snapshot->records + header->num_records * header->num_values);
+  snapshot->num_ids = num_ids;
+  snapshot->by_id = by_id;
+  return snapshot;
+}
+
+/**
+ * @brief Returns the header of a snapshot.
+ *
+ * @param snapshot The snapshot.
+ * @return the header.
+ */
+const snapshot_header_t *snapshot_header(const snapshot_t *snapshot) {
+  return snapshot->header;
+}
+
+/**
+ * @brief Returns the fields of the records of a snapshot.
+ *
+ * @param snapshot The snapshot.
+ * @return the fields (num_values of them).
+ */
+const snapshot_field_t *snapshot_fields(const snapshot_t *snapshot) {
+  return snapshot->fields;
+}
+
+/**
+ * @brief Searches the index of a key (binary search).
+ *
+ * @param snapshot The snapshot.
+ * @param key Key.
+ * @return the index of the record plus 1, SNAPSHOT_ABSENT if the key is not in the snapshot.
+ */
+static uint32_t _search(const snapshot_t *snapshot, const string_t *key) {
+  size_t low = 0;
+  size_t high = snapshot->header->num_records;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    const index_entry_t *entry = &snapshot->index[middle];
+    int cmp = _key_cmp(str_to_cstr(key), str_len(key), snapshot->keys + entry->key_offset, entry->key_length);
+    if (cmp == 0)
+      return middle + 1;
+
+    if (cmp < 0)
+      high = middle;
+    else
+      low = middle + 1;
+  }
+
+  return SNAPSHOT_ABSENT;
+}
+
+/**
+ * @brief Looks up the record of a key (binary search over the index, done
+ * once for an interned key: its result is remembered by the ID).
+ *
+ * @param snapshot The snapshot.
+ * @param key Key.
+ * @return The record, or NULL if the key is not in the snapshot.
+ */
+const float_t *snapshot_get(const snapshot_t *snapshot, const string_t *key) {
+  uint32_t id = str_id(key);
+  uint32_t index;
+  if (id != 0 && id <= snapshot->num_ids) {
+    /* the snapshot never changes, so racing lookups store the same index */
+    index = __atomic_load_n(&snapshot->by_id[id - 1], __ATOMIC_RELAXED);
+    if (index == 0) {
+      index = _search(snapshot, key);
+      __atomic_store_n(&snapshot->by_id[id - 1], index, __ATOMIC_RELAXED);
+    }
+  } else {
+    index = _search(snapshot, key);
+  }
+
+  return index == SNAPSHOT_ABSENT ? NULL : snapshot->records + (index - 1) * snapshot->header->num_values;
+}
+
+/**
+ * @brief Gets a record by its index (records are sorted by key), e.g. for iterating the snapshot.
+ *
+ * @param snapshot The snapshot.
+ * @param index Index of the record (less than num_records).
+ * @param key Key characters (output, not NULL terminated).
+ * @param length Key length (output).
+ * @return The record, or NULL if the index is out of range.
+ */
+const float_t *snapshot_at(const snapshot_t *snapshot, size_t index, const char **key, size_t *length) {
+  if (index >= snapshot->header->num_records)
+    return NULL;
+
+  *key = snapshot->keys + snapshot->index[index].key_offset;
+  *length = snapshot->index[index].key_length;
+  return snapshot->records + index * snapshot->header->num_values;
+}
+
+/**
+ * @brief Unmaps a snapshot.
+ *
+ * @param snapshot The snapshot.
+ */
+void snapshot_close(snapshot_t *snapshot) {
+  munmap(snapshot->data, snapshot->size);
+  free(snapshot->by_id);
+  free(snapshot);
+}
+
+/**
+ * @brief Merges the records of a snapshot and the updates of a store, sorted by key.
+ *
+ * @param base Snapshot (NULL if there's none).
+ * @param updates Store (NULL if there's none), its records replace the ones in the snapshot.
+ * @param num_items Number of records (output).
+ * @return The records (to be freed by the caller) or NULL on error.
+ */
+static item_t *_merge(const snapshot_t *base, const store_t *updates, size_t *num_items) {
+  size_t num_base = base ? base->header->num_records : 0;
+  size_t num_updates = updates ? store_size(updates) : 0;
+
+  item_t *sorted = malloc((num_updates + 1) * sizeof(item_t));
+  item_t *merged = malloc((num_base + num_updates + 1) * sizeof(item_t));
+  if (sorted == NULL || merged == NULL) {
+    free(sorted);
+    free(merged);
+    return NULL;
+  }
+
+  /* the base records are already sorted */
+  for (size_t i = 0; i < num_updates; i++)
+    sorted[i].values = store_at(updates, i, &sorted[i].key, &sorted[i].length);
+  qsort(sorted, num_updates, sizeof(item_t), _item_cmp);
+
+  size_t b = 0, u = 0, n = 0;
+  while (b < num_base || u < num_updates) {
+    item_t item;
+    if (b < num_base)
+      item.values = snapshot_at(base, b, &item.key, &item.length);
+
+    int cmp = b == num_base    ? 1
+              : u == num_updates ? -1
+                                 : _key_cmp(item.key, item.length, sorted[u].key, sorted[u].length);
+    if (cmp >= 0) {
+      /* an update replaces the record of the same key */
+      b += cmp == 0;
+      item = sorted[u++];
+    } else {
+      b++;
+    }
+    merged[n++] = item;
+  }
+
+  free(sorted);
+  *num_items = n;
+  return merged;
+}
+
+/**
+ * @brief Saves a snapshot, atomically (the file is replaced only once the new one is on disk).
+ *
+ * @param path Snapshot file.
+ * @param header Header (only num_values and flags are used).
+ * @param fields Fields of the records.
+ * @param base Snapshot whose records are saved (NULL if there's none).
+ * @param updates Store whose records are saved (NULL if there's none), replacing the ones in base.
+ * @return false on error, true on success.
+ */
+bool snapshot_save(const char *path, const snapshot_header_t *header, const snapshot_field_t *fields,
+                   const snapshot_t *base, const store_t *updates) {
+  size_t num_items;
+  item_t *items = _merge(base, updates, &num_items);
+  if (items == NULL)
+    return false;
+
+  snapshot_header_t out = {.version = SNAPSHOT_VERSION,
+                           .num_values = header->num_values,
+                           .flags = header->flags,
+                           .num_records = num_items};
+  memcpy(out.magic, snapshot_magic, sizeof(snapshot_magic));
+  for (size_t i = 0; i < num_items; i++)
+    out.keys_length += items[i].length;
+
+  char tmp[PATH_MAX];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  FILE *file = fopen(tmp, "wb");
+  if (file == NULL) {
+    free(items);
+    return false;
+  }
+
+  /* sections, one after the other */
+  bool success = fwrite(&out, sizeof(out), 1, file) == 1 &&
+                 fwrite(fields, sizeof(snapshot_field_t), out.num_values, file) == out.num_values;
+
+  uint64_t key_offset = 0;
+  for (size_t i = 0; success && i < num_items; i++) {
+    index_entry_t entry = {.key_offset = key_offset, .key_length = items[i].length};
+    success = fwrite(&entry, sizeof(entry), 1, file) == 1;
+    key_offset += items[i].length;
+  }
+
+  for (size_t i = 0; success && i < num_items; i++)
+    success = fwrite(items[i].values, sizeof(float_t), out.num_values, file) == out.num_values;
+
+  for (size_t i = 0; success && i < num_items; i++)
+    success = fwrite(items[i].key, 1, items[i].length, file) == items[i].length;
+
+  success = success && fflush(file) == 0 && fsync(fileno(file)) == 0;
+  success = fclose(file) == 0 && success;
+  free(items);
+
+  success = success && rename(tmp, path) == 0 && _sync_dir(path);
+  if (!success)
+    unlink(tmp);
+  return success;
+}
+
+/**
+ * @brief Converts a JSON file into a snapshot (see snapshot_from_json).
+ *
+ * @param json_path JSON file.
+ * @param path Snapshot file.
+ * @param filter Keys to convert (NULL converts them all).
+ * @param ctx Context of the filter.
+ * @return false on error, true on success.
+ */
+static bool _from_json(const char *json_path, const char *path, snapshot_filter_t filter, void *ctx) {
+  json_error_t json_load_error;
+  json_t *json = json_load_file(json_path, 0, &json_load_error);
+  if (!json_is_object(json)) {
+    json_decref(json);
+    return false;
+  }
+
+  snapshot_header_t header = {.num_values = 1, .flags = SNAPSHOT_FLAG_PLAIN};
+  snapshot_field_t fields[STORE_MAX_VALUES] = {{.type = field_type_float}};
+
+  const char *name;
+  json_t *value;
+  void *first = json_object_iter(json);
+  if (first != NULL && json_is_object(json_object_iter_value(first))) {
+    header.num_values = 0;
+    header.flags = 0;
+    json_object_foreach(json_object_iter_value(first), name, value) {
+      if (header.num_values == STORE_MAX_VALUES || strlen(name) >= SNAPSHOT_FIELD_NAME_SIZE) {
+        json_decref(json);
+        return false;
+      }
+
+      snapshot_field_t *field = &fields[header.num_values++];
+      field->type = json_is_integer(value) ? field_type_integer : field_type_float;
+      strcpy(field->name, name);
+    }
+  }
+
+  /* the long keys go to an arena (see str_set_arena), emptied after each key (the store copies it) */
+  store_t *store = store_create(header.num_values);
+  arena_t *arena = arena_create(STR_MAX_LENGTH + 1, 0);
+  arena_t *previous = str_set_arena(arena);
+  bool success = store != NULL && arena != NULL;
+  json_object_foreach(json, name, value) {
+    if (!success)
+      break;
+    if (filter != NULL && !filter(name, strlen(name), ctx))
+      continue;
+
+    float_t record[STORE_MAX_VALUES];
+    for (size_t i = 0; i < header.num_values; i++) {
+      json_t *number = header.flags & SNAPSHOT_FLAG_PLAIN ? value : json_object_get(value, fields[i].name);
+      success = success && json_is_number(number);
+      record[i] = json_number_value(number);
+    }
+
+    string_t key;
+    success = success && str_init(&key, name) && store_put(store, &key, record);
+    arena_reset(arena);
+  }
+
+  str_set_arena(previous);
+  success = success && snapshot_save(path, &header, fields, NULL, store);
+  if (store != NULL)
+    store_destroy(store);
+  if (arena != NULL)
+    arena_destroy(arena);
+  json_decref(json);
+  return success;
+}
+
+/**
+ * @brief Converts a snapshot into a JSON file (see snapshot_to_json).
+ *
+ * @param path Snapshot file.
+ * @param json_path JSON file.
+ * @return false on error, true on success.
+ */
+static bool _to_json(const char *path, const char *json_path) {
+  snapshot_t *snapshot = snapshot_open(path);
+  if (snapshot == NULL)
+    return false;
+
+  const snapshot_header_t *header = snapshot->header;
+  json_t *json = json_object();
+  for (size_t i = 0; i < header->num_records; i++) {
+    const char *key;
+    size_t length;
+    const float_t *record = snapshot_at(snapshot, i, &key, &length);
+
+    json_t *value;
+    if (header->flags & SNAPSHOT_FLAG_PLAIN) {
+      value = json_real(record[0]);
+    } else {
+      value = json_object();
+      for (size_t f = 0; f < header->num_values; f++) {
+        const snapshot_field_t *field = &snapshot->fields[f];
+        json_object_set_new(value, field->name,
+                            field->type == field_type_integer ? json_integer(( json_int_t )record[f])
+                                                              : json_real(record[f]));
+      }
+    }
+
+    char name[STR_MAX_LENGTH + 1];
+    if (length <= STR_MAX_LENGTH) {
+      memcpy(name, key, length);
+      name[length] = '\0';
+      json_object_set_new(json, name, value);
+    } else {
+      json_decref(value);
+    }
+  }
+
+  bool success = json_dump_file(json, json_path, 0) == 0;
+  json_decref(json);
+  snapshot_close(snapshot);
+  return success;
+}
+
+/**
+ * @brief Converts a JSON file into a snapshot.
+ * The fields of the records (names and types) are taken from the first value.
+ * The JSON tree is allocated from an arena, and released at once (see json_alloc.h).
+ *
+ * @param json_path JSON file.
+ * @param path Snapshot file.
+ * @param filter Keys to convert (NULL converts them all).
+ * @param ctx Context of the filter.
+ * @return false on error, true on success.
+ */
+bool snapshot_from_json(const char *json_path, const char *path, snapshot_filter_t filter, void *ctx) {
+  arena_t *arena = arena_create(JSON_ARENA_CHUNK_SIZE, 0);
+  arena_t *previous = json_alloc_set_arena(arena);
+  bool success = arena != NULL && _from_json(json_path, path, filter, ctx);
+
+  json_alloc_set_arena(previous);
+  if (arena != NULL)
+    arena_destroy(arena);
+  return success;
+}
+
+/**
+ * @brief Converts a snapshot into a JSON file.
+ * The JSON tree is allocated from an arena, and released at once (see json_alloc.h).
+ *
+ * @param path Snapshot file.
+ * @param json_path JSON file.
+ * @return false on error, true on success.
+ */
+bool snapshot_to_json(const char *path, const char *json_path) {
+  arena_t *arena = arena_create(JSON_ARENA_CHUNK_SIZE, 0);
+  arena_t *previous = json_alloc_set_arena(arena);
+  bool success = arena != NULL && _to_json(path, json_path);
+
+  json_alloc_set_arena(previous);
+  if (arena != NULL)
+    arena_destroy(arena);
+  return success;
+}
@@ -0,0 +1,86 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+/**
+ * @brief This module implements the snapshot files of the microservices state.
+ *
+ * A snapshot is a binary file meant to be memory mapped: opening it only maps
+ * it and checks its header, and the pages are read lazily as keys are looked
+ * up. It holds the records of a store sorted by key:
+ *
+ *   header     magic, version, number of values per record, flags, number
+ *              of records and size of the keys area (snapshot_header_t)
+ *   fields     name and type of each value (snapshot_field_t)
+ *   index      key offset and length of each record, sorted by key
+ *   records    the values of each record, in the same order (floats)
+ *   keys       the characters of the keys, one after the other
+ *
+ * Integers are in the host byte order (a snapshot from a host with a
+ * different byte order is rejected, since its version doesn't match).
+ *
+ * Snapshots are converted from/to the JSON files of the microservices (an
+ * object keyed by city/currency, whose values are either plain numbers or
+ * objects with the same fields).
+ */
+
+/* include area */
+#include "store.h"
+#include "str.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Current version of the format */
+#define SNAPSHOT_VERSION 1
+
+/** Max length of a field name (including the NULL terminator) */
+#define SNAPSHOT_FIELD_NAME_SIZE 31
+
+/** The records are plain numbers (num_values is 1, and the field has no name) */
+#define SNAPSHOT_FLAG_PLAIN 0x1
+
+/** Header of a snapshot */
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t num_values;
+  uint32_t flags;
+  uint64_t num_records;
+  uint64_t keys_length;
+} snapshot_header_t;
+
+/** Value of the records */
+typedef struct {
+  /** A field_type_t (integers are kept as floats, the type is used when converting to JSON). */
+  uint8_t type;
+  char name[SNAPSHOT_FIELD_NAME_SIZE];
+} snapshot_field_t;
+
+/** Memory mapped snapshot (see snapshot.c) */
+typedef struct snapshot snapshot_t;
+
+/** Selects the keys converted from a JSON file (e.g. the slice of an instance) */
+typedef bool (*snapshot_filter_t)(const char *key, size_t length, void *ctx);
+
+/*--------------------------------------------------------------------------
+   Prototypes
+--------------------------------------------------------------------------*/
+
+/* reading */
+snapshot_t *snapshot_open(const char *path);
+const snapshot_header_t *snapshot_header(const snapshot_t *snapshot);
+const snapshot_field_t *snapshot_fields(const snapshot_t *snapshot);
+const float_t *snapshot_get(const snapshot_t *snapshot, const string_t *key);
+const float_t *snapshot_at(const snapshot_t *snapshot, size_t index, const char **key, size_t *length);
+void snapshot_close(snapshot_t *snapshot);
+
+/* writing */
+bool snapshot_save(const char *path, const snapshot_header_t *header, const snapshot_field_t *fields,
+                   const snapshot_t *base, const store_t *updates);
+
+/* JSON conversion */
+bool snapshot_from_json(const char *json_path, const char *path, snapshot_filter_t filter, void *ctx);
+bool snapshot_to_json(const char *path, const char *json_path);
+
+#endif
@@ -0,0 +1,377 @@
+/* include area */
+#include "store.h"
+#include "epoch.h"
+#include "intern.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Initial number of slots (a power of 2) and initial size of the other arrays */
+#define STORE_INITIAL_SLOTS 16
+
+/** Slot of the hash table */
+typedef struct {
+  uint32_t hash;
+  /** Index of the entry plus 1 (0 if the slot is empty, set last when a key is added). */
+  uint32_t entry;
+} slot_t;
+
+/** Hash table (the number of slots is a power of 2) */
+typedef struct {
+  size_t num_slots;
+  slot_t slots[];
+} table_t;
+
+/** Entry of a key (its characters are in the keys area) */
+typedef struct {
+  size_t offset;
+  size_t length;
+  /** Index of the current version of the record. */
+  size_t record;
+} entry_t;
+
+struct store {
+  size_t num_values;
+
+  /* entry of each interned key (its index plus 1, 0 if it's not in the store) */
+  size_t num_ids;
+  uint32_t *by_id;
+
+  /* arrays read by the readers (published with atomic stores) */
+  table_t *table;
+  entry_t *entries;
+  float_t *records;
+  char *keys;
+
+  /* used only by the writer */
+  size_t num_entries;
+  size_t max_entries;
+  size_t num_records;
+  size_t max_records;
+  size_t keys_length;
+  size_t keys_capacity;
+};
+
+/**
+ * @brief Looks up the slot of a key.
+ *
+ * @param store The store.
+ * @param key Key characters.
+ * @param length Key length.
+ * @param hash Key hash.
+ * @return the slot of the key, or the empty slot where it would be inserted.
+ */
+static slot_t *_find(const store_t *store, const char *key, size_t length, uint32_t hash) {
+  table_t *table = __atomic_load_n(&store->table, __ATOMIC_ACQUIRE);
+  size_t mask = table->num_slots - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    slot_t *slot = &table->slots[i];
+    uint32_t index = __atomic_load_n(&slot->entry, __ATOMIC_ACQUIRE);
+    if (index == 0)
+      return slot;
+
+    /* the arrays are loaded after the slot, so they already have its entry */
+    const entry_t *entry = &__atomic_load_n(&store->entries, __ATOMIC_ACQUIRE)[index - 1];
+    const char *keys = __atomic_load_n(&store->keys, __ATOMIC_ACQUIRE);
+    if (slot->hash == hash && entry->length == length && memcmp(keys + entry->offset, key, length) == 0)
+      return slot;
+  }
+}
+
+/**
+ * @brief Returns the current version of the record of an entry (concurrent
+ * readers must be in a read section).
+ *
+ * @param store The store.
+ * @param index Index of the entry plus 1.
+ * @return the record.
+ */
+static const float_t *_record(const store_t *store, uint32_t index) {
+  const entry_t *entry = &__atomic_load_n(&store->entries, __ATOMIC_ACQUIRE)[index - 1];
+  size_t record = __atomic_load_n(&entry->record, __ATOMIC_ACQUIRE);
+  return __atomic_load_n(&store->records, __ATOMIC_ACQUIRE) + record * store->num_values;
+}
+
+/**
+ * @brief Copies an array into a larger one (the caller publishes it, and retires the old one).
+ *
+ * @param old The array.
+ * @param used Bytes in use.
+ * @param size Size of the new array (in bytes).
+ * @return The new array or NULL on error.
+ */
+static void *_grow_array(const void *old, size_t used, size_t size) {
+  void *data = malloc(size);
+  if (data != NULL && used > 0)
+    memcpy(data, old, used);
+
+  return data;
+}
+
+/**
+ * @brief Doubles the hash table.
+ *
+ * @param store The store.
+ * @return false on error, true on success.
+ */
+static bool _grow_table(store_t *store) {
+  table_t *old = store->table;
+  size_t num_slots = old->num_slots * 2;
+  table_t *table = calloc(1, sizeof(table_t) + num_slots * sizeof(slot_t));
+  if (table == NULL)
+    return false;
+
+  /* the keys are all different, so each one goes to the first empty slot */
+  table->num_slots = num_slots;
+  for (size_t i = 0; i < old->num_slots; i++) {
+    if (old->slots[i].entry == 0)
+      continue;
+
+    size_t j = old->slots[i].hash & (num_slots - 1);
+    while (table->slots[j].entry != 0)
+      j = (j + 1) & (num_slots - 1);
+    table->slots[j] = old->slots[i];
+  }
+
+  __atomic_store_n(&store->table, table, __ATOMIC_RELEASE);
+  epoch_retire(old, free);
+  return true;
+}
+
+/**
+ * @brief Makes room for more records.
+ *
+ * @param store The store.
+ * @param count Number of records.
+ * @return false on error, true on success.
+ */
+static bool _reserve_records(store_t *store, size_t count) {
+  if (store->num_records + count <= store->max_records)
+    return true;
+
+  size_t max_records = store->max_records ? store->max_records : STORE_INITIAL_SLOTS;
+  while (max_records < store->num_records + count)
+    max_records *= 2;
+
+  size_t record_size = store->num_values * sizeof(float_t);
+  float_t *old = store->records;
+  float_t *records = _grow_array(old, store->num_records * record_size, max_records * record_size);
+  if (records == NULL)
+    return false;
+
+  __atomic_store_n(&store->records, records, __ATOMIC_RELEASE);
+  if (old != NULL)
+    epoch_retire(old, free);
+  store->max_records = max_records;
+  return true;
+}
+
+/**
+ * @brief Makes room for more entries (and their keys).
+ *
+ * @param store The store.
+ * @param count Number of entries.
+ * @param keys_length Length of their keys (all together).
+ * @return false on error, true on success.
+ */
+static bool _reserve_entries(store_t *store, size_t count, size_t keys_length) {
+  while ((store->num_entries + count) * 4 > store->table->num_slots * 3) {
+    if (!_grow_table(store))
+      return false;
+  }
+
+  if (store->num_entries + count > store->max_entries) {
+    size_t max_entries = store->max_entries ? store->max_entries : STORE_INITIAL_SLOTS;
+    while (max_entries < store->num_entries + count)
+      max_entries *= 2;
+
+    entry_t *old = store->entries;
+    entry_t *entries = _grow_array(old, store->num_entries * sizeof(entry_t), max_entries * sizeof(entry_t));
+    if (entries == NULL)
+      return false;
+
+    __atomic_store_n(&store->entries, entries, __ATOMIC_RELEASE);
+    if (old != NULL)
+      epoch_retire(old, free);
+    store->max_entries = max_entries;
+  }
+
+  if (store->keys_length + keys_length > store->keys_capacity) {
+    size_t capacity = store->keys_capacity ? store->keys_capacity : 1024;
+    while (capacity < store->keys_length + keys_length)
+      capacity *= 2;
+
+    char *old = store->keys;
+    char *keys = _grow_array(old, store->keys_length, capacity);
+    if (keys == NULL)
+      return false;
+
+    __atomic_store_n(&store->keys, keys, __ATOMIC_RELEASE);
+    if (old != NULL)
+      epoch_retire(old, free);
+    store->keys_capacity = capacity;
+  }
+
+  return _reserve_records(store, count);
+}
+
+/**
+ * @brief Creates an empty store.
+ *
+ * @param num_values Number of floats in each record (up to STORE_MAX_VALUES).
+ * @return The store or NULL on error.
+ */
+store_t *store_create(size_t num_values) {
+  if (num_values == 0 || num_values > STORE_MAX_VALUES)
+    return NULL;
+
+  store_t *store = calloc(1, sizeof(store_t));
+  if (store == NULL)
+    return NULL;
+
+  /* the keys interned at startup (see intern.h) are found by their ID */
+  store->num_values = num_values;
+  store->num_ids = intern_count( );
+  store->by_id = store->num_ids ? calloc(store->num_ids, sizeof(uint32_t)) : NULL;
+  store->table = calloc(1, sizeof(table_t) + STORE_INITIAL_SLOTS * sizeof(slot_t));
+  if (store->table == NULL || (store->num_ids > 0 && store->by_id == NULL)) {
+    free(store->by_id);
+    free(store->table);
+    free(store);
+    return NULL;
+  }
+
+  store->table->num_slots = STORE_INITIAL_SLOTS;
+  return store;
+}
+
+/**
+ * @brief Looks up the record of a key (concurrent readers must be in a read section).
+ *
+ * @param store The store.
+ * @param key Key.
+ * @return The record (it doesn't change, a put creates a new version), or NULL
+ * if the key is not in the store.
+ */
+const float_t *store_get(const store_t *store, const string_t *key) {
+  uint32_t id = str_id(key);
+  const uint32_t *index_of = id != 0 && id <= store->num_ids
+                                 ? &store->by_id[id - 1]
+                                 : &_find(store, str_to_cstr(key), str_len(key), str_hash(key))->entry;
+  uint32_t index = __atomic_load_n(index_of, __ATOMIC_ACQUIRE);
+
+  return index == 0 ? NULL : _record(store, index);
+}
+
+/**
+ * @brief Makes room for a number of keys (and their records), so that many
+ * puts won't fail (e.g. to apply a batch as a whole, writer only).
+ *
+ * @param store The store.
+ * @param num_keys Number of keys (new or not).
+ * @param keys_length Length of the keys (all together).
+ * @return false on error, true on success.
+ */
+bool store_reserve(store_t *store, size_t num_keys, size_t keys_length) {
+  return _reserve_entries(store, num_keys, keys_length);
+}
+
+/**
+ * @brief Sets the record of a key, adding the key if it's not in the store (writer only).
+ *
+ * @param store The store.
+ * @param key Key.
+ * @param values Record (num_values floats).
+ * @return false on error, true on success.
+ */
+bool store_put(store_t *store, const string_t *key, const float_t *values) {
+  return store_put_n(store, str_to_cstr(key), str_len(key), values);
+}
+
+/**
+ * @brief Same as store_put, but the key is given by its characters.
+ *
+ * @param store The store.
+ * @param key Key characters.
+ * @param length Key length.
+ * @param values Record (num_values floats).
+ * @return false on error, true on success.
+ */
+bool store_put_n(store_t *store, const char *key, size_t length, const float_t *values) {
+  uint32_t hash = str_hash_n(key, length);
+  slot_t *slot = _find(store, key, length, hash);
+  bool found = slot->entry != 0;
+  if (!(found ? _reserve_records(store, 1) : _reserve_entries(store, 1, length)))
+    return false;
+
+  /* the new version of the record is written where no reader looks yet */
+  size_t record = store->num_records++;
+  memcpy(store->records + record * store->num_values, values, store->num_values * sizeof(float_t));
+
+  if (found) {
+    __atomic_store_n(&store->entries[slot->entry - 1].record, record, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  entry_t *entry = &store->entries[store->num_entries];
+  entry->offset = store->keys_length;
+  entry->length = length;
+  entry->record = record;
+  memcpy(store->keys + entry->offset, key, length);
+  store->keys_length += length;
+
+  /* looked up again (the table may have grown), and published last */
+  slot = _find(store, key, length, hash);
+  slot->hash = hash;
+  __atomic_store_n(&slot->entry, ++store->num_entries, __ATOMIC_RELEASE);
+
+  /* the key is interned again (the string may have been set before the table was filled) */
+  uint32_t id = intern_find(key, length, hash);
+  if (id != 0 && id <= store->num_ids)
+    __atomic_store_n(&store->by_id[id - 1], store->num_entries, __ATOMIC_RELEASE);
+  return true;
+}
+
+/**
+ * @brief Returns the number of keys in the store.
+ *
+ * @param store The store.
+ * @return number of keys.
+ */
+size_t store_size(const store_t *store) {
+  return store->num_entries;
+}
+
+/**
+ * @brief Gets an entry by its index (entries are kept in insertion order),
+ * e.g. for iterating the store (writer only, or once there are no writers).
+ *
+ * @param store The store.
+ * @param index Index of the entry (less than store_size).
+ * @param key Key characters (output, not NULL terminated).
+ * @param length Key length (output).
+ * @return The record, or NULL if the index is out of range.
+ */
+const float_t *store_at(const store_t *store, size_t index, const char **key, size_t *length) {
+  if (index >= store->num_entries)
+    return NULL;
+
+  const entry_t *entry = &store->entries[index];
+  *key = store->keys + entry->offset;
+  *length = entry->length;
+  return store->records + entry->record * store->num_values;
+}
+
+/**
+ * @brief Releases the store (once nobody can be reading it).
+ *
+ * @param store The store.
+ */
+void store_destroy(store_t *store) {
+  free(store->by_id);
+  free(store->table);
+  free(store->entries);
+  free(store->records);
+  free(store->keys);
+  free(store);
+}
@@ -0,0 +1,55 @@
+#ifndef STORE_H
+#define STORE_H
+
+/**
+ * @brief This module implements the key-value store of the microservices.
+ *
+ * The store is an open addressing hash table (linear probing) keyed by
+ * strings, whose values are fixed-size records of floats. The records are
+ * packed one after the other, apart from the slots, so a lookup is a single
+ * probe sequence over the slots (comparing the stored hashes first) followed
+ * by one access to the record. Keys are hashed when the string is set (see
+ * str_hash), so a lookup doesn't hash them again and it doesn't allocate.
+ * The keys interned when the store is created (see intern.h) skip the table:
+ * their entries are also kept in an array indexed by their ID.
+ *
+ * The store has a single writer (the callers synchronize the writers) and
+ * any number of concurrent readers, that don't take any lock: they read
+ * inside an epoch read section (see epoch.h). Nothing a reader may be
+ * reading is modified: records are never updated in place (a put appends
+ * the new version of the record, and switches the entry to it with an atomic
+ * store), and when an array is full it's copied into a larger one, which is
+ * published atomically while the old one is retired. The table doubles when
+ * it's 3/4 full, re-inserting the slots by their stored hashes.
+ *
+ * Old versions of the records are only reclaimed when the store is
+ * destroyed, so a store is meant to be replaced from time to time (e.g. the
+ * updates of a microservice, on every snapshot).
+ */
+
+/* include area */
+#include "str.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Max number of floats in a record */
+#define STORE_MAX_VALUES 8
+
+/** Key-value store (see store.c) */
+typedef struct store store_t;
+
+/*--------------------------------------------------------------------------
+   Prototypes
+--------------------------------------------------------------------------*/
+
+store_t *store_create(size_t num_values);
+const float_t *store_get(const store_t *store, const string_t *key);
+bool store_reserve(store_t *store, size_t num_keys, size_t keys_length);
+bool store_put(store_t *store, const string_t *key, const float_t *values);
+bool store_put_n(store_t *store, const char *key, size_t length, const float_t *values);
+size_t store_size(const store_t *store);
+const float_t *store_at(const store_t *store, size_t index, const char **key, size_t *length);
+void store_destroy(store_t *store);
+
+#endif
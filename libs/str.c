@@ -1,5 +1,42 @@
 /* include area */
 #include "str.h"
+#include "intern.h"
+
+/** Arena where the long strings of the thread go (see str_set_arena) */
+static __thread arena_t *_arena = NULL;
+
+/**
+ * @brief Returns the characters of a string.
+ *
+ * @param s String.
+ * @return the characters (inline or in an arena, depending on the length).
+ */
+static char *_chars(string_t *s) {
+  return s->length < STR_INLINE_SIZE ? s->u.chars : s->u.spilled;
+}
+
+/**
+ * @brief Sets the arena where the strings initialized by the calling thread
+ * keep their characters when they don't fit inline (without an arena, those
+ * strings fail to initialize).
+ *
+ * @param arena The arena (NULL for none).
+ * @return the previous arena of the thread.
+ */
+arena_t *str_set_arena(arena_t *arena) {
+  arena_t *previous = _arena;
+  _arena = arena;
+  return previous;
+}
+
+/**
+ * @brief Returns the arena of the calling thread (see str_set_arena).
+ *
+ * @return the arena (NULL if there's none).
+ */
+arena_t *str_get_arena(void) {
+  return _arena;
+}
 
 /**
  * @brief Initializes a string_t from a C string.
@@ -9,16 +46,64 @@
  * @return false if the C string was too large, true on success.
  */
 bool str_init(string_t *s, const char *cstr) {
-  size_t length = strlen(cstr);
-  if (length >= sizeof(s->buffer))
+  return str_init_n(s, cstr, strlen(cstr));
+}
+
+/**
+ * @brief Initializes a string_t from a buffer (not NULL terminated).
+ *
+ * @param s String to initialize.
+ * @param data Characters to copy into s.
+ * @param length Number of characters.
+ * @return false if the buffer was too large (or there's no room for it), true on success.
+ */
+bool str_init_n(string_t *s, const char *data, size_t length) {
+  char *chars = str_reserve(s, length);
+  if (chars == NULL)
     return false;
 
-  s->length = length;
-  memcpy(s->buffer, cstr, length);
-  s->buffer[s->length] = '\0';
+  memcpy(chars, data, length);
+  str_set_length(s, length);
   return true;
 }
 
+/**
+ * @brief Gets room for the characters of a string, so they can be written
+ * in place (e.g. by a deserializer), before setting its length.
+ *
+ * @param s String.
+ * @param length Number of characters.
+ * @return Where the characters go (length + 1 bytes), or NULL if the length
+ * exceeds STR_MAX_LENGTH or it doesn't fit inline and the arena is full (or
+ * there's none).
+ */
+char *str_reserve(string_t *s, size_t length) {
+  if (length > STR_MAX_LENGTH)
+    return NULL;
+  if (length < STR_INLINE_SIZE)
+    return s->u.chars;
+  if (_arena == NULL)
+    return NULL;
+
+  s->u.spilled = arena_alloc(_arena, length + 1);
+  return s->u.spilled;
+}
+
+/**
+ * @brief Sets the length of a string whose characters were written in place
+ * (see str_reserve), terminating it, computing its hash and looking up its ID.
+ *
+ * @param s String.
+ * @param length Number of characters (the same given to str_reserve).
+ */
+void str_set_length(string_t *s, size_t length) {
+  s->length = length;
+  char *chars = _chars(s);
+  chars[length] = '\0';
+  s->hash = str_hash_n(chars, length);
+  s->id = intern_find(chars, length, s->hash);
+}
+
 /**
  * @brief Returns the length of a string.
  *
@@ -29,6 +114,45 @@ size_t str_len(const string_t *s) {
   return s->length;
 }
 
+/**
+ * @brief Returns the hash of a string (computed when it was set, so lookups
+ * keyed by the string don't hash it again).
+ *
+ * @param s String.
+ * @return hash of the string.
+ */
+uint32_t str_hash(const string_t *s) {
+  return s->hash;
+}
+
+/**
+ * @brief Returns the ID of an interned key (looked up when the string was
+ * set, so lookups keyed by the ID don't compare the characters).
+ *
+ * @param s String.
+ * @return ID of the string (see intern.h), 0 if it isn't interned.
+ */
+uint32_t str_id(const string_t *s) {
+  return s->id;
+}
+
+/**
+ * @brief Hashes a sequence of characters (32 bits FNV-1a).
+ *
+ * @param data Characters.
+ * @param length Number of characters.
+ * @return hash of the characters.
+ */
+uint32_t str_hash_n(const char *data, size_t length) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= ( uint8_t )data[i];
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
 /**
  * @brief Compares 2 strings.
  *
@@ -39,10 +163,12 @@ size_t str_len(const string_t *s) {
  *         > 0 if s1 > s2
  */
 int str_cmp(const string_t *s1, const string_t *s2) {
+  if (s1->id != 0 && s1->id == s2->id)
+    return 0;
   if (str_len(s1) != str_len(s2))
     return str_len(s1) - str_len(s2);
 
-  return memcmp(s1->buffer, s2->buffer, s1->length);
+  return memcmp(str_to_cstr(s1), str_to_cstr(s2), s1->length);
 }
 
 /**
@@ -59,7 +185,7 @@ int cstr_cmp(const string_t *s, const char *cstr) {
   if (str_len(s) != length)
     return str_len(s) - length;
 
-  return memcmp(s->buffer, cstr, length);
+  return memcmp(str_to_cstr(s), cstr, length);
 }
 
 /**
@@ -69,5 +195,5 @@ int cstr_cmp(const string_t *s, const char *cstr) {
  * @return C string.
  */
 const char *str_to_cstr(const string_t *s) {
-  return s->buffer;
+  return s->length < STR_INLINE_SIZE ? s->u.chars : s->u.spilled;
 }
\ No newline at end of file
@@ -2,17 +2,41 @@
 #define STR_H
 
 /* include area */
+#include "arena.h"
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 
-/* string type */
+/** Max length of a string */
+#define STR_MAX_LENGTH 1023
+
+/** Strings shorter than this are kept inline, longer ones in the arena of the thread (see str_set_arena) */
+#define STR_INLINE_SIZE 48
+
+/* string type: small strings are kept inline, and the longer ones in an arena, so a
+ * copy of the struct shares their characters (valid until the arena is reset) */
 typedef struct {
-  char buffer[1024];
-  size_t length;
+  uint32_t length;
+  /** Hash of the characters, computed once when the string is set (see str_hash). */
+  uint32_t hash;
+  /** ID of the key, looked up once when the string is set (see str_id). */
+  uint32_t id;
+  union {
+    char chars[STR_INLINE_SIZE];
+    char *spilled;
+  } u;
 } string_t;
 
+arena_t *str_set_arena(arena_t *arena);
+arena_t *str_get_arena(void);
 bool str_init(string_t *s, const char *cstr);
+bool str_init_n(string_t *s, const char *data, size_t length);
+char *str_reserve(string_t *s, size_t length);
+void str_set_length(string_t *s, size_t length);
 size_t str_len(const string_t *s);
+uint32_t str_hash(const string_t *s);
+uint32_t str_id(const string_t *s);
+uint32_t str_hash_n(const char *data, size_t length);
 int str_cmp(const string_t *s1, const string_t *s2);
 int cstr_cmp(const string_t *s, const char *cstr);
 const char *str_to_cstr(const string_t *s);
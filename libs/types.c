@@ -1,9 +1,85 @@
 /* include area */
 #include "types.h"
+#include "arena.h"
 #include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 
+/** Separator of the list items in a C string */
+#define LIST_SEPARATOR ", "
+
+/**
+ * @brief Gets the items of a float list, taken from the arena of the calling
+ * thread (see str_set_arena) the first time.
+ *
+ * @param l The list.
+ * @return The items or NULL on error (e.g. the thread has no arena).
+ */
+static float_t *_float_list_items(float_list_t *l) {
+  arena_t *arena = str_get_arena( );
+  if (l->items == NULL && arena != NULL)
+    l->items = arena_alloc(arena, LIST_MAX_ITEMS * sizeof(float_t));
+
+  return l->items;
+}
+
+/**
+ * @brief Gets the characters area of a string list (and the ends of its items),
+ * taken from the arena of the calling thread (see str_set_arena) the first time.
+ *
+ * @param l The list.
+ * @return The characters or NULL on error (e.g. the thread has no arena).
+ */
+static char *_string_list_data(string_list_t *l) {
+  arena_t *arena = str_get_arena( );
+  if (l->data == NULL && arena != NULL &&
+      (l->ends = arena_alloc(arena, LIST_MAX_ITEMS * sizeof(uint16_t) + STRING_LIST_SIZE)) != NULL)
+    l->data = ( char * )(l->ends + LIST_MAX_ITEMS);
+
+  return l->data;
+}
+
+/**
+ * @brief Copies a float list (its items, into the arena of the calling thread).
+ *
+ * @param dst Copy of the list (output).
+ * @param src List to copy.
+ * @return false on error, true on success.
+ */
+static bool _float_list_copy(float_list_t *dst, const float_list_t *src) {
+  *dst = (float_list_t){0};
+  if (src->count == 0)
+    return true;
+
+  if (_float_list_items(dst) == NULL)
+    return false;
+
+  memcpy(dst->items, src->items, src->count * sizeof(float_t));
+  dst->count = src->count;
+  return true;
+}
+
+/**
+ * @brief Copies a string list (its items, into the arena of the calling thread).
+ *
+ * @param dst Copy of the list (output).
+ * @param src List to copy.
+ * @return false on error, true on success.
+ */
+static bool _string_list_copy(string_list_t *dst, const string_list_t *src) {
+  *dst = (string_list_t){0};
+  if (src->count == 0)
+    return true;
+
+  if (_string_list_data(dst) == NULL)
+    return false;
+
+  memcpy(dst->ends, src->ends, src->count * sizeof(uint16_t));
+  memcpy(dst->data, src->data, src->ends[src->count - 1] + 1);
+  dst->count = src->count;
+  return true;
+}
+
 /**
  * @brief Serializes a generic field into a C string.
  *
@@ -24,6 +100,12 @@ size_t field_to_cstr(char *s, size_t len, const void *field, field_type_t type)
 
     case field_type_string:
       return string_to_cstr(s, len, field);
+
+    case field_type_float_list:
+      return float_list_to_cstr(s, len, field);
+
+    case field_type_string_list:
+      return string_list_to_cstr(s, len, field);
   }
 
   /* invalid field type */
@@ -48,12 +130,52 @@ bool field_from_cstr(void *field, field_type_t type, const char *s) {
 
     case field_type_string:
       return string_from_cstr(field, s);
+
+    case field_type_float_list:
+      return float_list_from_cstr(field, s);
+
+    case field_type_string_list:
+      return string_list_from_cstr(field, s);
   }
 
   /* invalid field type */
   return 0;
 }
 
+/**
+ * @brief Copies a generic field. The characters a string keeps in an arena,
+ * and the items of a list, are copied too, into the arena of the calling
+ * thread (see str_set_arena).
+ *
+ * @param dst Copy of the field (output).
+ * @param src Field to copy.
+ * @param type Type of the field.
+ * @return false on error (e.g. there's no room for a long string), true on success.
+ */
+bool field_copy(void *dst, const void *src, field_type_t type) {
+  switch (type) {
+    case field_type_float:
+      memcpy(dst, src, sizeof(float_t));
+      return true;
+
+    case field_type_integer:
+      memcpy(dst, src, sizeof(integer_t));
+      return true;
+
+    case field_type_string:
+      return str_init_n(dst, str_to_cstr(src), str_len(src));
+
+    case field_type_float_list:
+      return _float_list_copy(dst, src);
+
+    case field_type_string_list:
+      return _string_list_copy(dst, src);
+  }
+
+  /* invalid field type */
+  return false;
+}
+
 /**
  * @brief Parses an integer_t from a C string.
  *
@@ -124,13 +246,7 @@ size_t float_to_cstr(char *s, size_t len, const float_t *f) {
  * @return false if the string didn't contain a valid string_t, true on success.
  */
 bool string_from_cstr(string_t *st, const char *s) {
-  size_t len = strlen(s);
-  if (len > sizeof(st->buffer))
-    return false;
-
-  memcpy(st->buffer, s, len);
-  st->length = len;
-  return true;
+  return str_init(st, s);
 }
 
 /**
@@ -149,7 +265,196 @@ size_t string_to_cstr(char *s, size_t len, const string_t *st) {
     return 0;
 
   /* copies the content */
-  memcpy(s, st->buffer, st->length);
+  memcpy(s, str_to_cstr(st), st->length);
   s[st->length] = '\0';
   return st->length + 1;
 }
+
+/**
+ * @brief Appends a float to a list.
+ *
+ * @param l The list.
+ * @param f Float to append.
+ * @return false if the list is full (or its items can't be allocated), true on success.
+ */
+bool float_list_append(float_list_t *l, float_t f) {
+  if (l->count == LIST_MAX_ITEMS || _float_list_items(l) == NULL)
+    return false;
+
+  l->items[l->count++] = f;
+  return true;
+}
+
+/**
+ * @brief Gets where the next item of a string list is written (so it can be
+ * read in place, then added with string_list_push).
+ *
+ * @param l The list.
+ * @param size Room left, including the NULL terminator of the item (output).
+ * @return Where the item is written, NULL if the list is full (or its items can't be allocated).
+ */
+char *string_list_next(string_list_t *l, size_t *size) {
+  size_t start = l->count ? l->ends[l->count - 1] + 1 : 0;
+  if (l->count == LIST_MAX_ITEMS || start == STRING_LIST_SIZE || _string_list_data(l) == NULL)
+    return NULL;
+
+  *size = STRING_LIST_SIZE - start;
+  return l->data + start;
+}
+
+/**
+ * @brief Adds the item written at string_list_next.
+ *
+ * @param l The list.
+ * @param length Item length (less than the size given by string_list_next).
+ */
+void string_list_push(string_list_t *l, size_t length) {
+  size_t start = l->count ? l->ends[l->count - 1] + 1 : 0;
+  l->data[start + length] = '\0';
+  l->ends[l->count++] = start + length;
+}
+
+/**
+ * @brief Appends a string to a list.
+ *
+ * @param l The list.
+ * @param data String characters.
+ * @param length String length.
+ * @return false if it doesn't fit, true on success.
+ */
+bool string_list_append(string_list_t *l, const char *data, size_t length) {
+  size_t size;
+  char *item = string_list_next(l, &size);
+  if (item == NULL || length >= size)
+    return false;
+
+  memcpy(item, data, length);
+  string_list_push(l, length);
+  return true;
+}
+
+/**
+ * @brief Gets an item of a string list.
+ *
+ * @param l The list.
+ * @param index Item index.
+ * @param length Item length (output).
+ * @return The item (NULL terminated) or NULL if the index is out of range.
+ */
+const char *string_list_get(const string_list_t *l, size_t index, size_t *length) {
+  if (index >= l->count)
+    return NULL;
+
+  size_t start = index ? l->ends[index - 1] + 1 : 0;
+  *length = l->ends[index] - start;
+  return l->data + start;
+}
+
+/**
+ * @brief Parses a float_list_t from a C string (comma separated floats).
+ *
+ * @param l Output list.
+ * @param s Input string.
+ * @return false if the string didn't contain a valid list, true on success.
+ */
+bool float_list_from_cstr(float_list_t *l, const char *s) {
+  l->count = 0;
+  while (*s != '\0') {
+    char *end;
+    float_t f = strtof(s, &end);
+    if (end == s || !float_list_append(l, f))
+      return false;
+
+    s = end + strspn(end, " ");
+    if (*s == ',')
+      s++;
+    else if (*s != '\0')
+      return false;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Parses a string_list_t from a C string (comma separated strings).
+ *
+ * @param l Output list.
+ * @param s Input string.
+ * @return false if the strings didn't fit in the list, true on success.
+ */
+bool string_list_from_cstr(string_list_t *l, const char *s) {
+  l->count = 0;
+  while (*s != '\0') {
+    s += strspn(s, " ");
+    size_t length = strcspn(s, ",");
+    if (!string_list_append(l, s, length))
+      return false;
+
+    s += length;
+    if (*s == ',')
+      s++;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Serializes a float_list_t into a C string (comma separated).
+ *
+ * @param s Output string where the list is serialized.
+ * @param len Max length of the output buffer.
+ *            If len is 0, then the number of bytes required to serialize the list are returned.
+ * @param l List to serialize.
+ * @return The number of bytes in the output buffer or 0 on error.
+ */
+size_t float_list_to_cstr(char *s, size_t len, const float_list_t *l) {
+  size_t length = 0;
+  for (uint32_t i = 0; i < l->count; i++) {
+    char *out = (length < len) ? s + length : NULL;
+    int bytes = snprintf(out, out ? len - length : 0, "%s%.4f", i ? LIST_SEPARATOR : "", l->items[i]);
+    if (bytes < 0)
+      return 0;
+    length += bytes;
+  }
+
+  if (len == 0)
+    return length + 1;
+
+  if (length >= len)
+    return 0;
+
+  s[length] = '\0';
+  return length + 1;
+}
+
+/**
+ * @brief Serializes a string_list_t into a C string (comma separated).
+ *
+ * @param s Output string where the list is serialized.
+ * @param len Max length of the output buffer.
+ *            If len is 0, then the number of bytes required to serialize the list are returned.
+ * @param l List to serialize.
+ * @return The number of bytes in the output buffer or 0 on error.
+ */
+size_t string_list_to_cstr(char *s, size_t len, const string_list_t *l) {
+  size_t length = 0;
+  for (uint32_t i = 0; i < l->count; i++) {
+    size_t item_length;
+    const char *item = string_list_get(l, i, &item_length);
+    char *out = (length < len) ? s + length : NULL;
+    int bytes =
+        snprintf(out, out ? len - length : 0, "%s%.*s", i ? LIST_SEPARATOR : "", ( int )item_length, item);
+    if (bytes < 0)
+      return 0;
+    length += bytes;
+  }
+
+  if (len == 0)
+    return length + 1;
+
+  if (length >= len)
+    return 0;
+
+  s[length] = '\0';
+  return length + 1;
+}
@@ -12,22 +12,62 @@ typedef enum {
   field_type_integer,
   field_type_float,
   field_type_string,
+  field_type_float_list,
+  field_type_string_list,
 } field_type_t;
 
+/** Max number of items in a list */
+#define LIST_MAX_ITEMS 64
+
+/** Size of the characters area of a string list (every item is NULL terminated) */
+#define STRING_LIST_SIZE 2048
+
 /** Type definitions */
 typedef int32_t integer_t;
 typedef float float_t;
 
+/* Lists keep their items in the arena of the thread that appends the first one (see
+ * str_set_arena), with room for all of them (LIST_MAX_ITEMS, or STRING_LIST_SIZE characters),
+ * so a copy of the struct shares them (valid until the arena is reset), like a long string. */
+
+/** List of floats */
+typedef struct {
+  uint32_t count;
+  float_t *items;
+} float_list_t;
+
+/** List of strings, packed one after the other (see string_list_get) */
+typedef struct {
+  uint32_t count;
+  /** Offset of the end of each item (its NULL terminator). */
+  uint16_t *ends;
+  char *data;
+} string_list_t;
+
+/* lists */
+bool float_list_append(float_list_t *l, float_t f);
+bool string_list_append(string_list_t *l, const char *data, size_t length);
+char *string_list_next(string_list_t *l, size_t *size);
+void string_list_push(string_list_t *l, size_t length);
+const char *string_list_get(const string_list_t *l, size_t index, size_t *length);
+
+/* copy */
+bool field_copy(void *dst, const void *src, field_type_t type);
+
 /* deserialization */
 bool field_from_cstr(void *field, field_type_t type, const char *s);
 bool integer_from_cstr(integer_t *i, const char *s);
 bool float_from_cstr(float_t *f, const char *s);
 bool string_from_cstr(string_t *st, const char *s);
+bool float_list_from_cstr(float_list_t *l, const char *s);
+bool string_list_from_cstr(string_list_t *l, const char *s);
 
 /* serialization */
 size_t field_to_cstr(char *s, size_t len, const void *field, field_type_t type);
 size_t integer_to_cstr(char *s, size_t len, const integer_t *i);
 size_t float_to_cstr(char *s, size_t len, const float_t *f);
 size_t string_to_cstr(char *s, size_t len, const string_t *st);
+size_t float_list_to_cstr(char *s, size_t len, const float_list_t *l);
+size_t string_list_to_cstr(char *s, size_t len, const string_list_t *l);
 
 #endif
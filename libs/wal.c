@@ -0,0 +1,556 @@
+/* include area */
+#define _GNU_SOURCE
+#include "wal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** Size (in bytes) of the encoded integers (key length, float bits and checksum) */
+#define WAL_WORD_SIZE 4
+
+/** Initial size (in bytes) of the buffer of appended records */
+#define WAL_BUFFER_SIZE 4096
+
+/** Set in the first word of a batch header (instead of a key length), the rest is the number of records */
+#define WAL_BATCH_FLAG 0x80000000u
+
+/** Size (in bytes) of a batch header (the number of records and its checksum) */
+#define WAL_BATCH_HEADER_SIZE (2 * WAL_WORD_SIZE)
+
+struct wal {
+  int fd;
+  char *path;
+  size_t num_values;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  /** Records appended but not written yet, and the buffer swapped with it while writing. */
+  char *data;
+  size_t length;
+  size_t capacity;
+  char *spare;
+  size_t spare_capacity;
+
+  /** Sequence number of the last record appended, and of the last one synced. */
+  uint64_t appended;
+  uint64_t durable;
+  /** Some writer is writing the records (see wal_commit). */
+  bool flushing;
+  /** A write failed: nothing else is committed. */
+  bool failed;
+
+  /** Size (in bytes) of the log, including the records not written yet. */
+  size_t size;
+};
+
+/**
+ * @brief Encodes a 32 bits integer (little endian).
+ *
+ * @param data Output (WAL_WORD_SIZE bytes).
+ * @param value Value.
+ */
+static void _u32_encode(char *data, uint32_t value) {
+  for (size_t i = 0; i < WAL_WORD_SIZE; i++)
+    data[i] = (value >> (8 * i)) & 0xFF;
+}
+
+/**
+ * @brief Decodes a 32 bits integer (little endian).
+ *
+ * @param data Input (WAL_WORD_SIZE bytes).
+ * @return the value.
+ */
+static uint32_t _u32_decode(const char *data) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < WAL_WORD_SIZE; i++)
+    value |= ( uint32_t )( uint8_t )data[i] << (8 * i);
+  return value;
+}
+
+/**
+ * @brief Returns the size of an encoded record.
+ *
+ * @param key_length Length of the key.
+ * @param num_values Number of floats in the record.
+ * @return size (in bytes).
+ */
+static size_t _record_size(size_t key_length, size_t num_values) {
+  return WAL_WORD_SIZE + key_length + num_values * WAL_WORD_SIZE + WAL_WORD_SIZE;
+}
+
+/**
+ * @brief Writes a whole buffer to a file.
+ *
+ * @param fd File.
+ * @param data Buffer.
+ * @param length Number of bytes.
+ * @return false on error, true on success.
+ */
+static bool _write_all(int fd, const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t bytes = write(fd, data, length);
+    if (bytes < 0 && errno == EINTR)
+      continue;
+    if (bytes < 0)
+      return false;
+
+    data += bytes;
+    length -= bytes;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Syncs the directory of a file (so a rename or a creation is durable).
+ *
+ * @param path File.
+ * @return false on error, true on success.
+ */
+static bool _sync_dir(const char *path) {
+  char dir[PATH_MAX];
+  const char *slash = strrchr(path, '/');
+  if (slash == NULL) {
+    strcpy(dir, ".");
+  } else if (slash == path) {
+    strcpy(dir, "/");
+  } else {
+    size_t length = slash - path;
+    if (length >= sizeof(dir))
+      return false;
+    memcpy(dir, path, length);
+    dir[length] = '\0';
+  }
+
+  int fd = open(dir, O_RDONLY | O_DIRECTORY);
+  if (fd < 0)
+    return false;
+
+  bool success = fsync(fd) == 0;
+  close(fd);
+  return success;
+}
+
+/**
+ * @brief Checks a record (its length and checksum).
+ *
+ * @param record Encoded record.
+ * @param available Bytes available from the start of the record.
+ * @param num_values Number of floats in a record.
+ * @return the size of the record, 0 if it's torn or corrupted.
+ */
+static size_t _record_check(const char *record, size_t available, size_t num_values) {
+  if (available < _record_size(0, num_values))
+    return 0;
+
+  size_t key_length = _u32_decode(record);
+  if (key_length > STR_MAX_LENGTH || available < _record_size(key_length, num_values))
+    return 0;
+
+  size_t checksum_offset = _record_size(key_length, num_values) - WAL_WORD_SIZE;
+  if (_u32_decode(record + checksum_offset) != str_hash_n(record, checksum_offset))
+    return 0;
+
+  return _record_size(key_length, num_values);
+}
+
+/**
+ * @brief Decodes a record (already checked) and passes it to the replay callback.
+ *
+ * @param record Encoded record.
+ * @param num_values Number of floats in a record.
+ * @param cb Callback.
+ * @param ctx Callback context.
+ */
+static void _record_replay(const char *record, size_t num_values, wal_replay_cb_t cb, void *ctx) {
+  size_t key_length = _u32_decode(record);
+
+  string_t key;
+  float_t values[num_values];
+  str_init_n(&key, record + WAL_WORD_SIZE, key_length);
+  for (size_t i = 0; i < num_values; i++) {
+    uint32_t bits = _u32_decode(record + WAL_WORD_SIZE + key_length + i * WAL_WORD_SIZE);
+    memcpy(&values[i], &bits, sizeof(bits));
+  }
+  cb(&key, values, ctx);
+}
+
+/**
+ * @brief Encodes a record: key length, key, values and checksum.
+ *
+ * @param record Output (_record_size bytes).
+ * @param key Key characters.
+ * @param key_length Key length.
+ * @param values Record values.
+ * @param num_values Number of floats in a record.
+ */
+static void _record_encode(char *record, const char *key, size_t key_length, const float_t *values,
+                           size_t num_values) {
+  size_t size = _record_size(key_length, num_values);
+  _u32_encode(record, key_length);
+  memcpy(record + WAL_WORD_SIZE, key, key_length);
+  for (size_t i = 0; i < num_values; i++) {
+    uint32_t bits;
+    memcpy(&bits, &values[i], sizeof(bits));
+    _u32_encode(record + WAL_WORD_SIZE + key_length + i * WAL_WORD_SIZE, bits);
+  }
+  _u32_encode(record + size - WAL_WORD_SIZE, str_hash_n(record, size - WAL_WORD_SIZE));
+}
+
+/**
+ * @brief Replays the records of a log file.
+ *
+ * @param fd Log file.
+ * @param num_values Number of floats in a record.
+ * @param cb Callback called with each record.
+ * @param ctx Callback context.
+ * @param valid Length of the valid records (output, the rest is a torn or corrupted tail).
+ * @return false on error, true on success.
+ */
+static bool _replay(int fd, size_t num_values, wal_replay_cb_t cb, void *ctx, size_t *valid) {
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    return false;
+
+  /* the whole log is read at once, and the records are decoded in place */
+  size_t length = st.st_size;
+  char *data = malloc(length ? length : 1);
+  if (data == NULL)
+    return false;
+
+  size_t offset = 0;
+  while (offset < length) {
+    ssize_t bytes = pread(fd, data + offset, length - offset, offset);
+    if (bytes < 0 && errno == EINTR)
+      continue;
+    if (bytes <= 0) {
+      free(data);
+      return false;
+    }
+    offset += bytes;
+  }
+
+  /* the long keys go to an arena (see str_set_arena), emptied after each record */
+  arena_t *arena = arena_create(STR_MAX_LENGTH + 1, 0);
+  if (arena == NULL) {
+    free(data);
+    return false;
+  }
+  arena_t *previous = str_set_arena(arena);
+
+  offset = 0;
+  while (length - offset >= _record_size(0, num_values)) {
+    /* a single record is like a batch of one */
+    size_t count = 1;
+    size_t start = offset;
+    uint32_t word = _u32_decode(data + offset);
+    if (word & WAL_BATCH_FLAG) {
+      if (length - offset < WAL_BATCH_HEADER_SIZE ||
+          _u32_decode(data + offset + WAL_WORD_SIZE) != str_hash_n(data + offset, WAL_WORD_SIZE))
+        break;
+      count = word & ~WAL_BATCH_FLAG;
+      start += WAL_BATCH_HEADER_SIZE;
+    }
+
+    /* every record of a batch must be valid before any of them is replayed */
+    size_t end = start, size = 1;
+    for (size_t i = 0; i < count && size > 0; i++) {
+      size = _record_check(data + end, length - end, num_values);
+      end += size;
+    }
+    if (size == 0)
+      break;
+
+    for (size_t i = start; i < end; i += _record_size(_u32_decode(data + i), num_values)) {
+      _record_replay(data + i, num_values, cb, ctx);
+      arena_reset(arena);
+    }
+
+    offset = end;
+  }
+
+  str_set_arena(previous);
+  arena_destroy(arena);
+  *valid = offset;
+  free(data);
+  return true;
+}
+
+/**
+ * @brief Replays the records of a log (e.g. one that was rotated).
+ *
+ * @param path Log file (it's fine if it doesn't exist).
+ * @param num_values Number of floats in a record.
+ * @param cb Callback called with each record.
+ * @param ctx Callback context.
+ * @return false on error, true on success.
+ */
+bool wal_replay(const char *path, size_t num_values, wal_replay_cb_t cb, void *ctx) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return errno == ENOENT;
+
+  size_t valid;
+  bool success = _replay(fd, num_values, cb, ctx, &valid);
+  close(fd);
+  return success;
+}
+
+/**
+ * @brief Opens a log for appending, replaying the records it already has.
+ *
+ * @param path Log file (created if it doesn't exist).
+ * @param num_values Number of floats in a record.
+ * @param cb Callback called with each record in the log.
+ * @param ctx Callback context.
+ * @return The log or NULL on error.
+ */
+wal_t *wal_open(const char *path, size_t num_values, wal_replay_cb_t cb, void *ctx) {
+  wal_t *wal = calloc(1, sizeof(wal_t));
+  if (wal == NULL)
+    return NULL;
+
+  wal->num_values = num_values;
+  wal->path = strdup(path);
+  wal->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (wal->path == NULL || wal->fd < 0) {
+    free(wal->path);
+    free(wal);
+    return NULL;
+  }
+
+  /* a torn tail is cut, so new records follow the valid ones */
+  size_t valid;
+  if (!_replay(wal->fd, num_values, cb, ctx, &valid) || ftruncate(wal->fd, valid) != 0 || !_sync_dir(path)) {
+    close(wal->fd);
+    free(wal->path);
+    free(wal);
+    return NULL;
+  }
+
+  wal->size = valid;
+  pthread_mutex_init(&wal->lock, NULL);
+  pthread_cond_init(&wal->cond, NULL);
+  return wal;
+}
+
+/**
+ * @brief Makes room in the buffer of appended records (with the lock held).
+ *
+ * @param wal The log.
+ * @param size Bytes to append.
+ * @return false on error, true on success.
+ */
+static bool _reserve(wal_t *wal, size_t size) {
+  if (wal->length + size <= wal->capacity)
+    return true;
+
+  size_t capacity = wal->capacity ? wal->capacity : WAL_BUFFER_SIZE;
+  while (capacity < wal->length + size)
+    capacity *= 2;
+
+  char *data = realloc(wal->data, capacity);
+  if (data == NULL)
+    return false;
+
+  wal->data = data;
+  wal->capacity = capacity;
+  return true;
+}
+
+/**
+ * @brief Appends a record to the log (in memory, see wal_commit).
+ *
+ * @param wal The log.
+ * @param key Key.
+ * @param values Record (num_values floats).
+ * @param seq Sequence number of the record (output, for wal_commit).
+ * @return false on error, true on success.
+ */
+bool wal_append(wal_t *wal, const string_t *key, const float_t *values, uint64_t *seq) {
+  size_t size = _record_size(str_len(key), wal->num_values);
+
+  pthread_mutex_lock(&wal->lock);
+  if (!_reserve(wal, size)) {
+    pthread_mutex_unlock(&wal->lock);
+    return false;
+  }
+
+  _record_encode(wal->data + wal->length, str_to_cstr(key), str_len(key), values, wal->num_values);
+  wal->length += size;
+  wal->size += size;
+  *seq = ++wal->appended;
+  pthread_mutex_unlock(&wal->lock);
+  return true;
+}
+
+/**
+ * @brief Appends a batch of records to the log (in memory, see wal_commit).
+ * The batch is replayed as a whole: if any of its records is torn, none is.
+ *
+ * @param wal The log.
+ * @param keys Keys.
+ * @param values Records (num_values floats for each key).
+ * @param seq Sequence number of the batch (output, for wal_commit).
+ * @return false on error, true on success.
+ */
+bool wal_append_batch(wal_t *wal, const string_list_t *keys, const float_t *values, uint64_t *seq) {
+  size_t size = WAL_BATCH_HEADER_SIZE;
+  for (uint32_t i = 0; i < keys->count; i++) {
+    size_t length;
+    string_list_get(keys, i, &length);
+    if (length > STR_MAX_LENGTH)
+      return false;
+    size += _record_size(length, wal->num_values);
+  }
+
+  pthread_mutex_lock(&wal->lock);
+  if (!_reserve(wal, size)) {
+    pthread_mutex_unlock(&wal->lock);
+    return false;
+  }
+
+  char *record = wal->data + wal->length;
+  _u32_encode(record, WAL_BATCH_FLAG | keys->count);
+  _u32_encode(record + WAL_WORD_SIZE, str_hash_n(record, WAL_WORD_SIZE));
+  record += WAL_BATCH_HEADER_SIZE;
+
+  for (uint32_t i = 0; i < keys->count; i++) {
+    size_t length;
+    const char *key = string_list_get(keys, i, &length);
+    _record_encode(record, key, length, values + i * wal->num_values, wal->num_values);
+    record += _record_size(length, wal->num_values);
+  }
+
+  wal->length += size;
+  wal->size += size;
+  *seq = ++wal->appended;
+  pthread_mutex_unlock(&wal->lock);
+  return true;
+}
+
+/**
+ * @brief Waits until a record (and every record before it) is on disk.
+ * The records appended by several writers are written and synced together:
+ * the first writer writes whatever was appended while it was syncing, until
+ * its record is on disk.
+ *
+ * @param wal The log.
+ * @param seq Sequence number of the record (see wal_append).
+ * @return false on error, true on success.
+ */
+bool wal_commit(wal_t *wal, uint64_t seq) {
+  pthread_mutex_lock(&wal->lock);
+  while (wal->durable < seq && !wal->failed) {
+    if (wal->flushing) {
+      pthread_cond_wait(&wal->cond, &wal->lock);
+      continue;
+    }
+
+    /* writes what was appended so far, while the other writers keep appending into the spare buffer */
+    char *data = wal->data;
+    size_t length = wal->length;
+    size_t capacity = wal->capacity;
+    uint64_t last = wal->appended;
+
+    wal->data = wal->spare;
+    wal->capacity = wal->spare_capacity;
+    wal->length = 0;
+    wal->flushing = true;
+    pthread_mutex_unlock(&wal->lock);
+
+    bool success = _write_all(wal->fd, data, length) && fdatasync(wal->fd) == 0;
+
+    pthread_mutex_lock(&wal->lock);
+    wal->spare = data;
+    wal->spare_capacity = capacity;
+    wal->flushing = false;
+    if (success) {
+      wal->durable = last;
+    } else {
+      perror("Failed writing the log");
+      wal->failed = true;
+    }
+    pthread_cond_broadcast(&wal->cond);
+  }
+
+  bool success = wal->durable >= seq;
+  pthread_mutex_unlock(&wal->lock);
+  return success;
+}
+
+/**
+ * @brief Commits every record and starts a new log, renaming the current one
+ * (e.g. once a snapshot covers its records, it can be removed).
+ * Records must not be appended meanwhile.
+ *
+ * @param wal The log.
+ * @param old_path New path of the current log.
+ * @return false on error, true on success.
+ */
+bool wal_rotate(wal_t *wal, const char *old_path) {
+  if (!wal_commit(wal, wal->appended))
+    return false;
+
+  pthread_mutex_lock(&wal->lock);
+  if (rename(wal->path, old_path) != 0) {
+    perror("Failed rotating the log");
+    pthread_mutex_unlock(&wal->lock);
+    return false;
+  }
+
+  /* keeps appending to the current log if the new one can't be created */
+  int fd = open(wal->path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  if (fd < 0) {
+    perror("Failed rotating the log");
+    rename(old_path, wal->path);
+    pthread_mutex_unlock(&wal->lock);
+    return false;
+  }
+
+  close(wal->fd);
+  wal->fd = fd;
+  wal->size = 0;
+  bool success = _sync_dir(wal->path);
+  pthread_mutex_unlock(&wal->lock);
+  return success;
+}
+
+/**
+ * @brief Returns the size of the log.
+ *
+ * @param wal The log.
+ * @return size (in bytes), including the records not committed yet.
+ */
+size_t wal_size(wal_t *wal) {
+  pthread_mutex_lock(&wal->lock);
+  size_t size = wal->size;
+  pthread_mutex_unlock(&wal->lock);
+  return size;
+}
+
+/**
+ * @brief Commits every record and closes the log.
+ *
+ * @param wal The log.
+ * @return false if some record couldn't be committed, true on success.
+ */
+bool wal_close(wal_t *wal) {
+  bool success = wal_commit(wal, wal->appended);
+
+  close(wal->fd);
+  pthread_cond_destroy(&wal->cond);
+  pthread_mutex_destroy(&wal->lock);
+  free(wal->data);
+  free(wal->spare);
+  free(wal->path);
+  free(wal);
+  return success;
+}
@@ -0,0 +1,48 @@
+#ifndef WAL_H
+#define WAL_H
+
+/**
+ * @brief This module implements a write-ahead log of store records.
+ *
+ * Every update of a store is appended to the log (the key and the whole
+ * record after the update, so replaying a record twice is harmless) before it
+ * is acknowledged. Appending only copies the record into memory: the records
+ * reach the disk when the writers commit them. Commits are grouped: the
+ * first writer that commits becomes the leader and writes every record
+ * appended so far with a single write and fdatasync, while the writers that
+ * commit meanwhile wait for it (and the next leader takes what they
+ * appended). So a burst of updates pays a single sync.
+ *
+ * Each record is checksummed: replay stops at the first torn or corrupted
+ * record (e.g. the tail of a crash), which is cut from the log. Records can
+ * also be appended as a batch (after a header with their number), which is
+ * replayed only if all of its records are valid.
+ */
+
+/* include area */
+#include "str.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Write-ahead log (see wal.c) */
+typedef struct wal wal_t;
+
+/** Callback that gets each record of a log on replay. */
+typedef void (*wal_replay_cb_t)(const string_t *key, const float_t *values, void *ctx);
+
+/*--------------------------------------------------------------------------
+   Prototypes
+--------------------------------------------------------------------------*/
+
+bool wal_replay(const char *path, size_t num_values, wal_replay_cb_t cb, void *ctx);
+wal_t *wal_open(const char *path, size_t num_values, wal_replay_cb_t cb, void *ctx);
+bool wal_append(wal_t *wal, const string_t *key, const float_t *values, uint64_t *seq);
+bool wal_append_batch(wal_t *wal, const string_list_t *keys, const float_t *values, uint64_t *seq);
+bool wal_commit(wal_t *wal, uint64_t seq);
+bool wal_rotate(wal_t *wal, const char *old_path);
+size_t wal_size(wal_t *wal);
+bool wal_close(wal_t *wal);
+
+#endif
@@ -1,6 +1,9 @@
 /* include area */
+#define _GNU_SOURCE
 #include "client.h"
+#include "json_alloc.h"
 #include "str.h"
+#include <jansson.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,6 +15,23 @@
 #define SECRET_PASSWORD "concutp2"
 #define INVALID_VALUE -999
 
+/** Max number of values of an update in a file (see batch_t) */
+#define BATCH_MAX_VALUES 3
+
+/** Size of the chunks of the arena where the long strings go (see str_set_arena) */
+#define ARENA_CHUNK_SIZE 4096
+
+/** Lists of a batch post: the keys and the values of each one (in the order of the file columns) */
+typedef struct {
+  /** Name of the key and the values in a JSONL update. */
+  const char *key_name;
+  const char *value_names[BATCH_MAX_VALUES];
+  size_t num_values;
+  /** Lists of the request. */
+  string_list_t *keys;
+  float_list_t *values[BATCH_MAX_VALUES];
+} batch_t;
+
 /**
  * @brief Prints a field through STDOUT.
  *
@@ -57,6 +77,10 @@ static void _print_help( ) {
   printf("\nAvailable REQ_TYPEs: \n");
   printf("Get weather : %d\nGet currency : %d \n", request_weather + 1, request_currency + 1);
   printf("Post weather : %d\nPost currency : %d \n", request_post_weather + 1, request_post_currency + 1);
+  printf("Get weather (batch) : %d\nGet currency (batch) : %d \n", request_batch_weather + 1,
+         request_batch_currency + 1);
+  printf("Post weather (file) : %d\nPost currency (file) : %d \n", request_post_batch_weather + 1,
+         request_post_batch_currency + 1);
   printf("\nAvailable OPTIONS: \n");
   printf("--pass: Defines password to attemp a post as administrator\n");
   printf("--c : Defines currency value (fails if administrator cannot authenticate)\n");
@@ -66,12 +90,20 @@ static void _print_help( ) {
   printf("\nSome usage examples:\n");
   printf("client %d \"buenos aires\" : Retrieves \"buenos aires\" city weather\n", request_weather + 1);
   printf("client %d \"Dolar\" : Retrieves \"Dolar\" currency value\n", request_currency + 1);
+  printf("client %d \"Dolar\" \"Euro\" : Retrieves \"Dolar\" and \"Euro\" currency values in one request\n",
+         request_batch_currency + 1);
   printf("client %d \"Dolar\" --pass PASS --c 18.00 : Sets \"Dolar\" currency value to 18 (if PASS is "
          "correct)\n",
          request_post_currency + 1);
   printf("client %d \"buenos aires\" --p 1001.1 --t 26.2 --pass PASS : Sets \"buenos aires\" presure to "
          "1001.1 and temperature to 26.2 (if PASS is correct)\n",
          request_post_weather + 1);
+  printf("client %d updates.csv --pass PASS : Sets the weather of every city in the file (if PASS is "
+         "correct)\n",
+         request_post_batch_weather + 1);
+  printf("\nThe files have an update per line, either JSON objects (e.g. {\"city\": \"salta\", "
+         "\"humidity\": 30}\nor {\"currency\": \"euro\", \"value\": 21.5}) or CSV lines "
+         "(city,humidity,pressure,temperature or\ncurrency,value). Missing values are not updated.\n");
 }
 
 /**
@@ -113,6 +145,32 @@ static bool _make_request(request_t *req, int argc, const char *argv[]) {
     case request_weather:
       str_init(&req->u.weather.city, argv[2]);
       return true;
+    case request_post_batch_weather:
+    case request_post_batch_currency:
+      /* the updates are read from the file (see _send_file) */
+      if (argc != 5 || strcmp(argv[3], "--pass")) {
+        _print_error_parsing( );
+        return false;
+      }
+      if (!_password_is_valid(argv[4])) {
+        printf("Authentication error: Password invalid!\n");
+        return false;
+      }
+      return true;
+    case request_batch_weather:
+    case request_batch_currency: {
+      /* every argument is a city/currency */
+      string_list_t *list = &req->u.batch_weather.cities;
+      if (req->type == request_batch_currency)
+        list = &req->u.batch_currency.currencies;
+      for (int i = 2; i < argc; i++) {
+        if (!string_list_append(list, argv[i], strlen(argv[i]))) {
+          _print_error_parsing( );
+          return false;
+        }
+      }
+      return true;
+    }
     // Admin (POST) requests
     case request_post_currency:
       if (argc != 7) {
@@ -225,13 +283,189 @@ static bool _parse_options(request_t *req, int argc, const char *argv[]) {
   return false;
 }
 
+/**
+ * @brief Sets up the lists of a batch post.
+ *
+ * @param batch Batch to set up.
+ * @param req Batch post request.
+ */
+static void _batch_init(batch_t *batch, request_t *req) {
+  if (req->type == request_post_batch_weather) {
+    request_post_batch_weather_t *b = &req->u.post_batch_weather;
+    *batch = (batch_t){.key_name = "city",
+                       .value_names = {"humidity", "pressure", "temperature"},
+                       .num_values = 3,
+                       .keys = &b->cities,
+                       .values = {&b->humidity, &b->pressure, &b->temperature}};
+  } else {
+    request_post_batch_currency_t *b = &req->u.post_batch_currency;
+    *batch = (batch_t){.key_name = "currency",
+                       .value_names = {"value"},
+                       .num_values = 1,
+                       .keys = &b->currencies,
+                       .values = {&b->values}};
+  }
+}
+
+/**
+ * @brief Parses an update (a line of the file).
+ *
+ * @param batch The batch (the names of its values).
+ * @param line JSON object or CSV line.
+ * @param key Key of the update (output).
+ * @param values Values of the update, INVALID_VALUE if missing (output).
+ * @return false on error, true on success.
+ */
+static bool _parse_update(const batch_t *batch, char *line, string_t *key, float_t *values) {
+  for (size_t i = 0; i < batch->num_values; i++)
+    values[i] = INVALID_VALUE;
+
+  if (line[strspn(line, " \t")] == '{') {
+    json_error_t error;
+    json_t *update = json_loads(line, 0, &error);
+    json_t *name = json_object_get(update, batch->key_name);
+    bool valid = json_is_string(name) && str_init(key, json_string_value(name));
+    for (size_t i = 0; valid && i < batch->num_values; i++) {
+      json_t *value = json_object_get(update, batch->value_names[i]);
+      if (json_is_number(value))
+        values[i] = json_number_value(value);
+      else if (value != NULL)
+        valid = false;
+    }
+
+    if (update != NULL)
+      json_decref(update);
+    return valid;
+  }
+
+  /* CSV: the key and then the values (an empty one is not updated) */
+  char *field = strsep(&line, ",");
+  if (!str_init(key, field) || str_len(key) == 0)
+    return false;
+
+  for (size_t i = 0; i < batch->num_values && line != NULL; i++) {
+    char *endptr;
+    field = strsep(&line, ",");
+    if (field[strspn(field, " ")] == '\0')
+      continue;
+
+    values[i] = strtof(field, &endptr);
+    if (endptr == field || endptr[strspn(endptr, " ")] != '\0')
+      return false;
+  }
+
+  return line == NULL;
+}
+
+/**
+ * @brief Sends a batch post and empties its lists.
+ *
+ * @param pool Connection to the server.
+ * @param req Batch post request.
+ * @param batch Lists of the request.
+ * @return false on error, true if every update was applied.
+ */
+static bool _send_batch(client_pool_t *pool, const request_t *req, batch_t *batch) {
+  response_t resp = {0};
+  if (!client_pool_send(pool, &resp, SERVER_PORT, req)) {
+    perror("Failed sending the request");
+    return false;
+  }
+
+  printf("%u updates: ", batch->keys->count);
+  if (!_print_response(&resp) || resp.type != response_result || cstr_cmp(&resp.u.result.message, "Success"))
+    return false;
+
+  batch->keys->count = 0;
+  for (size_t i = 0; i < batch->num_values; i++)
+    batch->values[i]->count = 0;
+  return true;
+}
+
+/**
+ * @brief Streams the updates of a file to the server, as batch posts of as
+ * many updates as they fit (through the same connection).
+ *
+ * @param req Batch post request.
+ * @param path File (JSONL or CSV).
+ * @return false on error, true on success.
+ */
+static bool _send_file(request_t *req, const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    perror("Failed opening the file");
+    return false;
+  }
+
+  client_pool_t *pool = client_pool_create(message_format_binary);
+  if (pool == NULL) {
+    perror("Failed connecting to the server");
+    fclose(file);
+    return false;
+  }
+
+  batch_t batch;
+  _batch_init(&batch, req);
+
+  /* the JSON of each update is released at once (see json_alloc.h) */
+  arena_t *arena = arena_create(ARENA_CHUNK_SIZE, 0);
+  arena_t *previous = json_alloc_set_arena(arena);
+
+  char *line = NULL;
+  size_t size = 0;
+  bool success = true;
+  for (size_t number = 1; success && getline(&line, &size, file) >= 0; number++) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[strspn(line, " \t")] == '\0')
+      continue;
+
+    string_t key;
+    float_t values[BATCH_MAX_VALUES];
+    bool parsed = _parse_update(&batch, line, &key, values);
+    if (arena != NULL)
+      arena_reset(arena);
+    if (!parsed) {
+      printf("Invalid update at line %zu\n", number);
+      success = false;
+      break;
+    }
+
+    /* sends the batch once it's full */
+    const char *name = str_to_cstr(&key);
+    if (!string_list_append(batch.keys, name, str_len(&key)))
+      success = _send_batch(pool, req, &batch) && string_list_append(batch.keys, name, str_len(&key));
+    for (size_t i = 0; success && i < batch.num_values; i++)
+      success = float_list_append(batch.values[i], values[i]);
+  }
+
+  if (success && batch.keys->count > 0)
+    success = _send_batch(pool, req, &batch);
+
+  json_alloc_set_arena(previous);
+  if (arena != NULL)
+    arena_destroy(arena);
+  free(line);
+  fclose(file);
+  client_pool_destroy(pool);
+  return success;
+}
+
 int main(int argc, const char *argv[]) {
+  json_alloc_init( );
+
+  /* the long strings (e.g. a long city name) are kept for the whole run */
+  str_set_arena(arena_create(ARENA_CHUNK_SIZE, 0));
+
   /* initializes the request */
   request_t req = {0};
 
   if (!_parse_options(&req, argc, argv))
     return 1;
 
+  /* the updates of a file go in as many requests as needed */
+  if (req.type == request_post_batch_weather || req.type == request_post_batch_currency)
+    return _send_file(&req, argv[2]) ? 0 : 1;
+
   /* sends the request and waits the response */
   response_t resp = {0};
   if (!client_send(&resp, SERVER_PORT, &req)) {
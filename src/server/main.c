@@ -1,17 +1,67 @@
 /* include area */
+#define _GNU_SOURCE
+#include "buffer.h"
+#include "cache.h"
 #include "client.h"
+#include "json_alloc.h"
+#include "log.h"
 #include "microservices.h"
+#include "router.h"
 #include "server.h"
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #define SELF_PORT 8002
 
+/** Max number of cached responses, and how long (in milliseconds) they are served */
+#define CACHE_CAPACITY 1024
+#define CACHE_TTL 2000
+
 /** Flag that indicates the program should finish */
 static bool exit_flag = false;
 
+/** Persistent connections to the microservices (shared by every server worker, binary encoded), used
+ * by the blocking handler. Each worker has its own asynchronous ones (see _upstreams_create). */
+static client_pool_t *upstreams = NULL;
+
+/** Responses to the GETs (binary encoded, see _handle_request) */
+static cache_t *responses = NULL;
+
+/** Instances of each microservice, and the keys each one holds (see router.h) */
+static router_t *router = NULL;
+
+/** Processes of the microservice instances (stopped if the portal fails to start) */
+static pid_t instances[ROUTER_MAX_SERVICES * ROUTER_MAX_INSTANCES];
+static size_t num_instances = 0;
+
+/** Instances a request goes to (see _route) */
+typedef struct {
+  request_type_t service;
+  /** The request carries a list of keys (a batch), otherwise a single key. */
+  bool batch;
+  /** Instance of each key. */
+  uint32_t num_keys;
+  uint8_t instances[LIST_MAX_ITEMS];
+} route_t;
+
+/** Request forwarded to the microservices, waiting for their responses (see _handle_request_async),
+ * in the arena of its call */
+typedef struct {
+  server_call_t *call;
+  /** Version given by the cache lookup that missed (see cache_put). */
+  uint64_t version;
+  /** Parts of the request without a response yet (plus one while they are sent, see _forward_done),
+   * and the responses merged so far. */
+  size_t pending;
+  size_t num_parts;
+  bool failed;
+  response_t resp;
+  request_t req;
+} forward_t;
+
 /**
  * @brief Handles exit signals.
  *
@@ -23,71 +73,534 @@ void sigint_handler(int signal) {
 }
 
 /**
- * @brief Middleware request handler.
+ * @brief Sets a response to a failed result.
+ *
+ * @param resp Response.
+ */
+static void _failed(response_t *resp) {
+  resp->type = response_result;
+  str_init(&resp->u.result.message, "Failed");
+}
+
+/**
+ * @brief Returns the number of items of a list field.
+ *
+ * @param list The field.
+ * @param type Type of the field (a list).
+ * @return the number of items (0 if the field is not a list).
+ */
+static uint32_t _list_count(const void *list, field_type_t type) {
+  if (type == field_type_string_list)
+    return (( const string_list_t * )list)->count;
+  if (type == field_type_float_list)
+    return (( const float_list_t * )list)->count;
+
+  return 0;
+}
+
+/**
+ * @brief Appends an item of a list field to another list.
+ *
+ * @param dst List where the item is appended.
+ * @param src List of the item.
+ * @param type Type of both lists.
+ * @param index Index of the item in src (a missing item is skipped).
+ */
+static void _list_append(void *dst, const void *src, field_type_t type, size_t index) {
+  if (index >= _list_count(src, type))
+    return;
+
+  if (type == field_type_string_list) {
+    size_t length;
+    const char *item = string_list_get(src, index, &length);
+    string_list_append(dst, item, length);
+  } else {
+    float_list_append(dst, (( const float_list_t * )src)->items[index]);
+  }
+}
+
+/**
+ * @brief Routes a request: its key (the first field) goes to the instance
+ * that holds it, and the keys of a batch may go to several instances.
+ *
+ * @param route Instances of the keys (output).
+ * @param r Request.
+ */
+static void _route(route_t *route, const request_t *r) {
+  const field_desc_t *field = &request_descs[r->type].fields[0];
+  const void *key = ( const char * )&r->u + field->offset;
+
+  route->service = get_base_request(r->type);
+  route->batch = field->type == field_type_string_list;
+  if (!route->batch) {
+    route->num_keys = 1;
+    route->instances[0] = router_instance(router, route->service, str_to_cstr(key), str_len(key));
+    return;
+  }
+
+  route->num_keys = _list_count(key, field->type);
+  for (uint32_t i = 0; i < route->num_keys; i++) {
+    size_t length;
+    const char *item = string_list_get(key, i, &length);
+    route->instances[i] = router_instance(router, route->service, item, length);
+  }
+}
+
+/**
+ * @brief Gets the part of a request that goes to an instance: the request
+ * itself if it has a single key, or the items of a batch whose keys are
+ * routed to the instance (the other list fields are split along the keys).
+ *
+ * @param route Route of the request (see _route).
+ * @param r Request.
+ * @param instance Index of the instance.
+ * @param part Storage for the part of a batch.
+ * @return The part, or NULL if nothing goes to the instance.
+ */
+static const request_t *_route_part(const route_t *route, const request_t *r, size_t instance,
+                                    request_t *part) {
+  if (!route->batch)
+    return route->instances[0] == instance ? r : NULL;
+
+  /* an empty batch still gets its answer, from the first instance */
+  bool found = route->num_keys == 0 && instance == 0;
+  const message_desc_t *desc = &request_descs[r->type];
+  *part = (request_t){.type = r->type};
+  for (uint32_t i = 0; i < route->num_keys; i++) {
+    if (route->instances[i] != instance)
+      continue;
+
+    found = true;
+    for (size_t f = 0; f < desc->num_fields; f++) {
+      const field_desc_t *field = &desc->fields[f];
+      _list_append(( char * )&part->u + field->offset, ( const char * )&r->u + field->offset, field->type, i);
+    }
+  }
+
+  return found ? part : NULL;
+}
+
+/**
+ * @brief Merges the response of a part of a request into the response of
+ * the whole request: the lists of batch responses are joined, and a result
+ * is a success only if every part succeeded.
+ *
+ * @param merged Response of the request (set by the first part).
+ * @param num_parts Number of parts merged so far (updated).
+ * @param part Response of a part.
+ */
+static void _merge_response(response_t *merged, size_t *num_parts, const response_t *part) {
+  if ((*num_parts)++ == 0) {
+    *merged = *part;
+    return;
+  }
+
+  if (part->type == merged->type && part->type != response_result) {
+    const message_desc_t *desc = &response_descs[part->type];
+    for (size_t f = 0; f < desc->num_fields; f++) {
+      const field_desc_t *field = &desc->fields[f];
+      const void *src = ( const char * )&part->u + field->offset;
+      for (uint32_t i = 0; i < _list_count(src, field->type); i++)
+        _list_append(( char * )&merged->u + field->offset, src, field->type, i);
+    }
+  } else if (merged->type == response_result && part->type == response_result) {
+    /* the first result that isn't a success is kept */
+    if (strcmp(str_to_cstr(&merged->u.result.message), "Success") == 0)
+      *merged = *part;
+  } else {
+    _failed(merged);
+  }
+}
+
+/**
+ * @brief Gets the target of a request that can be answered from the cache.
+ *
+ * @param r Request.
+ * @param target City/currency (output).
+ * @return false if the request is not cached (e.g. a post).
+ */
+static bool _cache_target(const request_t *r, const string_t **target) {
+  if (r->type == request_weather)
+    *target = &r->u.weather.city;
+  else if (r->type == request_currency)
+    *target = &r->u.currency.currency;
+  else
+    return false;
+
+  return true;
+}
+
+/**
+ * @brief Removes the cached responses of the cities/currencies a post updates.
+ *
+ * @param r Request.
+ */
+static void _cache_invalidate(const request_t *r) {
+  const string_list_t *targets = NULL;
+  request_type_t type = get_base_request(r->type);
+
+  switch (r->type) {
+    case request_post_weather: {
+      const string_t *city = &r->u.post_weather.city;
+      cache_invalidate(responses, type, str_to_cstr(city), str_len(city));
+      return;
+    }
+    case request_post_currency: {
+      const string_t *currency = &r->u.post_currency.currency;
+      cache_invalidate(responses, type, str_to_cstr(currency), str_len(currency));
+      return;
+    }
+    case request_post_batch_weather:
+      targets = &r->u.post_batch_weather.cities;
+      break;
+    case request_post_batch_currency:
+      targets = &r->u.post_batch_currency.currencies;
+      break;
+    default:
+      return;
+  }
+
+  for (uint32_t i = 0; i < targets->count; i++) {
+    size_t length;
+    const char *target = string_list_get(targets, i, &length);
+    cache_invalidate(responses, type, target, length);
+  }
+}
+
+/**
+ * @brief Answers a GET from the cache.
+ *
+ * @param resp Cached response (output).
+ * @param r Request.
+ * @param version Version to store the response on a miss (output, see cache_put).
+ * @return true if the response was cached.
+ */
+static bool _cache_lookup(response_t *resp, const request_t *r, uint64_t *version) {
+  const string_t *target = NULL;
+  char cached[CACHE_MAX_VALUE];
+  if (!_cache_target(r, &target))
+    return false;
+
+  size_t size = cache_get(responses, r->type, str_to_cstr(target), str_len(target), cached, version);
+  mem_reader_t reader = {.data = cached, .length = size};
+  if (size == 0 || !response_deserialize_as(resp, message_format_binary, mem_reader_read, &reader))
+    return false;
+
+  LOG_DEBUG("[SERVER] sending cached response: %s\n", response_str(resp));
+  return true;
+}
+
+/**
+ * @brief Caches the response to a GET (unless the target was updated since the lookup).
+ *
+ * @param r Request.
+ * @param resp Response of the microservice.
+ * @param version Version given by the lookup (see _cache_lookup).
+ */
+static void _cache_store(const request_t *r, const response_t *resp, uint64_t version) {
+  const string_t *target = NULL;
+  char cached[CACHE_MAX_VALUE];
+  mem_writer_t writer = {.data = cached, .size = sizeof(cached)};
+  if (_cache_target(r, &target) &&
+      response_serialize_as(resp, message_format_binary, mem_writer_write, &writer))
+    cache_put(responses, r->type, str_to_cstr(target), str_len(target), cached, writer.length, version);
+}
+
+/**
+ * @brief Middleware request handler (blocking).
+ * GETs are answered from the cache when possible, and posts invalidate the
+ * responses they update (once the microservice applied them).
  *
  * @param response to be formed, request sent by client, and server struct entity.
  */
 static void _handle_request(response_t *resp, const request_t *r, const server_t *serv) {
-  /* prints the request */
-  printf("[SERVER] got request: ");
-  request_print(r);
+  /* logs the request */
+  LOG_DEBUG("[SERVER] got request: %s\n", request_str(r));
+
+  uint64_t version = 0;
+  if (_cache_lookup(resp, r, &version))
+    return;
 
-  /* Send request to relevant microservice. */
-  int port = SELF_PORT + 1 + get_base_request(r->type);
-  if (!client_send(resp, port, r)) {
+  /* Send request to the instances of the relevant microservice. */
+  route_t route;
+  size_t num_parts = 0;
+  bool sent = true;
+  _route(&route, r);
+  for (size_t i = 0; sent && i < router_instances(router, route.service); i++) {
+    request_t storage;
+    response_t part_resp = {0};
+    const request_t *part = _route_part(&route, r, i, &storage);
+    if (part == NULL)
+      continue;
+
+    sent = client_pool_send(upstreams, &part_resp, router_port(router, route.service, i), part);
+    if (sent)
+      _merge_response(resp, &num_parts, &part_resp);
+  }
+
+  _cache_invalidate(r);
+  if (!sent) {
     perror("Error sending the request to the microservice");
+    _failed(resp);
     return;
   }
 
-  /* prints the response */
-  printf("[SERVER] sending response: ");
-  response_print(resp);
+  _cache_store(r, resp, version);
+
+  /* logs the response */
+  LOG_DEBUG("[SERVER] sending response: %s\n", response_str(resp));
+}
+
+/**
+ * @brief Answers a forwarded request once every part got its response.
+ *
+ * @param forward The forwarded request.
+ */
+static void _forward_done(forward_t *forward) {
+  if (--forward->pending > 0)
+    return;
+
+  _cache_invalidate(&forward->req);
+  if (forward->failed) {
+    perror("Error sending the request to the microservice");
+    _failed(&forward->resp);
+  } else {
+    _cache_store(&forward->req, &forward->resp, forward->version);
+  }
+
+  /* logs the response */
+  LOG_DEBUG("[SERVER] sending response: %s\n", response_str(&forward->resp));
+
+  /* releases the forwarded request too */
+  server_call_respond(forward->call, &forward->resp);
+}
+
+/**
+ * @brief Merges the response of an instance into the forwarded request.
+ *
+ * @param resp Response (NULL if the part failed).
+ * @param ctx The forwarded request.
+ */
+static void _on_upstream_response(response_t *resp, void *ctx) {
+  forward_t *forward = ctx;
+  if (resp == NULL)
+    forward->failed = true;
+  else
+    _merge_response(&forward->resp, &forward->num_parts, resp);
+
+  _forward_done(forward);
+}
+
+/**
+ * @brief Middleware request handler (asynchronous): like _handle_request,
+ * but the worker doesn't wait for the microservice, it keeps serving the
+ * other requests until the response arrives (see _on_upstream_response).
+ *
+ * @param call request being answered, request sent by client, and server struct entity.
+ */
+static void _handle_request_async(server_call_t *call, const request_t *r, const server_t *serv) {
+  /* logs the request */
+  LOG_DEBUG("[SERVER] got request: %s\n", request_str(r));
+
+  response_t resp = {0};
+  uint64_t version = 0;
+  if (_cache_lookup(&resp, r, &version)) {
+    server_call_respond(call, &resp);
+    return;
+  }
+
+  forward_t *forward = server_call_alloc(call, sizeof(forward_t));
+  if (forward == NULL) {
+    perror("Error sending the request to the microservice");
+    _failed(&resp);
+    server_call_respond(call, &resp);
+    return;
+  }
+
+  forward->call = call;
+  forward->version = version;
+  forward->pending = 1;
+  forward->num_parts = 0;
+  forward->failed = false;
+  forward->req = *r;
+
+  /* Send request to the instances of the relevant microservice (through the connections of this
+   * worker), the responses never arrive before every part is sent (see client_async_send). */
+  route_t route;
+  client_async_t *client = server_call_local(call);
+  _route(&route, r);
+  for (size_t i = 0; i < router_instances(router, route.service); i++) {
+    request_t storage;
+    const request_t *part = _route_part(&route, r, i, &storage);
+    uint16_t port = router_port(router, route.service, i);
+    if (part == NULL)
+      continue;
+
+    if (client_async_send(client, port, part, server_call_arena(call), _on_upstream_response, forward))
+      forward->pending++;
+    else
+      forward->failed = true;
+  }
+
+  _forward_done(forward);
+}
+
+/**
+ * @brief Opens the connections of a worker to the microservices (see server_local_t).
+ *
+ * @param fd Fd watched by the worker (output).
+ * @return The asynchronous client or NULL on error.
+ */
+static void *_upstreams_create(int *fd) {
+  client_async_t *client = client_async_create(message_format_binary);
+  if (client != NULL)
+    *fd = client_async_fd(client);
+
+  return client;
+}
+
+/**
+ * @brief Handles the responses that arrived through the connections of a worker.
+ *
+ * @param local The asynchronous client.
+ */
+static void _upstreams_process(void *local) {
+  client_async_process(local);
+}
+
+/**
+ * @brief Closes the connections of a worker.
+ *
+ * @param local The asynchronous client.
+ */
+static void _upstreams_destroy(void *local) {
+  client_async_destroy(local);
+}
+
+/**
+ * @brief Stops the microservice instances launched so far.
+ */
+static void _stop_microservices( ) {
+  for (size_t i = 0; i < num_instances; i++)
+    kill(instances[i], SIGINT);
+}
+
+/**
+ * @brief Parses the number of instances of each microservice (--weather N, --currency N).
+ *
+ * @param argc Number of arguments.
+ * @param argv Arguments.
+ * @param counts Number of instances of each microservice (output, by base request type).
+ * @return false on error (e.g. an unknown argument), true on success.
+ */
+static bool _parse_instances(int argc, const char *argv[], size_t *counts) {
+  for (int i = 1; i < argc; i += 2) {
+    request_type_t type = request_last;
+    if (strcmp(argv[i], "--weather") == 0)
+      type = request_weather;
+    else if (strcmp(argv[i], "--currency") == 0)
+      type = request_currency;
+
+    char *end = NULL;
+    long count = i + 1 < argc ? strtol(argv[i + 1], &end, 10) : 0;
+    if (type == request_last || end == argv[i + 1] || *end != '\0' || count < 1 ||
+        count > ROUTER_MAX_INSTANCES)
+      return false;
+
+    counts[type] = count;
+  }
+
+  return true;
 }
 
 int main(int argc, const char *argv[]) {
-  /* signal handling */
-  signal(SIGINT, sigint_handler);
+  /* before any JSON is loaded (the microservices convert their files) */
+  json_alloc_init( );
 
-  printf("Starting server...\n");
+  /* instances of each microservice (the keys are sharded among them) */
+  size_t counts[] = {[request_weather] = 1, [request_currency] = 1};
+  if (!_parse_instances(argc, argv, counts)) {
+    fprintf(stderr, "Usage: %s [--weather N] [--currency N] (1 to %d instances)\n", argv[0],
+            ROUTER_MAX_INSTANCES);
+    return 1;
+  }
 
-  server_t server;
-  if (!server_init(&server, SELF_PORT, _handle_request)) {
-    perror("Error al iniciar servidor");
+  /* the cities/currencies get the same IDs in every process (see intern.h) */
+  if (!intern_microservice_keys( ))
+    fprintf(stderr, "Warning: the keys of the microservices could not be interned\n");
+
+  router = router_create( );
+  for (request_type_t type = request_weather; router != NULL && type <= request_currency; type++) {
+    for (size_t i = 0; i < counts[type]; i++)
+      router_add(router, type, microservice_port(type, i));
+  }
+
+  if (router == NULL) {
+    perror("Error al crear la tabla de rutas");
     return 1;
   }
 
-  printf("server started!\n");
+  /* signal handling */
+  signal(SIGINT, sigint_handler);
 
-  /* microservicios */
+  /* microservicios (forked before starting the server threads, a child
+   * only inherits the thread that called fork) */
   printf("Launching microservices..\n");
 
-  int fork_weather = fork( );
-  if (fork_weather < 0) {
-    perror("Error al iniciar el servicio del clima");
-    return 2;
+  for (request_type_t type = request_weather; type <= request_currency; type++) {
+    for (size_t i = 0; i < counts[type]; i++) {
+      pid_t pid = fork( );
+      if (pid < 0) {
+        perror("Error al iniciar un microservicio");
+        _stop_microservices( );
+        return 2;
+      }
+
+      if (pid == 0) {
+        router_destroy(router);
+        return launch_microservice(type, i, counts[type], &exit_flag);
+      }
+
+      instances[num_instances++] = pid;
+    }
   }
 
-  if (fork_weather == 0)
-    return launch_microservice(request_weather, &exit_flag);
+  printf("Starting server...\n");
 
-  int fork_currency = fork( );
+  upstreams = client_pool_create(message_format_binary);
+  responses = cache_create(CACHE_CAPACITY, CACHE_TTL);
+  if (upstreams == NULL || responses == NULL) {
+    perror("Error al crear el pool de conexiones");
+    _stop_microservices( );
+    return 1;
+  }
 
-  if (fork_currency < 0) {
-    perror("Error al iniciar el servicio de divisas");
-    return 2;
+  server_t server = {0};
+  server.async_handler = _handle_request_async;
+  server.local = (server_local_t){_upstreams_create, _upstreams_process, _upstreams_destroy};
+  if (!server_init(&server, SELF_PORT, _handle_request, server_mode_reactor, SERVER_WORKERS_AUTO)) {
+    perror("Error al iniciar servidor");
+    client_pool_destroy(upstreams);
+    cache_destroy(responses);
+    _stop_microservices( );
+    return 1;
   }
 
-  if (fork_currency == 0)
-    return launch_microservice(request_currency, &exit_flag);
+  printf("server started!\n");
 
   /* handles client requests */
   while (!exit_flag) {
-    printf("waiting connection...\n");
     if (!server_handle_request(&server)) {
       break;
     }
   }
 
   server_stop(&server);
+  client_pool_destroy(upstreams);
+  cache_destroy(responses);
+  router_destroy(router);
+
+  /* writes the records still in the rings of the log */
+  log_close( );
   return 0;
 }
@@ -1,82 +1,618 @@
+#define _GNU_SOURCE
 #include "microservices.h"
-#include <jansson.h>
+#include "buffer.h"
+#include "epoch.h"
+#include "intern.h"
+#include "log.h"
+#include "router.h"
+#include "snapshot.h"
+#include "store.h"
+#include "wal.h"
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
 #define WEATHER_JSON_FILE "weather.json"
+#define WEATHER_SNAPSHOT_FILE "weather.snap"
+#define WEATHER_LOG_FILE "weather.wal"
 #define CURRENCY_JSON_FILE "currency.json"
+#define CURRENCY_SNAPSHOT_FILE "currency.snap"
+#define CURRENCY_LOG_FILE "currency.wal"
 #define INVALID_VALUE -999
 #define VALID(n) (n) != INVALID_VALUE
 
-typedef struct weather_ctx { json_t *json; } weather_ctx_t;
+/** Seconds between checks of the log size, and size (in bytes) of the log that triggers a snapshot */
+#define SNAPSHOT_INTERVAL 10
+#define SNAPSHOT_LOG_SIZE (1 << 20)
 
-typedef struct currency_ctx { json_t *json; } currency_ctx_t;
+/** Number of microservices (the base request types): the instances of each one take every
+ * NUM_MICROSERVICES ports from SELF_PORT + 1 on (see microservice_port) */
+#define NUM_MICROSERVICES (request_currency + 1)
+
+/** Size of the names of the state files of an instance */
+#define STATE_FILE_NAME_SIZE 64
+
+/** Number of serialization formats, and max size of the encoded fields of a GET response */
+#define NUM_FORMATS (message_format_binary + 1)
+#define ENCODED_MAX_SIZE 128
+
+/** Fields of the GET response of a key, serialized in a format (see _micro_encoded_response) */
+typedef struct {
+  size_t length;
+  char data[];
+} encoded_t;
+
+/** Files where the state of a microservice is kept */
+typedef struct {
+  /** Initial state (JSON), the first snapshot is converted from it. */
+  const char *json;
+  /** Snapshot of the state (see snapshot.h). */
+  const char *snapshot;
+  /** Updates since the snapshot, and updates of a rotated log that may not be in the snapshot yet. */
+  const char *log;
+  const char *old_log;
+  /** Names of the record values (NULL if a record is a single number). */
+  const char *const *fields;
+  size_t num_values;
+} state_files_t;
+
+/* The state is the snapshot plus the updates in the log: the handlers run
+ * concurrently in every server worker. GETs don't take any lock, they read
+ * inside an epoch read section (see epoch.h), so POSTs never block them.
+ * POSTs take the write lock (and they log the update before answering). */
+typedef struct micro_state {
+  /** Records of the last snapshot (memory mapped), updates being saved into
+   * the next snapshot (NULL if none) and later updates. Replaced with atomic
+   * stores under the write lock, the old ones are retired. */
+  snapshot_t *snapshot;
+  store_t *frozen;
+  store_t *store;
+  wal_t *wal;
+  pthread_mutex_t write_lock;
+
+  /** Instance of the microservice: it only holds the keys routed to it (see router.h),
+   * in its own files (named after the instance, unless it's the only one). */
+  request_type_t type;
+  size_t instance;
+  size_t num_instances;
+  state_files_t files;
+  char file_names[3][STATE_FILE_NAME_SIZE];
+
+  /** Fields of the GET responses already serialized, by the ID of their key (see str_id) and format
+   * (num_ids * NUM_FORMATS). Built on the first GET of a key and published with an atomic store, so
+   * GETs read them inside their read section; retired when the key is set. The generation of a key
+   * changes on every set, so a GET that read the record before doesn't keep its response. */
+  encoded_t **encoded;
+  uint32_t *generations;
+  size_t num_ids;
+
+  /** Background snapshots (stop is guarded by snapshot_lock). */
+  pthread_t snapshotter;
+  pthread_mutex_t snapshot_lock;
+  pthread_cond_t snapshot_cond;
+  bool stop;
+} micro_state_t;
+
+typedef micro_state_t weather_ctx_t;
+typedef micro_state_t currency_ctx_t;
+
+/* values in the records of the weather store */
+enum { weather_humidity, weather_temperature, weather_pressure, weather_num_values };
+
+static const char *const weather_fields[] = {"humidity", "temperature", "pressure"};
+
+static const state_files_t weather_files = {
+    .json = WEATHER_JSON_FILE,
+    .snapshot = WEATHER_SNAPSHOT_FILE,
+    .log = WEATHER_LOG_FILE,
+    .old_log = WEATHER_LOG_FILE ".old",
+    .fields = weather_fields,
+    .num_values = weather_num_values,
+};
+
+static const state_files_t currency_files = {
+    .json = CURRENCY_JSON_FILE,
+    .snapshot = CURRENCY_SNAPSHOT_FILE,
+    .log = CURRENCY_LOG_FILE,
+    .old_log = CURRENCY_LOG_FILE ".old",
+    .fields = NULL,
+    .num_values = 1,
+};
+
+/** Keys of an instance (see _in_slice) */
+typedef struct {
+  router_t *router;
+  request_type_t type;
+  size_t instance;
+} slice_t;
 
 /**
- * @brief Allocates the context for a microsever of type weather.
+ * @brief Selects the keys routed to an instance (see snapshot_filter_t).
  *
- * @param pointer to server structure.
+ * @param key Key characters.
+ * @param length Key length.
+ * @param ctx The slice of the instance.
+ * @return true if the key belongs to the instance.
  */
-void _create_weather_context(server_t *serv) {
-  weather_ctx_t *context = malloc(sizeof(weather_ctx_t));
-  if (context == NULL) {
-    perror("Failed micro-context allocation!");
-    return;
+static bool _in_slice(const char *key, size_t length, void *ctx) {
+  const slice_t *slice = ctx;
+  return router_instance(slice->router, slice->type, key, length) == slice->instance;
+}
+
+/**
+ * @brief Converts the JSON file of a microservice into the snapshot of an
+ * instance, with only the keys routed to it (the same routes as the portal).
+ *
+ * @param state The state.
+ * @return false on error, true on success.
+ */
+static bool _snapshot_from_json(const micro_state_t *state) {
+  const state_files_t *files = &state->files;
+  if (state->num_instances < 2)
+    return snapshot_from_json(files->json, files->snapshot, NULL, NULL);
+
+  slice_t slice = {.router = router_create( ), .type = state->type, .instance = state->instance};
+  bool success = slice.router != NULL;
+  for (size_t i = 0; success && i < state->num_instances; i++)
+    success = router_add(slice.router, state->type, microservice_port(state->type, i));
+
+  success = success && snapshot_from_json(files->json, files->snapshot, _in_slice, &slice);
+  if (slice.router != NULL)
+    router_destroy(slice.router);
+  return success;
+}
+
+/**
+ * @brief Maps the snapshot of a microservice, converting it from its JSON
+ * file the first time.
+ *
+ * @param state The state (its files and instance).
+ * @return The snapshot or NULL on error (or if its records don't have the expected values).
+ */
+static snapshot_t *_open_snapshot(const micro_state_t *state) {
+  const state_files_t *files = &state->files;
+  snapshot_t *snapshot = snapshot_open(files->snapshot);
+  if (snapshot == NULL && errno == ENOENT && _snapshot_from_json(state))
+    snapshot = snapshot_open(files->snapshot);
+
+  if (snapshot == NULL)
+    return NULL;
+
+  const snapshot_header_t *header = snapshot_header(snapshot);
+  bool valid = header->num_values == files->num_values && !(header->flags & SNAPSHOT_FLAG_PLAIN) == !!files->fields;
+  for (size_t i = 0; valid && files->fields && i < files->num_values; i++)
+    valid = strcmp(snapshot_fields(snapshot)[i].name, files->fields[i]) == 0;
+
+  if (!valid) {
+    snapshot_close(snapshot);
+    return NULL;
   }
-  serv->context = context;
-  json_error_t json_load_error;
-  json_t *weather_json = json_load_file(WEATHER_JSON_FILE, 0, &json_load_error);
-  if (weather_json == NULL) {
-    perror("Failed JSON load of weather file!");
+
+  return snapshot;
+}
+
+/**
+ * @brief Saves a new snapshot with the records of the current one and some updates.
+ *
+ * @param state The state.
+ * @param updates Updates (they replace the records of the current snapshot).
+ * @return The new snapshot (already on disk) or NULL on error.
+ */
+static snapshot_t *_save_snapshot(const micro_state_t *state, const store_t *updates) {
+  const snapshot_t *base = state->snapshot;
+  if (!snapshot_save(state->files.snapshot, snapshot_header(base), snapshot_fields(base), base, updates))
+    return NULL;
+
+  return _open_snapshot(state);
+}
+
+/**
+ * @brief Looks up a record: the later updates first, then the snapshot.
+ * Readers must be in a read section (or hold the write lock).
+ *
+ * @param state The state.
+ * @param key Key.
+ * @return The record or NULL if the key is not in the state.
+ */
+static const float_t *_state_get(micro_state_t *state, const string_t *key) {
+  /* loaded in the opposite order they are published (see _snapshot), so no update is missed */
+  const float_t *record = store_get(__atomic_load_n(&state->store, __ATOMIC_ACQUIRE), key);
+  const store_t *frozen = __atomic_load_n(&state->frozen, __ATOMIC_ACQUIRE);
+  if (record == NULL && frozen != NULL)
+    record = store_get(frozen, key);
+  if (record == NULL)
+    record = snapshot_get(__atomic_load_n(&state->snapshot, __ATOMIC_ACQUIRE), key);
+
+  return record;
+}
+
+/**
+ * @brief Gets where the encoded fields of a key are published.
+ *
+ * @param state The state.
+ * @param id ID of the key (interned, see str_id).
+ * @param format Serialization format.
+ * @return The slot.
+ */
+static encoded_t **_encoded_slot(micro_state_t *state, uint32_t id, message_format_t format) {
+  return &state->encoded[(id - 1) * NUM_FORMATS + format];
+}
+
+/**
+ * @brief Drops the encoded responses of a key, once its record is updated
+ * (a GET that read the old record sees the new generation, see _encoded_build).
+ * The write lock must be held.
+ *
+ * @param state The state.
+ * @param id ID of the key (0 if it's not interned, then it has none).
+ */
+static void _state_invalidate(micro_state_t *state, uint32_t id) {
+  if (id == 0 || id > state->num_ids)
     return;
+
+  __atomic_add_fetch(&state->generations[id - 1], 1, __ATOMIC_SEQ_CST);
+  for (int format = 0; format < NUM_FORMATS; format++) {
+    encoded_t *old = __atomic_exchange_n(_encoded_slot(state, id, format), NULL, __ATOMIC_SEQ_CST);
+    if (old != NULL)
+      epoch_retire(old, free);
   }
-  context->json = weather_json;
 }
 
 /**
- * @brief Frees the resources associated to the weather microserv. Optionally writes the state to disk.
+ * @brief Sets a record, logging it (see wal_commit).
+ * The write lock must be held.
  *
- * @param pointer to server structure & bool to save state.
+ * @param state The state.
+ * @param key Key.
+ * @param values Record.
+ * @param seq Sequence number of the update in the log (output).
+ * @return false on error, true on success.
  */
-void _finish_weather_service(server_t *serv, bool save_state) {
-  weather_ctx_t *ctx = serv->context;
-  if (json_dump_file(ctx->json, WEATHER_JSON_FILE, 0) == -1) {
-    perror("Error saving weather state to file");
+static bool _state_put(micro_state_t *state, const string_t *key, const float_t *values, uint64_t *seq) {
+  /* logged first, so the state never has an update that isn't in the log */
+  if (!wal_append(state->wal, key, values, seq))
+    return false;
+
+  if (!store_put(state->store, key, values)) {
+    perror("Failed updating the state");
+    return false;
   }
-  json_decref(ctx->json);
-  free(ctx);
+
+  _state_invalidate(state, str_id(key));
+  return true;
 }
 
 /**
- * @brief Frees the resources associated to the currency microserv. Optionally writes the state to disk.
+ * @brief Sets a batch of records, logging them as a whole (see wal_append_batch).
+ * The room for the records is reserved before logging them, so once the batch
+ * is in the log it's applied to the state as a whole too.
+ * The write lock must be held.
  *
- * @param pointer to server structure & bool to save state.
+ * @param state The state.
+ * @param keys Keys.
+ * @param values Records (one after the other, in the same order as the keys).
+ * @param seq Sequence number of the batch in the log (output).
+ * @return false on error, true on success.
  */
-void _finish_currency_service(server_t *serv, bool save_state) {
-  weather_ctx_t *ctx = serv->context;
-  if (json_dump_file(ctx->json, CURRENCY_JSON_FILE, 0) == -1) {
-    perror("Error saving currency state to file");
+static bool _state_put_batch(micro_state_t *state, const string_list_t *keys, const float_t *values,
+                             uint64_t *seq) {
+  size_t keys_length = 0;
+  for (uint32_t i = 0; i < keys->count; i++) {
+    size_t length;
+    string_list_get(keys, i, &length);
+    keys_length += length;
+  }
+
+  if (!store_reserve(state->store, keys->count, keys_length)) {
+    perror("Failed updating the state");
+    return false;
   }
-  json_decref(ctx->json);
-  free(ctx);
+
+  if (!wal_append_batch(state->wal, keys, values, seq))
+    return false;
+
+  /* the puts don't fail, there's room for every record */
+  for (uint32_t i = 0; i < keys->count; i++) {
+    size_t length;
+    const char *name = string_list_get(keys, i, &length);
+    store_put_n(state->store, name, length, values + i * state->files.num_values);
+    _state_invalidate(state, intern_find(name, length, str_hash_n(name, length)));
+  }
+
+  return true;
 }
 
 /**
- * @brief Allocates the context for a microsever of type currency.
+ * @brief Destroys a retired snapshot (see epoch_retire).
  *
- * @param pointer to server structure.
+ * @param ptr The snapshot.
+ */
+static void _snapshot_destroy(void *ptr) {
+  snapshot_close(ptr);
+}
+
+/**
+ * @brief Destroys a retired store (see epoch_retire).
+ *
+ * @param ptr The store.
+ */
+static void _store_destroy(void *ptr) {
+  store_destroy(ptr);
+}
+
+/**
+ * @brief Log replay callback: sets a record of the store.
+ *
+ * @param key Key.
+ * @param values Record.
+ * @param ctx The store.
+ */
+static void _replay_record(const string_t *key, const float_t *values, void *ctx) {
+  store_put(ctx, key, values);
+}
+
+/**
+ * @brief Takes a snapshot of the state, removing the updates it covers from the log.
+ * The updates so far are frozen (and the log is rotated) while the writers
+ * are blocked (readers never are), then they are saved with the records of the current snapshot
+ * in the background, and finally the new snapshot replaces the current one.
+ *
+ * @param state The state.
+ * @return false on error, true on success.
+ */
+static bool _snapshot(micro_state_t *state) {
+  /* a snapshot that failed is retried with the same updates (they are still in the rotated log) */
+  if (state->frozen == NULL) {
+    store_t *store = store_create(state->files.num_values);
+    if (store == NULL)
+      return false;
+
+    pthread_mutex_lock(&state->write_lock);
+    bool rotated = wal_rotate(state->wal, state->files.old_log);
+    if (rotated) {
+      __atomic_store_n(&state->frozen, state->store, __ATOMIC_RELEASE);
+      __atomic_store_n(&state->store, store, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&state->write_lock);
+
+    if (!rotated) {
+      store_destroy(store);
+      return false;
+    }
+  }
+
+  /* only this thread replaces the snapshot and the frozen updates, and nobody else writes them */
+  snapshot_t *snapshot = _save_snapshot(state, state->frozen);
+  if (snapshot == NULL) {
+    perror("Failed taking a snapshot of the state");
+    return false;
+  }
+
+  pthread_mutex_lock(&state->write_lock);
+  snapshot_t *old_snapshot = state->snapshot;
+  store_t *frozen = state->frozen;
+  __atomic_store_n(&state->snapshot, snapshot, __ATOMIC_RELEASE);
+  __atomic_store_n(&state->frozen, NULL, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&state->write_lock);
+
+  /* readers may still be looking at them */
+  epoch_retire(old_snapshot, _snapshot_destroy);
+  epoch_retire(frozen, _store_destroy);
+  unlink(state->files.old_log);
+  return true;
+}
+
+/**
+ * @brief Background snapshots: once the log gets large, a snapshot replaces it.
+ *
+ * @param arg The state.
+ * @return NULL.
+ */
+static void *_snapshotter(void *arg) {
+  micro_state_t *state = arg;
+
+  pthread_mutex_lock(&state->snapshot_lock);
+  while (!state->stop) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += SNAPSHOT_INTERVAL;
+    pthread_cond_timedwait(&state->snapshot_cond, &state->snapshot_lock, &deadline);
+    if (state->stop)
+      break;
+
+    pthread_mutex_unlock(&state->snapshot_lock);
+    if (state->frozen != NULL || wal_size(state->wal) >= SNAPSHOT_LOG_SIZE)
+      _snapshot(state);
+    pthread_mutex_lock(&state->snapshot_lock);
+  }
+  pthread_mutex_unlock(&state->snapshot_lock);
+
+  return NULL;
+}
+
+/**
+ * @brief Names the files of an instance after the files of its microservice
+ * (e.g. weather.snap.2), unless it's the only instance.
+ *
+ * @param state The state (its instance is already set).
+ * @param files Files of the microservice.
+ * @return false on error (a name is too long), true on success.
+ */
+static bool _instance_files(micro_state_t *state, const state_files_t *files) {
+  state->files = *files;
+  if (state->num_instances < 2)
+    return true;
+
+  const char *names[] = {files->snapshot, files->log, files->log};
+  const char *suffixes[] = {"", "", ".old"};
+  for (size_t i = 0; i < 3; i++) {
+    size_t size = sizeof(state->file_names[i]);
+    if (snprintf(state->file_names[i], size, "%s.%zu%s", names[i], state->instance, suffixes[i]) >= size)
+      return false;
+  }
+
+  state->files.snapshot = state->file_names[0];
+  state->files.log = state->file_names[1];
+  state->files.old_log = state->file_names[2];
+  return true;
+}
+
+/**
+ * @brief Loads the state of an instance of a microservice: the snapshot is
+ * only mapped (so the service can answer right away), and the updates in the
+ * logs are replayed.
+ *
+ * @param service_files Files of the microservice.
+ * @param type Type of the microservice.
+ * @param instance Index of the instance.
+ * @param num_instances Number of instances of the microservice.
+ * @return The state or NULL on error.
+ */
+static micro_state_t *_open_state(const state_files_t *service_files, request_type_t type, size_t instance,
+                                  size_t num_instances) {
+  micro_state_t *state = calloc(1, sizeof(micro_state_t));
+  if (state == NULL)
+    return NULL;
+
+  state->type = type;
+  state->instance = instance;
+  state->num_instances = num_instances;
+  if (!_instance_files(state, service_files)) {
+    free(state);
+    return NULL;
+  }
+
+  const state_files_t *files = &state->files;
+  state->snapshot = _open_snapshot(state);
+  state->store = store_create(files->num_values);
+  state->num_ids = intern_count( );
+  state->encoded = calloc(state->num_ids * NUM_FORMATS + 1, sizeof(encoded_t *));
+  state->generations = calloc(state->num_ids + 1, sizeof(uint32_t));
+
+  /* a rotated log is left behind if a snapshot didn't finish */
+  bool rotated = access(files->old_log, F_OK) == 0;
+  if (state->snapshot == NULL || state->store == NULL || state->encoded == NULL ||
+      state->generations == NULL ||
+      !wal_replay(files->old_log, files->num_values, _replay_record, state->store) ||
+      (state->wal = wal_open(files->log, files->num_values, _replay_record, state->store)) == NULL) {
+    if (state->snapshot != NULL)
+      snapshot_close(state->snapshot);
+    if (state->store != NULL)
+      store_destroy(state->store);
+    free(state->encoded);
+    free(state->generations);
+    free(state);
+    return NULL;
+  }
+
+  pthread_mutex_init(&state->write_lock, NULL);
+  pthread_mutex_init(&state->snapshot_lock, NULL);
+  pthread_cond_init(&state->snapshot_cond, NULL);
+
+  /* the next rotation would overwrite it, so its updates go to a snapshot first
+   * (the updates stay in the store too, they are the same as in the snapshot) */
+  if (rotated) {
+    snapshot_t *snapshot = _save_snapshot(state, state->store);
+    if (snapshot != NULL) {
+      snapshot_close(state->snapshot);
+      state->snapshot = snapshot;
+      unlink(files->old_log);
+    }
+  }
+
+  if (pthread_create(&state->snapshotter, NULL, _snapshotter, state) != 0) {
+    perror("pthread_create");
+    wal_close(state->wal);
+    snapshot_close(state->snapshot);
+    store_destroy(state->store);
+    free(state->encoded);
+    free(state->generations);
+    pthread_cond_destroy(&state->snapshot_cond);
+    pthread_mutex_destroy(&state->snapshot_lock);
+    pthread_mutex_destroy(&state->write_lock);
+    free(state);
+    return NULL;
+  }
+
+  return state;
+}
+
+/**
+ * @brief Releases the state of a microservice (its updates are already in the log).
+ *
+ * @param state The state.
  */
-void _create_currency_context(server_t *serv) {
-  currency_ctx_t *context = malloc(sizeof(currency_ctx_t));
-  if (context == NULL) {
-    perror("Failed micro-context allocation!");
+static void _close_state(micro_state_t *state) {
+  pthread_mutex_lock(&state->snapshot_lock);
+  state->stop = true;
+  pthread_cond_signal(&state->snapshot_cond);
+  pthread_mutex_unlock(&state->snapshot_lock);
+  pthread_join(state->snapshotter, NULL);
+
+  if (!wal_close(state->wal))
+    perror("Error saving state to the log");
+
+  /* the workers are stopped, so nobody is reading anymore */
+  epoch_flush( );
+  snapshot_close(state->snapshot);
+  if (state->frozen != NULL)
+    store_destroy(state->frozen);
+  store_destroy(state->store);
+  for (size_t i = 0; i < state->num_ids * NUM_FORMATS; i++)
+    free(state->encoded[i]);
+  free(state->encoded);
+  free(state->generations);
+  pthread_cond_destroy(&state->snapshot_cond);
+  pthread_mutex_destroy(&state->snapshot_lock);
+  pthread_mutex_destroy(&state->write_lock);
+  free(state);
+}
+
+/**
+ * @brief Allocates the context for a microsever of type weather.
+ *
+ * @param pointer to server structure, index of the instance and number of instances.
+ */
+void _create_weather_context(server_t *serv, size_t instance, size_t num_instances) {
+  serv->context = _open_state(&weather_files, request_weather, instance, num_instances);
+  if (serv->context == NULL) {
+    perror("Failed loading the weather state!");
     return;
   }
-  serv->context = context;
-  json_error_t json_load_error;
-  json_t *currency_json = json_load_file(CURRENCY_JSON_FILE, 0, &json_load_error);
-  if (currency_json == NULL) {
-    perror("Failed JSON load of currency file!");
+}
+
+/**
+ * @brief Frees the resources associated to the weather microserv.
+ * The state is already on disk (see _open_state).
+ *
+ * @param pointer to server structure.
+ */
+void _finish_weather_service(server_t *serv) {
+  if (serv->context != NULL)
+    _close_state(serv->context);
+}
+
+/**
+ * @brief Frees the resources associated to the currency microserv.
+ * The state is already on disk (see _open_state).
+ *
+ * @param pointer to server structure.
+ */
+void _finish_currency_service(server_t *serv) {
+  if (serv->context != NULL)
+    _close_state(serv->context);
+}
+
+/**
+ * @brief Allocates the context for a microsever of type currency.
+ *
+ * @param pointer to server structure, index of the instance and number of instances.
+ */
+void _create_currency_context(server_t *serv, size_t instance, size_t num_instances) {
+  serv->context = _open_state(&currency_files, request_currency, instance, num_instances);
+  if (serv->context == NULL) {
+    perror("Failed loading the currency state!");
     return;
   }
-  context->json = currency_json;
 }
 /**
  * @brief Fills a response with the weather status for a given city.
@@ -84,40 +620,103 @@ void _create_currency_context(server_t *serv) {
  * @param weather context of server (w/ structures), city name and struct* weather response.
  */
 bool _get_city_weather(weather_ctx_t *context, const string_t *city, response_weather_t *resp) {
-  json_t *weather_json = json_object_get(context->json, str_to_cstr(city));
-  if (weather_json == NULL) {
-    perror("Error trying to fetch weather info for city");
+  const float_t *record = _state_get(context, city);
+  if (record == NULL) {
     return false;
   }
-  // This doesn't lose memory because of borrowed references.
-  // https://jansson.readthedocs.io/en/2.10/apiref.html#c.json_decref
-  resp->humidity = json_integer_value(json_object_get(weather_json, "humidity"));
-  resp->pressure = json_real_value(json_object_get(weather_json, "pressure"));
-  resp->temperature = json_real_value(json_object_get(weather_json, "temperature"));
+
+  resp->humidity = record[weather_humidity];
+  resp->pressure = record[weather_pressure];
+  resp->temperature = record[weather_temperature];
 
   return true;
 }
 
 /**
- * @brief Updates the weather context with new valid values in a request.
+ * @brief Fills a batch response with the weather status of the cities that
+ * are found (in a single read section).
  *
- * @param weather context of server (w/ structures), city name and ptr to struct weather **request**.
+ * @param weather context of server (w/ structures), city names and struct* batch weather response.
  */
-bool _set_city_weather(weather_ctx_t *context, const string_t *city, const request_t *r) {
-  json_t *weather_json = json_object_get(context->json, str_to_cstr(city));
-  if (weather_json == NULL) {
+void _get_cities_weather(weather_ctx_t *context, const string_list_t *cities,
+                         response_batch_weather_t *resp) {
+  epoch_enter( );
+  for (uint32_t i = 0; i < cities->count; i++) {
+    string_t city;
+    size_t length;
+    const char *name = string_list_get(cities, i, &length);
+    const float_t *record = str_init_n(&city, name, length) ? _state_get(context, &city) : NULL;
+    if (record == NULL)
+      continue;
+
+    /* the response has room for every city of the request */
+    string_list_append(&resp->cities, name, length);
+    float_list_append(&resp->humidity, record[weather_humidity]);
+    float_list_append(&resp->pressure, record[weather_pressure]);
+    float_list_append(&resp->temperature, record[weather_temperature]);
+  }
+  epoch_exit( );
+}
+
+/**
+ * @brief Updates the weather context with new valid values in a request,
+ * logging the update (see wal_commit).
+ *
+ * @param weather context of server (w/ structures), city name, ptr to struct weather **request** and
+ * sequence number of the update in the log (output).
+ */
+bool _set_city_weather(weather_ctx_t *context, const string_t *city, const request_t *r, uint64_t *seq) {
+  const float_t *record = _state_get(context, city);
+  if (record == NULL) {
     perror("Error trying to fetch weather info for city");
     return false;
   }
   // We could define some macros to make this code less cluttered.
+  float_t updated[weather_num_values];
+  memcpy(updated, record, sizeof(updated));
   if (VALID(r->u.post_weather.humidity))
-    json_integer_set(json_object_get(weather_json, "humidity"), r->u.post_weather.humidity);
+    updated[weather_humidity] = r->u.post_weather.humidity;
   if (VALID(r->u.post_weather.pressure))
-    json_real_set(json_object_get(weather_json, "pressure"), r->u.post_weather.pressure);
+    updated[weather_pressure] = r->u.post_weather.pressure;
   if (VALID(r->u.post_weather.temperature))
-    json_real_set(json_object_get(weather_json, "temperature"), r->u.post_weather.temperature);
+    updated[weather_temperature] = r->u.post_weather.temperature;
 
-  return true;
+  return _state_put(context, city, updated, seq);
+}
+
+/**
+ * @brief Updates the weather context with a batch of new valid values, as a
+ * whole: nothing is updated if any city is not found (see _state_put_batch).
+ *
+ * @param weather context of server (w/ structures), ptr to struct batch weather **request** and
+ * sequence number of the batch in the log (output).
+ */
+bool _set_cities_weather(weather_ctx_t *context, const request_post_batch_weather_t *r, uint64_t *seq) {
+  uint32_t count = r->cities.count;
+  if (r->humidity.count != count || r->pressure.count != count || r->temperature.count != count)
+    return false;
+
+  float_t updated[LIST_MAX_ITEMS][weather_num_values];
+  for (uint32_t i = 0; i < count; i++) {
+    string_t city;
+    size_t length;
+    const char *name = string_list_get(&r->cities, i, &length);
+    const float_t *record = str_init_n(&city, name, length) ? _state_get(context, &city) : NULL;
+    if (record == NULL) {
+      fprintf(stderr, "Error trying to fetch weather info for city %s\n", name);
+      return false;
+    }
+
+    memcpy(updated[i], record, sizeof(updated[i]));
+    if (VALID(r->humidity.items[i]))
+      updated[i][weather_humidity] = r->humidity.items[i];
+    if (VALID(r->pressure.items[i]))
+      updated[i][weather_pressure] = r->pressure.items[i];
+    if (VALID(r->temperature.items[i]))
+      updated[i][weather_temperature] = r->temperature.items[i];
+  }
+
+  return _state_put_batch(context, &r->cities, &updated[0][0], seq);
 }
 
 /**
@@ -126,23 +725,39 @@ bool _set_city_weather(weather_ctx_t *context, const string_t *city, const reque
  * @param Pointers to response, request and server struct.
  */
 static void _handle_weather(response_t *resp, const request_t *r, const server_t *serv) {
-  printf("[MICROSERVICE] got request: ");
-  request_print(r);
-
   weather_ctx_t *context = ( weather_ctx_t * )serv->context;
-  if (r->type == request_post_weather) {
+  if (r->type == request_post_weather || r->type == request_post_batch_weather) {
     resp->type = response_result;
 
-    // Set weather.
-    if (!_set_city_weather(context, &r->u.weather.city, r)) {
+    // Set weather (a batch is applied in a single pass under the lock).
+    uint64_t seq;
+    bool updated;
+    pthread_mutex_lock(&context->write_lock);
+    if (r->type == request_post_weather)
+      updated = _set_city_weather(context, &r->u.weather.city, r, &seq);
+    else
+      updated = _set_cities_weather(context, &r->u.post_batch_weather, &seq);
+    pthread_mutex_unlock(&context->write_lock);
+
+    /* answered once the update is on disk (the sync is shared with the concurrent updates) */
+    updated = updated && wal_commit(context->wal, seq);
+
+    if (!updated) {
       str_init(&resp->u.result.message, "Failed");
     } else {
       str_init(&resp->u.result.message, "Success");
     }
+  } else if (r->type == request_batch_weather) {
+    resp->type = response_batch_weather;
+    _get_cities_weather(context, &r->u.batch_weather.cities, &resp->u.batch_weather);
   } else {
     // Get weather status.
     resp->type = response_weather;
-    if (!_get_city_weather(context, &r->u.weather.city, &resp->u.weather)) {
+    epoch_enter( );
+    bool found = _get_city_weather(context, &r->u.weather.city, &resp->u.weather);
+    epoch_exit( );
+
+    if (!found) {
       resp->type = response_result;
       str_init(&resp->u.result.message, "Not found");
     }
@@ -155,31 +770,88 @@ static void _handle_weather(response_t *resp, const request_t *r, const server_t
  * @param currency context of server (w/ structures) and currency name.
  */
 bool _get_currency_exchange(currency_ctx_t *context, const string_t *currency, float_t *exchange) {
-  json_t *value = json_object_get(context->json, str_to_cstr(currency));
+  const float_t *value = _state_get(context, currency);
   if (value == NULL) {
     return false;
   }
 
-  *exchange = json_real_value(value);
+  *exchange = *value;
   return true;
 }
 
 /**
- * @brief Updates the currency context with new valid values in a request.
+ * @brief Fills a batch response with the exchange values of the currencies
+ * that are found (in a single read section).
+ *
+ * @param currency context of server (w/ structures), currency names and struct* batch currency response.
+ */
+void _get_currencies_exchange(currency_ctx_t *context, const string_list_t *currencies,
+                              response_batch_currency_t *resp) {
+  epoch_enter( );
+  for (uint32_t i = 0; i < currencies->count; i++) {
+    string_t currency;
+    size_t length;
+    const char *name = string_list_get(currencies, i, &length);
+    const float_t *value = str_init_n(&currency, name, length) ? _state_get(context, &currency) : NULL;
+    if (value == NULL)
+      continue;
+
+    string_list_append(&resp->currencies, name, length);
+    float_list_append(&resp->quotes, *value);
+  }
+  epoch_exit( );
+}
+
+/**
+ * @brief Updates the currency context with new valid values in a request,
+ * logging the update (see wal_commit).
  *
- * @param currency context of server (w/ structures), city name and ptr to struct currency **request**.
+ * @param currency context of server (w/ structures), city name, ptr to struct currency **request** and
+ * sequence number of the update in the log (output).
  */
-bool _set_currency_exchange(currency_ctx_t *context, const string_t *currency, const request_t *r) {
-  json_t *currency_json = json_object_get(context->json, str_to_cstr(currency));
-  if (currency_json == NULL) {
+bool _set_currency_exchange(currency_ctx_t *context, const string_t *currency, const request_t *r,
+                            uint64_t *seq) {
+  const float_t *value = _state_get(context, currency);
+  if (value == NULL) {
     perror("Error trying to fetch currency info for coin");
     return false;
   }
   // As before, we could re-use some macros here.
+  float_t updated = *value;
   if (VALID(r->u.post_currency.value))
-    json_real_set(currency_json, r->u.post_currency.value);
+    updated = r->u.post_currency.value;
 
-  return true;
+  return _state_put(context, currency, &updated, seq);
+}
+
+/**
+ * @brief Updates the currency context with a batch of new valid values, as a
+ * whole: nothing is updated if any currency is not found (see _state_put_batch).
+ *
+ * @param currency context of server (w/ structures), ptr to struct batch currency **request** and
+ * sequence number of the batch in the log (output).
+ */
+bool _set_currencies_exchange(currency_ctx_t *context, const request_post_batch_currency_t *r,
+                              uint64_t *seq) {
+  uint32_t count = r->currencies.count;
+  if (r->values.count != count)
+    return false;
+
+  float_t updated[LIST_MAX_ITEMS];
+  for (uint32_t i = 0; i < count; i++) {
+    string_t currency;
+    size_t length;
+    const char *name = string_list_get(&r->currencies, i, &length);
+    const float_t *value = str_init_n(&currency, name, length) ? _state_get(context, &currency) : NULL;
+    if (value == NULL) {
+      fprintf(stderr, "Error trying to fetch currency info for coin %s\n", name);
+      return false;
+    }
+
+    updated[i] = VALID(r->values.items[i]) ? r->values.items[i] : *value;
+  }
+
+  return _state_put_batch(context, &r->currencies, updated, seq);
 }
 
 /**
@@ -188,21 +860,38 @@ bool _set_currency_exchange(currency_ctx_t *context, const string_t *currency, c
  * @param response and request structures, along with server structure.
  */
 static void _handle_currency(response_t *resp, const request_t *r, const server_t *serv) {
-  printf("[MICROSERVICE] got request: ");
-  request_print(r);
-
   currency_ctx_t *context = ( currency_ctx_t * )serv->context;
-  if (r->type == request_post_currency) {
+  if (r->type == request_post_currency || r->type == request_post_batch_currency) {
     resp->type = response_result;
 
-    printf("Updating currency value to %f\n", r->u.post_currency.value);
-    if (!_set_currency_exchange(context, &r->u.currency.currency, r)) {
+    uint64_t seq;
+    bool updated;
+    pthread_mutex_lock(&context->write_lock);
+    if (r->type == request_post_currency) {
+      LOG_DEBUG("Updating currency value to %f\n", r->u.post_currency.value);
+      updated = _set_currency_exchange(context, &r->u.currency.currency, r, &seq);
+    } else {
+      updated = _set_currencies_exchange(context, &r->u.post_batch_currency, &seq);
+    }
+    pthread_mutex_unlock(&context->write_lock);
+
+    /* answered once the update is on disk */
+    updated = updated && wal_commit(context->wal, seq);
+
+    if (!updated) {
       str_init(&resp->u.result.message, "Failed");
     } else {
       str_init(&resp->u.result.message, "Success");
     }
+  } else if (r->type == request_batch_currency) {
+    resp->type = response_batch_currency;
+    _get_currencies_exchange(context, &r->u.batch_currency.currencies, &resp->u.batch_currency);
   } else {
-    if (_get_currency_exchange(context, &r->u.currency.currency, &resp->u.currency.quote)) {
+    epoch_enter( );
+    bool found = _get_currency_exchange(context, &r->u.currency.currency, &resp->u.currency.quote);
+    epoch_exit( );
+
+    if (found) {
       resp->type = response_currency;
     } else {
       resp->type = response_result;
@@ -225,14 +914,14 @@ static void _micro_handle_request(response_t *resp, const request_t *r, const se
   // Furthermore, in the future we might add more context to the server struct
   // (pending discussion on PR #9)
 
+  /* the GETs answered by the encoded handler are logged there (see _micro_encoded_response) */
+  LOG_DEBUG("[MICROSERVICE] got request: %s\n", request_str(r));
+
   if (get_base_request(r->type) != serv->type && r->type != request_last) {
     perror("Sent request to wrong server!");
     return;
   }
 
-  /* Prop: Use a hash in order to save all pairs (city, weather) or
-   * (coin, value) */
-
   switch (get_base_request(serv->type)) {
     case request_weather:
       _handle_weather(resp, r, serv);
@@ -244,59 +933,173 @@ static void _micro_handle_request(response_t *resp, const request_t *r, const se
       break;
   }
 }
+/**
+ * @brief Serializes the fields of the GET response of a key and publishes them,
+ * unless another GET did it first (then it gets those) or the key is set
+ * meanwhile (then they are only used by this GET, see _state_invalidate).
+ * The caller must be in a read section.
+ *
+ * @param state The state.
+ * @param r The GET.
+ * @param resp Its response (the fields are set, the type must be set already).
+ * @param key Its key (interned).
+ * @param format Serialization format.
+ * @param stale Fields dropped because the key was set meanwhile, retired once
+ * the caller leaves its read section (output, NULL if none).
+ * @return The encoded fields or NULL if the key is not in the state (or on error).
+ */
+static encoded_t *_encoded_build(micro_state_t *state, const request_t *r, response_t *resp,
+                                 const string_t *key, message_format_t format, encoded_t **stale) {
+  uint32_t id = str_id(key);
+  uint32_t generation = __atomic_load_n(&state->generations[id - 1], __ATOMIC_SEQ_CST);
+  bool found = (r->type == request_weather) ? _get_city_weather(state, key, &resp->u.weather)
+                                            : _get_currency_exchange(state, key, &resp->u.currency.quote);
+
+  char fields[ENCODED_MAX_SIZE];
+  mem_writer_t writer = {.data = fields, .size = sizeof(fields)};
+  encoded_t *encoded = NULL;
+  if (!found || !response_serialize_fields_as(resp, format, mem_writer_write, &writer) ||
+      (encoded = malloc(sizeof(encoded_t) + writer.length)) == NULL)
+    return NULL;
+
+  encoded->length = writer.length;
+  memcpy(encoded->data, fields, writer.length);
+
+  encoded_t *published = NULL;
+  encoded_t **slot = _encoded_slot(state, id, format);
+  if (!__atomic_compare_exchange_n(slot, &published, encoded, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+    free(encoded);
+    return published;
+  }
+
+  /* the set may have dropped the fields before they were published (the set that changes the
+   * generation retires them otherwise) */
+  published = encoded;
+  if (__atomic_load_n(&state->generations[id - 1], __ATOMIC_SEQ_CST) != generation &&
+      __atomic_compare_exchange_n(slot, &published, NULL, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+    *stale = encoded;
+
+  return encoded;
+}
+
+/**
+ * @brief Answers a GET with its response already serialized: the fields of
+ * the response of each key are serialized on its first GET and kept until the
+ * key is set, so the next GETs only copy them (after the type and id). Only
+ * the interned keys keep them (see intern.h), the others are answered by the
+ * request handler.
+ *
+ * @param request, format and id of the response, output callback and its context, and server structure.
+ * @return false if the request is not a GET of a key in the state (the request handler answers it).
+ */
+static bool _micro_encoded_response(const request_t *r, message_format_t format, message_id_t id,
+                                    write_cb_t out, void *out_ctx, const server_t *serv) {
+  if (r->type != serv->type || (r->type != request_weather && r->type != request_currency))
+    return false;
+
+  micro_state_t *state = serv->context;
+  response_t resp = {.type = (r->type == request_weather) ? response_weather : response_currency};
+  const string_t *key = (r->type == request_weather) ? &r->u.weather.city : &r->u.currency.currency;
+  if (str_id(key) == 0 || str_id(key) > state->num_ids)
+    return false;
+
+  /* the fields are read inside the read section, a set retires them */
+  encoded_t *stale = NULL;
+  epoch_enter( );
+  encoded_t *encoded = __atomic_load_n(_encoded_slot(state, str_id(key), format), __ATOMIC_ACQUIRE);
+  if (encoded == NULL)
+    encoded = _encoded_build(state, r, &resp, key, format, &stale);
+
+  /* otherwise the request handler answers (and logs) it */
+  bool success = encoded != NULL && response_serialize_encoded_as(resp.type, id, format, encoded->data,
+                                                                  encoded->length, out, out_ctx);
+  epoch_exit( );
+
+  if (stale != NULL)
+    epoch_retire(stale, free);
+
+  if (success)
+    LOG_DEBUG("[MICROSERVICE] got request: %s\n", request_str(r));
+  return success;
+}
+
 /**
  * @brief Maps requests types to one of request_weather, _currency or _last.
  *
  * @param request type to be mapped.
  */
 inline request_type_t get_base_request(request_type_t type) {
-  if (type == request_post_currency)
+  if (type == request_post_currency || type == request_batch_currency || type == request_post_batch_currency)
     return request_currency;
 
-  if (type == request_post_weather)
+  if (type == request_post_weather || type == request_batch_weather || type == request_post_batch_weather)
     return request_weather;
 
   return type;
 }
 /**
- * @brief Launches and executes the main loop of the microservice.
+ * @brief Returns the port of an instance of a microservice.
  *
- * @param type of microservice and pointer to the exit flag that is
- * modified on signal (server/main.c:sigint_handler).
+ * @param type of microservice (a base request type) and index of the instance.
  */
-int launch_microservice(request_type_t type, bool *exit_flag) {
-  server_t microserver;
+uint16_t microservice_port(request_type_t type, size_t instance) {
+  return SELF_PORT + 1 + type + instance * NUM_MICROSERVICES;
+}
 
-  microserver.type = type;
-  int port = SELF_PORT + type + 1; // Add +1, since enums start at 0.
+/**
+ * @brief Interns the cities and currencies of the JSON files of the microservices.
+ *
+ * @return false if a file couldn't be read (its keys are looked up by their characters).
+ */
+bool intern_microservice_keys( ) {
+  bool weather = intern_from_json(weather_files.json);
+  return intern_from_json(currency_files.json) && weather;
+}
 
-  if (!server_init(&microserver, port, _micro_handle_request)) {
-    perror("Error al iniciar el microservicio");
-    return 1;
-  }
+/**
+ * @brief Launches and executes the main loop of an instance of the microservice.
+ *
+ * @param type of microservice, index of the instance, number of instances of
+ * the microservice (the instance holds only the keys routed to it) and pointer
+ * to the exit flag that is modified on signal (server/main.c:sigint_handler).
+ */
+int launch_microservice(request_type_t type, size_t instance, size_t num_instances, bool *exit_flag) {
+  server_t microserver = {0};
+
+  microserver.type = type;
+  microserver.encoded_handler = _micro_encoded_response;
+  int port = microservice_port(type, instance);
 
+  /* the context must be ready before the server workers start handling requests */
   if (type == request_weather) {
-    _create_weather_context(&microserver);
+    _create_weather_context(&microserver, instance, num_instances);
   } else if (type == request_currency) {
-    _create_currency_context(&microserver);
+    _create_currency_context(&microserver, instance, num_instances);
+  }
+
+  if (!server_init(&microserver, port, _micro_handle_request, server_mode_reactor, SERVER_WORKERS_AUTO)) {
+    perror("Error al iniciar el microservicio");
+    return 1;
   }
 
   /* handles client (portal, middleware's) requests */
   while (!*exit_flag) {
-    printf("waiting connection...\n");
     if (!server_handle_request(&microserver)) {
       break;
     }
   }
 
+  /* stops the workers before releasing the context they use */
+  server_stop(&microserver);
+
+  /* the state is already on disk (in the snapshot and the log) */
   if (type == request_weather) {
-    // If flag is true, weather state is saved to file.
-    _finish_weather_service(&microserver, *exit_flag);
+    _finish_weather_service(&microserver);
   } else if (type == request_currency) {
-    // Same, but with currencies.
-    _finish_currency_service(&microserver, *exit_flag);
+    _finish_currency_service(&microserver);
   }
 
-  server_stop(&microserver);
+  /* writes the records still in the rings of the log */
+  log_close( );
   return 0;
 }
@@ -4,7 +4,12 @@
 #include <stdlib.h>
 #include <unistd.h>
 
-int launch_microservice(request_type_t type, bool *exit_flag);
+int launch_microservice(request_type_t type, size_t instance, size_t num_instances, bool *exit_flag);
+// Returns the port of an instance of a microservice (type is a base request type, see below).
+uint16_t microservice_port(request_type_t type, size_t instance);
+// Interns the keys of the datasets of the microservices (before forking them, so every
+// process shares the IDs).
+bool intern_microservice_keys(void);
 // Returns the basic request_type associated with the provided request.
 // i.e.,
 // request_post_weather => request_weather
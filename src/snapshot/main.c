@@ -0,0 +1,42 @@
+/* include area */
+#include "json_alloc.h"
+#include "snapshot.h"
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * @brief Prints the usage of the converter.
+ */
+static void _print_help( ) {
+  printf("Usage: snapshot COMMAND INPUT OUTPUT\n");
+  printf("\nAvailable COMMANDs: \n");
+  printf("from-json : converts a JSON file (e.g. weather.json) into a snapshot (e.g. weather.snap)\n");
+  printf("to-json : converts a snapshot into a JSON file\n");
+  printf("\nA snapshot doesn't include the updates in its log (e.g. weather.wal) until the microservice takes a new "
+         "one.\n");
+}
+
+int main(int argc, const char *argv[]) {
+  json_alloc_init( );
+  if (argc != 4) {
+    _print_help( );
+    return 1;
+  }
+
+  bool success;
+  if (strcmp(argv[1], "from-json") == 0) {
+    success = snapshot_from_json(argv[2], argv[3], NULL, NULL);
+  } else if (strcmp(argv[1], "to-json") == 0) {
+    success = snapshot_to_json(argv[2], argv[3]);
+  } else {
+    _print_help( );
+    return 1;
+  }
+
+  if (!success) {
+    perror("Failed converting the file");
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,85 @@
+#include "arena.h"
+#include "json_alloc.h"
+#include "scunit.h"
+#include "str.h"
+#include <jansson.h>
+#include <stdint.h>
+#include <string.h>
+
+TEST(ArenaAlloc) {
+  arena_t *arena = arena_create(256, 1024);
+  ASSERT_TRUE(arena != NULL);
+
+  char *a = arena_alloc(arena, 10);
+  char *b = arena_alloc(arena, 100);
+  ASSERT_TRUE(a != NULL && b != NULL);
+  ASSERT_EQ(0, ( uintptr_t )a & (ARENA_ALIGN - 1));
+  ASSERT_EQ(0, ( uintptr_t )b & (ARENA_ALIGN - 1));
+  ASSERT_TRUE(b >= a + 10);
+  memset(a, 'a', 10);
+  memset(b, 'b', 100);
+
+  /* a large allocation gets its own chunk, and the max size is enforced */
+  ASSERT_TRUE(arena_alloc(arena, 600) != NULL);
+  ASSERT_EQ(256 + 608, arena_size(arena));
+  ASSERT_TRUE(arena_alloc(arena, 600) == NULL);
+
+  /* a reset reuses the chunks */
+  arena_reset(arena);
+  ASSERT_TRUE(arena_alloc(arena, 10) == a);
+  ASSERT_TRUE(arena_alloc(arena, 600) != NULL);
+  ASSERT_EQ(256 + 608, arena_size(arena));
+
+  arena_destroy(arena);
+}
+
+TEST(ArenaStrings) {
+  char name[200];
+  memset(name, 'x', sizeof(name) - 1);
+  name[sizeof(name) - 1] = '\0';
+
+  /* short strings are inline, the long ones need an arena */
+  string_t s;
+  ASSERT_TRUE(str_init(&s, "buenos aires"));
+  ASSERT_FALSE(str_init(&s, name));
+
+  arena_t *arena = arena_create(1024, 0);
+  arena_t *previous = str_set_arena(arena);
+  ASSERT_TRUE(str_init(&s, name));
+  ASSERT_EQ(strlen(name), str_len(&s));
+  ASSERT_EQ(0, cstr_cmp(&s, name));
+  ASSERT_EQ(str_hash_n(name, strlen(name)), str_hash(&s));
+
+  /* a copy shares the characters */
+  string_t copy = s;
+  ASSERT_EQ(0, str_cmp(&s, &copy));
+  ASSERT_TRUE(str_to_cstr(&s) == str_to_cstr(&copy));
+
+  char too_long[STR_MAX_LENGTH + 2];
+  memset(too_long, 'x', sizeof(too_long) - 1);
+  too_long[sizeof(too_long) - 1] = '\0';
+  ASSERT_FALSE(str_init(&s, too_long));
+
+  str_set_arena(previous);
+  arena_destroy(arena);
+}
+
+TEST(ArenaJson) {
+  json_alloc_init( );
+  json_t *kept = json_string("peso");
+  ASSERT_TRUE(kept != NULL);
+
+  /* the values created while the arena is set come from it */
+  arena_t *arena = arena_create(4096, 0);
+  arena_t *previous = json_alloc_set_arena(arena);
+  json_t *json = json_object( );
+  ASSERT_EQ(0, json_object_set_new(json, "dollar", json_real(17.38)));
+  ASSERT_TRUE(arena_size(arena) > 0);
+  ASSERT_TRUE(json_real_value(json_object_get(json, "dollar")) == 17.38);
+
+  /* and the others are still freed */
+  json_decref(json);
+  json_decref(kept);
+  json_alloc_set_arena(previous);
+  arena_destroy(arena);
+}
@@ -0,0 +1,81 @@
+#define _GNU_SOURCE
+#include "buffer.h"
+#include "scunit.h"
+#include <stdbool.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+TEST(RecvBuffer) {
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+  /* a single recv gets everything available */
+  recv_buffer_t b = {0};
+  ASSERT_EQ(10, write(fds[1], "0123456789", 10));
+  ASSERT_EQ(10, recv_buffer_fill(&b, fds[0]));
+
+  /* consumes in place */
+  size_t length;
+  const char *data = recv_buffer_peek(&b, &length);
+  ASSERT_EQ(10, length);
+  ASSERT_EQ(0, memcmp(data, "0123", 4));
+  recv_buffer_consume(&b, 4);
+
+  data = recv_buffer_peek(&b, &length);
+  ASSERT_EQ(6, length);
+  ASSERT_EQ(0, memcmp(data, "456789", 6));
+
+  /* room for more than the initial size (keeping the unconsumed bytes) */
+  ASSERT_TRUE(recv_buffer_reserve(&b, 3 * BUFFER_INITIAL_SIZE));
+  data = recv_buffer_peek(&b, &length);
+  ASSERT_EQ(6, length);
+  ASSERT_EQ(0, memcmp(data, "456789", 6));
+
+  ASSERT_EQ(3, write(fds[1], "abc", 3));
+  ASSERT_TRUE(recv_buffer_fill_to(&b, fds[0], 9));
+  data = recv_buffer_peek(&b, &length);
+  ASSERT_EQ(9, length);
+  ASSERT_EQ(0, memcmp(data, "456789abc", 9));
+  recv_buffer_consume(&b, 9);
+
+  /* the peer closes before the bytes arrive */
+  ASSERT_EQ(2, write(fds[1], "de", 2));
+  close(fds[1]);
+  ASSERT_FALSE(recv_buffer_fill_to(&b, fds[0], 3));
+  ASSERT_EQ(0, recv_buffer_fill(&b, fds[0]));
+
+  recv_buffer_free(&b);
+  close(fds[0]);
+}
+
+TEST(SendBuffer) {
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+  /* nothing is sent while it's corked */
+  send_buffer_t b = {0};
+  send_buffer_cork(&b);
+  ASSERT_TRUE(send_buffer_write("0123", 4, &b));
+  ASSERT_TRUE(send_buffer_write("4567", 4, &b));
+  ASSERT_TRUE(send_buffer_flush(&b, fds[1]));
+  ASSERT_EQ(8, send_buffer_pending(&b));
+
+  /* everything is sent at once */
+  send_buffer_uncork(&b);
+  ASSERT_TRUE(send_buffer_flush(&b, fds[1]));
+  ASSERT_EQ(0, send_buffer_pending(&b));
+
+  char data[16];
+  ASSERT_EQ(8, read(fds[0], data, sizeof(data)));
+  ASSERT_EQ(0, memcmp(data, "01234567", 8));
+
+  /* the peer is gone */
+  close(fds[0]);
+  ASSERT_TRUE(send_buffer_write("89", 2, &b));
+  ASSERT_FALSE(send_buffer_flush(&b, fds[1]));
+  ASSERT_EQ(2, send_buffer_pending(&b));
+
+  send_buffer_free(&b);
+  close(fds[1]);
+}
@@ -0,0 +1,80 @@
+#define _GNU_SOURCE
+#include "cache.h"
+#include "scunit.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HOT "buenos aires"
+
+TEST(CacheGetPut) {
+  cache_t *cache = cache_create(64, 1000);
+  ASSERT_TRUE(cache != NULL);
+
+  char value[CACHE_MAX_VALUE];
+  uint64_t version;
+  ASSERT_EQ(0, cache_get(cache, 0, HOT, strlen(HOT), value, &version));
+  cache_put(cache, 0, HOT, strlen(HOT), "21.5", 4, version);
+
+  ASSERT_EQ(4, cache_get(cache, 0, HOT, strlen(HOT), value, &version));
+  ASSERT_EQ(0, memcmp(value, "21.5", 4));
+
+  /* the type is part of the key */
+  ASSERT_EQ(0, cache_get(cache, 1, HOT, strlen(HOT), value, &version));
+
+  /* an invalidation removes the key, and a value fetched before it is not stored */
+  ASSERT_EQ(0, cache_get(cache, 1, HOT, strlen(HOT), value, &version));
+  cache_invalidate(cache, 1, HOT, strlen(HOT));
+  cache_put(cache, 1, HOT, strlen(HOT), "stale", 5, version);
+  ASSERT_EQ(0, cache_get(cache, 1, HOT, strlen(HOT), value, &version));
+
+  cache_invalidate(cache, 0, HOT, strlen(HOT));
+  ASSERT_EQ(0, cache_get(cache, 0, HOT, strlen(HOT), value, &version));
+
+  cache_destroy(cache);
+}
+
+TEST(CacheExpire) {
+  cache_t *cache = cache_create(64, 10);
+  ASSERT_TRUE(cache != NULL);
+
+  char value[CACHE_MAX_VALUE];
+  uint64_t version;
+  cache_get(cache, 0, HOT, strlen(HOT), value, &version);
+  cache_put(cache, 0, HOT, strlen(HOT), "21.5", 4, version);
+  ASSERT_EQ(4, cache_get(cache, 0, HOT, strlen(HOT), value, &version));
+
+  usleep(20000);
+  ASSERT_EQ(0, cache_get(cache, 0, HOT, strlen(HOT), value, &version));
+  cache_destroy(cache);
+}
+
+TEST(CacheEvict) {
+  cache_t *cache = cache_create(64, 60000);
+  ASSERT_TRUE(cache != NULL);
+
+  char value[CACHE_MAX_VALUE];
+  uint64_t version;
+  cache_get(cache, 0, HOT, strlen(HOT), value, &version);
+  cache_put(cache, 0, HOT, strlen(HOT), "21.5", 4, version);
+
+  /* one-off keys don't evict a key that keeps being hit */
+  for (int i = 0; i < 1000; i++) {
+    char key[16];
+    snprintf(key, sizeof(key), "key%d", i);
+    cache_get(cache, 0, key, strlen(key), value, &version);
+    cache_put(cache, 0, key, strlen(key), "1", 1, version);
+    ASSERT_EQ(4, cache_get(cache, 0, HOT, strlen(HOT), value, &version));
+  }
+
+  /* and the cache is bounded */
+  size_t cached = 0;
+  for (int i = 0; i < 1000; i++) {
+    char key[16];
+    snprintf(key, sizeof(key), "key%d", i);
+    cached += cache_get(cache, 0, key, strlen(key), value, &version);
+  }
+  ASSERT_TRUE(cached < 64);
+
+  cache_destroy(cache);
+}
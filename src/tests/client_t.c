@@ -0,0 +1,522 @@
+#define _GNU_SOURCE
+#include "buffer.h"
+#include "client.h"
+#include "frame.h"
+#include "scunit.h"
+#include "server.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/** Ports of the loopback server and the raw upstreams of the tests */
+#define ECHO_PORT 8102
+#define PEER_PORT 8103
+#define RESET_PORT 8104
+
+/** Max requests a raw upstream reads from a connection */
+#define PEER_MAX_REQUESTS 8
+
+#define NUM_THREADS 4
+#define NUM_CALLS 200
+
+/** Loopback server: it answers each weather request with a result whose message is the city */
+typedef struct {
+  server_t server;
+  pthread_t thread;
+  bool stop;
+} echo_t;
+
+/**
+ * @brief Echoes the city of a request.
+ */
+static void _echo(response_t *resp, const request_t *req, const server_t *serv) {
+  resp->type = response_result;
+  if (!str_init_n(&resp->u.result.message, str_to_cstr(&req->u.weather.city), str_len(&req->u.weather.city)))
+    str_init(&resp->u.result.message, "Failed");
+}
+
+/**
+ * @brief Runs the event loop of the loopback server until it's stopped.
+ */
+static void *_echo_loop(void *arg) {
+  echo_t *echo = arg;
+  while (!__atomic_load_n(&echo->stop, __ATOMIC_ACQUIRE) && server_handle_request(&echo->server))
+    ;
+
+  return NULL;
+}
+
+/**
+ * @brief Starts the loopback server (a single worker, in its own thread).
+ */
+static bool _echo_start(echo_t *echo) {
+  *echo = (echo_t){0};
+  if (!server_init(&echo->server, ECHO_PORT, _echo, server_mode_reactor, 1))
+    return false;
+
+  if (pthread_create(&echo->thread, NULL, _echo_loop, echo) != 0) {
+    server_stop(&echo->server);
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Stops the loopback server (connecting to it wakes up its loop).
+ */
+static void _echo_stop(echo_t *echo) {
+  __atomic_store_n(&echo->stop, true, __ATOMIC_RELEASE);
+
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(ECHO_PORT)};
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd >= 0)
+    connect(fd, ( struct sockaddr * )&addr, sizeof(addr));
+
+  pthread_join(echo->thread, NULL);
+  if (fd >= 0)
+    close(fd);
+  server_stop(&echo->server);
+}
+
+/**
+ * @brief Sets a city longer than what a string keeps inline (so it's kept in an arena).
+ */
+static void _long_city(request_t *req, size_t n) {
+  char city[STR_INLINE_SIZE * 2];
+  int length = snprintf(city, sizeof(city), "%zu ", n);
+  memset(city + length, 'x', sizeof(city) - length - 1);
+  city[sizeof(city) - 1] = '\0';
+
+  *req = (request_t){.type = request_weather};
+  str_init(&req->u.weather.city, city);
+}
+
+/* shared by the threads of ClientPoolLongStrings */
+typedef struct {
+  client_pool_t *pool;
+  size_t thread;
+  size_t mismatches;
+} pool_user_t;
+
+/**
+ * @brief Sends requests through the pool with its own arena (reset after each
+ * response, like the server does), checking every response.
+ */
+static void *_pool_user(void *arg) {
+  pool_user_t *user = arg;
+  arena_t *arena = arena_create(4096, 0);
+  str_set_arena(arena);
+
+  for (size_t i = 0; i < NUM_CALLS; i++) {
+    request_t req;
+    response_t resp = {0};
+    _long_city(&req, user->thread * NUM_CALLS + i);
+    if (!client_pool_send(user->pool, &resp, ECHO_PORT, &req) || resp.type != response_result ||
+        str_cmp(&resp.u.result.message, &req.u.weather.city) != 0)
+      user->mismatches++;
+
+    arena_reset(arena);
+  }
+
+  str_set_arena(NULL);
+  arena_destroy(arena);
+  return NULL;
+}
+
+TEST(ClientPoolLongStrings) {
+  echo_t echo;
+  ASSERT_TRUE(_echo_start(&echo));
+  client_pool_t *pool = client_pool_create(message_format_binary);
+  ASSERT_TRUE(pool != NULL);
+
+  /* the responses are read by any of the callers, but each one gets its own in its arena */
+  pool_user_t users[NUM_THREADS];
+  pthread_t threads[NUM_THREADS];
+  for (size_t i = 0; i < NUM_THREADS; i++) {
+    users[i] = (pool_user_t){.pool = pool, .thread = i};
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, _pool_user, &users[i]));
+  }
+
+  size_t mismatches = 0;
+  for (size_t i = 0; i < NUM_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+    mismatches += users[i].mismatches;
+  }
+
+  client_pool_destroy(pool);
+  _echo_stop(&echo);
+  ASSERT_EQ(0, mismatches);
+}
+
+/* a request of the asynchronous client tests, waiting for its response */
+typedef struct {
+  request_t req;
+  arena_t *arena;
+  bool done;
+  bool matches;
+  /** Id of the response (0 if it failed), and the number of calls done before it. */
+  message_id_t id;
+  size_t order;
+} async_call_t;
+
+/** Calls done so far (see async_call_t.order) */
+static size_t completed = 0;
+
+/**
+ * @brief Checks the response of an asynchronous request: it's in the arena of the call.
+ */
+static void _on_response(response_t *resp, void *ctx) {
+  async_call_t *call = ctx;
+  call->done = true;
+  call->id = resp ? resp->id : 0;
+  call->order = completed++;
+  call->matches = resp != NULL && resp->type == response_result && str_get_arena( ) == call->arena &&
+                  str_cmp(&resp->u.result.message, &call->req.u.weather.city) == 0;
+}
+
+/**
+ * @brief Processes the events of an asynchronous client until a number of calls are done.
+ */
+static size_t _async_wait(client_async_t *client, const async_call_t *calls, size_t count) {
+  size_t done = 0;
+  for (int round = 0; round < 1000 && done < count; round++) {
+    struct pollfd pfd = {.fd = client_async_fd(client), .events = POLLIN};
+    if (poll(&pfd, 1, 10) > 0)
+      client_async_process(client);
+
+    done = 0;
+    for (size_t i = 0; i < count; i++)
+      done += calls[i].done;
+  }
+
+  return done;
+}
+
+TEST(ClientAsyncLongStrings) {
+  echo_t echo;
+  ASSERT_TRUE(_echo_start(&echo));
+  client_async_t *client = client_async_create(message_format_binary);
+  ASSERT_TRUE(client != NULL);
+
+  /* every call gets its response in its own arena (the thread has none) */
+  static async_call_t calls[8];
+  for (size_t i = 0; i < 8; i++) {
+    calls[i] = (async_call_t){.arena = arena_create(4096, 0)};
+    _long_city(&calls[i].req, i);
+    ASSERT_TRUE(client_async_send(client, ECHO_PORT, &calls[i].req, calls[i].arena, _on_response, &calls[i]));
+  }
+
+  size_t done = _async_wait(client, calls, 8);
+  size_t matches = 0;
+  for (size_t i = 0; i < 8; i++) {
+    matches += calls[i].matches;
+    arena_destroy(calls[i].arena);
+  }
+
+  client_async_destroy(client);
+  _echo_stop(&echo);
+  ASSERT_EQ(8, done);
+  ASSERT_EQ(8, matches);
+}
+
+/* Raw upstream: for each connection it takes, it reads a number of requests, then it answers them in
+ * reverse order (only their ids tell them apart) or it closes the connection without answering */
+typedef struct {
+  int fd;
+  size_t connections;
+  size_t count;
+  bool answer;
+  /** Connections served so far. */
+  size_t served;
+  pthread_t thread;
+} peer_t;
+
+/**
+ * @brief Reads a framed request (blocking).
+ */
+static bool _peer_read(recv_buffer_t *in, int fd, request_t *req) {
+  size_t length;
+  frame_header_t header;
+  if (!recv_buffer_fill_to(in, fd, FRAME_HEADER_SIZE) ||
+      !frame_header_read(&header, recv_buffer_peek(in, &length), FRAME_HEADER_SIZE) ||
+      !recv_buffer_fill_to(in, fd, frame_length(&header)))
+    return false;
+
+  mem_reader_t reader = {.data = recv_buffer_peek(in, &length) + FRAME_HEADER_SIZE,
+                         .length = header.payload_length};
+  bool success = request_deserialize_as(req, header.format, mem_reader_read, &reader);
+  recv_buffer_consume(in, frame_length(&header));
+  return success;
+}
+
+/**
+ * @brief Appends the (framed) answer of a request: a result whose message is the city.
+ */
+static bool _peer_write(send_buffer_t *out, const request_t *req) {
+  response_t resp = {.type = response_result, .id = req->id};
+  resp.u.result.message = req->u.weather.city;
+
+  size_t start = out->end;
+  char header_data[FRAME_HEADER_SIZE] = {0};
+  frame_header_t header = {.format = message_format_binary};
+  if (!send_buffer_write(header_data, sizeof(header_data), out) ||
+      !response_serialize_as(&resp, header.format, send_buffer_write, out))
+    return false;
+
+  header.payload_length = out->end - start - FRAME_HEADER_SIZE;
+  return frame_header_write(out->data + start, &header);
+}
+
+/**
+ * @brief Serves the connections of a raw upstream.
+ */
+static void *_peer_loop(void *arg) {
+  peer_t *peer = arg;
+  for (size_t c = 0; c < peer->connections; c++) {
+    int fd = accept(peer->fd, NULL, NULL);
+    if (fd < 0)
+      break;
+
+    size_t count = 0;
+    request_t reqs[PEER_MAX_REQUESTS];
+    recv_buffer_t in = {0};
+    while (count < peer->count && _peer_read(&in, fd, &reqs[count]))
+      count++;
+
+    send_buffer_t out = {0};
+    for (size_t i = count; peer->answer && i > 0; i--)
+      _peer_write(&out, &reqs[i - 1]);
+    send_buffer_flush(&out, fd);
+
+    recv_buffer_free(&in);
+    send_buffer_free(&out);
+    close(fd);
+    __atomic_add_fetch(&peer->served, 1, __ATOMIC_RELEASE);
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief Opens a listener on a loopback port.
+ */
+static int _listen(uint16_t port) {
+  int on = 1;
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+      bind(fd, ( struct sockaddr * )&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/**
+ * @brief Starts a raw upstream (its listener is there until it's stopped, even after its connections).
+ */
+static bool _peer_start(peer_t *peer, size_t connections, size_t count, bool answer) {
+  *peer = (peer_t){.connections = connections, .count = count, .answer = answer};
+  peer->fd = _listen(PEER_PORT);
+  if (peer->fd < 0)
+    return false;
+
+  if (pthread_create(&peer->thread, NULL, _peer_loop, peer) != 0) {
+    close(peer->fd);
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Waits for a raw upstream to serve its connections, and closes its listener.
+ */
+static void _peer_stop(peer_t *peer) {
+  pthread_join(peer->thread, NULL);
+  close(peer->fd);
+}
+
+/**
+ * @brief Sends asynchronous requests for short cities (a failed send counts as a failed call).
+ */
+static void _async_send_all(client_async_t *client, async_call_t *calls, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    char city[32];
+    snprintf(city, sizeof(city), "city %zu", i);
+    calls[i] = (async_call_t){.req = {.type = request_weather}};
+    str_init(&calls[i].req.u.weather.city, city);
+    if (!client_async_send(client, PEER_PORT, &calls[i].req, NULL, _on_response, &calls[i]))
+      calls[i].done = true;
+  }
+}
+
+TEST(ClientAsyncPipeline) {
+  peer_t peer;
+  ASSERT_TRUE(_peer_start(&peer, 1, PEER_MAX_REQUESTS, true));
+  client_async_t *client = client_async_create(message_format_binary);
+  ASSERT_TRUE(client != NULL);
+
+  /* every request goes through the same connection, and gets the response with its id */
+  static async_call_t calls[PEER_MAX_REQUESTS];
+  completed = 0;
+  _async_send_all(client, calls, PEER_MAX_REQUESTS);
+  size_t done = _async_wait(client, calls, PEER_MAX_REQUESTS);
+  _peer_stop(&peer);
+  client_async_destroy(client);
+
+  ASSERT_EQ(PEER_MAX_REQUESTS, done);
+  for (size_t i = 0; i < PEER_MAX_REQUESTS; i++) {
+    ASSERT_TRUE(calls[i].matches);
+    ASSERT_EQ(i + 1, calls[i].id);
+    ASSERT_EQ(PEER_MAX_REQUESTS - 1 - i, calls[i].order);
+  }
+}
+
+TEST(ClientAsyncBroken) {
+  peer_t peer;
+  ASSERT_TRUE(_peer_start(&peer, 1, 4, false));
+  client_async_t *client = client_async_create(message_format_binary);
+  ASSERT_TRUE(client != NULL);
+
+  /* the upstream closes the connection without answering: every call fails */
+  static async_call_t calls[4];
+  _async_send_all(client, calls, 4);
+  ASSERT_EQ(4, _async_wait(client, calls, 4));
+  for (size_t i = 0; i < 4; i++)
+    ASSERT_FALSE(calls[i].matches);
+
+  /* and once it's gone, the next connection can't be established */
+  _peer_stop(&peer);
+  _async_send_all(client, calls, 1);
+  ASSERT_EQ(1, _async_wait(client, calls, 1));
+  ASSERT_FALSE(calls[0].matches);
+  client_async_destroy(client);
+}
+
+TEST(ClientPoolStale) {
+  peer_t peer;
+  ASSERT_TRUE(_peer_start(&peer, 2, 1, true));
+  client_pool_t *pool = client_pool_create(message_format_binary);
+  ASSERT_TRUE(pool != NULL);
+
+  request_t req = {.type = request_weather};
+  str_init(&req.u.weather.city, "city");
+  response_t resp = {0};
+  ASSERT_TRUE(client_pool_send(pool, &resp, PEER_PORT, &req));
+
+  /* the upstream closed the pooled connection, the request goes through a new one */
+  while (__atomic_load_n(&peer.served, __ATOMIC_ACQUIRE) == 0)
+    usleep(1000);
+  resp = (response_t){0};
+  ASSERT_TRUE(client_pool_send(pool, &resp, PEER_PORT, &req));
+  ASSERT_EQ(0, str_cmp(&resp.u.result.message, &req.u.weather.city));
+
+  _peer_stop(&peer);
+  client_pool_destroy(pool);
+  ASSERT_EQ(2, peer.served);
+}
+
+/* a request of ClientAsyncResetByCallback, whose callback sends another one */
+typedef struct {
+  async_call_t call;
+  client_async_t *client;
+  async_call_t *next;
+  bool sent;
+} chained_call_t;
+
+/**
+ * @brief Checks the response of a request, then sends another one to the reset upstream.
+ */
+static void _on_response_send(response_t *resp, void *ctx) {
+  chained_call_t *chained = ctx;
+  _on_response(resp, &chained->call);
+  chained->sent =
+      client_async_send(chained->client, RESET_PORT, &chained->next->req, NULL, _on_response, chained->next);
+}
+
+/**
+ * @brief Answers a request by hand, through a connection of a raw upstream.
+ */
+static bool _answer(int fd) {
+  request_t req;
+  recv_buffer_t in = {0};
+  send_buffer_t out = {0};
+  bool success = _peer_read(&in, fd, &req) && _peer_write(&out, &req) && send_buffer_flush(&out, fd);
+  recv_buffer_free(&in);
+  send_buffer_free(&out);
+  return success;
+}
+
+/**
+ * @brief Takes a connection of the client and answers its first request by hand (the client's events
+ * are processed until it's sent).
+ *
+ * @return The connection or -1 on error.
+ */
+static int _accept_answer(int listener, client_async_t *client) {
+  int fd = accept(listener, NULL, NULL);
+  struct pollfd pfd = {.fd = fd, .events = POLLIN};
+  for (int round = 0; fd >= 0 && round < 1000 && poll(&pfd, 1, 1) == 0; round++)
+    client_async_process(client);
+
+  if (fd >= 0 && !_answer(fd)) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+TEST(ClientAsyncResetByCallback) {
+  client_async_t *client = client_async_create(message_format_binary);
+  int listeners[] = {_listen(PEER_PORT), _listen(RESET_PORT)};
+  ASSERT_TRUE(client != NULL && listeners[0] >= 0 && listeners[1] >= 0);
+
+  /* an idle connection to each upstream, answered by hand (so they act when the test says) */
+  static async_call_t calls[2];
+  int fds[2];
+  _async_send_all(client, calls, 1);
+  calls[1] = (async_call_t){.req = calls[0].req};
+  ASSERT_TRUE(client_async_send(client, RESET_PORT, &calls[1].req, NULL, _on_response, &calls[1]));
+  fds[0] = _accept_answer(listeners[0], client);
+  fds[1] = _accept_answer(listeners[1], client);
+  ASSERT_TRUE(fds[0] >= 0 && fds[1] >= 0);
+  ASSERT_EQ(2, _async_wait(client, calls, 2));
+
+  /* a response arrives, then the other connection is reset: the callback of the response sends
+   * through the reset connection, whose own event comes next in the same round */
+  static chained_call_t chained;
+  static async_call_t next;
+  chained = (chained_call_t){.call = {.req = calls[0].req}, .client = client, .next = &next};
+  next = (async_call_t){.req = calls[0].req};
+  ASSERT_TRUE(client_async_send(client, PEER_PORT, &chained.call.req, NULL, _on_response_send, &chained));
+  ASSERT_TRUE(_answer(fds[0]));
+
+  struct linger linger = {.l_onoff = 1, .l_linger = 0};
+  setsockopt(fds[1], SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+  close(fds[1]);
+  ASSERT_EQ(1, _async_wait(client, &chained.call, 1));
+  ASSERT_TRUE(chained.call.matches);
+
+  /* the request fails, either right away or through its callback */
+  ASSERT_TRUE(!chained.sent || _async_wait(client, &next, 1) == 1);
+  ASSERT_FALSE(next.matches);
+
+  client_async_destroy(client);
+  close(fds[0]);
+  close(listeners[0]);
+  close(listeners[1]);
+}
@@ -0,0 +1,41 @@
+#include "frame.h"
+#include "scunit.h"
+#include <stdbool.h>
+
+TEST(FrameHeader) {
+  {
+    char data[FRAME_HEADER_SIZE];
+    frame_header_t h = {.payload_length = 1234};
+    ASSERT_TRUE(frame_header_write(data, &h));
+
+    frame_header_t header;
+    ASSERT_TRUE(frame_header_read(&header, data, sizeof(data)));
+    ASSERT_EQ(1234, header.payload_length);
+    ASSERT_FALSE(header.close);
+    ASSERT_EQ(message_format_json, header.format);
+    ASSERT_EQ(FRAME_HEADER_SIZE + 1234, frame_length(&header));
+  }
+  {
+    char data[FRAME_HEADER_SIZE];
+    frame_header_t h = {.payload_length = FRAME_MAX_PAYLOAD, .close = true, .format = message_format_binary};
+    ASSERT_TRUE(frame_header_write(data, &h));
+
+    frame_header_t header;
+    ASSERT_TRUE(frame_header_read(&header, data, sizeof(data)));
+    ASSERT_EQ(FRAME_MAX_PAYLOAD, header.payload_length);
+    ASSERT_TRUE(header.close);
+    ASSERT_EQ(message_format_binary, header.format);
+  }
+}
+
+TEST(FrameHeaderInvalid) {
+  char data[FRAME_HEADER_SIZE] = {0};
+
+  /* the payload length doesn't fit in the header */
+  frame_header_t h = {.payload_length = ( size_t )FRAME_MAX_PAYLOAD + 1};
+  ASSERT_FALSE(frame_header_write(data, &h));
+
+  /* incomplete header */
+  frame_header_t header;
+  ASSERT_FALSE(frame_header_read(&header, data, FRAME_HEADER_SIZE - 1));
+}
@@ -0,0 +1,83 @@
+#define _GNU_SOURCE
+#include "intern.h"
+#include "scunit.h"
+#include "snapshot.h"
+#include "store.h"
+#include <stdio.h>
+#include <unistd.h>
+
+#define INTERN_TEST_FILE "/tmp/intern_t.snap"
+
+TEST(InternAdd) {
+  intern_clear( );
+  ASSERT_EQ(0, intern_find("peso", 4, str_hash_n("peso", 4)));
+
+  ASSERT_EQ(1, intern_add("peso", 4));
+  ASSERT_EQ(2, intern_add("euro", 4));
+  ASSERT_EQ(1, intern_add("peso", 4));
+  ASSERT_EQ(2, intern_count( ));
+  ASSERT_EQ(2, intern_find("euro", 4, str_hash_n("euro", 4)));
+  ASSERT_EQ(0, intern_find("pes", 3, str_hash_n("pes", 3)));
+
+  /* strings look up their ID when they are set */
+  string_t key, other;
+  ASSERT_TRUE(str_init(&key, "euro"));
+  ASSERT_TRUE(str_init(&other, "dollar"));
+  ASSERT_EQ(2, str_id(&key));
+  ASSERT_EQ(0, str_id(&other));
+  ASSERT_TRUE(str_cmp(&key, &other) != 0);
+
+  /* the table grows */
+  for (size_t i = 0; i < 1000; i++) {
+    char name[16];
+    size_t length = sprintf(name, "city %zu", i);
+    ASSERT_EQ(i + 3, intern_add(name, length));
+  }
+  ASSERT_EQ(1, intern_add("peso", 4));
+  ASSERT_EQ(503, intern_find("city 500", 8, str_hash_n("city 500", 8)));
+
+  intern_clear( );
+  ASSERT_EQ(0, intern_count( ));
+}
+
+TEST(InternLookups) {
+  intern_clear( );
+  string_t early;
+  ASSERT_TRUE(str_init(&early, "euro"));
+  ASSERT_EQ(1, intern_add("peso", 4));
+  ASSERT_EQ(2, intern_add("euro", 4));
+  ASSERT_EQ(3, intern_add("yen", 3));
+
+  /* interned and plain keys, and a key set before it was interned */
+  float_t value = 17.25;
+  string_t peso, dollar, euro, yen;
+  ASSERT_TRUE(str_init(&peso, "peso") && str_init(&dollar, "dollar"));
+  ASSERT_TRUE(str_init(&euro, "euro") && str_init(&yen, "yen"));
+  store_t *store = store_create(1);
+  ASSERT_TRUE(store != NULL);
+  ASSERT_TRUE(store_put(store, &peso, &value));
+  ASSERT_TRUE(store_put(store, &dollar, &value));
+  ASSERT_TRUE(store_put(store, &early, &value));
+  ASSERT_EQ(17.25, store_get(store, &peso)[0]);
+  ASSERT_EQ(17.25, store_get(store, &dollar)[0]);
+  ASSERT_EQ(17.25, store_get(store, &euro)[0]);
+  ASSERT_TRUE(store_get(store, &yen) == NULL);
+
+  /* snapshot lookups by ID are remembered, found or not */
+  snapshot_header_t header = {.num_values = 1, .flags = SNAPSHOT_FLAG_PLAIN};
+  snapshot_field_t fields[] = {{.type = field_type_float}};
+  ASSERT_TRUE(snapshot_save(INTERN_TEST_FILE, &header, fields, NULL, store));
+  store_destroy(store);
+
+  snapshot_t *snapshot = snapshot_open(INTERN_TEST_FILE);
+  ASSERT_TRUE(snapshot != NULL);
+  for (size_t i = 0; i < 2; i++) {
+    ASSERT_EQ(17.25, snapshot_get(snapshot, &euro)[0]);
+    ASSERT_EQ(17.25, snapshot_get(snapshot, &dollar)[0]);
+    ASSERT_TRUE(snapshot_get(snapshot, &yen) == NULL);
+  }
+
+  snapshot_close(snapshot);
+  unlink(INTERN_TEST_FILE);
+  intern_clear( );
+}
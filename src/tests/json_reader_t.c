@@ -0,0 +1,112 @@
+#include "requests.h"
+#include "scunit.h"
+#include <stdbool.h>
+#include <string.h>
+
+/**
+ * @brief Helpers
+ */
+
+typedef struct {
+  const char *data;
+  size_t offset;
+} cstr_reader_t;
+
+static size_t _read_cb(void *data, size_t bytes, void *cb_ctx) {
+  cstr_reader_t *reader = cb_ctx;
+  size_t available = strlen(reader->data + reader->offset);
+  if (bytes > available)
+    bytes = available;
+
+  memcpy(data, reader->data + reader->offset, bytes);
+  reader->offset += bytes;
+  return bytes;
+}
+
+static bool _parse_request(request_t *r, const char *json) {
+  cstr_reader_t reader = {.data = json};
+  return request_deserialize(r, _read_cb, &reader);
+}
+
+TEST(JsonReaderAnyOrder) {
+  {
+    /* fields before the type, unknown keys (of any kind) are skipped */
+    request_t r = {0};
+    ASSERT_TRUE(_parse_request(&r, " {\"humidity\": 5.5e1, \"extra\": {\"a\": [1, true, null, \"}\"]},"
+                                   "\"city\": \"Santiago \\u00e1\\n\", \"@type\": \"post_weather\", "
+                                   "\"pressure\": -1.5, \"@id\": 12, \"temperature\": 0.0}"));
+    ASSERT_EQ(request_post_weather, r.type);
+    ASSERT_EQ(12, r.id);
+    ASSERT_EQ(0, cstr_cmp(&r.u.post_weather.city, "Santiago \xc3\xa1\n"));
+    ASSERT_EQ(55, r.u.post_weather.humidity);
+    ASSERT_EQ(-1.5, r.u.post_weather.pressure);
+    ASSERT_EQ(0, r.u.post_weather.temperature);
+  }
+  {
+    /* consumes exactly one message */
+    cstr_reader_t reader = {.data = "{\"@type\":\"currency\",\"currency\":\"pesos\"}{\"@type\""};
+    request_t r = {0};
+    ASSERT_TRUE(request_deserialize(&r, _read_cb, &reader));
+    ASSERT_EQ(request_currency, r.type);
+    ASSERT_EQ(0, r.id);
+    ASSERT_EQ(0, strcmp(reader.data + reader.offset, "{\"@type\""));
+  }
+}
+
+TEST(JsonReaderListsBeforeType) {
+  /* the items of the lists are kept in an arena */
+  arena_t *arena = arena_create(4096, 0);
+  arena_t *previous = str_set_arena(arena);
+  {
+    /* lists (and unknown keys, not counted as pending) before the type */
+    request_t r = {0};
+    size_t length;
+    ASSERT_TRUE(_parse_request(&r, "{\"humidity\": [1.5, 2.5], \"cities\": [\"a\", \"b\"], \"x1\": 1,"
+                                   "\"x2\": 2, \"x3\": 3, \"x4\": 4, \"x5\": 5, \"x6\": 6, \"x7\": 7,"
+                                   "\"x8\": 8, \"pressure\": [ ], \"x9\": [\"c\"],"
+                                   "\"@type\": \"post_batch_weather\", \"temperature\": [ ]}"));
+    ASSERT_EQ(request_post_batch_weather, r.type);
+    ASSERT_EQ(2, r.u.post_batch_weather.cities.count);
+    ASSERT_EQ(0, strcmp("b", string_list_get(&r.u.post_batch_weather.cities, 1, &length)));
+    ASSERT_EQ(2, r.u.post_batch_weather.humidity.count);
+    ASSERT_EQ(2.5, r.u.post_batch_weather.humidity.items[1]);
+    ASSERT_EQ(0, r.u.post_batch_weather.pressure.count);
+    ASSERT_EQ(0, r.u.post_batch_weather.temperature.count);
+  }
+  {
+    /* an empty list fits a string list */
+    request_t r = {0};
+    ASSERT_TRUE(_parse_request(&r, "{\"cities\": [], \"@type\": \"batch_weather\"}"));
+    ASSERT_EQ(request_batch_weather, r.type);
+    ASSERT_EQ(0, r.u.batch_weather.cities.count);
+  }
+  {
+    /* the items must match the list type */
+    request_t r = {0};
+    ASSERT_FALSE(_parse_request(&r, "{\"cities\": [1.5], \"@type\": \"batch_weather\"}"));
+    ASSERT_FALSE(_parse_request(&r, "{\"cities\": [\"a\", 1.5], \"@type\": \"batch_weather\"}"));
+    ASSERT_FALSE(_parse_request(&r, "{\"city\": [\"a\"], \"@type\": \"weather\"}"));
+  }
+  str_set_arena(previous);
+  arena_destroy(arena);
+}
+
+TEST(JsonReaderInvalid) {
+  request_t r = {0};
+
+  /* missing field */
+  ASSERT_FALSE(_parse_request(&r, "{\"@type\":\"post_currency\",\"currency\":\"pesos\"}"));
+  /* integers and floats can't be mixed up */
+  ASSERT_FALSE(_parse_request(&r, "{\"@type\":\"post_currency\",\"currency\":\"pesos\",\"value\":3}"));
+  /* unknown type */
+  ASSERT_FALSE(_parse_request(&r, "{\"@type\":\"weathr\",\"city\":\"x\"}"));
+  /* missing type */
+  ASSERT_FALSE(_parse_request(&r, "{\"city\":\"x\"}"));
+  /* syntax errors */
+  ASSERT_FALSE(_parse_request(&r, "{\"@type\":\"weather\",\"city\":\"x\",}"));
+  ASSERT_FALSE(_parse_request(&r, "{\"@type\":\"weather\",\"city\":\"x\""));
+  ASSERT_FALSE(_parse_request(&r, "{\"@type\":\"weather\",\"city\":\"x\",\"n\":01}"));
+  ASSERT_FALSE(_parse_request(&r, "[\"@type\"]"));
+  /* invalid id */
+  ASSERT_FALSE(_parse_request(&r, "{\"@type\":\"weather\",\"@id\":-1,\"city\":\"x\"}"));
+}
@@ -0,0 +1,78 @@
+#include "json_writer.h"
+#include "requests.h"
+#include "scunit.h"
+#include <stdbool.h>
+#include <string.h>
+
+/**
+ * @brief Helpers
+ */
+
+static bool _float_eq(float_t f, const char *expected) {
+  char s[JSON_FLOAT_MAX_LENGTH + 1];
+  size_t length = json_float_format(s, f);
+  s[length] = '\0';
+  return length > 0 && strcmp(s, expected) == 0;
+}
+
+TEST(JsonFloatFormat) {
+  /* shortest representation, always as a JSON real */
+  ASSERT_TRUE(_float_eq(27.3, "27.3"));
+  ASSERT_TRUE(_float_eq(57, "57.0"));
+  ASSERT_TRUE(_float_eq(1030.92, "1030.92"));
+  ASSERT_TRUE(_float_eq(-0.25, "-0.25"));
+  ASSERT_TRUE(_float_eq(0.001, "0.001"));
+  ASSERT_TRUE(_float_eq(1e-7, "1e-7"));
+  ASSERT_TRUE(_float_eq(16777216, "16777216.0"));
+  ASSERT_TRUE(_float_eq(0, "0.0"));
+
+  /* out of the fast range */
+  ASSERT_TRUE(_float_eq(1e30, "1e+30"));
+
+  /* NaN can't be represented */
+  char s[JSON_FLOAT_MAX_LENGTH];
+  ASSERT_EQ(0, json_float_format(s, 0.0f / 0.0f));
+}
+
+TEST(JsonWriterMessage) {
+  {
+    response_t r = {.type = response_weather, .id = 7};
+    r.u.weather.humidity = 57;
+    r.u.weather.pressure = 1030.92;
+    r.u.weather.temperature = 21.22;
+
+    char buffer[256];
+    json_writer_t w;
+    json_writer_init(&w, buffer, sizeof(buffer), NULL, NULL);
+    ASSERT_TRUE(json_writer_message(&w, &r.u, &response_descs[r.type], r.id));
+
+    const char *expected =
+        "{\"@type\":\"weather\",\"@id\":7,\"humidity\":57.0,\"pressure\":1030.92,\"temperature\":21.22}";
+    ASSERT_EQ(strlen(expected), w.length);
+    ASSERT_EQ(0, memcmp(buffer, expected, w.length));
+  }
+  {
+    /* escaped strings */
+    request_t r = {.type = request_weather};
+    ASSERT_TRUE(str_init(&r.u.weather.city, "a\"b\\c\n\x01"));
+
+    char buffer[256];
+    json_writer_t w;
+    json_writer_init(&w, buffer, sizeof(buffer), NULL, NULL);
+    ASSERT_TRUE(json_writer_message(&w, &r.u, &request_descs[r.type], r.id));
+
+    const char *expected = "{\"@type\":\"weather\",\"city\":\"a\\\"b\\\\c\\n\\u0001\"}";
+    ASSERT_EQ(strlen(expected), w.length);
+    ASSERT_EQ(0, memcmp(buffer, expected, w.length));
+  }
+  {
+    /* doesn't fit (without an output callback) */
+    request_t r = {.type = request_weather};
+    ASSERT_TRUE(str_init(&r.u.weather.city, "Buenos Aires"));
+
+    char buffer[16];
+    json_writer_t w;
+    json_writer_init(&w, buffer, sizeof(buffer), NULL, NULL);
+    ASSERT_FALSE(json_writer_message(&w, &r.u, &request_descs[r.type], r.id));
+  }
+}
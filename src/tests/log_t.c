@@ -0,0 +1,118 @@
+#define _GNU_SOURCE
+#include "log.h"
+#include "scunit.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NUM_RECORDS 10000
+
+/**
+ * @brief Reads the log of the process (after closing it), without the time of each line.
+ */
+static size_t _read_log(char *text, size_t size) {
+  char name[32], line[512];
+  sprintf(name, "%d.log", ( int )getpid( ));
+  FILE *file = fopen(name, "r");
+  size_t length = 0;
+  while (file && fgets(line, sizeof(line), file)) {
+    const char *message = strstr(line, "] ") + 2;
+    length += snprintf(text + length, size - length, "%s", message);
+  }
+
+  if (file)
+    fclose(file);
+  unlink(name);
+  return length;
+}
+
+TEST(LogFormat) {
+  /* (the formats can't go inside the asserts, they would be part of theirs) */
+  char city[] = "buenos aires";
+  int queued = log_write(NONE_L, "got %s (%d, %5.2f%%)\n", city, -3, 21.5) == 0;
+  queued += log_write(INFO_L, "[%*s|%-4u|%.*s|%c|%lx]\n", 6, "ab", 7u, 3, city, 'z', 255ul) == 0;
+  queued += log_write(ERROR_L, "%zu %hhd %lld %s\n", ( size_t )42, 300, -5ll, ( char * )NULL) == 0;
+
+  /* the arguments are copied when the record is written */
+  strcpy(city, "london");
+
+  log_set_debug_mode(false);
+  queued += log_write(DEBUG_L, "hidden\n") == 0;
+  queued += log_write(STAT_L, "%d requests\n", 10) == 0;
+  ASSERT_EQ(4, queued);
+  log_set_debug_mode(true);
+  log_close( );
+
+  char text[1024];
+  _read_log(text, sizeof(text));
+  const char *expected = "got buenos aires (-3, 21.50%)\n"
+                         "[INFO] [    ab|7   |bue|z|ff]\n"
+                         "[ERROR] 42 44 -5 (null)\n"
+                         "[STATS] 10 requests\n";
+  ASSERT_EQ(0, strcmp(text, expected));
+}
+
+TEST(LogUnsupported) {
+  /* conversions that can't be copied into a record are rejected (nothing is logged) */
+  int count = 0;
+  int rejected = log_write(INFO_L, "%d%n\n", 1, &count) == -2;
+  rejected += log_write(INFO_L, "%ls\n", L"wide") == -2;
+  rejected += log_write(INFO_L, "%2$d %1$d\n", 1, 2) == -2;
+  rejected += log_write(INFO_L, "%Ld 100%\n", 1ll) == -2;
+  ASSERT_EQ(4, rejected);
+
+  /* the background thread is woken up by the first record (it doesn't poll) */
+  int queued = log_write(WARNING_L, "%d%%\n", 100);
+  ASSERT_EQ(0, queued);
+  usleep(100000);
+
+  char text[256];
+  _read_log(text, sizeof(text));
+  const char *expected = "[WARN] 100%\n";
+  ASSERT_EQ(0, strcmp(text, expected));
+  log_close( );
+}
+
+TEST(LogMacros) {
+  /* the arguments of a disabled level aren't evaluated */
+  int evaluated = 0;
+  LOG_INFO("info %d\n", ++evaluated);
+  ASSERT_EQ(1, evaluated);
+
+  log_set_debug_mode(false);
+  LOG_INFO("info %d\n", ++evaluated);
+  LOG_STAT("stat %d\n", ++evaluated);
+  ASSERT_EQ(2, evaluated);
+  log_set_debug_mode(true);
+
+  /* and the levels below LOG_MIN_LEVEL are not even built */
+  LOG_DEBUG("debug %d\n", ++evaluated);
+  ASSERT_EQ(LOG_MIN_LEVEL <= DEBUG_L ? 3 : 2, evaluated);
+  log_close( );
+
+  char text[256];
+  _read_log(text, sizeof(text));
+  ASSERT_TRUE(strstr(text, "[INFO] info 1\n[STATS] stat 2\n") == text);
+}
+
+TEST(LogDropped) {
+  char padding[200];
+  memset(padding, 'x', sizeof(padding) - 1);
+  padding[sizeof(padding) - 1] = '\0';
+
+  /* records that don't fit in the ring are dropped and counted, never waited for */
+  size_t queued = 0;
+  for (size_t i = 0; i < NUM_RECORDS; i++)
+    queued += log_write(INFO_L, "%zu %s\n", i, padding) == 0;
+  ASSERT_EQ(NUM_RECORDS, queued + log_dropped( ));
+  size_t dropped = log_dropped( );
+  log_close( );
+
+  static char text[NUM_RECORDS * 256];
+  _read_log(text, sizeof(text));
+  size_t lines = 0;
+  for (const char *p = text; (p = strstr(p, padding)) != NULL; p++)
+    lines++;
+  ASSERT_EQ(queued, lines);
+  ASSERT_TRUE(dropped == 0 || strstr(text, "log records dropped") != NULL);
+}
@@ -84,6 +84,10 @@ static bool _field_init(void *field, const field_desc_t *desc, void *cb_ctx) {
     case field_type_string:
       str_init(field, cb_ctx);
       break;
+
+    case field_type_float_list:
+    case field_type_string_list:
+      return false;
   }
   return true;
 }
@@ -88,3 +88,195 @@ TEST(ResponseSerialize) {
     ASSERT_EQ(r.u.weather.temperature, rd.u.weather.temperature);
   }
 }
+
+TEST(CorrelationId) {
+  {
+    request_t r = {.type = request_weather, .id = 4000000000u};
+    ASSERT_TRUE(str_init(&r.u.weather.city, SE));
+
+    buffer_t buffer = {0};
+    ASSERT_TRUE(request_serialize(&r, _write_cb, &buffer));
+
+    request_t rd = {0};
+    ASSERT_TRUE(request_deserialize(&rd, _read_cb, &buffer));
+    ASSERT_EQ(r.id, rd.id);
+  }
+  {
+    /* the id is optional (0 means unset) */
+    response_t r = {.type = response_currency};
+    r.u.currency.quote = 3.5;
+
+    buffer_t buffer = {0};
+    ASSERT_TRUE(response_serialize(&r, _write_cb, &buffer));
+
+    response_t rd = {.id = 7};
+    ASSERT_TRUE(response_deserialize(&rd, _read_cb, &buffer));
+    ASSERT_EQ(0, rd.id);
+  }
+}
+
+TEST(BinarySerialize) {
+  {
+    request_t r = {.type = request_post_weather, .id = 42};
+    ASSERT_TRUE(str_init(&r.u.post_weather.city, SE));
+    r.u.post_weather.humidity = 57;
+    r.u.post_weather.pressure = -1.25;
+    r.u.post_weather.temperature = 27.3;
+
+    buffer_t buffer = {0};
+    ASSERT_TRUE(request_serialize_as(&r, message_format_binary, _write_cb, &buffer));
+
+    /* type, id, 3 floats and the string with its length (1 byte varint) */
+    ASSERT_EQ(1 + 4 + 3 * 4 + 1 + strlen(SE), buffer.bytes);
+
+    request_t rd = {0};
+    ASSERT_TRUE(request_deserialize_as(&rd, message_format_binary, _read_cb, &buffer));
+    ASSERT_EQ(r.type, rd.type);
+    ASSERT_EQ(r.id, rd.id);
+    ASSERT_EQ(str_cmp(&r.u.post_weather.city, &rd.u.post_weather.city), 0);
+    ASSERT_EQ(r.u.post_weather.humidity, rd.u.post_weather.humidity);
+    ASSERT_EQ(r.u.post_weather.pressure, rd.u.post_weather.pressure);
+    ASSERT_EQ(r.u.post_weather.temperature, rd.u.post_weather.temperature);
+  }
+  {
+    /* long strings need a multi-byte length (and they are kept in an arena) */
+    arena_t *arena = arena_create(1024, 0);
+    arena_t *previous = str_set_arena(arena);
+    response_t r = {.type = response_result};
+    char message[300];
+    memset(message, 'x', sizeof(message) - 1);
+    message[sizeof(message) - 1] = '\0';
+    ASSERT_TRUE(str_init(&r.u.result.message, message));
+
+    buffer_t buffer = {0};
+    ASSERT_TRUE(response_serialize_as(&r, message_format_binary, _write_cb, &buffer));
+
+    response_t rd = {0};
+    ASSERT_TRUE(response_deserialize_as(&rd, message_format_binary, _read_cb, &buffer));
+    ASSERT_EQ(r.type, rd.type);
+    ASSERT_EQ(str_cmp(&r.u.result.message, &rd.u.result.message), 0);
+    str_set_arena(previous);
+    arena_destroy(arena);
+  }
+  {
+    /* truncated message */
+    response_t r = {.type = response_currency};
+    r.u.currency.quote = 3.5;
+
+    buffer_t buffer = {0};
+    ASSERT_TRUE(response_serialize_as(&r, message_format_binary, _write_cb, &buffer));
+    buffer.bytes--;
+
+    response_t rd = {0};
+    ASSERT_FALSE(response_deserialize_as(&rd, message_format_binary, _read_cb, &buffer));
+  }
+}
+
+TEST(BatchSerialize) {
+  /* the items of the lists are kept in an arena */
+  arena_t *arena = arena_create(4096, 0);
+  arena_t *previous = str_set_arena(arena);
+  response_t r = {.type = response_batch_weather, .id = 3};
+  ASSERT_TRUE(string_list_append(&r.u.batch_weather.cities, BSAS, strlen(BSAS)));
+  ASSERT_TRUE(string_list_append(&r.u.batch_weather.cities, SE, strlen(SE)));
+  for (int i = 0; i < 2; i++) {
+    ASSERT_TRUE(float_list_append(&r.u.batch_weather.humidity, 50 + i));
+    ASSERT_TRUE(float_list_append(&r.u.batch_weather.pressure, 1000.5 + i));
+    ASSERT_TRUE(float_list_append(&r.u.batch_weather.temperature, -2.25 * i));
+  }
+
+  /* same lists in both formats */
+  message_format_t formats[] = {message_format_json, message_format_binary};
+  for (size_t f = 0; f < ASIZE(formats); f++) {
+    buffer_t buffer = {0};
+    ASSERT_TRUE(response_serialize_as(&r, formats[f], _write_cb, &buffer));
+
+    response_t rd = {0};
+    ASSERT_TRUE(response_deserialize_as(&rd, formats[f], _read_cb, &buffer));
+    ASSERT_EQ(r.type, rd.type);
+    ASSERT_EQ(2, rd.u.batch_weather.cities.count);
+
+    size_t length;
+    ASSERT_EQ(0, strcmp(SE, string_list_get(&rd.u.batch_weather.cities, 1, &length)));
+    ASSERT_EQ(strlen(SE), length);
+    ASSERT_EQ(r.u.batch_weather.temperature.count, rd.u.batch_weather.temperature.count);
+    ASSERT_EQ(0, memcmp(r.u.batch_weather.temperature.items, rd.u.batch_weather.temperature.items,
+                        r.u.batch_weather.temperature.count * sizeof(float_t)));
+    ASSERT_EQ(r.u.batch_weather.humidity.items[1], rd.u.batch_weather.humidity.items[1]);
+  }
+
+  /* empty lists */
+  request_t req = {.type = request_batch_currency};
+  buffer_t buffer = {0};
+  ASSERT_TRUE(request_serialize(&req, _write_cb, &buffer));
+
+  request_t rd = {.u.batch_currency.currencies.count = 5};
+  ASSERT_TRUE(request_deserialize(&rd, _read_cb, &buffer));
+  ASSERT_EQ(0, rd.u.batch_currency.currencies.count);
+
+  /* a copy takes its own items */
+  size_t length;
+  response_t copy;
+  ASSERT_TRUE(response_copy(&copy, &r));
+  ASSERT_TRUE(copy.u.batch_weather.humidity.items != r.u.batch_weather.humidity.items);
+  ASSERT_TRUE(float_list_append(&copy.u.batch_weather.humidity, 7));
+  ASSERT_EQ(2, r.u.batch_weather.humidity.count);
+  ASSERT_EQ(0, strcmp(SE, string_list_get(&copy.u.batch_weather.cities, 1, &length)));
+  str_set_arena(previous);
+  arena_destroy(arena);
+}
+
+TEST(ListLimits) {
+  /* without an arena there's nowhere to keep the items */
+  string_list_t l = {0};
+  ASSERT_FALSE(string_list_append(&l, "x", 1));
+
+  arena_t *arena = arena_create(4096, 0);
+  arena_t *previous = str_set_arena(arena);
+  char item[STRING_LIST_SIZE];
+  memset(item, 'x', sizeof(item));
+
+  /* every item takes its terminator */
+  ASSERT_FALSE(string_list_append(&l, item, sizeof(item)));
+  ASSERT_TRUE(string_list_append(&l, item, sizeof(item) - 1));
+  ASSERT_FALSE(string_list_append(&l, "", 0));
+
+  float_list_t f = {0};
+  for (int i = 0; i < LIST_MAX_ITEMS; i++)
+    ASSERT_TRUE(float_list_append(&f, i));
+  ASSERT_FALSE(float_list_append(&f, 0));
+
+  char s[32];
+  float_list_t g = {.count = 2, .items = (float_t[]){1.5, 2}};
+  ASSERT_TRUE(float_list_to_cstr(s, sizeof(s), &g) > 0);
+  ASSERT_EQ(0, strcmp("1.5000, 2.0000", s));
+  ASSERT_TRUE(float_list_from_cstr(&f, s));
+  ASSERT_EQ(2, f.count);
+  ASSERT_EQ(0, memcmp(f.items, g.items, 2 * sizeof(float_t)));
+  str_set_arena(previous);
+  arena_destroy(arena);
+}
+
+TEST(EncodedSerialize) {
+  response_t r = {.type = response_weather, .id = 42};
+  r.u.weather.humidity = 55;
+  r.u.weather.pressure = 1013.25;
+  r.u.weather.temperature = 21.5;
+
+  /* the fields encoded once and sent with any id are the same as the whole response */
+  message_format_t formats[] = {message_format_json, message_format_binary};
+  for (size_t f = 0; f < ASIZE(formats); f++) {
+    buffer_t whole = {0}, fields = {0}, encoded = {0};
+    ASSERT_TRUE(response_serialize_as(&r, formats[f], _write_cb, &whole));
+    ASSERT_TRUE(response_serialize_fields_as(&r, formats[f], _write_cb, &fields));
+    ASSERT_TRUE(response_serialize_encoded_as(r.type, r.id, formats[f], fields.data, fields.bytes, _write_cb,
+                                              &encoded));
+    ASSERT_EQ(whole.bytes, encoded.bytes);
+    ASSERT_EQ(0, memcmp(whole.data, encoded.data, whole.bytes));
+
+    response_t rd = {0};
+    ASSERT_TRUE(response_deserialize_as(&rd, formats[f], _read_cb, &encoded));
+    ASSERT_EQ(42, rd.id);
+    ASSERT_EQ(r.u.weather.pressure, rd.u.weather.pressure);
+  }
+}
@@ -0,0 +1,57 @@
+#include "router.h"
+#include "scunit.h"
+#include <stdio.h>
+#include <string.h>
+
+#define NUM_KEYS 1000
+
+TEST(RouterSingle) {
+  router_t *router = router_create( );
+  ASSERT_TRUE(router != NULL);
+  ASSERT_EQ(0, router_instances(router, 0));
+
+  ASSERT_TRUE(router_add(router, 0, 8081));
+  ASSERT_EQ(1, router_instances(router, 0));
+  ASSERT_EQ(0, router_instance(router, 0, "london", 6));
+  ASSERT_EQ(8081, router_port(router, 0, 0));
+
+  /* services are independent */
+  ASSERT_EQ(0, router_instances(router, 1));
+  ASSERT_FALSE(router_add(router, ROUTER_MAX_SERVICES, 8082));
+
+  router_destroy(router);
+}
+
+TEST(RouterConsistent) {
+  router_t *small = router_create( ), *large = router_create( );
+  ASSERT_TRUE(small != NULL && large != NULL);
+  for (size_t i = 0; i < 4; i++) {
+    ASSERT_TRUE(router_add(small, 0, 8081 + i));
+    ASSERT_TRUE(router_add(large, 0, 8081 + i));
+  }
+  ASSERT_TRUE(router_add(large, 0, 8085));
+
+  size_t counts[5] = {0}, moved = 0;
+  for (size_t k = 0; k < NUM_KEYS; k++) {
+    char key[16];
+    size_t length = sprintf(key, "city %zu", k);
+    size_t before = router_instance(small, 0, key, length);
+    size_t after = router_instance(large, 0, key, length);
+    ASSERT_TRUE(before < 4 && after < 5);
+    counts[after]++;
+
+    /* a new instance only takes keys from the others */
+    if (before != after) {
+      ASSERT_EQ(4, after);
+      moved++;
+    }
+  }
+
+  /* about 1/5 of the keys move, and every instance gets its share */
+  ASSERT_TRUE(moved > NUM_KEYS / 10 && moved < NUM_KEYS * 3 / 10);
+  for (size_t i = 0; i < 5; i++)
+    ASSERT_TRUE(counts[i] > NUM_KEYS / 10);
+
+  router_destroy(small);
+  router_destroy(large);
+}
@@ -0,0 +1,73 @@
+#define _GNU_SOURCE
+#include "scunit.h"
+#include "snapshot.h"
+#include <stdio.h>
+#include <unistd.h>
+
+#define SNAPSHOT_TEST_FILE "/tmp/snapshot_t.snap"
+
+/**
+ * @brief Puts a single value record into a store.
+ */
+static bool _put(store_t *store, const char *name, float_t value) {
+  string_t key;
+  return str_init(&key, name) && store_put(store, &key, &value);
+}
+
+/**
+ * @brief Looks up a single value record of a snapshot (-1 if it's not there).
+ */
+static float_t _get(const snapshot_t *snapshot, const char *name) {
+  string_t key;
+  str_init(&key, name);
+  const float_t *value = snapshot_get(snapshot, &key);
+  return value ? *value : -1;
+}
+
+TEST(SnapshotSaveOpen) {
+  snapshot_header_t header = {.num_values = 1, .flags = SNAPSHOT_FLAG_PLAIN};
+  snapshot_field_t fields[] = {{.type = field_type_float}};
+
+  store_t *store = store_create(1);
+  ASSERT_TRUE(_put(store, "peso", 1));
+  ASSERT_TRUE(_put(store, "euro", 20.5));
+  ASSERT_TRUE(_put(store, "dollar", 17.25));
+  ASSERT_TRUE(snapshot_save(SNAPSHOT_TEST_FILE, &header, fields, NULL, store));
+  store_destroy(store);
+
+  snapshot_t *snapshot = snapshot_open(SNAPSHOT_TEST_FILE);
+  ASSERT_TRUE(snapshot != NULL);
+  ASSERT_EQ(3, snapshot_header(snapshot)->num_records);
+  ASSERT_EQ(17.25, _get(snapshot, "dollar"));
+  ASSERT_EQ(1, _get(snapshot, "peso"));
+  ASSERT_EQ(-1, _get(snapshot, "pes"));
+  ASSERT_EQ(-1, _get(snapshot, "yen"));
+
+  /* records are sorted by key */
+  const char *key;
+  size_t length;
+  ASSERT_TRUE(snapshot_at(snapshot, 0, &key, &length) != NULL);
+  ASSERT_EQ(0, memcmp(key, "dollar", length));
+
+  /* a new snapshot merges the updates with the records of the current one */
+  store = store_create(1);
+  ASSERT_TRUE(_put(store, "yen", 0.125));
+  ASSERT_TRUE(_put(store, "euro", 21));
+  ASSERT_TRUE(snapshot_save(SNAPSHOT_TEST_FILE, &header, fields, snapshot, store));
+  store_destroy(store);
+  snapshot_close(snapshot);
+
+  snapshot = snapshot_open(SNAPSHOT_TEST_FILE);
+  ASSERT_TRUE(snapshot != NULL);
+  ASSERT_EQ(4, snapshot_header(snapshot)->num_records);
+  ASSERT_EQ(21, _get(snapshot, "euro"));
+  ASSERT_EQ(0.125, _get(snapshot, "yen"));
+  ASSERT_EQ(17.25, _get(snapshot, "dollar"));
+  snapshot_close(snapshot);
+
+  /* a truncated file is rejected */
+  ASSERT_EQ(0, truncate(SNAPSHOT_TEST_FILE, 100));
+  ASSERT_TRUE(snapshot_open(SNAPSHOT_TEST_FILE) == NULL);
+
+  unlink(SNAPSHOT_TEST_FILE);
+}
@@ -0,0 +1,156 @@
+#include "epoch.h"
+#include "scunit.h"
+#include "store.h"
+#include <pthread.h>
+#include <stdio.h>
+
+TEST(StoreGetPut) {
+  store_t *store = store_create(2);
+  ASSERT_TRUE(store != NULL);
+
+  string_t key;
+  ASSERT_TRUE(str_init(&key, "buenos aires"));
+  ASSERT_TRUE(store_get(store, &key) == NULL);
+
+  float_t values[] = {21.5, 1030};
+  ASSERT_TRUE(store_put(store, &key, values));
+
+  const float_t *record = store_get(store, &key);
+  ASSERT_TRUE(record != NULL);
+  ASSERT_EQ(21.5, record[0]);
+
+  /* a different key with the same length */
+  string_t other;
+  ASSERT_TRUE(str_init(&other, "buenos airez"));
+  ASSERT_TRUE(store_get(store, &other) == NULL);
+
+  /* puts replace the record of an existing key (with a new version, the old one doesn't change) */
+  values[0] = 17;
+  ASSERT_TRUE(store_put(store, &key, values));
+  ASSERT_EQ(1, store_size(store));
+  ASSERT_EQ(17, store_get(store, &key)[0]);
+  ASSERT_EQ(1030, store_get(store, &key)[1]);
+  ASSERT_EQ(21.5, record[0]);
+
+  store_destroy(store);
+}
+
+TEST(StoreGrow) {
+  store_t *store = store_create(1);
+  ASSERT_TRUE(store != NULL);
+
+  /* many more keys than the initial slots */
+  for (int i = 0; i < 100000; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "key%d", i);
+
+    string_t key;
+    float_t value = i;
+    ASSERT_TRUE(str_init(&key, name));
+    ASSERT_TRUE(store_put(store, &key, &value));
+  }
+  ASSERT_EQ(100000, store_size(store));
+
+  for (int i = 0; i < 100000; i += 997) {
+    char name[16];
+    snprintf(name, sizeof(name), "key%d", i);
+
+    string_t key;
+    ASSERT_TRUE(str_init(&key, name));
+    ASSERT_TRUE(store_get(store, &key) != NULL);
+    ASSERT_EQ(i, *store_get(store, &key));
+  }
+
+  /* entries keep the insertion order */
+  const char *key;
+  size_t length;
+  const float_t *value = store_at(store, 42, &key, &length);
+  ASSERT_TRUE(value != NULL);
+  ASSERT_EQ(5, length);
+  ASSERT_EQ(0, memcmp(key, "key42", 5));
+  ASSERT_EQ(42, *value);
+  ASSERT_TRUE(store_at(store, 100000, &key, &length) == NULL);
+
+  store_destroy(store);
+}
+
+TEST(StoreReserve) {
+  store_t *store = store_create(1);
+  ASSERT_TRUE(store != NULL);
+  ASSERT_TRUE(store_reserve(store, 1000, 1000 * 8));
+
+  float_t value = 1;
+  ASSERT_TRUE(store_put_n(store, "key0", 4, &value));
+
+  string_t first;
+  ASSERT_TRUE(str_init(&first, "key0"));
+  const float_t *record = store_get(store, &first);
+  ASSERT_TRUE(record != NULL);
+
+  /* the reserved room is enough, so the records are never moved */
+  for (int i = 1; i < 1000; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "key%d", i);
+    ASSERT_TRUE(store_put_n(store, name, strlen(name), &value));
+  }
+  ASSERT_EQ(1000, store_size(store));
+  ASSERT_TRUE(store_get(store, &first) == record);
+
+  store_destroy(store);
+}
+
+/* shared by the writer and the readers of StoreConcurrentReaders */
+typedef struct {
+  store_t *store;
+  bool done;
+  size_t inconsistent;
+} concurrent_t;
+
+/**
+ * @brief Reads records while they are updated: both values of a record are always the same.
+ */
+static void *_reader(void *arg) {
+  concurrent_t *shared = arg;
+  string_t key;
+  str_init(&key, "key0");
+
+  while (!__atomic_load_n(&shared->done, __ATOMIC_ACQUIRE)) {
+    epoch_enter( );
+    const float_t *record = store_get(shared->store, &key);
+    if (record != NULL && record[0] != record[1])
+      shared->inconsistent++;
+    epoch_exit( );
+  }
+
+  return NULL;
+}
+
+TEST(StoreConcurrentReaders) {
+  concurrent_t shared = {.store = store_create(2)};
+  ASSERT_TRUE(shared.store != NULL);
+
+  pthread_t readers[4];
+  for (size_t i = 0; i < 4; i++)
+    ASSERT_EQ(0, pthread_create(&readers[i], NULL, _reader, &shared));
+
+  /* updates a record being read, while the store grows */
+  for (int i = 0; i < 20000; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "key%d", i % 2 ? i : 0);
+
+    string_t key;
+    float_t values[] = {i, i};
+    ASSERT_TRUE(str_init(&key, name));
+    ASSERT_TRUE(store_put(shared.store, &key, values));
+  }
+
+  __atomic_store_n(&shared.done, true, __ATOMIC_RELEASE);
+  for (size_t i = 0; i < 4; i++)
+    pthread_join(readers[i], NULL);
+
+  ASSERT_EQ(0, shared.inconsistent);
+  ASSERT_EQ(10001, store_size(shared.store));
+
+  epoch_flush( );
+  store_destroy(shared.store);
+}
@@ -0,0 +1,121 @@
+#define _GNU_SOURCE
+#include "scunit.h"
+#include "wal.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define WAL_TEST_FILE "/tmp/wal_t.wal"
+#define WAL_TEST_OLD_FILE "/tmp/wal_t.wal.old"
+
+/* replayed records: the last key and value, and how many */
+typedef struct {
+  string_t key;
+  float_t value;
+  size_t count;
+} replayed_t;
+
+static void _replayed(const string_t *key, const float_t *values, void *ctx) {
+  replayed_t *replayed = ctx;
+  replayed->key = *key;
+  replayed->value = values[0];
+  replayed->count++;
+}
+
+TEST(WalReplay) {
+  unlink(WAL_TEST_FILE);
+
+  replayed_t replayed = {0};
+  wal_t *wal = wal_open(WAL_TEST_FILE, 1, _replayed, &replayed);
+  ASSERT_TRUE(wal != NULL);
+  ASSERT_EQ(0, replayed.count);
+
+  /* records are committed together */
+  string_t key;
+  uint64_t first, second;
+  float_t value = 17.5;
+  ASSERT_TRUE(str_init(&key, "dollar"));
+  ASSERT_TRUE(wal_append(wal, &key, &value, &first));
+  value = 18;
+  ASSERT_TRUE(wal_append(wal, &key, &value, &second));
+  ASSERT_TRUE(wal_commit(wal, second));
+  ASSERT_TRUE(wal_commit(wal, first));
+  ASSERT_TRUE(wal_close(wal));
+
+  ASSERT_TRUE(wal_replay(WAL_TEST_FILE, 1, _replayed, &replayed));
+  ASSERT_EQ(2, replayed.count);
+  ASSERT_EQ(0, cstr_cmp(&replayed.key, "dollar"));
+  ASSERT_EQ(18, replayed.value);
+
+  /* a torn record (e.g. a crash while writing it) is cut */
+  int fd = open(WAL_TEST_FILE, O_WRONLY | O_APPEND);
+  ASSERT_EQ(5, write(fd, "\x06\0\0\0d", 5));
+  close(fd);
+
+  replayed.count = 0;
+  wal = wal_open(WAL_TEST_FILE, 1, _replayed, &replayed);
+  ASSERT_TRUE(wal != NULL);
+  ASSERT_EQ(2, replayed.count);
+  ASSERT_EQ(2 * (4 + 6 + 4 + 4), wal_size(wal));
+
+  /* a rotated log keeps the records, the new one starts empty */
+  value = 19;
+  ASSERT_TRUE(wal_append(wal, &key, &value, &first));
+  ASSERT_TRUE(wal_rotate(wal, WAL_TEST_OLD_FILE));
+  ASSERT_EQ(0, wal_size(wal));
+  ASSERT_TRUE(wal_close(wal));
+
+  replayed.count = 0;
+  ASSERT_TRUE(wal_replay(WAL_TEST_OLD_FILE, 1, _replayed, &replayed));
+  ASSERT_EQ(3, replayed.count);
+  ASSERT_EQ(19, replayed.value);
+
+  replayed.count = 0;
+  ASSERT_TRUE(wal_replay(WAL_TEST_FILE, 1, _replayed, &replayed));
+  ASSERT_EQ(0, replayed.count);
+
+  unlink(WAL_TEST_FILE);
+  unlink(WAL_TEST_OLD_FILE);
+}
+
+TEST(WalBatch) {
+  unlink(WAL_TEST_FILE);
+
+  replayed_t replayed = {0};
+  wal_t *wal = wal_open(WAL_TEST_FILE, 1, _replayed, &replayed);
+  ASSERT_TRUE(wal != NULL);
+
+  /* the keys are kept in an arena */
+  arena_t *arena = arena_create(4096, 0);
+  arena_t *previous = str_set_arena(arena);
+  string_list_t keys = {0};
+  float_t values[] = {1, 2, 3};
+  ASSERT_TRUE(string_list_append(&keys, "peso", 4));
+  ASSERT_TRUE(string_list_append(&keys, "euro", 4));
+  ASSERT_TRUE(string_list_append(&keys, "real", 4));
+
+  uint64_t seq;
+  ASSERT_TRUE(wal_append_batch(wal, &keys, values, &seq));
+  ASSERT_TRUE(wal_commit(wal, seq));
+  ASSERT_TRUE(wal_append_batch(wal, &keys, values, &seq));
+  ASSERT_TRUE(wal_close(wal));
+
+  /* the header and the 3 records of each batch */
+  size_t batch_size = 8 + 3 * (4 + 4 + 4 + 4);
+  ASSERT_TRUE(wal_replay(WAL_TEST_FILE, 1, _replayed, &replayed));
+  ASSERT_EQ(6, replayed.count);
+  ASSERT_EQ(0, cstr_cmp(&replayed.key, "real"));
+
+  /* a batch with a torn record is cut as a whole */
+  ASSERT_EQ(0, truncate(WAL_TEST_FILE, 2 * batch_size - 1));
+  replayed.count = 0;
+  wal = wal_open(WAL_TEST_FILE, 1, _replayed, &replayed);
+  ASSERT_TRUE(wal != NULL);
+  ASSERT_EQ(3, replayed.count);
+  ASSERT_EQ(batch_size, wal_size(wal));
+  ASSERT_TRUE(wal_close(wal));
+
+  str_set_arena(previous);
+  arena_destroy(arena);
+  unlink(WAL_TEST_FILE);
+}